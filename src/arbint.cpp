@@ -55,7 +55,7 @@ Arbint::Arbint(const Arbint & cpy) : m_digits(cpy.m_digits), m_sign(cpy.m_sign)
 	
 }
 
-Arbint::Arbint(const vector<digit_t> & digits) : m_digits(digits), m_sign(false)
+Arbint::Arbint(const vector<digit_t> & digits, bool sign) : m_digits(digits), m_sign(sign)
 {
 	
 }
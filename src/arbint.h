@@ -17,7 +17,7 @@ namespace IPDF
 			typedef uint64_t digit_t;
 		
 			Arbint(int64_t i);
-			Arbint(const std::vector<digit_t> & digits);
+			Arbint(const std::vector<digit_t> & digits, bool sign = false);
 			Arbint(unsigned n, digit_t d0, ...);
 			Arbint(const std::string & str, const std::string & base="0123456789");
 			virtual ~Arbint() {}
@@ -30,6 +30,7 @@ namespace IPDF
 			}
 			
 			inline bool Sign() const {return m_sign;}
+			inline const std::vector<digit_t> & Digits() const {return m_digits;}
 			inline char SignChar() const {return (m_sign) ? '-' : '+';}
 			std::string DigitStr() const;
 
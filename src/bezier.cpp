@@ -1,6 +1,5 @@
 #include "bezier.h"
 
-#include <unordered_map>
 #include <cmath>
 #include <algorithm>
 
@@ -111,22 +110,13 @@ vector<BReal> SolveCubic(const BReal & a, const BReal & b, const BReal & c, cons
 
 /**
  * Factorial
- * Use dynamic programming / recursion
+ * (Not memoised; this is called from more than one thread when importing SVGs)
  */
 int Factorial(int n)
 {
-	static unordered_map<int, int> dp;
-	static bool init = false;
-	if (!init)
-	{
-		init = true;
-		dp[0] = 1;
-	}
-	auto it = dp.find(n);
-	if (it != dp.end())
-		return it->second;
-	int result = n*Factorial(n-1);
-	dp[n] = result;
+	int result = 1;
+	for (int i = 2; i <= n; ++i)
+		result *= i;
 	return result;
 }
 
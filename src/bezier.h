@@ -31,7 +31,7 @@ namespace IPDF
 		BReal x3; BReal y3;
 		
 		typedef enum {UNKNOWN, LINE, QUADRATIC, CUSP, LOOP, SERPENTINE} Type;
-		Type type;
+		mutable Type type; // worked out (once) by GetType
 		
 		//Bezier() = default; // Needed so we can fread/fwrite this struct... for now.
 		Bezier(BReal _x0=0, BReal _y0=0, BReal _x1=0, BReal _y1=0, BReal _x2=0, BReal _y2=0, BReal _x3=0, BReal _y3=0) : x0(_x0), y0(_y0), x1(_x1), y1(_y1), x2(_x2), y2(_y2), x3(_x3), y3(_y3), type(UNKNOWN)
@@ -39,7 +39,7 @@ namespace IPDF
 
 		}
 		
-		Type GetType()
+		Type GetType() const
 		{
 			if (type != Bezier::UNKNOWN)
 				return type;
@@ -184,7 +184,7 @@ namespace IPDF
 		}
 
 		// Performs one round of De Casteljau subdivision and returns the [t,1] part.
-		Bezier DeCasteljauSubdivideLeft(const BReal& t)
+		Bezier DeCasteljauSubdivideLeft(const BReal& t) const
 		{
 			BReal one_minus_t = BReal(1) - t;
 
@@ -211,7 +211,7 @@ namespace IPDF
 			return Bezier(x0, y0, x01, y01, x012, y012, x0123, y0123);
 		}
 		// Performs one round of De Casteljau subdivision and returns the [t,1] part.
-		Bezier DeCasteljauSubdivideRight(const BReal& t)
+		Bezier DeCasteljauSubdivideRight(const BReal& t) const
 		{
 			BReal one_minus_t = BReal(1) - t;
 
@@ -238,7 +238,7 @@ namespace IPDF
 			return Bezier(x0123, y0123, x123, y123, x23, y23, x3, y3);
 		}
 
-		Bezier ReParametrise(const BReal& t0, const BReal& t1)
+		Bezier ReParametrise(const BReal& t0, const BReal& t1) const
 		{
 			//Debug("Reparametrise: %f -> %f",Double(t0),Double(t1));
 			Bezier new_bezier;
@@ -253,7 +253,7 @@ namespace IPDF
 			return new_bezier;
 		}
 		
-		std::vector<Bezier> ClipToRectangle(const BRect & r)
+		std::vector<Bezier> ClipToRectangle(const BRect & r) const
 		{
 			// Find points of intersection with the rectangle.
 			Debug("Clipping Bezier to BRect %s", r.Str().c_str());
@@ -0,0 +1,221 @@
+/**
+ * @file chunkvector.h
+ * @brief std::vector-like storage that can refer to a chunk of a MappedFile in place
+ */
+
+#ifndef _CHUNKVECTOR_H
+#define _CHUNKVECTOR_H
+
+#include "common.h"
+#include "mappedfile.h"
+#include <memory>
+#include <algorithm>
+#include <iterator>
+
+namespace IPDF
+{
+	/**
+	 * Behaves like the (small) part of std::vector that Objects needs.
+	 * Can either own its elements, or point straight at an array in a MappedFile.
+	 * Mapped elements can be modified in place (the mapping is private; the kernel copies the page on first write).
+	 * Anything that changes the size copies the mapped elements into owned storage first.
+	 * Only use Map for types that are safe to fwrite/fread (ie: when Real is a primitive type).
+	 * Owned elements are kept in pages of PAGE_SIZE, so growing never moves (or needs room for a second copy of) the elements already there.
+	 */
+	template <class T>
+	class ChunkVector
+	{
+		public:
+			static const size_t PAGE_BITS = 12;
+			static const size_t PAGE_SIZE = 1 << PAGE_BITS;
+
+			class const_iterator : public std::iterator<std::random_access_iterator_tag, T, std::ptrdiff_t, const T*, const T&>
+			{
+				public:
+					const_iterator(const ChunkVector * v, size_t i) : m_v(v), m_i(i) {}
+					const T & operator*() const {return (*m_v)[m_i];}
+					const T * operator->() const {return &(*m_v)[m_i];}
+					const T & operator[](std::ptrdiff_t n) const {return (*m_v)[m_i + n];}
+					const_iterator & operator++() {++m_i; return *this;}
+					const_iterator operator++(int) {const_iterator old(*this); ++m_i; return old;}
+					const_iterator & operator--() {--m_i; return *this;}
+					const_iterator & operator+=(std::ptrdiff_t n) {m_i += n; return *this;}
+					const_iterator operator+(std::ptrdiff_t n) const {return const_iterator(m_v, m_i + n);}
+					const_iterator operator-(std::ptrdiff_t n) const {return const_iterator(m_v, m_i - n);}
+					std::ptrdiff_t operator-(const const_iterator & sub) const {return (std::ptrdiff_t)m_i - (std::ptrdiff_t)sub.m_i;}
+					bool operator==(const const_iterator & equ) const {return m_i == equ.m_i;}
+					bool operator!=(const const_iterator & equ) const {return m_i != equ.m_i;}
+					bool operator<(const const_iterator & cmp) const {return m_i < cmp.m_i;}
+				private:
+					const ChunkVector * m_v;
+					size_t m_i;
+			};
+
+			ChunkVector() : m_pages(), m_size(0), m_file(), m_mapped(NULL), m_mapped_size(0) {}
+			ChunkVector(const ChunkVector & cpy) : m_pages(), m_size(0), m_file(), m_mapped(NULL), m_mapped_size(0) {Append(cpy);}
+			ChunkVector & operator=(const ChunkVector & equ)
+			{
+				if (&equ == this) return *this;
+				clear();
+				Append(equ);
+				return *this;
+			}
+			/** Moving takes the pages (or mapping) as they are, so a std::vector of things holding ChunkVectors can grow without copying them **/
+			ChunkVector(ChunkVector && mv) noexcept
+				: m_pages(std::move(mv.m_pages)), m_size(mv.m_size), m_file(std::move(mv.m_file)), m_mapped(mv.m_mapped), m_mapped_size(mv.m_mapped_size)
+			{
+				mv.m_pages.clear();
+				mv.m_size = 0;
+				mv.Unmap();
+			}
+			ChunkVector & operator=(ChunkVector && mv) noexcept
+			{
+				if (&mv == this) return *this;
+				m_pages = std::move(mv.m_pages);
+				m_size = mv.m_size;
+				m_file = std::move(mv.m_file);
+				m_mapped = mv.m_mapped;
+				m_mapped_size = mv.m_mapped_size;
+				mv.m_pages.clear();
+				mv.m_size = 0;
+				mv.Unmap();
+				return *this;
+			}
+
+			/** Refer to count elements starting at offset bytes into file; discards any current elements **/
+			void Map(const std::shared_ptr<MappedFile> & file, size_t offset, size_t count)
+			{
+				if (offset + count*sizeof(T) > file->Size())
+					Fatal("Chunk [%u, %u) is outside \"%s\" (%u bytes)", offset, offset+count*sizeof(T), file->Filename().c_str(), file->Size());
+				if (offset % alignof(T) != 0)
+					Fatal("Chunk at %u is misaligned for a %u byte type", offset, sizeof(T));
+				m_pages.clear();
+				m_pages.shrink_to_fit();
+				m_size = 0;
+				m_file = file;
+				m_mapped = (T*)(file->Data() + offset);
+				m_mapped_size = count;
+			}
+
+			/** Refer to count elements of mapped (which must be mapped) starting at begin; discards any current elements **/
+			void MapPart(const ChunkVector & mapped, size_t begin, size_t count)
+			{
+				Map(mapped.m_file, (const uint8_t*)(mapped.m_mapped + begin) - mapped.m_file->Data(), count);
+			}
+
+			/** Copy mapped elements into owned storage (no-op if they are already owned) **/
+			void Detach(size_t reserve = 0)
+			{
+				if (m_mapped == NULL) return;
+				T * mapped = m_mapped;
+				size_t count = m_mapped_size;
+				std::shared_ptr<MappedFile> file(m_file); // keep it mapped while we copy
+				Unmap();
+				m_pages.reserve(Pages(std::max(reserve, count)));
+				for (size_t i = 0; i < count; i += PAGE_SIZE)
+				{
+					AddPage();
+					m_pages.back().assign(mapped + i, mapped + std::min(count, i + PAGE_SIZE));
+				}
+				m_size = count;
+			}
+
+			bool Mapped() const {return (m_mapped != NULL);}
+
+			size_t size() const {return (m_mapped != NULL) ? m_mapped_size : m_size;}
+			size_t capacity() const {return (m_mapped != NULL) ? m_mapped_size : std::max(m_size, m_pages.capacity() * PAGE_SIZE);}
+			bool empty() const {return size() == 0;}
+
+			/** Contiguous runs of elements; all but the last page are PAGE_SIZE long (mapped elements are one run) **/
+			size_t PageCount() const {return (m_mapped != NULL) ? ((m_mapped_size > 0) ? 1 : 0) : m_pages.size();}
+			T * Page(size_t p) {return (m_mapped != NULL) ? m_mapped : m_pages[p].data();}
+			const T * Page(size_t p) const {return (m_mapped != NULL) ? m_mapped : m_pages[p].data();}
+			size_t PageLength(size_t p) const {return (m_mapped != NULL) ? m_mapped_size : m_pages[p].size();}
+
+			T & operator[](size_t i) {return (m_mapped != NULL) ? m_mapped[i] : m_pages[i >> PAGE_BITS][i & (PAGE_SIZE-1)];}
+			const T & operator[](size_t i) const {return (m_mapped != NULL) ? m_mapped[i] : m_pages[i >> PAGE_BITS][i & (PAGE_SIZE-1)];}
+			T & back() {return (*this)[size()-1];}
+			const T & back() const {return (*this)[size()-1];}
+			void Set(size_t i, const T & t) {(*this)[i] = t;}
+
+			const_iterator begin() const {return const_iterator(this, 0);}
+			const_iterator end() const {return const_iterator(this, size());}
+
+			void push_back(const T & t)
+			{
+				if (m_mapped != NULL)
+				{
+					T copy(t); // t may be one of the mapped elements
+					Detach(size()+1);
+					push_back(copy);
+					return;
+				}
+				if (m_size == m_pages.size() * PAGE_SIZE)
+					AddPage();
+				m_pages.back().push_back(t);
+				++m_size;
+			}
+			void pop_back() {resize(size()-1);}
+			void reserve(size_t n) {Detach(n); m_pages.reserve(Pages(n));}
+			void resize(size_t n)
+			{
+				Detach(n);
+				m_pages.reserve(Pages(n));
+				while (m_size < n)
+				{
+					if (m_size == m_pages.size() * PAGE_SIZE)
+						AddPage();
+					std::vector<T> & page = m_pages.back();
+					size_t add = std::min(n - m_size, PAGE_SIZE - page.size());
+					page.resize(page.size() + add);
+					m_size += add;
+				}
+				while (m_size > n)
+				{
+					std::vector<T> & page = m_pages.back();
+					size_t remove = std::min(m_size - n, page.size());
+					page.resize(page.size() - remove);
+					m_size -= remove;
+					if (page.empty())
+						m_pages.pop_back();
+				}
+			}
+			void clear() {Unmap(); m_pages.clear(); m_size = 0;}
+
+		private:
+			static size_t Pages(size_t n) {return (n + PAGE_SIZE - 1) >> PAGE_BITS;}
+
+			/** The first page grows like a std::vector, so small vectors stay small; the rest are allocated whole **/
+			void AddPage()
+			{
+				m_pages.push_back(std::vector<T>());
+				if (m_pages.size() > 1)
+					m_pages.back().reserve(PAGE_SIZE);
+			}
+
+			void Append(const ChunkVector & from)
+			{
+				reserve(size() + from.size());
+				for (size_t p = 0; p < from.PageCount(); ++p)
+				{
+					for (size_t i = 0; i < from.PageLength(p); ++i)
+						push_back(from.Page(p)[i]);
+				}
+			}
+
+			void Unmap()
+			{
+				m_file.reset();
+				m_mapped = NULL;
+				m_mapped_size = 0;
+			}
+
+			std::vector<std::vector<T> > m_pages;
+			size_t m_size; // owned elements
+			std::shared_ptr<MappedFile> m_file; // keeps the mapping alive
+			T * m_mapped;
+			size_t m_mapped_size;
+	};
+}
+
+#endif //_CHUNKVECTOR_H
@@ -1,8 +1,12 @@
 #include "document.h"
 #include "bezier.h"
+#include "mappedfile.h"
+#include "serialiser.h"
+#include "svgreader.h"
 #include "profiler.h"
+#include "SDL.h"
 #include <cstdio>
-#include <fstream>
+#include <algorithm>
 
 #include "../contrib/pugixml-1.4/src/pugixml.cpp"
 #include "transformationtype.h"
@@ -12,40 +16,199 @@
 using namespace IPDF;
 using namespace std;
 
-//TODO: Make this work for variable sized Reals
+/** Identifies a document file (and not some random file with a .ipdf extension) **/
+static const char DOC_MAGIC[4] = {'I','P','D','F'};
+/** Increment when the layout of the header or any chunk changes **/
+static const uint32_t DOC_VERSION = 4;
+/** Chunks start on a page boundary so that mapping one chunk never drags in pages of another **/
+static const uint64_t DOC_CHUNK_ALIGN = 4096;
+
+/**
+ * Header at the start of a document file
+ * Followed immediately by num_chunks DocChunkEntry's
+ */
+struct DocHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t real_type; // REALTYPE the document was saved with
+	uint32_t rect_size; // sizeof(Rect) and sizeof(Bezier) the document was saved with
+	uint32_t bezier_size;
+	uint32_t num_chunks;
+};
+
+// Reals that are just bytes are saved as they are (so they can be mapped); anything else has to be packed
+#if REALTYPE == REAL_SINGLE || REALTYPE == REAL_DOUBLE || REALTYPE == REAL_LONG_DOUBLE
+	#define DOC_REAL_ENCODING CE_RAW
+#else
+	#define DOC_REAL_ENCODING CE_PACKED
+#endif
+#if defined(TRANSFORM_BEZIERS_TO_PATH) && PATHREAL != REAL_SINGLE && PATHREAL != REAL_DOUBLE && PATHREAL != REAL_LONG_DOUBLE
+	#define DOC_PREAL_ENCODING CE_PACKED
+#else
+	#define DOC_PREAL_ENCODING DOC_REAL_ENCODING
+#endif
+
+/** Location of a chunk in a document file **/
+struct DocChunkEntry
+{
+	uint32_t type; // DocChunkTypes
+	uint32_t encoding; // DocChunkEncoding
+	uint64_t offset; // bytes from the start of the file
+	uint64_t size; // in bytes
+};
+
+/** How a Path is stored in a CT_OBJPATHS chunk (the fill points are a cache and are not saved) **/
+struct PathRecord
+{
+	unsigned start;
+	unsigned end;
+	unsigned index;
+	Vec2 top;
+	Vec2 bottom;
+	Vec2 left;
+	Vec2 right;
+	PRect bounds;
+	Colour fill;
+	Colour stroke;
+};
+
+static PathRecord PathToRecord(const Path & path)
+{
+	return PathRecord{path.m_start, path.m_end, path.m_index, path.m_top, path.m_bottom, path.m_left, path.m_right, path.m_bounds, path.m_fill, path.m_stroke};
+}
+
+static Path PathFromRecord(const PathRecord & record)
+{
+	Path path;
+	path.m_start = record.start;
+	path.m_end = record.end;
+	path.m_index = record.index;
+	path.m_top = record.top;
+	path.m_bottom = record.bottom;
+	path.m_left = record.left;
+	path.m_right = record.right;
+	path.m_bounds = record.bounds;
+	path.m_fill = record.fill;
+	path.m_stroke = record.stroke;
+	return path;
+}
+
+static void WritePathRecord(Serialiser & packed, const PathRecord & record)
+{
+	packed.Varint(record.start);
+	packed.Varint(record.end);
+	packed.Varint(record.index);
+	packed.Write(record.top);
+	packed.Write(record.bottom);
+	packed.Write(record.left);
+	packed.Write(record.right);
+	packed.Write(record.bounds);
+	packed.Bytes(&record.fill, sizeof(Colour));
+	packed.Bytes(&record.stroke, sizeof(Colour));
+}
+
+static void ReadPathRecord(Deserialiser & packed, PathRecord & record)
+{
+	record.start = packed.Varint();
+	record.end = packed.Varint();
+	record.index = packed.Varint();
+	packed.Read(record.top);
+	packed.Read(record.bottom);
+	packed.Read(record.left);
+	packed.Read(record.right);
+	packed.Read(record.bounds);
+	packed.Bytes(&record.fill, sizeof(Colour));
+	packed.Bytes(&record.stroke, sizeof(Colour));
+}
+
+/** Contents of a CT_QUADTREE chunk **/
+struct QuadTreeRecord
+{
+	int32_t root_id;
+	int32_t insert_node;
+	int32_t view_node;
+};
+
+/**
+ * How a QuadTreeNode is stored in a CT_QUADTREENODES chunk
+ * The object chunks hold the objects not in the quadtree, then each node's in turn; the ranges are where the node's are
+ * (its data indices and paths count from the start of its own)
+ */
+struct Document::QuadNodeRecord
+{
+	int32_t top_left;
+	int32_t top_right;
+	int32_t bottom_left;
+	int32_t bottom_right;
+	int32_t parent;
+	int32_t child_type;
+	uint32_t object_begin;
+	uint32_t object_end;
+	uint32_t bezier_begin;
+	uint32_t bezier_end;
+	uint32_t path_begin;
+	uint32_t path_end;
+	uint32_t dirty_begin; // objects of the node not yet propagated (all the runs, and any between them)
+	uint32_t dirty_end;
+};
+
+// Loads a ChunkVector<T> of size num_elements from a file, a page at a time.
+template<typename T, class V>
+static void LoadStructVector(FILE *src_file, size_t num_elems, V& dest)
+{
+	size_t structsread = 0;
+	dest.resize(num_elems);
+	for (size_t p = 0; p < dest.PageCount(); ++p)
+		structsread += fread(dest.Page(p), sizeof(T), dest.PageLength(p), src_file);
+	if (structsread != num_elems)
+		Fatal("Only read %u structs (expected %u)!", structsread, num_elems);
+}
+
+// Saves a ChunkVector<T> to a file. Size must be saves separately.
+template<typename T, class V>
+static void SaveStructVector(FILE *dst_file, const V& src)
+{
+	size_t written = 0;
+	for (size_t p = 0; p < src.PageCount(); ++p)
+		written += fwrite(src.Page(p), sizeof(T), src.PageLength(p), dst_file);
+	if (written != src.size())
+		Fatal("Only wrote %u structs (expected %u)!", written, src.size());
+}
 
-// Loads an std::vector<T> of size num_elements from a file.
 template<typename T>
 static void LoadStructVector(FILE *src_file, size_t num_elems, std::vector<T>& dest)
 {
-	size_t structsread = 0;
 	dest.resize(num_elems);
-	structsread = fread(dest.data(), sizeof(T), num_elems, src_file);
+	size_t structsread = fread(dest.data(), sizeof(T), num_elems, src_file);
 	if (structsread != num_elems)
 		Fatal("Only read %u structs (expected %u)!", structsread, num_elems);
 }
 
-// Saves an std::vector<T> to a file. Size must be saves separately.
 template<typename T>
-static void SaveStructVector(FILE *dst_file, std::vector<T>& src)
+static void SaveStructVector(FILE *dst_file, const std::vector<T>& src)
 {
-	size_t written = 0;
-	written = fwrite(src.data(), sizeof(T), src.size(), dst_file);
+	size_t written = fwrite(src.data(), sizeof(T), src.size(), dst_file);
 	if (written != src.size())
 		Fatal("Only wrote %u structs (expected %u)!", written, src.size());
 }
 
-static void WriteChunkHeader(FILE *dst_file, DocChunkTypes type, uint32_t size)
+#ifdef TIERED_OBJECTS
+// Raw chunks of Reals are only written when Real is plain old data, which it never is with TIERED_OBJECTS
+template<typename T>
+static void LoadStructVector(FILE *src_file, size_t num_elems, TieredVector<T>& dest)
 {
-	size_t written = 0;
-	written = fwrite(&type, sizeof(type), 1, dst_file);
-	if (written != 1)
-		Fatal("Could not write Chunk header! (ID)");
-	written = fwrite(&size, sizeof(size), 1, dst_file);
-	if (written != 1)
-		Fatal("Could not write Chunk header (size)!");
+	Fatal("Can't load %u raw %u byte structs when objects are tiered", num_elems, sizeof(T));
+}
+
+template<typename T>
+static void SaveStructVector(FILE *dst_file, const TieredVector<T>& src)
+{
+	Fatal("Can't save %u raw %u byte structs when objects are tiered", src.size(), sizeof(T));
 }
+#endif
 
+// Version 1 documents are just a sequence of these followed by the chunk data.
 static bool ReadChunkHeader(FILE *src_file, DocChunkTypes& type, uint32_t& size)
 {
 	if (fread(&type, sizeof(DocChunkTypes), 1, src_file) != 1)
@@ -55,35 +218,189 @@ static bool ReadChunkHeader(FILE *src_file, DocChunkTypes& type, uint32_t& size)
 	return true;
 }
 
+static void PadToAlignment(FILE *dst_file, uint64_t offset)
+{
+	static const uint8_t zeroes[DOC_CHUNK_ALIGN] = {0};
+	uint64_t padding = (DOC_CHUNK_ALIGN - offset % DOC_CHUNK_ALIGN) % DOC_CHUNK_ALIGN;
+	if (fwrite(zeroes, 1, padding, dst_file) != padding)
+		Fatal("Couldn't pad chunk to %u bytes", DOC_CHUNK_ALIGN);
+}
+
+// Checks the header is something we can load, and gets the chunk table.
+static bool CheckDocHeader(const DocHeader & header, const string & filename)
+{
+	if (memcmp(header.magic, DOC_MAGIC, sizeof(DOC_MAGIC)) != 0)
+		return false;
+	if (header.version != DOC_VERSION)
+		Fatal("\"%s\" is version %u; expected %u", filename.c_str(), header.version, DOC_VERSION);
+	if (header.real_type != REALTYPE || header.rect_size != sizeof(Rect) || header.bezier_size != sizeof(Bezier))
+		Fatal("\"%s\" was saved with REALTYPE %u (Rect %u bytes, Bezier %u bytes); we have %u (Rect %u bytes, Bezier %u bytes)",
+			filename.c_str(), header.real_type, header.rect_size, header.bezier_size, REALTYPE, sizeof(Rect), sizeof(Bezier));
+	return true;
+}
+
 void Document::Save(const string & filename)
 {
 	Debug("Saving document to file \"%s\"...", filename.c_str());
-	FILE * file = fopen(filename.c_str(), "w");
+	FILE * file = fopen(filename.c_str(), "wb");
 	if (file == NULL)
 		Fatal("Couldn't open file \"%s\" - %s", filename.c_str(), strerror(errno));
 
-	size_t written;
-	Debug("Number of objects (%u)...", ObjectCount());
-	WriteChunkHeader(file, CT_NUMOBJS, sizeof(m_count));
-	written = fwrite(&m_count, sizeof(m_count), 1, file);
-	if (written != 1)
-		Fatal("Failed to write number of objects!");
+	// Chunks are written in one pass; packed chunk sizes aren't known until they are written,
+	// so the chunk table is filled in as we go and written again at the end
+	vector<DocChunkEntry> chunks;
+	chunks.push_back(DocChunkEntry{CT_NUMOBJS, CE_RAW, 0, 0});
+	chunks.push_back(DocChunkEntry{CT_OBJTYPES, CE_RAW, 0, 0});
+	chunks.push_back(DocChunkEntry{CT_OBJBOUNDS, DOC_REAL_ENCODING, 0, 0});
+	chunks.push_back(DocChunkEntry{CT_OBJINDICES, CE_RAW, 0, 0});
+	chunks.push_back(DocChunkEntry{CT_OBJBEZIERS, DOC_REAL_ENCODING, 0, 0});
+	chunks.push_back(DocChunkEntry{CT_OBJPATHS, DOC_PREAL_ENCODING, 0, 0});
+	// The objects not in the quadtree, then those of each node
+	vector<const Objects*> parts(1, &m_objects);
+	unsigned object_end = m_objects.types.size(), bezier_end = m_objects.beziers.size(), path_end = m_objects.paths.size(); // of all the parts
+#ifndef QUADTREE_DISABLED
+	QuadTreeRecord quadtree_record = {m_quadtree.root_id, m_current_insert_node, m_view_node};
+	vector<QuadNodeRecord> node_records;
+	for (unsigned i = 0; i < m_quadtree.nodes.size(); ++i)
+	{
+		const QuadTreeNode & node = m_quadtree.nodes[i];
+		parts.push_back(&node.objects);
+		QuadNodeRecord record = {node.top_left, node.top_right, node.bottom_left, node.bottom_right, node.parent, node.child_type,
+			object_end, object_end + (uint32_t)node.objects.types.size(), bezier_end, bezier_end + (uint32_t)node.objects.beziers.size(),
+			path_end, path_end + (uint32_t)node.objects.paths.size(), 0, 0};
+		for (unsigned d = 0; d < node.dirty.size(); ++d)
+		{
+			record.dirty_begin = (d == 0) ? node.dirty[d].first : min(record.dirty_begin, node.dirty[d].first);
+			record.dirty_end = max(record.dirty_end, node.dirty[d].second);
+		}
+		node_records.push_back(record);
+		object_end = record.object_end;
+		bezier_end = record.bezier_end;
+		path_end = record.path_end;
+	}
+	chunks.push_back(DocChunkEntry{CT_QUADTREE, CE_RAW, 0, 0});
+	chunks.push_back(DocChunkEntry{CT_QUADTREENODES, CE_RAW, 0, 0});
+#endif
 
-	Debug("Object types...");
-	WriteChunkHeader(file, CT_OBJTYPES, m_objects.types.size() * sizeof(ObjectType));
-	SaveStructVector<ObjectType>(file, m_objects.types);
+	DocHeader header = {{DOC_MAGIC[0], DOC_MAGIC[1], DOC_MAGIC[2], DOC_MAGIC[3]}, DOC_VERSION, REALTYPE, sizeof(Rect), sizeof(Bezier), (uint32_t)chunks.size()};
+	if (fwrite(&header, sizeof(header), 1, file) != 1)
+		Fatal("Could not write document header!");
+	if (fwrite(chunks.data(), sizeof(DocChunkEntry), chunks.size(), file) != chunks.size())
+		Fatal("Could not write chunk table!");
+	uint64_t offset = sizeof(DocHeader) + chunks.size() * sizeof(DocChunkEntry);
 
-	Debug("Object bounds...");
-	WriteChunkHeader(file, CT_OBJBOUNDS, m_objects.bounds.size() * sizeof(Rect));
-	SaveStructVector<Rect>(file, m_objects.bounds);
+	for (unsigned i = 0; i < chunks.size(); ++i)
+	{
+		PadToAlignment(file, offset);
+		chunks[i].offset = offset + (DOC_CHUNK_ALIGN - offset % DOC_CHUNK_ALIGN) % DOC_CHUNK_ALIGN;
+		Serialiser packed(file);
+		switch (chunks[i].type)
+		{
+		case CT_NUMOBJS:
+			Debug("Number of objects (%u)...", ObjectCount());
+			if (fwrite(&m_count, sizeof(m_count), 1, file) != 1)
+				Fatal("Failed to write number of objects!");
+			chunks[i].size = sizeof(m_count);
+			break;
+		case CT_OBJTYPES:
+			Debug("Object types...");
+			for (unsigned p = 0; p < parts.size(); ++p)
+			{
+				SaveStructVector<ObjectType>(file, parts[p]->types);
+				chunks[i].size += parts[p]->types.size() * sizeof(ObjectType);
+			}
+			break;
+		case CT_OBJBOUNDS:
+			Debug("Object bounds...");
+			if (chunks[i].encoding == CE_RAW)
+			{
+				for (unsigned p = 0; p < parts.size(); ++p)
+				{
+					SaveStructVector<Rect>(file, parts[p]->bounds);
+					chunks[i].size += parts[p]->bounds.size() * sizeof(Rect);
+				}
+				break;
+			}
+			packed.Varint(object_end);
+			for (unsigned p = 0; p < parts.size(); ++p)
+			{
+				for (unsigned j = 0; j < parts[p]->bounds.size(); ++j)
+					packed.Write(parts[p]->bounds[j]);
+			}
+			break;
+		case CT_OBJINDICES:
+			Debug("Object data indices...");
+			for (unsigned p = 0; p < parts.size(); ++p)
+			{
+				SaveStructVector<unsigned>(file, parts[p]->data_indices);
+				chunks[i].size += parts[p]->data_indices.size() * sizeof(unsigned);
+			}
+			break;
+		case CT_OBJBEZIERS:
+			Debug("Bezier data...");
+			if (chunks[i].encoding == CE_RAW)
+			{
+				for (unsigned p = 0; p < parts.size(); ++p)
+				{
+					SaveStructVector<Bezier>(file, parts[p]->beziers);
+					chunks[i].size += parts[p]->beziers.size() * sizeof(Bezier);
+				}
+				break;
+			}
+			packed.Varint(bezier_end);
+			for (unsigned p = 0; p < parts.size(); ++p)
+			{
+				for (unsigned j = 0; j < parts[p]->beziers.size(); ++j)
+					packed.Write(parts[p]->beziers[j]);
+			}
+			break;
+		case CT_OBJPATHS:
+			Debug("Path data...");
+			if (chunks[i].encoding == CE_RAW)
+			{
+				for (unsigned p = 0; p < parts.size(); ++p)
+				{
+					for (unsigned j = 0; j < parts[p]->paths.size(); ++j)
+					{
+						PathRecord record = PathToRecord(parts[p]->paths[j]);
+						if (fwrite(&record, sizeof(record), 1, file) != 1)
+							Fatal("Failed to write path %u!", j);
+					}
+					chunks[i].size += parts[p]->paths.size() * sizeof(PathRecord);
+				}
+				break;
+			}
+			packed.Varint(path_end);
+			for (unsigned p = 0; p < parts.size(); ++p)
+			{
+				for (unsigned j = 0; j < parts[p]->paths.size(); ++j)
+					WritePathRecord(packed, PathToRecord(parts[p]->paths[j]));
+			}
+			break;
+#ifndef QUADTREE_DISABLED
+		case CT_QUADTREE:
+			Debug("Quadtree (root %d)...", m_quadtree.root_id);
+			if (fwrite(&quadtree_record, sizeof(quadtree_record), 1, file) != 1)
+				Fatal("Failed to write quadtree!");
+			chunks[i].size = sizeof(QuadTreeRecord);
+			break;
+		case CT_QUADTREENODES:
+			Debug("Quadtree nodes...");
+			SaveStructVector<QuadNodeRecord>(file, node_records);
+			chunks[i].size = node_records.size() * sizeof(QuadNodeRecord);
+			break;
+#endif
+		}
+		packed.Flush();
+		if (chunks[i].encoding != CE_RAW)
+			chunks[i].size = packed.Size();
+		offset = chunks[i].offset + chunks[i].size;
+	}
 
-	Debug("Object data indices...");
-	WriteChunkHeader(file, CT_OBJINDICES, m_objects.data_indices.size() * sizeof(unsigned));
-	SaveStructVector<unsigned>(file, m_objects.data_indices);
-	
-	Debug("Bezier data...");
-	WriteChunkHeader(file, CT_OBJBEZIERS, m_objects.beziers.size() * sizeof(uint8_t));
-	SaveStructVector<Bezier>(file, m_objects.beziers);
+	if (fseek(file, sizeof(DocHeader), SEEK_SET) != 0)
+		Fatal("Couldn't seek back to the chunk table - %s", strerror(errno));
+	if (fwrite(chunks.data(), sizeof(DocChunkEntry), chunks.size(), file) != chunks.size())
+		Fatal("Could not write chunk table!");
 
 	int err = fclose(file);
 	if (err != 0)
@@ -96,20 +413,136 @@ void Document::Save(const string & filename)
 
 void Document::GenBaseQuadtree()
 {
-	m_quadtree.nodes.push_back(QuadTreeNode{QUADTREE_EMPTY, QUADTREE_EMPTY, QUADTREE_EMPTY, QUADTREE_EMPTY, QUADTREE_EMPTY, QTC_UNKNOWN, 0, ObjectCount(), -1});
+	// The objects so far become the root's
+	m_quadtree.nodes.push_back(QuadTreeNode());
+	m_quadtree.nodes.back().objects = std::move(m_objects);
+	m_objects.Clear();
 	m_quadtree.root_id = 0;
+	m_quadtree.Reindex();
+}
+
+/** Remove the last object of objects (but not its data) **/
+static void PopObject(Objects & objects)
+{
+	objects.types.pop_back();
+	objects.bounds.resize(objects.bounds.size()-1);
+	objects.data_indices.pop_back();
 }
 
-int Document::ClipObjectToQuadChild(int object_id, QuadTreeNodeChildren type)
+/**
+ * Give the PATH object just added to to (a copy of one in from, still with from's data index) a path of its own,
+ * over the copies of that path's Beziers just before it
+ * origins holds the object of from that each of the last origins.size() objects of to came from
+ * @returns false (having removed the object) if none of its Beziers were copied
+ */
+static bool LinkPathCopy(const Objects & from, Objects & to, const std::vector<unsigned> & origins)
+{
+	const Path & path = from.paths[to.data_indices.back()];
+	unsigned base = to.types.size() - origins.size();
+	unsigned first = 0, last = 0;
+	bool found = false;
+	for (unsigned i = origins.size()-1; i-- > 0;)
+	{
+		if (origins[i] < path.m_start)
+			break;
+		if (origins[i] > path.m_end)
+			continue;
+		if (!found)
+			last = base + i;
+		first = base + i;
+		found = true;
+	}
+	if (!found)
+	{
+		PopObject(to);
+		return false;
+	}
+	Path copy(to, first, last, path.m_fill, path.m_stroke);
+	copy.m_index = to.types.size()-1;
+	to.paths.push_back(copy);
+	to.data_indices.back() = to.paths.size()-1;
+	return true;
+}
+
+/**
+ * Append object id of from to to with new bounds, with its own copy of its Bezier, or of its path (see LinkPathCopy)
+ * @returns the number of objects added
+ */
+static unsigned CopyObject(const Objects & from, unsigned id, const Rect & bounds, Objects & to, std::vector<unsigned> & origins)
+{
+	unsigned data_index = from.data_indices[id];
+	if (from.types[id] == BEZIER)
+	{
+		to.beziers.push_back(from.beziers[data_index]);
+		data_index = to.beziers.size()-1;
+	}
+	to.types.push_back(from.types[id]);
+	to.bounds.push_back(bounds);
+	to.data_indices.push_back(data_index);
+	origins.push_back(id);
+	if (from.types[id] == PATH && !LinkPathCopy(from, to, origins))
+	{
+		origins.pop_back();
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Clip object id of from into to as Document::ClipObjectToQuadChild does, then give a path its own copy (see LinkPathCopy)
+ * @returns the number of objects added
+ */
+static unsigned ClipIntoQuadChild(const Objects & from, unsigned id, QuadTreeNodeChildren type, Objects & to, std::vector<unsigned> & origins)
+{
+	unsigned added = Document::ClipObjectToQuadChild(from, id, type, to);
+	origins.resize(origins.size() + added, id);
+	if (from.types[id] == PATH && added == 1 && !LinkPathCopy(from, to, origins))
+	{
+		origins.pop_back();
+		return 0;
+	}
+	return added;
+}
+
+/**
+ * Append the object i of clipped, which ClipObjectToQuadChild made from object origin of from, to to, as ClipIntoQuadChild would have
+ * @returns the number of objects added
+ */
+static unsigned AppendClipped(const Objects & clipped, unsigned i, unsigned origin, const Objects & from, Objects & to, std::vector<unsigned> & origins)
+{
+	unsigned data_index = clipped.data_indices[i];
+	if (clipped.types[i] == BEZIER)
+	{
+		to.beziers.push_back(clipped.beziers[data_index]);
+		data_index = to.beziers.size()-1;
+	}
+	to.types.push_back(clipped.types[i]);
+	to.bounds.push_back(clipped.bounds[i]);
+	to.data_indices.push_back(data_index);
+	origins.push_back(origin);
+	if (clipped.types[i] == PATH && !LinkPathCopy(from, to, origins))
+	{
+		origins.pop_back();
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Add the pieces of object object_id of from that are in the child type to to, in the child's coordinates
+ * Beziers get their own copies of their data in to; a PATH keeps the data index of its path in from (see LinkPathCopy)
+ * @returns the number of pieces
+ */
+int Document::ClipObjectToQuadChild(const Objects & from, unsigned object_id, QuadTreeNodeChildren type, Objects & to)
 {
 	PROFILE_SCOPE("Document::ClipObjectToQuadChild");
-	switch (m_objects.types[object_id])
+	switch (from.types[object_id])
 	{
 	case RECT_FILLED:
 	case RECT_OUTLINE:
 	case PATH:
 		{
-		Rect obj_bounds = TransformToQuadChild(m_objects.bounds[object_id], type);
+		Rect obj_bounds = TransformToQuadChild(from.bounds[object_id], type);
 		if (obj_bounds.x < 0)
 		{
 			obj_bounds.w += obj_bounds.x;
@@ -128,322 +561,1126 @@ int Document::ClipObjectToQuadChild(int object_id, QuadTreeNodeChildren type)
 		{
 			obj_bounds.h += (1 - (obj_bounds.y + obj_bounds.h));
 		}
-		m_objects.bounds.push_back(obj_bounds);
-		m_objects.types.push_back(m_objects.types[object_id]);
-		m_objects.data_indices.push_back(m_objects.data_indices[object_id]);
+		to.bounds.push_back(obj_bounds);
+		to.types.push_back(from.types[object_id]);
+		to.data_indices.push_back(from.data_indices[object_id]);
 		return 1;
 		}
 	case BEZIER:
 		{
 		// If we're entirely within the quadtree node, no clipping need occur.
-		if (ContainedInQuadChild(m_objects.bounds[object_id], type))
+		if (ContainedInQuadChild(from.bounds[object_id], type))
 		{
-			m_objects.bounds.push_back(TransformToQuadChild(m_objects.bounds[object_id], type));
-			m_objects.types.push_back(m_objects.types[object_id]);
-			m_objects.data_indices.push_back(m_objects.data_indices[object_id]);
+			to.beziers.push_back(from.beziers[from.data_indices[object_id]]);
+			to.bounds.push_back(TransformToQuadChild(from.bounds[object_id], type));
+			to.types.push_back(from.types[object_id]);
+			to.data_indices.push_back(to.beziers.size()-1);
 			return 1;
 		}
-		Rect clip_bezier_bounds = TransformRectCoordinates(m_objects.bounds[object_id], TransformFromQuadChild(Rect{0,0,1,1}, type)); 
-		std::vector<Bezier> new_curves = m_objects.beziers[m_objects.data_indices[object_id]].ClipToRectangle(clip_bezier_bounds);
+		Rect clip_bezier_bounds = TransformRectCoordinates(from.bounds[object_id], TransformFromQuadChild(Rect{0,0,1,1}, type));
+		std::vector<Bezier> new_curves = from.beziers[from.data_indices[object_id]].ClipToRectangle(clip_bezier_bounds);
 		for (size_t i = 0; i < new_curves.size(); ++i)
 		{
-			Rect new_bounds = TransformToQuadChild(m_objects.bounds[object_id], type);
-			Bezier new_curve_data = new_curves[i].ToAbsolute(TransformToQuadChild(m_objects.bounds[object_id],type));
+			Rect new_bounds = TransformToQuadChild(from.bounds[object_id], type);
+			Bezier new_curve_data = new_curves[i].ToAbsolute(TransformToQuadChild(from.bounds[object_id],type));
 			new_bounds = new_curve_data.SolveBounds();
 			Debug("New bounds: %s", new_bounds.Str().c_str());
 			new_curve_data = new_curve_data.ToRelative(new_bounds);
-			unsigned index = AddBezierData(new_curve_data);
-			m_objects.bounds.push_back(new_bounds);
-			m_objects.types.push_back(BEZIER);
-			m_objects.data_indices.push_back(index);
+			to.beziers.push_back(new_curve_data);
+			to.bounds.push_back(new_bounds);
+			to.types.push_back(BEZIER);
+			to.data_indices.push_back(to.beziers.size()-1);
 		}
 		return new_curves.size();
 		}
 	default:
-		Debug("Adding %s -> %s", m_objects.bounds[object_id].Str().c_str(), TransformToQuadChild(m_objects.bounds[object_id], type).Str().c_str());
-		m_objects.bounds.push_back(TransformToQuadChild(m_objects.bounds[object_id], type));
-		m_objects.types.push_back(m_objects.types[object_id]);
-		m_objects.data_indices.push_back(m_objects.data_indices[object_id]);
+		Debug("Adding %s -> %s", from.bounds[object_id].Str().c_str(), TransformToQuadChild(from.bounds[object_id], type).Str().c_str());
+		to.bounds.push_back(TransformToQuadChild(from.bounds[object_id], type));
+		to.types.push_back(from.types[object_id]);
+		to.data_indices.push_back(from.data_indices[object_id]);
 		return 1;
 	}
 	return 0;
 }
+
+/** Children started by RequestQuadChild for prefetching, beyond which more prefetches are ignored **/
+static const size_t QUADTREE_PREFETCH_JOBS = 4;
+
+/**
+ * A child being generated on its own thread
+ * The objects of the parent that intersect it are copied into inputs, which the thread clips just as GenQuadChild would
+ */
+struct Document::QuadChildJob
+{
+	QuadChildJob(QuadTreeIndex _parent, QuadTreeNodeChildren _type)
+		: parent(_parent), type(_type), parent_objects(0), inputs(), clipped(), thread(NULL)
+	{
+		SDL_AtomicSet(&done, 0);
+	}
+	QuadTreeIndex parent;
+	QuadTreeNodeChildren type;
+	unsigned parent_objects; // QuadNodeObjects(parent) when the objects were copied
+	Objects inputs;
+	Objects clipped; // the child's objects, once done
+	SDL_Thread * thread;
+	SDL_atomic_t done;
+};
+
 QuadTreeIndex Document::GenQuadChild(QuadTreeIndex parent, QuadTreeNodeChildren type)
 {
 	PROFILE_SCOPE("Document::GenQuadChild()");
-	QuadTreeIndex new_index = m_quadtree.nodes.size();
-	Debug("-------------- Generating Quadtree Node %d (parent %d, type %d) ----------------------", new_index, parent, type);
-	m_quadtree.nodes.push_back(QuadTreeNode{QUADTREE_EMPTY, QUADTREE_EMPTY, QUADTREE_EMPTY, QUADTREE_EMPTY, parent, type, 0, 0, -1, true});
+	// If it is already being generated in the background, finish that rather than doing it twice
+	for (unsigned j = 0; j < m_quad_jobs.size(); ++j)
+	{
+		if (m_quad_jobs[j]->parent != parent || m_quad_jobs[j]->type != type)
+			continue;
+		QuadChildJob * job = m_quad_jobs[j];
+		m_quad_jobs.erase(m_quad_jobs.begin() + j);
+		QuadTreeIndex child = FinishQuadChild(job);
+		if (child != QUADTREE_EMPTY)
+			return child;
+		break;
+	}
 
-	m_quadtree.nodes[new_index].object_begin = m_objects.bounds.size();
-	for (QuadTreeIndex overlay = parent; overlay != -1; overlay = m_quadtree.nodes[overlay].next_overlay)
+	ClipQuadChildren(parent, &type, 1);
+	return m_quadtree.Child(parent, type);
+}
+
+/**
+ * Generate all the children of a node that don't exist yet, clipping them in one parallel pass
+ * For when the view is about to need them (it draws the neighbours of the node it is in)
+ */
+void Document::GenQuadChildren(QuadTreeIndex parent)
+{
+	static const QuadTreeNodeChildren children[] = {QTC_TOP_LEFT, QTC_TOP_RIGHT, QTC_BOTTOM_LEFT, QTC_BOTTOM_RIGHT};
+	QuadTreeNodeChildren missing[4];
+	unsigned count = 0;
+	for (unsigned c = 0; c < 4; ++c)
+	{
+		// Finish any being generated in the background instead
+		for (unsigned j = 0; j < m_quad_jobs.size(); ++j)
+		{
+			if (m_quad_jobs[j]->parent != parent || m_quad_jobs[j]->type != children[c])
+				continue;
+			QuadChildJob * job = m_quad_jobs[j];
+			m_quad_jobs.erase(m_quad_jobs.begin() + j);
+			FinishQuadChild(job);
+			break;
+		}
+		if (m_quadtree.Child(parent, children[c]) == QUADTREE_EMPTY)
+			missing[count++] = children[c];
+	}
+	if (count > 0)
+		ClipQuadChildren(parent, missing, count);
+}
+
+/** Consecutive objects of the parent clipped by one worker at a time **/
+static const size_t QUADTREE_CLIP_CHUNK = 64;
+
+/** Where a worker put the objects it clipped from QUADTREE_CLIP_CHUNK objects of the parent **/
+struct Document::QuadClipChunk
+{
+	QuadTreeNodeChildren type;
+	unsigned input_begin; // objects of the parent
+	unsigned input_end;
+	unsigned worker;
+	unsigned object_begin; // in the worker's staging objects
+	unsigned object_end;
+};
+
+/** A thread clipping objects of a parent into its own Objects, to be merged later **/
+struct Document::QuadClipWorker
+{
+	QuadClipWorker(unsigned _id, const Objects & _source, std::vector<QuadClipChunk> & _chunks, SDL_atomic_t & _next_chunk)
+		: id(_id), source(_source), chunks(_chunks), next_chunk(_next_chunk), staging(), origins() {}
+	unsigned id;
+	const Objects & source; // only read while the workers run
+	std::vector<QuadClipChunk> & chunks; // shared; each is written by whichever worker takes it
+	SDL_atomic_t & next_chunk;
+	Objects staging;
+	std::vector<unsigned> origins; // object of the source each staging object was clipped from
+};
+
+/**
+ * Number of threads to clip quadtree children with
+ * Clipping gives the same result on any number of threads, except where the Real type keeps per-thread state
+ */
+unsigned Document::ClipThreads() const
+{
+#if REALTYPE == REAL_IRRAM || REALTYPE == REAL_MPFRCPP || REALTYPE == REAL_VFPU
+	return 1; // precision (and iRRAM's state) belongs to the main thread, and the VFPU has one socket for everyone
+#endif
+	return (m_clip_threads == 0) ? max(SDL_GetCPUCount(), 1) : m_clip_threads;
+}
+
+int Document::RunQuadClipWorker(void * data)
+{
+	QuadClipWorker & worker = *((QuadClipWorker*)data);
+	for (int c = SDL_AtomicAdd(&worker.next_chunk, 1); c < (int)worker.chunks.size(); c = SDL_AtomicAdd(&worker.next_chunk, 1))
 	{
-		for (unsigned i = m_quadtree.nodes[overlay].object_begin; i < m_quadtree.nodes[overlay].object_end; ++i)
+		QuadClipChunk & chunk = worker.chunks[c];
+		chunk.worker = worker.id;
+		chunk.object_begin = worker.staging.types.size();
+		for (unsigned i = chunk.input_begin; i < chunk.input_end; ++i)
 		{
-			if (IntersectsQuadChild(m_objects.bounds[i], type))
+			if (!IntersectsQuadChild(worker.source.bounds[i], chunk.type))
+				continue;
+			// Paths are given their own copies when merged; their Beziers may have been clipped by another worker
+			unsigned added = ClipObjectToQuadChild(worker.source, i, chunk.type, worker.staging);
+			worker.origins.resize(worker.origins.size() + added, i);
+		}
+		chunk.object_end = worker.staging.types.size();
+	}
+	return 0;
+}
+
+/**
+ * Make the given children of parent, clipping its objects on a pool of threads and merging them in order
+ * The children are the same as clipping each object in turn on one thread (which is what happens for small nodes)
+ */
+void Document::ClipQuadChildren(QuadTreeIndex parent, const QuadTreeNodeChildren * types, unsigned count)
+{
+	PROFILE_SCOPE("Document::ClipQuadChildren()");
+	// Adding nodes can move the others, so add them before holding on to the parent's objects
+	QuadTreeIndex children[4];
+	for (unsigned t = 0; t < count; ++t)
+	{
+		children[t] = NewQuadNode(parent, types[t]);
+		Debug("-------------- Generating Quadtree Node %d (parent %d, type %d) ----------------------", children[t], parent, types[t]);
+	}
+	const Objects & source = m_quadtree.nodes[parent].objects;
+	unsigned inputs = source.types.size();
+	size_t chunks_per_child = (inputs + QUADTREE_CLIP_CHUNK - 1) / QUADTREE_CLIP_CHUNK;
+	unsigned threads = min(ClipThreads(), (unsigned)(count * chunks_per_child));
+
+	std::vector<QuadClipChunk> chunks;
+	std::vector<QuadClipWorker*> workers;
+	if (threads > 1)
+	{
+		for (unsigned t = 0; t < count; ++t)
+		{
+			for (size_t c = 0; c < chunks_per_child; ++c)
+				chunks.push_back(QuadClipChunk{types[t], (unsigned)(c*QUADTREE_CLIP_CHUNK), (unsigned)min((size_t)inputs, (c+1)*QUADTREE_CLIP_CHUNK), 0, 0, 0});
+		}
+		SDL_atomic_t next_chunk;
+		SDL_AtomicSet(&next_chunk, 0);
+		std::vector<SDL_Thread*> pool;
+		for (unsigned i = 0; i < threads; ++i)
+			workers.push_back(new QuadClipWorker(i, source, chunks, next_chunk));
+		for (unsigned i = 1; i < threads; ++i)
+		{
+			SDL_Thread * thread = SDL_CreateThread(RunQuadClipWorker, "QuadClip", workers[i]);
+			if (thread == NULL)
+				Warn("Couldn't create quadtree clipping thread: %s", SDL_GetError()); // the other workers will do its share
+			else
+				pool.push_back(thread);
+		}
+		RunQuadClipWorker(workers[0]);
+		for (unsigned i = 0; i < pool.size(); ++i)
+			SDL_WaitThread(pool[i], NULL);
+	}
+
+	for (unsigned t = 0; t < count; ++t)
+	{
+		QuadTreeNodeChildren type = types[t];
+		Objects & objects = m_quadtree.nodes[children[t]].objects;
+		std::vector<unsigned> origins;
+		if (threads <= 1)
+		{
+			for (unsigned i = 0; i < inputs; ++i)
 			{
-				m_count += ClipObjectToQuadChild(i, type);
+				if (IntersectsQuadChild(source.bounds[i], type))
+				{
+					m_count += ClipIntoQuadChild(source, i, type, objects, origins);
+				}
 			}
 		}
+		else
+		{
+			// Merge; this is what ClipIntoQuadChild would have added, in the same order
+			for (size_t c = t*chunks_per_child; c < (t+1)*chunks_per_child; ++c)
+			{
+				const QuadClipWorker & worker = *workers[chunks[c].worker];
+				for (unsigned i = chunks[c].object_begin; i < chunks[c].object_end; ++i)
+					m_count += AppendClipped(worker.staging, i, worker.origins[i], source, objects, origins);
+			}
+		}
+		// No objects are dirty.
+		m_quadtree.SetChild(parent, type, children[t]);
 	}
-	m_quadtree.nodes[new_index].object_end = m_objects.bounds.size();
-	// No objects are dirty.
-	m_quadtree.nodes[new_index].object_dirty = m_objects.bounds.size();
-	switch (type)
+	for (unsigned i = 0; i < workers.size(); ++i)
+		delete workers[i];
+	m_document_dirty = true;
+}
+
+/** Number of objects in a node; if this changes, a child being generated from it is out of date **/
+unsigned Document::QuadNodeObjects(QuadTreeIndex node) const
+{
+	return m_quadtree.nodes[node].objects.types.size();
+}
+
+int Document::RunQuadChildJob(void * data)
+{
+	QuadChildJob & job = *((QuadChildJob*)data);
+	std::vector<unsigned> origins;
+	for (unsigned i = 0; i < job.inputs.types.size(); ++i)
+		ClipIntoQuadChild(job.inputs, i, job.type, job.clipped, origins);
+	SDL_AtomicSet(&job.done, 1);
+	return 0;
+}
+
+/**
+ * Start generating a child on a background thread (if it isn't already)
+ * Prefetches are dropped when QUADTREE_PREFETCH_JOBS are already running
+ */
+QuadTreeIndex Document::RequestQuadChild(QuadTreeIndex parent, QuadTreeNodeChildren type, bool prefetch)
+{
+	QuadTreeIndex child = m_quadtree.Child(parent, type);
+	if (child != QUADTREE_EMPTY)
+		return child;
+	for (unsigned j = 0; j < m_quad_jobs.size(); ++j)
 	{
-		case QTC_TOP_LEFT:
-			m_quadtree.nodes[parent].top_left = new_index;
-			break;
-		case QTC_TOP_RIGHT:
-			m_quadtree.nodes[parent].top_right = new_index;
-			break;
-		case QTC_BOTTOM_LEFT:
-			m_quadtree.nodes[parent].bottom_left = new_index;
-			break;
-		case QTC_BOTTOM_RIGHT:
-			m_quadtree.nodes[parent].bottom_right = new_index;
-			break;
-		default:
-			Fatal("Tried to add a QuadTree child of invalid type!");
+		if (m_quad_jobs[j]->parent == parent && m_quad_jobs[j]->type == type)
+			return QUADTREE_EMPTY;
 	}
-	m_document_dirty = true;
+	if (prefetch && m_quad_jobs.size() >= QUADTREE_PREFETCH_JOBS)
+		return QUADTREE_EMPTY;
+
+	PROFILE_SCOPE("Document::RequestQuadChild()");
+	QuadChildJob * job = new QuadChildJob(parent, type);
+	job->parent_objects = QuadNodeObjects(parent);
+	const Objects & from = m_quadtree.nodes[parent].objects;
+	std::vector<unsigned> origins;
+	for (unsigned i = 0; i < from.types.size(); ++i)
+	{
+		if (IntersectsQuadChild(from.bounds[i], type))
+			CopyObject(from, i, from.bounds[i], job->inputs, origins);
+	}
+	Debug("Generating Quadtree child %d of %d in the background from %u objects", type, parent, job->inputs.types.size());
+
+#if REALTYPE == REAL_IRRAM || REALTYPE == REAL_MPFRCPP || REALTYPE == REAL_VFPU
+	// Precision (and iRRAM's state) belongs to the main thread, and the VFPU has one socket for everyone
+	RunQuadChildJob(job);
+#else
+	job->thread = SDL_CreateThread(RunQuadChildJob, "QuadChild", job);
+	if (job->thread == NULL)
+	{
+		Warn("Couldn't create quadtree thread: %s", SDL_GetError());
+		RunQuadChildJob(job);
+	}
+#endif
+	m_quad_jobs.push_back(job);
+	return QUADTREE_EMPTY;
+}
+
+/**
+ * Wait for a job and add its child, in the same way GenQuadChild does
+ * Returns QUADTREE_EMPTY if the parent changed since it started; if the child already exists, returns that
+ */
+QuadTreeIndex Document::FinishQuadChild(QuadChildJob * job)
+{
+	if (job->thread != NULL)
+		SDL_WaitThread(job->thread, NULL);
+	QuadTreeIndex new_index = m_quadtree.Child(job->parent, job->type);
+	if (new_index == QUADTREE_EMPTY && QuadNodeObjects(job->parent) == job->parent_objects)
+	{
+		PROFILE_SCOPE("Document::FinishQuadChild()");
+		new_index = NewQuadNode(job->parent, job->type);
+		Debug("-------------- Adding Quadtree Node %d (parent %d, type %d) ----------------------", new_index, job->parent, job->type);
+		m_count += job->clipped.types.size();
+		m_quadtree.nodes[new_index].objects = std::move(job->clipped);
+		m_quadtree.SetChild(job->parent, job->type, new_index);
+		m_document_dirty = true;
+	}
+	delete job;
 	return new_index;
 }
 
-void Document::OverlayQuadChildren(QuadTreeIndex orig_parent, QuadTreeIndex parent, QuadTreeNodeChildren type)
+bool Document::MergeQuadChildren()
+{
+	bool merged = false;
+	for (unsigned j = 0; j < m_quad_jobs.size();)
+	{
+		QuadChildJob * job = m_quad_jobs[j];
+		if (SDL_AtomicGet(&job->done) == 0)
+		{
+			++j;
+			continue;
+		}
+		m_quad_jobs.erase(m_quad_jobs.begin() + j);
+		QuadTreeIndex parent = job->parent;
+		QuadTreeNodeChildren type = job->type;
+		if (FinishQuadChild(job) == QUADTREE_EMPTY)
+			RequestQuadChild(parent, type); // out of date; start again from what the parent has now
+		else
+			merged = true;
+	}
+	return merged;
+}
+
+/** Wait for (and discard) any children being generated in the background **/
+void Document::CancelQuadChildren()
+{
+	for (unsigned j = 0; j < m_quad_jobs.size(); ++j)
+	{
+		if (m_quad_jobs[j]->thread != NULL)
+			SDL_WaitThread(m_quad_jobs[j]->thread, NULL);
+		delete m_quad_jobs[j];
+	}
+	m_quad_jobs.clear();
+}
+
+/**
+ * Add an (empty) node to the quadtree, in the place of an evicted one if there is one
+ * This can move the other nodes (and their objects) in memory
+ */
+QuadTreeIndex Document::NewQuadNode(QuadTreeIndex parent, QuadTreeNodeChildren type)
+{
+	if (m_free_quad_nodes.empty())
+	{
+		m_quadtree.nodes.push_back(QuadTreeNode(parent, type));
+		return m_quadtree.nodes.size()-1;
+	}
+	QuadTreeIndex index = m_free_quad_nodes.back();
+	m_free_quad_nodes.pop_back();
+	m_quadtree.nodes[index] = QuadTreeNode(parent, type);
+	if ((size_t)index < m_quad_node_used.size())
+		m_quad_node_used[index] = 0;
+	return index;
+}
+
+void Document::SetQuadtreeViewNode(QuadTreeIndex node)
 {
-	PROFILE_SCOPE("Document::OverlayQuadChildren()");
-	QuadTreeIndex new_index = m_quadtree.nodes.size();
-	Debug("-------------- Generating Quadtree Node %d (orig %d parent %d, type %d) ----------------------", new_index, orig_parent, parent, type);
-	m_quadtree.nodes.push_back(QuadTreeNode{QUADTREE_EMPTY, QUADTREE_EMPTY, QUADTREE_EMPTY, QUADTREE_EMPTY, orig_parent, type, 0, 0, -1, true});
+	m_view_node = node;
+	if (node == QUADTREE_EMPTY)
+		return;
+	// Stamp the node and its ancestors, so whole subtrees age together
+	++m_quad_use_count;
+	if (m_quad_node_used.size() < m_quadtree.nodes.size())
+		m_quad_node_used.resize(m_quadtree.nodes.size(), 0);
+	for (QuadTreeIndex n = node; n != QUADTREE_EMPTY; n = m_quadtree.nodes[n].parent)
+		m_quad_node_used[n] = m_quad_use_count;
+}
 
-	m_quadtree.nodes[new_index].object_begin = m_objects.bounds.size();
-	for (unsigned i = m_quadtree.nodes[parent].object_dirty; i < m_quadtree.nodes[parent].object_end; ++i)
+/**
+ * Evict generated nodes, furthest (in tree distance) from the view node first and least recently viewed among equals,
+ *  until the objects fit in 3/4 of the budget (so we don't evict again on the next frame)
+ * Evicted nodes are regenerated from their parent by GenQuadChild when they are next needed
+ * Nodes with objects that haven't been propagated, the view and insert nodes, their ancestors, the view node's children
+ * and the neighbours drawn with it are kept
+ */
+bool Document::EnforceQuadtreeBudget()
+{
+	// Jobs make children of nodes that could be evicted (and reused), so wait until they have been merged
+	if (m_quadtree_budget == 0 || m_count <= m_quadtree_budget || !m_quad_jobs.empty() || m_quadtree.root_id == QUADTREE_EMPTY)
+		return false;
+	PROFILE_SCOPE("Document::EnforceQuadtreeBudget()");
+	QuadTreeIndex view = GetQuadtreeViewNode();
+	size_t n = m_quadtree.nodes.size();
+	if (m_quad_node_used.size() < n)
+		m_quad_node_used.resize(n, 0);
+
+	static const QuadTreeNodeChildren children[] = {QTC_TOP_LEFT, QTC_TOP_RIGHT, QTC_BOTTOM_LEFT, QTC_BOTTOM_RIGHT};
+	// Walk the tree from the root; children come after their parents in order
+	std::vector<bool> view_path(n, false), keep(n, false);
+	for (QuadTreeIndex a = view; a != QUADTREE_EMPTY; a = m_quadtree.nodes[a].parent)
+		view_path[a] = keep[a] = true;
+	for (QuadTreeIndex a = m_current_insert_node; a != QUADTREE_EMPTY; a = m_quadtree.nodes[a].parent)
+		keep[a] = true;
+	// View::RenderQuadtreeNode draws the neighbours to the right and below too; evicting those would only make them again next frame
+	static const int neighbours[][2] = {{1,0}, {0,1}, {1,1}};
+	for (unsigned i = 0; i < sizeof(neighbours)/sizeof(neighbours[0]); ++i)
+	{
+		QuadTreeIndex neighbour = m_quadtree.GetNeighbour(view, neighbours[i][0], neighbours[i][1], NULL);
+		if (neighbour != QUADTREE_EMPTY)
+			keep[neighbour] = true;
+	}
+	std::vector<QuadTreeIndex> order(1, m_quadtree.root_id);
+	std::vector<unsigned> depth(n, 0), lca_depth(n, 0), objects(n, 0);
+	for (size_t i = 0; i < order.size(); ++i)
 	{
-		if (IntersectsQuadChild(m_objects.bounds[i], type))
+		QuadTreeIndex node = order[i];
+		objects[node] = QuadNodeObjects(node);
+		if (!m_quadtree.nodes[node].dirty.empty())
+			keep[node] = true;
+		for (unsigned c = 0; c < 4; ++c)
 		{
-			m_count += ClipObjectToQuadChild(i, type);
+			QuadTreeIndex child = m_quadtree.Child(node, children[c]);
+			if (child == QUADTREE_EMPTY)
+				continue;
+			depth[child] = depth[node] + 1;
+			// The deepest common ancestor with the view node
+			lca_depth[child] = (view_path[child]) ? depth[child] : lca_depth[node];
+			if (node == view)
+				keep[child] = true;
+			order.push_back(child);
 		}
 	}
-	m_quadtree.nodes[new_index].object_end = m_objects.bounds.size();
-	QuadTreeIndex orig_node = -1;
+	// A node must be kept if anything beneath it is (walking backwards visits children before parents)
+	for (size_t i = order.size(); i-- > 1;)
+	{
+		if (keep[order[i]])
+			keep[m_quadtree.nodes[order[i]].parent] = true;
+	}
+
+	unsigned view_depth = depth[view];
+	std::vector<QuadTreeIndex> candidates;
+	for (size_t i = 1; i < order.size(); ++i)
+	{
+		if (!keep[order[i]])
+			candidates.push_back(order[i]);
+	}
+	std::sort(candidates.begin(), candidates.end(), [&](QuadTreeIndex a, QuadTreeIndex b)
+	{
+		unsigned da = depth[a] + view_depth - 2*lca_depth[a];
+		unsigned db = depth[b] + view_depth - 2*lca_depth[b];
+		return (da != db) ? (da > db) : (m_quad_node_used[a] < m_quad_node_used[b]);
+	});
+
+	// Evicting a node takes its descendants with it; they are further away, so were considered already
+	std::vector<bool> evicted(n, false);
+	unsigned target = m_quadtree_budget - m_quadtree_budget/4;
+	unsigned remaining = m_count;
+	for (size_t i = 0; i < candidates.size() && remaining > target; ++i)
+	{
+		std::vector<QuadTreeIndex> subtree(1, candidates[i]);
+		for (size_t j = 0; j < subtree.size(); ++j)
+		{
+			QuadTreeIndex node = subtree[j];
+			if (evicted[node])
+				continue;
+			evicted[node] = true;
+			remaining -= objects[node];
+			for (unsigned c = 0; c < 4; ++c)
+			{
+				if (m_quadtree.Child(node, children[c]) != QUADTREE_EMPTY)
+					subtree.push_back(m_quadtree.Child(node, children[c]));
+			}
+		}
+		m_quadtree.SetChild(m_quadtree.nodes[candidates[i]].parent, m_quadtree.nodes[candidates[i]].child_type, QUADTREE_EMPTY);
+	}
+	if (remaining == m_count)
+		return false;
+	Debug("Evicting quadtree nodes; %u objects -> %u (budget %u)", m_count, remaining, m_quadtree_budget);
+	EvictQuadNodes(evicted);
+	return true;
+}
+
+/**
+ * Drop evicted nodes with their objects
+ * Every node's Beziers and paths are its own, so nothing any other node has changes
+ * The nodes themselves are kept for NewQuadNode to reuse, so no QuadTreeIndex changes
+ */
+void Document::EvictQuadNodes(const std::vector<bool> & evicted)
+{
+	BoundsChanged(); // evicted nodes will be reused for others
+	for (size_t node = 0; node < evicted.size(); ++node)
+	{
+		if (!evicted[node])
+			continue;
+		m_count -= QuadNodeObjects(node);
+		m_quadtree.Unindex(node);
+		m_quadtree.nodes[node] = QuadTreeNode();
+		m_free_quad_nodes.push_back(node);
+	}
+	m_document_dirty = true;
+#ifdef TIERED_OBJECTS
+	// Only what is left in view gets read (and cached) again
+	for (size_t node = 0; node < m_quadtree.nodes.size(); ++node)
+	{
+		m_quadtree.nodes[node].objects.bounds.Uncache();
+		m_quadtree.nodes[node].objects.beziers.Uncache();
+	}
+#endif
+}
+
+/**
+ * Note that objects [begin, end) were added to a node (rather than copied from its parent or children),
+ * so PropagateQuadChanges copies them to the nodes around it
+ */
+void Document::MarkQuadDirty(QuadTreeIndex node, unsigned begin, unsigned end)
+{
+	if (begin == end)
+		return;
+	QuadTreeNode & n = m_quadtree.nodes[node];
+	n.render_dirty = true;
+	if (!n.dirty.empty() && n.dirty.back().second == begin)
+		n.dirty.back().second = end;
+	else
+		n.dirty.push_back(make_pair(begin, end));
+}
+
+/**
+ * Clip objects [begin, end) of parent into its existing child, and on into that child's existing children
+ */
+void Document::PropagateToQuadChild(QuadTreeIndex parent, QuadTreeNodeChildren type, unsigned begin, unsigned end)
+{
+	PROFILE_SCOPE("Document::PropagateToQuadChild()");
+	QuadTreeIndex child = m_quadtree.Child(parent, type);
+	if (child == QUADTREE_EMPTY)
+		Fatal("Tried to propagate to a QuadTree child that didn't exist!");
+	Debug("-------------- Propagating objects %u -> %u of Quadtree Node %d to %d (type %d) ----------------------", begin, end, parent, child, type);
+
+	const Objects & from = m_quadtree.nodes[parent].objects;
+	Objects & to = m_quadtree.nodes[child].objects;
+	unsigned first = to.types.size();
+	std::vector<unsigned> origins;
+	for (unsigned i = begin; i < end; ++i)
+	{
+		if (IntersectsQuadChild(from.bounds[i], type))
+		{
+			m_count += ClipIntoQuadChild(from, i, type, to, origins);
+		}
+	}
+	unsigned last = to.types.size();
+	if (first == last)
+		return;
+	m_quadtree.nodes[child].render_dirty = true;
+
+	// Recurse into any extant children.
+	static const QuadTreeNodeChildren children[] = {QTC_TOP_LEFT, QTC_TOP_RIGHT, QTC_BOTTOM_LEFT, QTC_BOTTOM_RIGHT};
+	for (unsigned c = 0; c < 4; ++c)
+	{
+		if (m_quadtree.Child(child, children[c]) != QUADTREE_EMPTY)
+			PropagateToQuadChild(child, children[c], first, last);
+	}
+	m_document_dirty = true;
+}
+
+/**
+ * Add objects [begin, end) of from, the child of type type, to its parent's objects to, in the parent's coordinates
+ * Those that end up smaller than m_quadtree_lod both ways show as little more than a dot of their colour; each square of that size
+ * with more than one that look alike (see LODKey) gets just the first of them, stretched to cover the rest.
+ * That is much cheaper to draw than (say) thousands of Beziers, but it can move pixels by up to a square.
+ * @returns the number of objects added
+ */
+unsigned Document::AddToQuadParent(const Objects & from, unsigned begin, unsigned end, QuadTreeNodeChildren type, Objects & to)
+{
+	struct Impostor
+	{
+		Rect cover;
+		unsigned first; // drawn over cover, in the place of all of them
+	};
+	map<pair<pair<int64_t, int64_t>, int>, Impostor> impostors;
+	unsigned added = 0;
+	std::vector<unsigned> origins;
+	for (unsigned i = begin; i < end; ++i)
+	{
+		Rect new_bounds = TransformFromQuadChild(from.bounds[i], type);
+		// If the object is too small to be seen, discard it (lines along an axis are still seen, and paths need them)
+		if (!new_bounds.w && !new_bounds.h) continue;
+		int key = (m_quadtree_lod > Real(0) && new_bounds.w < m_quadtree_lod && new_bounds.h < m_quadtree_lod) ? LODKey(from, i) : -1;
+		if (key >= 0)
+		{
+			pair<int64_t, int64_t> square((int64_t)floor(Double(new_bounds.x / m_quadtree_lod)), (int64_t)floor(Double(new_bounds.y / m_quadtree_lod)));
+			map<pair<pair<int64_t, int64_t>, int>, Impostor>::iterator impostor = impostors.find(make_pair(square, key));
+			if (impostor == impostors.end())
+			{
+				impostors[make_pair(square, key)] = Impostor{new_bounds, i};
+				continue;
+			}
+			Rect & cover = impostor->second.cover;
+			Real x1 = max(cover.x + cover.w, new_bounds.x + new_bounds.w);
+			Real y1 = max(cover.y + cover.h, new_bounds.y + new_bounds.h);
+			cover.x = min(cover.x, new_bounds.x);
+			cover.y = min(cover.y, new_bounds.y);
+			cover.w = x1 - cover.x;
+			cover.h = y1 - cover.y;
+			continue;
+		}
+		added += CopyObject(from, i, new_bounds, to, origins);
+	}
+	for (map<pair<pair<int64_t, int64_t>, int>, Impostor>::iterator impostor = impostors.begin(); impostor != impostors.end(); ++impostor)
+		added += CopyObject(from, impostor->second.first, impostor->second.cover, to, origins);
+	return added;
+}
+
+/**
+ * Add objects [begin, end) of child to its parent, and on to the parent's parent
+ */
+void Document::PropagateToQuadParent(QuadTreeIndex child, unsigned begin, unsigned end)
+{
+	PROFILE_SCOPE("Document::PropagateToQuadParent()");
+	QuadTreeIndex parent = m_quadtree.nodes[child].parent;
+	if (parent == QUADTREE_EMPTY)
+		return;
+	Objects & to = m_quadtree.nodes[parent].objects;
+	unsigned first = to.types.size();
+	m_count += AddToQuadParent(m_quadtree.nodes[child].objects, begin, end, m_quadtree.nodes[child].child_type, to);
+	Debug("PropagateToQuadParent(%d, %u, %u) added %u objects to %d", child, begin, end, to.types.size() - first, parent);
+	if (to.types.size() == first)
+		return;
+	m_quadtree.nodes[parent].render_dirty = true;
+	PropagateToQuadParent(parent, first, to.types.size());
+	m_document_dirty = true;
+}
+
+void Document::PropagateQuadChanges(QuadTreeIndex node)
+{
+	if (node == QUADTREE_EMPTY)
+		return;
+	std::vector<std::pair<unsigned, unsigned> > dirty;
+	dirty.swap(m_quadtree.nodes[node].dirty);
+	static const QuadTreeNodeChildren children[] = {QTC_TOP_LEFT, QTC_TOP_RIGHT, QTC_BOTTOM_LEFT, QTC_BOTTOM_RIGHT};
+	for (unsigned d = 0; d < dirty.size(); ++d)
+	{
+		// Recurse into our parent, should we have any.
+		PropagateToQuadParent(node, dirty[d].first, dirty[d].second);
+		// Recurse into any extant children.
+		for (unsigned c = 0; c < 4; ++c)
+		{
+			if (m_quadtree.Child(node, children[c]) != QUADTREE_EMPTY)
+				PropagateToQuadChild(node, children[c], dirty[d].first, dirty[d].second);
+		}
+	}
+}
+
+// Reparent a quadtree node, making it the "type" child of a new node.
+QuadTreeIndex Document::GenQuadParent(QuadTreeIndex child, QuadTreeNodeChildren type)
+{
+	QuadTreeIndex new_index = NewQuadNode(QUADTREE_EMPTY, QTC_UNKNOWN);
+
+	const Objects & from = m_quadtree.nodes[child].objects;
+	m_count += AddToQuadParent(from, 0, from.types.size(), type, m_quadtree.nodes[new_index].objects);
 	switch (type)
 	{
 		case QTC_TOP_LEFT:
-			orig_node = m_quadtree.nodes[orig_parent].top_left;
+			m_quadtree.nodes[new_index].top_left = child;
 			break;
 		case QTC_TOP_RIGHT:
-			orig_node = m_quadtree.nodes[orig_parent].top_right;
+			m_quadtree.nodes[new_index].top_right = child;
 			break;
 		case QTC_BOTTOM_LEFT:
-			orig_node = m_quadtree.nodes[orig_parent].bottom_left;
+			m_quadtree.nodes[new_index].bottom_left = child;
 			break;
 		case QTC_BOTTOM_RIGHT:
-			orig_node = m_quadtree.nodes[orig_parent].bottom_right;
+			m_quadtree.nodes[new_index].bottom_right = child;
 			break;
 		default:
-			Fatal("Tried to overlay a QuadTree child of invalid type!");
+			Fatal("Tried to add a QuadTree child of invalid type!");
 	}
-	if (orig_node == -1)
-		Fatal("Tried to overlay a QuadTree child that didn't exist!");
+	m_document_dirty = true;
+	return new_index;
+}
 
-	// Add us to the node's overlay linked list.
-	QuadTreeIndex prev_overlay = orig_node;
-	while (m_quadtree.nodes[prev_overlay].next_overlay != -1) prev_overlay = m_quadtree.nodes[prev_overlay].next_overlay;
-	Debug("- Original node %d, Previous overlay %d, new overlay %d", orig_node, prev_overlay, new_index);
-	m_quadtree.nodes[prev_overlay].next_overlay = new_index;
+#endif
 
-	// Recurse into any extant children.
-	if (m_quadtree.nodes[orig_node].top_left != -1)
-		OverlayQuadChildren(orig_node, new_index, QTC_TOP_LEFT);
-	if (m_quadtree.nodes[orig_node].top_right != -1)
-		OverlayQuadChildren(orig_node, new_index, QTC_TOP_RIGHT);
-	if (m_quadtree.nodes[orig_node].bottom_left != -1)
-		OverlayQuadChildren(orig_node, new_index, QTC_BOTTOM_LEFT);
-	if (m_quadtree.nodes[orig_node].bottom_right != -1)
-		OverlayQuadChildren(orig_node, new_index, QTC_BOTTOM_RIGHT);
-
-	m_quadtree.nodes[new_index].object_dirty = m_quadtree.nodes[new_index].object_end;
-	m_quadtree.nodes[new_index].next_overlay = -1;
-	m_document_dirty = true;
+/**
+ * Objects with the same key look the same (a dot of one colour) when too small to make out their shape, so one can stand in for the others.
+ * Their type sets the colour, and so does the kind of a Bezier when Bezier types are shown; -1 for paths, which have colours of their own
+ * and bounds worked out from their Beziers.
+ */
+int Document::LODKey(const Objects & objects, unsigned id)
+{
+	switch (objects.types[id])
+	{
+		case PATH:
+			return -1;
+		case BEZIER:
+			return BEZIER + NUMBER_OF_OBJECT_TYPES*objects.beziers[objects.data_indices[id]].GetType();
+		default:
+			return objects.types[id];
+	}
 }
 
-void Document::OverlayQuadParent(QuadTreeIndex orig_child, QuadTreeIndex child, QuadTreeNodeChildren type)
+void Document::Load(const string & filename)
 {
-	PROFILE_SCOPE("Document::OverlayQuadParent()");
-	QuadTreeIndex new_index = m_quadtree.nodes.size();
-	m_quadtree.nodes.push_back(QuadTreeNode{QUADTREE_EMPTY, QUADTREE_EMPTY, QUADTREE_EMPTY, QUADTREE_EMPTY, -1, QTC_UNKNOWN, 0, 0, -1, true});
+	m_objects.Clear();
+	m_count = 0;
+	BoundsChanged();
+#ifndef QUADTREE_DISABLED
+	CancelQuadChildren();
+	m_quadtree = QuadTree();
+	m_free_quad_nodes.clear();
+	m_quad_node_used.clear();
+	m_current_insert_node = m_view_node = -1;
+#endif
+	if (filename == "")
+	{
+		Debug("Loaded empty document.");
+		return;
+	}
+	Debug("Loading document from file \"%s\"", filename.c_str());
+	FILE * file = fopen(filename.c_str(), "rb");
+	if (file == NULL)
+		Fatal("Couldn't open file \"%s\" - %s", filename.c_str(), strerror(errno));
 
-	m_quadtree.nodes[new_index].object_begin = m_objects.bounds.size();
-	m_quadtree.nodes[new_index].object_dirty = m_objects.bounds.size();
-	for (QuadTreeIndex overlay = child; overlay != -1; overlay = m_quadtree.nodes[overlay].next_overlay)
+	DocHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || !CheckDocHeader(header, filename))
+	{
+		Warn("\"%s\" has no header; assuming version 1", filename.c_str());
+		rewind(file);
+		LoadChunkStream(file);
+	}
+	else
 	{
-		for (unsigned i = m_quadtree.nodes[overlay].object_begin; i < m_quadtree.nodes[overlay].object_end; ++i)
+		vector<DocChunkEntry> chunks(header.num_chunks);
+		if (fread(chunks.data(), sizeof(DocChunkEntry), chunks.size(), file) != chunks.size())
+			Fatal("Failed to read chunk table of \"%s\"", filename.c_str());
+		for (unsigned i = 0; i < chunks.size(); ++i)
 		{
-			Rect new_bounds = TransformFromQuadChild(m_objects.bounds[i], type);
-			// If the object is too small to be seen, discard it.
-			if (!new_bounds.w || !new_bounds.h) continue;
-			m_objects.bounds.push_back(new_bounds);
-			m_objects.types.push_back(m_objects.types[i]);
-			m_objects.data_indices.push_back(m_objects.data_indices[i]);
-			m_count++;
+			if (fseek(file, chunks[i].offset, SEEK_SET) != 0)
+				Fatal("Couldn't seek to chunk %u at %lu - %s", i, (unsigned long)chunks[i].offset, strerror(errno));
+			LoadChunk(file, (DocChunkTypes)chunks[i].type, chunks[i].size, (DocChunkEncoding)chunks[i].encoding);
 		}
 	}
-	m_quadtree.nodes[new_index].object_end = m_objects.bounds.size();
-	QuadTreeIndex orig_node = m_quadtree.nodes[orig_child].parent;
-	if (orig_node == -1)
-		Fatal("Tried to overlay a QuadTree child that didn't exist!");
+	fclose(file);
+	Debug("Successfully loaded %u objects from \"%s\"", ObjectCount(), filename.c_str());
+#ifndef QUADTREE_DISABLED
+	if (m_quadtree.root_id == QUADTREE_EMPTY)
+	{
+		GenBaseQuadtree();
+	}
+	m_quadtree.Reindex();
+#endif
+}
 
-	// Add us to the node's overlay linked list.
-	QuadTreeIndex prev_overlay = orig_node;
-	while (m_quadtree.nodes[prev_overlay].next_overlay != -1) prev_overlay = m_quadtree.nodes[prev_overlay].next_overlay;
-	m_quadtree.nodes[prev_overlay].next_overlay = new_index;
-	Debug("OverlayQuadParent(%d, %d, %d) = %d", orig_child, child, type, new_index);
+/**
+ * Load a document by mapping the file into memory
+ * The object arrays refer directly to the mapped chunks, so only pages that are actually used get read
+ * Falls back to Document::Load for files (or Real types) that can't be used in place
+ */
+void Document::LoadMapped(const string & filename)
+{
+#if REALTYPE != REAL_SINGLE && REALTYPE != REAL_DOUBLE && REALTYPE != REAL_LONG_DOUBLE
+	Warn("Can't use mapped objects with REALTYPE %d (\"%s\"); reading instead", REALTYPE, g_real_name[REALTYPE]);
+	Load(filename);
+	return;
+#endif
+	m_objects.Clear();
+	m_count = 0;
+	BoundsChanged();
+#ifndef QUADTREE_DISABLED
+	CancelQuadChildren();
+	m_quadtree = QuadTree();
+	m_free_quad_nodes.clear();
+	m_quad_node_used.clear();
+	m_current_insert_node = m_view_node = -1;
+#endif
+	Debug("Mapping document from file \"%s\"", filename.c_str());
+	shared_ptr<MappedFile> file(new MappedFile(filename));
 
-	// Recurse into any extant parent.
-	if (m_quadtree.nodes[orig_node].parent != -1)
-		OverlayQuadParent(orig_node, new_index, m_quadtree.nodes[orig_node].child_type);
+	if (file->Size() < sizeof(DocHeader) || !CheckDocHeader(*(const DocHeader*)file->Data(), filename))
+	{
+		Warn("\"%s\" has no header; can't map version 1 documents", filename.c_str());
+		file.reset();
+		Load(filename);
+		return;
+	}
+	const DocHeader & header = *(const DocHeader*)file->Data();
+	if (sizeof(DocHeader) + header.num_chunks * sizeof(DocChunkEntry) > file->Size())
+		Fatal("Chunk table of \"%s\" is truncated", filename.c_str());
+	const DocChunkEntry * chunks = (const DocChunkEntry*)(file->Data() + sizeof(DocHeader));
 
-	m_quadtree.nodes[new_index].object_dirty = m_quadtree.nodes[new_index].object_end;
-	m_quadtree.nodes[new_index].next_overlay = -1;
-	m_document_dirty = true;
+	for (unsigned i = 0; i < header.num_chunks; ++i)
+	{
+		const DocChunkEntry & chunk = chunks[i];
+		if (chunk.offset + chunk.size > file->Size())
+			Fatal("Chunk %u of \"%s\" is truncated", i, filename.c_str());
+		if (chunk.encoding == CE_PACKED)
+		{
+			// Has to be decoded, but can at least be decoded straight out of the mapping
+			Deserialiser packed(file->Data() + chunk.offset, chunk.size);
+			LoadPackedChunk(packed, (DocChunkTypes)chunk.type);
+			continue;
+		}
+		switch (chunk.type)
+		{
+		case CT_NUMOBJS:
+			memcpy(&m_count, file->Data() + chunk.offset, sizeof(m_count));
+			Debug("Number of objects: %u", ObjectCount());
+			break;
+		case CT_OBJTYPES:
+			m_objects.types.Map(file, chunk.offset, chunk.size/sizeof(ObjectType));
+			break;
+#ifndef TIERED_OBJECTS
+		case CT_OBJBOUNDS:
+			m_objects.bounds.Map(file, chunk.offset, chunk.size/sizeof(Rect));
+			break;
+#endif
+		case CT_OBJINDICES:
+			m_objects.data_indices.Map(file, chunk.offset, chunk.size/sizeof(unsigned));
+			break;
+#ifndef TIERED_OBJECTS
+		case CT_OBJBEZIERS:
+			m_objects.beziers.Map(file, chunk.offset, chunk.size/sizeof(Bezier));
+			break;
+#endif
+		case CT_OBJPATHS:
+		{
+			// Paths own a std::vector, so they can't be used in place
+			const PathRecord * records = (const PathRecord*)(file->Data() + chunk.offset);
+			m_objects.paths.clear();
+			m_objects.paths.reserve(chunk.size/sizeof(PathRecord));
+			for (unsigned p = 0; p < chunk.size/sizeof(PathRecord); ++p)
+				m_objects.paths.push_back(PathFromRecord(records[p]));
+			break;
+		}
+#ifndef QUADTREE_DISABLED
+		case CT_QUADTREE:
+		{
+			const QuadTreeRecord & record = *(const QuadTreeRecord*)(file->Data() + chunk.offset);
+			m_quadtree.root_id = record.root_id;
+			m_current_insert_node = record.insert_node;
+			m_view_node = record.view_node;
+			break;
+		}
+#else
+		case CT_QUADTREE:
+			Debug("Ignoring quadtree chunk (quadtree is disabled)");
+			break;
+#endif
+		case CT_QUADTREENODES:
+			LoadQuadNodes((const QuadNodeRecord*)(file->Data() + chunk.offset), chunk.size/sizeof(QuadNodeRecord));
+			break;
+		default:
+			Warn("Unknown chunk type %u", chunk.type);
+			break;
+		}
+	}
+	Debug("Successfully mapped %u objects from \"%s\"", ObjectCount(), filename.c_str());
+#ifndef QUADTREE_DISABLED
+	if (m_quadtree.root_id == QUADTREE_EMPTY)
+	{
+		GenBaseQuadtree();
+	}
+	m_quadtree.Reindex();
+#endif
 }
 
-void Document::PropagateQuadChanges(QuadTreeIndex node)
+/**
+ * Read one chunk's data from the current position in file
+ */
+void Document::LoadChunk(FILE * file, DocChunkTypes chunk_type, uint64_t chunk_size, DocChunkEncoding encoding)
 {
-	for(QuadTreeIndex overlay = node; overlay != -1; overlay = m_quadtree.nodes[overlay].next_overlay)
+	if (encoding == CE_PACKED)
 	{
-		// We don't care about clean overlays.
-		if (m_quadtree.nodes[overlay].object_dirty == m_quadtree.nodes[overlay].object_end) continue;
-		// Recurse into our parent, should we have any.
-		if (m_quadtree.nodes[node].parent != -1)
-			OverlayQuadParent(node, overlay, m_quadtree.nodes[node].child_type);
-		// Recurse into any extant children.
-		if (m_quadtree.nodes[node].top_left != -1)
-			OverlayQuadChildren(node, overlay, QTC_TOP_LEFT);
-		if (m_quadtree.nodes[node].top_right != -1)
-			OverlayQuadChildren(node, overlay, QTC_TOP_RIGHT);
-		if (m_quadtree.nodes[node].bottom_left != -1)
-			OverlayQuadChildren(node, overlay, QTC_BOTTOM_LEFT);
-		if (m_quadtree.nodes[node].bottom_right != -1)
-			OverlayQuadChildren(node, overlay, QTC_BOTTOM_RIGHT);
+		Deserialiser packed(file, chunk_size);
+		LoadPackedChunk(packed, chunk_type);
+		return;
+	}
+	if (encoding != CE_RAW)
+		Fatal("Chunk of type %d has unknown encoding %d", chunk_type, encoding);
+	switch(chunk_type)
+	{
+	case CT_NUMOBJS:
+		if (fread(&m_count, sizeof(m_count), 1, file) != 1)
+			Fatal("Failed to read number of objects!");
+		Debug("Number of objects: %u", ObjectCount());
+		break;
+	case CT_OBJTYPES:
+		Debug("Object types...");
+		LoadStructVector<ObjectType>(file, chunk_size/sizeof(ObjectType), m_objects.types);
+		break;
+	case CT_OBJBOUNDS:
+		Debug("Object bounds...");
+		LoadStructVector<Rect>(file, chunk_size/sizeof(Rect), m_objects.bounds);
+		break;
+	case CT_OBJINDICES:
+		Debug("Object data indices...");
+		LoadStructVector<unsigned>(file, chunk_size/sizeof(unsigned), m_objects.data_indices);
+		break;
+	case CT_OBJBEZIERS:
+		Debug("Bezier data...");
+		LoadStructVector<Bezier>(file, chunk_size/sizeof(Bezier), m_objects.beziers);
+		break;
+		
+	case CT_OBJPATHS:
+	{
+		Debug("Path data...");
+		vector<PathRecord> records;
+		LoadStructVector<PathRecord>(file, chunk_size/sizeof(PathRecord), records);
+		m_objects.paths.clear();
+		m_objects.paths.reserve(records.size());
+		for (unsigned i = 0; i < records.size(); ++i)
+			m_objects.paths.push_back(PathFromRecord(records[i]));
+		break;
+	}
+#ifndef QUADTREE_DISABLED
+	case CT_QUADTREE:
+	{
+		Debug("Quadtree...");
+		QuadTreeRecord record;
+		if (fread(&record, sizeof(record), 1, file) != 1)
+			Fatal("Failed to read quadtree!");
+		m_quadtree.root_id = record.root_id;
+		m_current_insert_node = record.insert_node;
+		m_view_node = record.view_node;
+		break;
+	}
+#endif
+	case CT_QUADTREENODES:
+	{
+		Debug("Quadtree nodes...");
+		vector<QuadNodeRecord> records;
+		LoadStructVector<QuadNodeRecord>(file, chunk_size/sizeof(QuadNodeRecord), records);
+		LoadQuadNodes(records.data(), records.size());
+		break;
+	}
+	default:
+		Debug("Ignoring chunk of type %d", chunk_type);
+		fseek(file, chunk_size, SEEK_CUR);
+		break;
+	}
+}
 
-		m_quadtree.nodes[overlay].object_dirty = m_quadtree.nodes[overlay].object_end;
+/**
+ * Read a chunk that was written by a Serialiser
+ */
+void Document::LoadPackedChunk(Deserialiser & packed, DocChunkTypes chunk_type)
+{
+	uint64_t count = packed.Varint();
+	if (count > packed.Remaining())
+		Fatal("Chunk of type %d claims %lu elements in %lu bytes", chunk_type, (unsigned long)count, (unsigned long)packed.Remaining());
+	switch (chunk_type)
+	{
+	case CT_OBJBOUNDS:
+		Debug("Object bounds (packed)...");
+		m_objects.bounds.clear();
+		m_objects.bounds.reserve(count);
+		for (unsigned i = 0; i < count; ++i)
+		{
+			Rect bounds;
+			packed.Read(bounds);
+			m_objects.bounds.push_back(bounds);
+		}
+		break;
+	case CT_OBJBEZIERS:
+		Debug("Bezier data (packed)...");
+		m_objects.beziers.clear();
+		m_objects.beziers.reserve(count);
+		for (unsigned i = 0; i < count; ++i)
+		{
+			Bezier bezier;
+			packed.Read(bezier);
+			m_objects.beziers.push_back(bezier);
+		}
+		break;
+	case CT_OBJPATHS:
+	{
+		Debug("Path data (packed)...");
+		m_objects.paths.clear();
+		m_objects.paths.reserve(count);
+		for (unsigned i = 0; i < count; ++i)
+		{
+			PathRecord record;
+			ReadPathRecord(packed, record);
+			m_objects.paths.push_back(PathFromRecord(record));
+		}
+		break;
+	}
+	default:
+		Fatal("Chunk of type %d can't be packed", chunk_type);
+	}
+	if (packed.Remaining() != 0)
+		Fatal("%lu bytes left over after chunk of type %d", (unsigned long)packed.Remaining(), chunk_type);
+}
+
+/**
+ * Read a version 1 document (chunk headers interleaved with the chunks)
+ */
+void Document::LoadChunkStream(FILE * file)
+{
+	DocChunkTypes chunk_type;
+	uint32_t chunk_size;
+	while (ReadChunkHeader(file, chunk_type, chunk_size))
+	{
+		LoadChunk(file, chunk_type, chunk_size);
 	}
 }
 
-// Reparent a quadtree node, making it the "type" child of a new node.
-QuadTreeIndex Document::GenQuadParent(QuadTreeIndex child, QuadTreeNodeChildren type)
+// Sets part to elements [begin, end) of whole
+template<class V>
+static void SplitVector(const V & whole, size_t begin, size_t end, V & part)
 {
-	QuadTreeIndex new_index = m_quadtree.nodes.size();
-	m_quadtree.nodes.push_back(QuadTreeNode{QUADTREE_EMPTY, QUADTREE_EMPTY, QUADTREE_EMPTY, QUADTREE_EMPTY, -1, QTC_UNKNOWN, 0, 0, -1, true});
+	part.clear();
+	part.reserve(end - begin);
+	for (size_t i = begin; i < end; ++i)
+		part.push_back(whole[i]);
+}
 
-	m_quadtree.nodes[new_index].object_begin = m_objects.bounds.size();
-	for (QuadTreeIndex overlay = child; overlay != -1; overlay = m_quadtree.nodes[overlay].next_overlay)
-	{
-		for (unsigned i = m_quadtree.nodes[overlay].object_begin; i < m_quadtree.nodes[overlay].object_end; ++i)
-		{
-			Rect new_bounds = TransformFromQuadChild(m_objects.bounds[i], type);
-			// If the object is too small to be seen, discard it.
-			if (!new_bounds.w || !new_bounds.h) continue;
-			m_objects.bounds.push_back(new_bounds);
-			m_objects.types.push_back(m_objects.types[i]);
-			m_objects.data_indices.push_back(m_objects.data_indices[i]);
-			m_count++;
-		}
-	}
-	m_quadtree.nodes[new_index].object_end = m_objects.bounds.size();
-	m_quadtree.nodes[new_index].object_dirty = m_objects.bounds.size();
-	switch (type)
+// Mapped elements stay mapped
+template<typename T>
+static void SplitVector(const ChunkVector<T> & whole, size_t begin, size_t end, ChunkVector<T> & part)
+{
+	if (!whole.Mapped())
 	{
-		case QTC_TOP_LEFT:
-			m_quadtree.nodes[new_index].top_left = child;
-			break;
-		case QTC_TOP_RIGHT:
-			m_quadtree.nodes[new_index].top_right = child;
-			break;
-		case QTC_BOTTOM_LEFT:
-			m_quadtree.nodes[new_index].bottom_left = child;
-			break;
-		case QTC_BOTTOM_RIGHT:
-			m_quadtree.nodes[new_index].bottom_right = child;
-			break;
-		default:
-			Fatal("Tried to add a QuadTree child of invalid type!");
+		SplitVector<ChunkVector<T> >(whole, begin, end, part);
+		return;
 	}
-	return new_index;
-	m_document_dirty = true;
+	part.MapPart(whole, begin, end - begin);
 }
 
-#endif
+static void SplitObjects(const Objects & whole, size_t object_begin, size_t object_end, size_t bezier_begin, size_t bezier_end,
+	size_t path_begin, size_t path_end, Objects & part)
+{
+	if (object_begin > object_end || object_end > whole.types.size() || object_end > whole.bounds.size() || object_end > whole.data_indices.size()
+		|| bezier_begin > bezier_end || bezier_end > whole.beziers.size() || path_begin > path_end || path_end > whole.paths.size())
+		Fatal("Quadtree node objects [%u, %u) are outside the %u objects loaded", object_begin, object_end, whole.types.size());
+	SplitVector(whole.types, object_begin, object_end, part.types);
+	SplitVector(whole.bounds, object_begin, object_end, part.bounds);
+	SplitVector(whole.data_indices, object_begin, object_end, part.data_indices);
+	SplitVector(whole.beziers, bezier_begin, bezier_end, part.beziers);
+	part.paths.assign(whole.paths.begin() + path_begin, whole.paths.begin() + path_end);
+}
 
-void Document::Load(const string & filename)
+/**
+ * Give each quadtree node its objects, out of those just loaded (see QuadNodeRecord); mapped objects stay mapped
+ * Without the quadtree, only the root's objects are kept (or none of the nodes', if some objects were outside the quadtree)
+ */
+void Document::LoadQuadNodes(const QuadNodeRecord * records, size_t count)
 {
-	m_objects.bounds.clear();
-	m_count = 0;
-	if (filename == "")
-	{
-		Debug("Loaded empty document.");
+	if (count == 0)
 		return;
+#ifndef QUADTREE_DISABLED
+	m_quadtree.nodes.resize(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		const QuadNodeRecord & record = records[i];
+		QuadTreeNode & node = m_quadtree.nodes[i];
+		node = QuadTreeNode(record.parent, (QuadTreeNodeChildren)record.child_type);
+		node.top_left = record.top_left;
+		node.top_right = record.top_right;
+		node.bottom_left = record.bottom_left;
+		node.bottom_right = record.bottom_right;
+		SplitObjects(m_objects, record.object_begin, record.object_end, record.bezier_begin, record.bezier_end, record.path_begin, record.path_end, node.objects);
+		if (record.dirty_begin != record.dirty_end)
+			node.dirty.push_back(make_pair(record.dirty_begin, record.dirty_end));
 	}
-	Debug("Loading document from file \"%s\"", filename.c_str());
-	FILE * file = fopen(filename.c_str(), "r");
-	if (file == NULL)
-		Fatal("Couldn't open file \"%s\"", filename.c_str(), strerror(errno));
-
-	size_t read;
-
-	DocChunkTypes chunk_type;
-	uint32_t chunk_size;
-	while (ReadChunkHeader(file, chunk_type, chunk_size))
+#else
+	// The root has (a copy of) everything, so it is the document; unless objects were added outside the quadtree
+	size_t root = count;
+	for (size_t i = 0; i < count && records[0].object_begin == 0; ++i)
 	{
-		switch(chunk_type)
-		{
-		case CT_NUMOBJS:
-			read = fread(&m_count, sizeof(m_count), 1, file);
-			if (read != 1)
-				Fatal("Failed to read number of objects!");
-			Debug("Number of objects: %u", ObjectCount());
-			break;
-		case CT_OBJTYPES:
-			Debug("Object types...");
-			LoadStructVector<ObjectType>(file, chunk_size/sizeof(ObjectType), m_objects.types);
-			break;
-		case CT_OBJBOUNDS:
-			Debug("Object bounds...");
-			LoadStructVector<Rect>(file, chunk_size/sizeof(Rect), m_objects.bounds);
-			break;
-		case CT_OBJINDICES:
-			Debug("Object data indices...");
-			LoadStructVector<unsigned>(file, chunk_size/sizeof(unsigned), m_objects.data_indices);
-			break;
-		case CT_OBJBEZIERS:
-			Debug("Bezier data...");
-			LoadStructVector<Bezier>(file, chunk_size/sizeof(Bezier), m_objects.beziers);
-			break;
-			
-		case CT_OBJPATHS:
-			Debug("Path data...");
-			Warn("Not handled because lazy");
-			break;
-		}
+		if (records[i].parent == QUADTREE_EMPTY && records[i].object_end > records[i].object_begin
+			&& (root == count || records[i].object_end - records[i].object_begin > records[root].object_end - records[root].object_begin))
+			root = i;
 	}
-	Debug("Successfully loaded %u objects from \"%s\"", ObjectCount(), filename.c_str());
-#ifndef QUADTREE_DISABLED
-	if (m_quadtree.root_id == QUADTREE_EMPTY)
+	if (root < count)
 	{
-		GenBaseQuadtree();
+		Warn("Keeping only the objects of the root of %u quadtree nodes (quadtree is disabled)", count);
+		Objects objects;
+		SplitObjects(m_objects, records[root].object_begin, records[root].object_end, records[root].bezier_begin, records[root].bezier_end,
+			records[root].path_begin, records[root].path_end, objects);
+		m_objects = std::move(objects);
+		m_count = m_objects.types.size();
+		return;
 	}
+	Warn("Dropping the objects of %u quadtree nodes (quadtree is disabled)", count);
+	m_count = records[0].object_begin;
 #endif
+	Objects flat;
+	SplitObjects(m_objects, 0, records[0].object_begin, 0, records[0].bezier_begin, 0, records[0].path_begin, flat);
+	m_objects = std::move(flat);
 }
 
 unsigned Document::AddPath(unsigned start_index, unsigned end_index, const Colour & fill, const Colour & stroke)
 {
-	Path path(m_objects, start_index, end_index, fill, stroke);
+	Path path(InsertObjects(), start_index, end_index, fill, stroke);
 	unsigned data_index = AddPathData(path);
-	Rect bounds = path.SolveBounds(m_objects);
+	Rect bounds = path.SolveBounds(InsertObjects());
 	unsigned result = Add(PATH, bounds,data_index);
-	m_objects.paths[data_index].m_index = result;
+	InsertObjects().paths[data_index].m_index = result;
 	//Debug("Added path %u -> %u (%u objects) colour {%u,%u,%u,%u}, stroke {%u,%u,%u,%u}", start_index, end_index, (end_index - start_index), fill.r, fill.g, fill.b, fill.a, stroke.r, stroke.g, stroke.b, stroke.a);
 	return result;
 }
@@ -464,9 +1701,9 @@ unsigned Document::AddBezier(const Bezier & bezier)
 	unsigned index = AddBezierData(data);
 	return Add(BEZIER, bounds, index);
 }
-// Adds an object to the Document, clipping it to m_clip_rect.
+// Adds an object to objects, clipping it to clip_rect.
 // Helper function called by Document::Add()
-int Document::AddClip(ObjectType type, const Rect& bounds, unsigned data_index, const Rect& clip_rect)
+int Document::AddClip(Objects & objects, ObjectType type, const Rect& bounds, unsigned data_index, const Rect& clip_rect)
 {
 	PROFILE_SCOPE("Document::AddAndClip");
 	switch (type)
@@ -476,9 +1713,9 @@ int Document::AddClip(ObjectType type, const Rect& bounds, unsigned data_index,
 	case PATH:
 		{
 		Rect obj_bounds = clip_rect.Clip(bounds);
-		m_objects.bounds.push_back(obj_bounds);
-		m_objects.types.push_back(type);
-		m_objects.data_indices.push_back(data_index);
+		objects.bounds.push_back(obj_bounds);
+		objects.types.push_back(type);
+		objects.data_indices.push_back(data_index);
 		return 1;
 		}
 	case BEZIER:
@@ -486,121 +1723,210 @@ int Document::AddClip(ObjectType type, const Rect& bounds, unsigned data_index,
 		// If we're entirely within the clipping rect, no clipping need occur.
 		if (clip_rect.Contains(bounds))
 		{
-			m_objects.bounds.push_back(bounds);
-			m_objects.types.push_back(type);
-			m_objects.data_indices.push_back(data_index);
+			objects.bounds.push_back(bounds);
+			objects.types.push_back(type);
+			objects.data_indices.push_back(data_index);
 			return 1;
 		}
 		Rect clip_bezier_bounds = TransformRectCoordinates(bounds, clip_rect); 
-		std::vector<Bezier> new_curves = m_objects.beziers[data_index].ClipToRectangle(clip_bezier_bounds);
+		std::vector<Bezier> new_curves = objects.beziers[data_index].ClipToRectangle(clip_bezier_bounds);
 		for (size_t i = 0; i < new_curves.size(); ++i)
 		{
 			Bezier new_curve_data = new_curves[i].ToAbsolute(bounds);
 			Rect new_bounds = new_curve_data.SolveBounds();
 			new_curve_data = new_curve_data.ToRelative(new_bounds);
-			unsigned index = AddBezierData(new_curve_data);
-			m_objects.bounds.push_back(new_bounds);
-			m_objects.types.push_back(BEZIER);
-			m_objects.data_indices.push_back(index);
+			objects.beziers.push_back(new_curve_data);
+			objects.bounds.push_back(new_bounds);
+			objects.types.push_back(BEZIER);
+			objects.data_indices.push_back(objects.beziers.size()-1);
 		}
 		return new_curves.size();
 		}
 	default:
-		m_objects.bounds.push_back(bounds);
-		m_objects.types.push_back(type);
-		m_objects.data_indices.push_back(data_index);
+		objects.bounds.push_back(bounds);
+		objects.types.push_back(type);
+		objects.data_indices.push_back(data_index);
 		return 1;
 	}
 	return 0;
 }
 
+#ifndef QUADTREE_DISABLED
+/**
+ * The data index in to of a copy of the data (at data_index in from) of an object of the given type
+ * Objects only use the Beziers and paths of the arena they are in
+ */
+static unsigned CopyObjectData(ObjectType type, unsigned data_index, const Objects & from, Objects & to)
+{
+	if (&from == &to)
+		return data_index;
+	switch (type)
+	{
+	case BEZIER:
+		to.beziers.push_back(from.beziers[data_index]);
+		return to.beziers.size()-1;
+	case PATH:
+		to.paths.push_back(from.paths[data_index]);
+		return to.paths.size()-1;
+	default:
+		return data_index;
+	}
+}
+#endif
+
+/**
+ * Add an object, whose data (if any) was added with AddBezierData or AddPathData
+ * With the quadtree, it goes in the node (next to qti, or the insert node) its position falls in, clipped to it;
+ * a path stays with its Beziers in the insert node
+ * @returns the ID of the (first) object added, among the objects of the node it went in
+ */
 unsigned Document::Add(ObjectType type, const Rect & bounds, unsigned data_index, QuadTreeIndex qti)
 {
 	PROFILE_SCOPE("Document::Add");
 	Rect new_bounds = bounds;
+	m_document_dirty = true;
 #ifndef QUADTREE_DISABLED
-	int num_added = 1;
 	if (qti == -1) qti = m_current_insert_node;
 	if (qti != -1)
 	{
 		// Move the object to the quadtree node it should be in.
-		m_quadtree.GetCanonicalCoords(qti, new_bounds.x, new_bounds.y, this);
+		QuadTreeIndex node = qti;
+		if (type != PATH)
+			m_quadtree.GetCanonicalCoords(node, new_bounds.x, new_bounds.y, this);
+		// (there are no nodes beyond the edges of the root; there it is clipped to the node it was added to)
+		if (node == QUADTREE_EMPTY)
+		{
+			node = qti;
+			new_bounds = bounds;
+		}
+		// (making a new node can move the others)
+		Objects & objects = m_quadtree.nodes[node].objects;
+		data_index = CopyObjectData(type, data_index, InsertObjects(), objects);
+		unsigned first = objects.types.size();
 		Rect cliprect = Rect(0,0,1,1);
-		num_added = AddClip(type, new_bounds, data_index, cliprect);
+		unsigned num_added = AddClip(objects, type, new_bounds, data_index, cliprect);
+		MarkQuadDirty(node, first, first + num_added);
+		m_count += num_added;
+		return first;
 	}
-	else
 #endif
-	{
-		m_objects.types.push_back(type);
-		m_objects.bounds.push_back(new_bounds);
-		m_objects.data_indices.push_back(data_index);
-	}
+	m_objects.types.push_back(type);
+	m_objects.bounds.push_back(new_bounds);
+	m_objects.data_indices.push_back(data_index);
+	return (m_count++);
+}
+
+/** Make room for extra more elements, still growing geometrically when called repeatedly **/
+template <class V>
+static void ReserveFor(V & v, size_t extra)
+{
+	if (v.size() + extra > v.capacity())
+		v.reserve(max(v.size() + extra, 2*v.capacity()));
+}
+
+/**
+ * Add count objects at once, in order
+ * Gives the same objects as calling Add on each of them, but space is reserved once
+ * @returns the ID of the first object added (clipping to a quadtree node can turn one object into several)
+ */
+unsigned Document::AddBatch(const ObjectType * types, const Rect * bounds, const unsigned * data_indices, unsigned count, QuadTreeIndex qti)
+{
+	PROFILE_SCOPE("Document::AddBatch");
+	Objects & objects = InsertObjects();
+	unsigned first = objects.types.size();
+	ReserveFor(objects.types, count);
+	ReserveFor(objects.bounds, count);
+	ReserveFor(objects.data_indices, count);
 	m_document_dirty = true;
 #ifndef QUADTREE_DISABLED
+	if (qti == -1) qti = m_current_insert_node;
 	if (qti != -1)
 	{
-		QuadTreeIndex new_qti = qti;
-		while (m_quadtree.nodes[new_qti].next_overlay != -1)
+		// Runs of objects going in the same node are marked dirty together (see MarkQuadDirty)
+		for (unsigned i = 0; i < count; ++i)
 		{
-			if (m_count == m_quadtree.nodes[new_qti].object_end+1)
-			{
-				m_quadtree.nodes[new_qti].object_end += num_added;
-				m_quadtree.nodes[new_qti].render_dirty = true;
-				new_qti = -1;
-				break;
-			}
-			new_qti = m_quadtree.nodes[new_qti].next_overlay;
-		}
-		if (new_qti != -1)
-		{
-			QuadTreeIndex overlay = m_quadtree.nodes.size();
-			Debug("Adding new overlay, nqti = %d, overlay = %d", new_qti, overlay);
-			m_quadtree.nodes.push_back(QuadTreeNode{QUADTREE_EMPTY, QUADTREE_EMPTY, QUADTREE_EMPTY, QUADTREE_EMPTY, -1, QTC_UNKNOWN, 0, 0, -1});
-			m_quadtree.nodes[overlay].object_begin = m_count;
-			// All objects are dirty.
-			m_quadtree.nodes[overlay].object_dirty = m_count;
-			m_quadtree.nodes[overlay].object_end = m_count+num_added;
-			m_quadtree.nodes[overlay].next_overlay = -1;
-			m_quadtree.nodes[overlay].render_dirty = true;
-			m_quadtree.nodes[new_qti].next_overlay = overlay;
-			new_qti = overlay;
-		}
-	}
-	m_count += num_added;
-	return m_count-num_added;
-#else // words fail me (still not amused)
-	return (m_count++);
+			unsigned id = Add(types[i], bounds[i], data_indices[i], qti);
+			if (i == 0)
+				first = id;
+		}
+		return first;
+	}
 #endif
-	
+	for (unsigned i = 0; i < count; ++i)
+	{
+		objects.types.push_back(types[i]);
+		objects.bounds.push_back(bounds[i]);
+		objects.data_indices.push_back(data_indices[i]);
+	}
+	m_count += count;
+	return first;
 }
 
 unsigned Document::AddBezierData(const Bezier & bezier)
 {
-	m_objects.beziers.push_back(bezier);
-	return m_objects.beziers.size()-1;
+	Objects & objects = InsertObjects();
+	objects.beziers.push_back(bezier);
+	return objects.beziers.size()-1;
 }
 
 unsigned Document::AddPathData(const Path & path)
 {
-	m_objects.paths.push_back(path);
-	return m_objects.paths.size()-1;
+	Objects & objects = InsertObjects();
+	objects.paths.push_back(path);
+	return objects.paths.size()-1;
 }
 
 void Document::DebugDumpObjects()
 {
 	Debug("Objects for Document %p are:", this);
-	for (unsigned id = 0; id < ObjectCount(); ++id)
+	for (unsigned id = 0; id < m_objects.types.size(); ++id)
 	{
 		Debug("%u. \tType: %u\tBounds: %s", id, m_objects.types[id], m_objects.bounds[id].Str().c_str());
 	}
 }
 
+// Compare values rather than bytes; Reals aren't always plain old data
+static bool SameObjects(const Objects & a, const Objects & b)
+{
+	return (a.bounds.size() == b.bounds.size()
+		&& equal(a.bounds.begin(), a.bounds.end(), b.bounds.begin())
+		&& a.data_indices.size() == b.data_indices.size()
+		&& equal(a.data_indices.begin(), a.data_indices.end(), b.data_indices.begin())
+		&& a.beziers.size() == b.beziers.size()
+		&& equal(a.beziers.begin(), a.beziers.end(), b.beziers.begin()));
+}
+
+/**
+ * The objects of a document in order, leaving out empty arenas;
+ * GenBaseQuadtree only moves m_objects into the root, so it doesn't change these
+ */
+static void FilledArenas(const Objects & objects, vector<const Objects*> & arenas)
+{
+	if (objects.types.size() > 0)
+		arenas.push_back(&objects);
+}
+
 bool Document::operator==(const Document & equ) const
 {
-	return (ObjectCount() == equ.ObjectCount() 
-		&& memcmp(m_objects.bounds.data(), equ.m_objects.bounds.data(), ObjectCount() * sizeof(Rect)) == 0
-		&& memcmp(m_objects.data_indices.data(), equ.m_objects.data_indices.data(), ObjectCount() * sizeof(unsigned)) == 0
-		&& memcmp(m_objects.beziers.data(), equ.m_objects.beziers.data(), m_objects.beziers.size() * sizeof(Bezier)) == 0);
+	if (ObjectCount() != equ.ObjectCount())
+		return false;
+	vector<const Objects*> mine, theirs;
+	FilledArenas(m_objects, mine);
+	FilledArenas(equ.m_objects, theirs);
+#ifndef QUADTREE_DISABLED
+	for (size_t i = 0; i < m_quadtree.nodes.size(); ++i)
+		FilledArenas(m_quadtree.nodes[i].objects, mine);
+	for (size_t i = 0; i < equ.m_quadtree.nodes.size(); ++i)
+		FilledArenas(equ.m_quadtree.nodes[i].objects, theirs);
+#endif
+	if (mine.size() != theirs.size())
+		return false;
+	for (size_t i = 0; i < mine.size(); ++i)
+	{
+		if (!SameObjects(*mine[i], *theirs[i]))
+			return false;
+	}
+	return true;
 }
 
 
@@ -765,152 +2091,411 @@ inline Colour ParseColourString(const string & colour_str)
 	return c;
 }
 
+/** Centre the contents of an <svg> element **/
+static void CentreSVG(const SVGElement & svg, SVGMatrix & transform)
+{
+	Real ww = RealFromStr(svg.String("width"));
+	Real hh = RealFromStr(svg.String("height"));
+	transform.e -= transform.a * ww/Real(2);
+	transform.f -= transform.d * hh/Real(2);
+}
+
+/** Elements whose children are parsed; the children of anything else are ignored **/
+static bool IsSVGContainer(const string & name)
+{
+	return (name == "svg" || name == "g" || name == "group");
+}
+
+static void SVGElementFromNode(const pugi::xml_node & node, SVGElement & element)
+{
+	element.name = node.name();
+	element.attributes.clear();
+	for (pugi::xml_attribute attrib = node.first_attribute(); attrib; attrib = attrib.next_attribute())
+		element.attributes.push_back(pair<string, string>(attrib.name(), attrib.value()));
+}
+
 void Document::ParseSVGNode(pugi::xml_node & root, SVGMatrix & parent_transform)
 {
 	//Debug("Parse node <%s>", root.name());
 
+	SVGElement element;
+	SVGElementFromNode(root, element);
 	
 	// Centre the SVGs
-	if (strcmp(root.name(),"svg") == 0)
+	if (element.name == "svg")
 	{
-		Real ww = RealFromStr(root.attribute("width").as_string());
-		Real hh = RealFromStr(root.attribute("height").as_string());
-		parent_transform.e -= parent_transform.a * ww/Real(2);
-		parent_transform.f -= parent_transform.d * hh/Real(2);
+		CentreSVG(element, parent_transform);
 	}
 	
 	for (pugi::xml_node child = root.first_child(); child; child = child.next_sibling())
 	{
+		SVGElementFromNode(child, element);
 		SVGMatrix transform(parent_transform);	
-		pugi::xml_attribute attrib_trans = child.attribute("transform");
-		if (!attrib_trans.empty())
+		if (element.Has("transform"))
 		{
-			ParseSVGTransform(attrib_trans.as_string(), transform);
+			ParseSVGTransform(element.String("transform"), transform);
 		}
 		
-		
-		
-		if (strcmp(child.name(), "svg") == 0 || strcmp(child.name(),"g") == 0
-			|| strcmp(child.name(), "group") == 0)
+		if (IsSVGContainer(element.name))
 		{
-			
 			ParseSVGNode(child, transform);
 			continue;
 		}
-		else if (strcmp(child.name(), "path") == 0)
+		ImportSVGElement(element, transform, child.child_value());
+	}
+}
+
+/**
+ * Parse SVG as it is read, instead of building a DOM first
+ * Gives the same result as ParseSVGNode, but only keeps one element per level of nesting in memory
+ */
+void Document::ParseSVGStream(SVGReader & reader, const SVGMatrix & root_transform)
+{
+	struct Level
+	{
+		SVGMatrix transform;
+		bool container; // otherwise everything inside is ignored
+	};
+	vector<Level> levels(1, Level{root_transform, true});
+
+	// <text> can't be added until its text has been read; like pugixml's child_value, that's the first text directly inside it
+	SVGElement text_element;
+	SVGMatrix text_transform = root_transform;
+	string text;
+	size_t text_level = 0;
+	bool text_read = false;
+
+	for (SVGReader::Event event = reader.Next(); event != SVGReader::DONE; event = reader.Next())
+	{
+		switch (event)
 		{
-			string d = child.attribute("d").as_string();
-			//Debug("Path data attribute is \"%s\"", d.c_str());
-			bool closed = false;
-			pair<unsigned, unsigned> range = ParseSVGPathData(d, transform, closed);
-			if (true && range.first < m_count && range.second < m_count)//(closed)
+		case SVGReader::START:
+		{
+			const SVGElement & element = reader.Element();
+			if (!levels.back().container)
 			{
-				
-				string colour_str("");
-				map<string, string> style;
-				if (child.attribute("style"))
-				{
-					ParseSVGStyleData(child.attribute("style").as_string(), style);
-				}
-				
-				// Determine shading colour
-				if (child.attribute("fill"))
-				{
-					colour_str = child.attribute("fill").as_string();
-				}
-				else if (style.find("fill") != style.end())
-				{
-					colour_str = style["fill"];
-				}
-				Colour fill = ParseColourString(colour_str);
-				Colour stroke = fill;
-			
-				if (child.attribute("stroke"))
-				{
-					colour_str = child.attribute("stroke").as_string();
-					stroke = ParseColourString(colour_str);
-				}
-				else if (style.find("stroke") != style.end())
-				{
-					colour_str = style["stroke"];
-					stroke = ParseColourString(colour_str);
-				}
-				
-				
-				// Determin shading alpha
-				if (child.attribute("fill-opacity"))
-				{
-					fill.a = 255*child.attribute("fill-opacity").as_float();
-				}
-				else if (style.find("fill-opacity") != style.end())
-				{
-					fill.a = 255*strtod(style["fill-opacity"].c_str(), NULL);
-				}
-				if (child.attribute("stroke-opacity"))
-				{
-					stroke.a = 255*child.attribute("stroke-opacity").as_float();
-				}
-				else if (style.find("stroke-opacity") != style.end())
-				{
-					stroke.a = 255*strtod(style["stroke-opacity"].c_str(), NULL);
-				}
-				AddPath(range.first, range.second, fill, stroke);
+				levels.push_back(Level{levels.back().transform, false});
+				break;
 			}
-			
+			SVGMatrix transform(levels.back().transform);
+			if (element.Has("transform"))
+			{
+				ParseSVGTransform(element.String("transform"), transform);
+			}
+			if (IsSVGContainer(element.name))
+			{
+				if (element.name == "svg")
+					CentreSVG(element, transform);
+				levels.push_back(Level{transform, true});
+				break;
+			}
+			levels.push_back(Level{transform, false});
+			if (element.name == "text")
+			{
+				text_element = element;
+				text_transform = transform;
+				text.clear();
+				text_level = levels.size();
+				text_read = false;
+				break;
+			}
+			ImportSVGElement(element, transform, "");
+			break;
 		}
-		else if (strcmp(child.name(), "line") == 0)
-		{
-			Real x0(child.attribute("x1").as_float());
-			Real y0(child.attribute("y1").as_float());
-			Real x1(child.attribute("x2").as_float());
-			Real y1(child.attribute("y2").as_float());
-			TransformXYPair(x0,y0,transform);
-			TransformXYPair(x1,y1,transform);
-			AddBezier(Bezier(x0,y0,x1,y1,x1,y1,x1,y1));
+		case SVGReader::TEXT:
+			if (text_level == levels.size() && !text_read)
+			{
+				text = reader.Text();
+				text_read = true;
+			}
+			break;
+		case SVGReader::END:
+			if (text_level == levels.size())
+			{
+				ImportSVGElement(text_element, text_transform, text);
+				text_level = 0;
+			}
+			if (levels.size() > 1)
+				levels.pop_back();
+			else
+				Warn("Unexpected </%s>", reader.Element().name.c_str());
+			break;
+		default:
+			break;
 		}
-		else if (strcmp(child.name(), "rect") == 0)
+	}
+	// Unclosed <text> (the input is truncated, but a DOM would still have it)
+	if (text_level != 0)
+		ImportSVGElement(text_element, text_transform, text);
+	FlushSVGImport();
+}
+
+/**
+ * Add a (non container) SVG element to the document
+ * @param transform - includes the element's own transform attribute
+ * @param text - the text inside the element (only used for <text>)
+ */
+void Document::ParseSVGElement(const SVGElement & element, const SVGMatrix & transform, const string & text)
+{
+	if (element.name == "path")
+	{
+		string d = element.String("d");
+		//Debug("Path data attribute is \"%s\"", d.c_str());
+		bool closed = false;
+		pair<unsigned, unsigned> range = ParseSVGPathData(d, transform, closed);
+		if (true && range.first < InsertObjects().types.size() && range.second < InsertObjects().types.size())//(closed)
 		{
-			Real coords[4];
-			const char * attrib_names[] = {"x", "y", "width", "height"};
-			for (size_t i = 0; i < 4; ++i)
-				coords[i] = child.attribute(attrib_names[i]).as_float();
 			
-			Real x2(coords[0]+coords[2]);
-			Real y2(coords[1]+coords[3]);
-			TransformXYPair(coords[0],coords[1],transform); // x, y, transform
-			TransformXYPair(x2,y2,transform);
-			coords[2] = x2 - coords[0];
-			coords[3] = y2 - coords[1];
-			
-			bool outline = !(child.attribute("fill") && strcmp(child.attribute("fill").as_string(),"none") != 0);
-			Add(outline?RECT_OUTLINE:RECT_FILLED, Rect(coords[0], coords[1], coords[2], coords[3]),0);
-		}
-		else if (strcmp(child.name(), "circle") == 0)
-		{
-			Real cx = child.attribute("cx").as_float();
-			Real cy = child.attribute("cy").as_float();
-			Real r = child.attribute("r").as_float();
+			string colour_str("");
+			map<string, string> style;
+			if (element.Has("style"))
+			{
+				ParseSVGStyleData(element.String("style"), style);
+			}
 			
-			Real x = (cx - r);
-			Real y = (cy - r);
-			TransformXYPair(x,y,transform);
-			Real w = Real(2)*r*transform.a; // width scales
-			Real h = Real(2)*r*transform.d; // height scales
+			// Determine shading colour
+			if (element.Has("fill"))
+			{
+				colour_str = element.String("fill");
+			}
+			else if (style.find("fill") != style.end())
+			{
+				colour_str = style["fill"];
+			}
+			Colour fill = ParseColourString(colour_str);
+			Colour stroke = fill;
+		
+			if (element.Has("stroke"))
+			{
+				colour_str = element.String("stroke");
+				stroke = ParseColourString(colour_str);
+			}
+			else if (style.find("stroke") != style.end())
+			{
+				colour_str = style["stroke"];
+				stroke = ParseColourString(colour_str);
+			}
 			
 			
-			Rect rect(x,y,w,h);
-			Add(CIRCLE_FILLED, rect,0);
-			Debug("Added Circle %s", rect.Str().c_str());			
+			// Determin shading alpha
+			if (element.Has("fill-opacity"))
+			{
+				fill.a = 255*element.Float("fill-opacity");
+			}
+			else if (style.find("fill-opacity") != style.end())
+			{
+				fill.a = 255*strtod(style["fill-opacity"].c_str(), NULL);
+			}
+			if (element.Has("stroke-opacity"))
+			{
+				stroke.a = 255*element.Float("stroke-opacity");
+			}
+			else if (style.find("stroke-opacity") != style.end())
+			{
+				stroke.a = 255*strtod(style["stroke-opacity"].c_str(), NULL);
+			}
+			AddPath(range.first, range.second, fill, stroke);
 		}
-		else if (strcmp(child.name(), "text") == 0)
+		
+	}
+	else if (element.name == "line")
+	{
+		Real x0(element.Float("x1"));
+		Real y0(element.Float("y1"));
+		Real x1(element.Float("x2"));
+		Real y1(element.Float("y2"));
+		TransformXYPair(x0,y0,transform);
+		TransformXYPair(x1,y1,transform);
+		AddBezier(Bezier(x0,y0,x1,y1,x1,y1,x1,y1));
+	}
+	else if (element.name == "rect")
+	{
+		Real coords[4];
+		const char * attrib_names[] = {"x", "y", "width", "height"};
+		for (size_t i = 0; i < 4; ++i)
+			coords[i] = element.Float(attrib_names[i]);
+		
+		Real x2(coords[0]+coords[2]);
+		Real y2(coords[1]+coords[3]);
+		TransformXYPair(coords[0],coords[1],transform); // x, y, transform
+		TransformXYPair(x2,y2,transform);
+		coords[2] = x2 - coords[0];
+		coords[3] = y2 - coords[1];
+		
+		bool outline = !(element.Has("fill") && strcmp(element.String("fill"),"none") != 0);
+		Add(outline?RECT_OUTLINE:RECT_FILLED, Rect(coords[0], coords[1], coords[2], coords[3]),0);
+	}
+	else if (element.name == "circle")
+	{
+		Real cx = element.Float("cx");
+		Real cy = element.Float("cy");
+		Real r = element.Float("r");
+		
+		Real x = (cx - r);
+		Real y = (cy - r);
+		TransformXYPair(x,y,transform);
+		Real w = Real(2)*r*transform.a; // width scales
+		Real h = Real(2)*r*transform.d; // height scales
+		
+		
+		Rect rect(x,y,w,h);
+		Add(CIRCLE_FILLED, rect,0);
+		Debug("Added Circle %s", rect.Str().c_str());			
+	}
+	else if (element.name == "text")
+	{
+		Real x = element.Float("x");
+		Real y = element.Float("y");
+		TransformXYPair(x,y,transform);
+		Debug("Add text \"%s\"", text.c_str());
+		AddText(text.c_str(), 0.05, x, y);
+	}
+}
+
+/** Queued SVG elements are added in batches of this many, so streaming still uses bounded memory **/
+static const size_t SVG_IMPORT_BATCH = 4096;
+/** Consecutive elements parsed by one worker at a time **/
+static const size_t SVG_IMPORT_CHUNK = 32;
+
+/** Where a worker put the objects for SVG_IMPORT_CHUNK queued elements **/
+struct Document::SVGImportChunk
+{
+	unsigned worker;
+	unsigned object_begin;
+	unsigned object_end;
+};
+
+/** A thread adding queued elements to its own Document, to be merged later **/
+struct Document::SVGImportWorker
+{
+	SVGImportWorker(unsigned _id, const vector<SVGImportTask> & _tasks, vector<SVGImportChunk> & _chunks, SDL_atomic_t & _next_chunk)
+		: id(_id), tasks(_tasks), chunks(_chunks), next_chunk(_next_chunk), staging("", "") {}
+	unsigned id;
+	const vector<SVGImportTask> & tasks;
+	vector<SVGImportChunk> & chunks; // shared; each is written by whichever worker takes it
+	SDL_atomic_t & next_chunk;
+	Document staging;
+};
+
+/**
+ * Number of threads to add SVG elements with
+ * Some things have to be added strictly in order on one thread
+ */
+unsigned Document::ImportThreads() const
+{
+#if REALTYPE == REAL_IRRAM || REALTYPE == REAL_MPFRCPP || REALTYPE == REAL_VFPU
+	return 1; // precision (and iRRAM's state) belongs to the main thread, and the VFPU has one socket for everyone
+#endif
+#ifndef QUADTREE_DISABLED
+	if (m_current_insert_node != -1)
+		return 1; // objects are clipped into the quadtree as they are added
+#endif
+	// With one CPU the workers can't overlap, and staging and merging cost about 20% more than adding in place
+	unsigned cpus = max(SDL_GetCPUCount(), 1);
+	if (cpus == 1)
+		return 1;
+	return (m_import_threads == 0) ? cpus : m_import_threads;
+}
+
+/**
+ * Add a (non container) SVG element now, or queue it for FlushSVGImport when using more than one thread
+ */
+void Document::ImportSVGElement(const SVGElement & element, const SVGMatrix & transform, const string & text)
+{
+	if (ImportThreads() <= 1 || element.name == "text")
+	{
+		// Text needs the font, which the workers don't have, so add everything before it first
+		FlushSVGImport();
+		ParseSVGElement(element, transform, text);
+		return;
+	}
+	m_import_queue.push_back(SVGImportTask{element, transform, text});
+	if (m_import_queue.size() >= SVG_IMPORT_BATCH)
+		FlushSVGImport();
+}
+
+int Document::RunSVGImportWorker(void * data)
+{
+	SVGImportWorker & worker = *((SVGImportWorker*)data);
+	for (int c = SDL_AtomicAdd(&worker.next_chunk, 1); c < (int)worker.chunks.size(); c = SDL_AtomicAdd(&worker.next_chunk, 1))
+	{
+		SVGImportChunk & chunk = worker.chunks[c];
+		chunk.worker = worker.id;
+		chunk.object_begin = worker.staging.m_count;
+		size_t end = min(worker.tasks.size(), (c+1)*SVG_IMPORT_CHUNK);
+		for (size_t t = c*SVG_IMPORT_CHUNK; t < end; ++t)
+			worker.staging.ParseSVGElement(worker.tasks[t].element, worker.tasks[t].transform, worker.tasks[t].text);
+		chunk.object_end = worker.staging.m_count;
+	}
+	return 0;
+}
+
+/**
+ * Parse the queued SVG elements on a pool of threads, then merge what they added in document order
+ * Object IDs and Path ranges are the same as adding the elements one at a time
+ */
+void Document::FlushSVGImport()
+{
+	if (m_import_queue.empty())
+		return;
+	PROFILE_SCOPE("Document::FlushSVGImport");
+	unsigned threads = min(ImportThreads(), (unsigned)((m_import_queue.size() + SVG_IMPORT_CHUNK - 1) / SVG_IMPORT_CHUNK));
+	vector<SVGImportChunk> chunks((m_import_queue.size() + SVG_IMPORT_CHUNK - 1) / SVG_IMPORT_CHUNK);
+	SDL_atomic_t next_chunk;
+	SDL_AtomicSet(&next_chunk, 0);
+
+	vector<SVGImportWorker*> workers;
+	vector<SDL_Thread*> pool;
+	for (unsigned i = 0; i < threads; ++i)
+		workers.push_back(new SVGImportWorker(i, m_import_queue, chunks, next_chunk));
+	for (unsigned i = 1; i < threads; ++i)
+	{
+		SDL_Thread * thread = SDL_CreateThread(RunSVGImportWorker, "SVGImport", workers[i]);
+		if (thread == NULL)
+			Warn("Couldn't create SVG import thread: %s", SDL_GetError()); // the other workers will do its share
+		else
+			pool.push_back(thread);
+	}
+	RunSVGImportWorker(workers[0]);
+	for (unsigned i = 0; i < pool.size(); ++i)
+		SDL_WaitThread(pool[i], NULL);
+
+	// Merge; this is what AddBezier and AddPath would have done, in the same order
+	// (Nothing is clipped, since ImportThreads is 1 when there is a quadtree insert node, so IDs are just offset)
+	vector<ObjectType> types;
+	vector<Rect> bounds;
+	vector<unsigned> data_indices;
+	for (unsigned c = 0; c < chunks.size(); ++c)
+	{
+		const Objects & from = workers[chunks[c].worker]->staging.m_objects;
+		unsigned offset = m_objects.types.size() - chunks[c].object_begin;
+		types.clear();
+		bounds.clear();
+		data_indices.clear();
+		for (unsigned i = chunks[c].object_begin; i < chunks[c].object_end; ++i)
 		{
-			Real x = child.attribute("x").as_float();
-			Real y = child.attribute("y").as_float();
-			TransformXYPair(x,y,transform);
-			Debug("Add text \"%s\"", child.child_value());
-			AddText(child.child_value(), 0.05, x, y);
+			unsigned data_index = from.data_indices[i];
+			if (from.types[i] == BEZIER)
+			{
+				data_index = AddBezierData(from.beziers[data_index]);
+			}
+			else if (from.types[i] == PATH)
+			{
+				Path path(from.paths[data_index]);
+				path.m_start += offset;
+				path.m_end += offset;
+				path.m_index = i + offset;
+				data_index = AddPathData(path);
+			}
+			types.push_back(from.types[i]);
+			bounds.push_back(from.bounds[i]);
+			data_indices.push_back(data_index);
 		}
+		AddBatch(types.data(), bounds.data(), data_indices.data(), types.size());
 	}
+	for (unsigned i = 0; i < workers.size(); ++i)
+		delete workers[i];
+	m_import_queue.clear();
 }
 
 void Document::ParseSVGStyleData(const string & style, map<string, string> & results)
@@ -940,31 +2525,308 @@ void Document::ParseSVG(const string & input, const Rect & bounds)
 	Debug("Loaded XML - %s", result.description());
 	SVGMatrix transform = {bounds.w, 0,bounds.x, 0,bounds.h,bounds.y};
 	ParseSVGNode(doc_xml, transform);
+	FlushSVGImport();
 }
 
 /**
  * Load an SVG into a rectangle
+ * The file is parsed as it is read (see ParseSVGStream), so it never has to fit in memory
  */
 void Document::LoadSVG(const string & filename, const Rect & bounds)
 {
-	using namespace pugi;
-	
-	xml_document doc_xml;
-	ifstream input(filename.c_str(), ios_base::in);
-	xml_parse_result result = doc_xml.load(input);
-	
-	if (!result)
-		Error("Couldn't load \"%s\" - %s", filename.c_str(), result.description());
-		
-	Debug("Loaded XML from \"%s\" - %s", filename.c_str(), result.description());
-	
-	input.close();
+	FILE * file = fopen(filename.c_str(), "rb");
+	if (file == NULL)
+	{
+		Error("Couldn't load \"%s\" - %s", filename.c_str(), strerror(errno));
+		return;
+	}
 						// a c e, b d f
 	SVGMatrix transform = {bounds.w,0 ,bounds.x, 0,bounds.h,bounds.y};
-	ParseSVGNode(doc_xml, transform);
+	SVGReader reader(file);
+	ParseSVGStream(reader, transform);
+	fclose(file);
+	Debug("Loaded XML from \"%s\"%s", filename.c_str(), (reader.Failed()) ? " (with errors)" : "");
+}
+
+
+
+/**
+ * Walks over SVG path data in place; nothing is copied or allocated
+ * Commas and whitespace between tokens are both optional, as the SVG grammar allows ("M1-2.5.5" is three numbers)
+ */
+class PathDataLexer
+{
+	public:
+		PathDataLexer(const string & d) : m_pos(d.c_str()), m_end(d.c_str() + d.size()) {}
+
+		bool AtEnd() {SkipSeparators(); return m_pos >= m_end;}
+
+		/** Consume and return a command letter, or return '\0' if the next token isn't one **/
+		char Command()
+		{
+			SkipSeparators();
+			if (m_pos < m_end && isalpha((unsigned char)*m_pos))
+				return *(m_pos++);
+			return '\0';
+		}
+
+		bool Number(Real & value);
+
+		/** Arc flags are a single '0' or '1', which need not be separated from what follows **/
+		bool Flag(bool & flag)
+		{
+			SkipSeparators();
+			if (m_pos >= m_end || (*m_pos != '0' && *m_pos != '1'))
+				return false;
+			flag = (*(m_pos++) == '1');
+			return true;
+		}
+
+	private:
+		void SkipSeparators()
+		{
+			while (m_pos < m_end && (*m_pos == ',' || *m_pos == ' ' || *m_pos == '\t' || *m_pos == '\n' || *m_pos == '\r' || *m_pos == '\f'))
+				++m_pos;
+		}
+
+		const char * m_pos;
+		const char * m_end;
+};
+
+/**
+ * Convert a decimal number to a Real
+ * The number is digits * 10^exponent, where the first 19 significant digits are in mantissa
+ * [start, end) is the text of the number for when that isn't enough
+ */
+static Real DecimalToReal(const char * start, const char * end, bool negative, uint64_t mantissa, unsigned digits, int exponent)
+{
+#if REALTYPE == REAL_SINGLE || REALTYPE == REAL_DOUBLE || REALTYPE == REAL_LONG_DOUBLE
+	// If both the mantissa and the power of ten are exact, one multiply or divide rounds correctly (Clinger's fast path)
+	#if REALTYPE == REAL_SINGLE
+	static const uint64_t max_mantissa = (uint64_t)1 << 24;
+	static const int max_exponent = 10;
+	#elif REALTYPE == REAL_DOUBLE
+	static const uint64_t max_mantissa = (uint64_t)1 << 53;
+	static const int max_exponent = 22;
+	#else
+	static const uint64_t max_mantissa = UINT64_MAX;
+	static const int max_exponent = 27;
+	#endif
+	if (digits <= 19 && mantissa <= max_mantissa && exponent >= -max_exponent && exponent <= max_exponent)
+	{
+		Real power(1);
+		for (int i = abs(exponent); i > 0; --i)
+			power *= 10;
+		Real value(mantissa);
+		value = (exponent < 0) ? value / power : value * power;
+		return (negative) ? -value : value;
+	}
+#elif REALTYPE == REAL_GMPRAT
+	// Exact; digits * 10^exponent as a fraction
+	Real value;
+	mpq_ptr q = value.Op();
+	if (digits <= 19 && exponent <= 0)
+	{
+		// The only common factors of mantissa and 10^-exponent are 2s and 5s, so cancel them without a gcd
+		unsigned twos = -exponent, fives = -exponent;
+		for (; mantissa != 0 && mantissa % 2 == 0 && twos > 0; --twos)
+			mantissa /= 2;
+		for (; mantissa != 0 && mantissa % 5 == 0 && fives > 0; --fives)
+			mantissa /= 5;
+		mpz_set_ui(mpq_numref(q), mantissa);
+		if (mantissa != 0)
+		{
+			mpz_ui_pow_ui(mpq_denref(q), 5, fives);
+			mpz_mul_2exp(mpq_denref(q), mpq_denref(q), twos);
+		}
+	}
+	else
+	{
+		if (digits <= 19)
+		{
+			mpz_set_ui(mpq_numref(q), mantissa);
+		}
+		else
+		{
+			for (const char * c = start; c < end && *c != 'e' && *c != 'E'; ++c)
+			{
+				if (isdigit((unsigned char)*c))
+				{
+					mpz_mul_ui(mpq_numref(q), mpq_numref(q), 10);
+					mpz_add_ui(mpq_numref(q), mpq_numref(q), *c - '0');
+				}
+			}
+		}
+		mpz_t power;
+		mpz_init(power);
+		mpz_ui_pow_ui(power, 10, abs(exponent));
+		if (exponent >= 0)
+			mpz_mul(mpq_numref(q), mpq_numref(q), power);
+		else
+			mpz_set(mpq_denref(q), power);
+		mpz_clear(power);
+		mpq_canonicalize(q);
+	}
+	if (negative)
+		mpq_neg(q, q);
+	return value;
+#endif
+	// Everything else goes through the type's own conversion, from a copy (however long the number is)
+	return RealFromStr(string(start, end).c_str());
+}
+
+/**
+ * Read a number: sign? (digits ('.' digits?)? | '.' digits) (('e'|'E') sign? digits)?
+ * Returns false (without consuming anything) if there isn't one
+ */
+bool PathDataLexer::Number(Real & value)
+{
+	SkipSeparators();
+	const char * start = m_pos;
+	const char * c = m_pos;
+	bool negative = false;
+	if (c < m_end && (*c == '+' || *c == '-'))
+		negative = (*(c++) == '-');
+
+	uint64_t mantissa = 0;
+	unsigned digits = 0; // significant digits, not counting leading zeros
+	int exponent = 0;
+	bool any = false;
+	for (bool fraction = false; c < m_end; ++c)
+	{
+		if (*c == '.' && !fraction)
+		{
+			fraction = true;
+			continue;
+		}
+		if (!isdigit((unsigned char)*c))
+			break;
+		any = true;
+		if (digits > 0 || *c != '0')
+		{
+			if (++digits <= 19)
+				mantissa = 10*mantissa + (*c - '0');
+		}
+		if (fraction)
+			--exponent;
+	}
+	if (!any)
+		return false;
+
+	if (c < m_end && (*c == 'e' || *c == 'E'))
+	{
+		const char * e = c + 1;
+		bool negative_exponent = false;
+		if (e < m_end && (*e == '+' || *e == '-'))
+			negative_exponent = (*(e++) == '-');
+		if (e < m_end && isdigit((unsigned char)*e))
+		{
+			int power = 0;
+			for (; e < m_end && isdigit((unsigned char)*e); ++e)
+				power = min(10*power + (*e - '0'), 100000); // far beyond any Real we can convert to
+			exponent += (negative_exponent) ? -power : power;
+			c = e;
+		}
+	}
+	m_pos = c;
+	value = DecimalToReal(start, c, negative, mantissa, digits, exponent);
+	return true;
+}
+
+/** Transform a cubic's control points by an SVG transform **/
+static Bezier TransformBezier(const Real (&x)[4], const Real (&y)[4], const SVGMatrix & transform)
+{
+	Real tx[4] = {x[0], x[1], x[2], x[3]};
+	Real ty[4] = {y[0], y[1], y[2], y[3]};
+	for (int j = 0; j < 4; ++j)
+		TransformXYPair(tx[j], ty[j], transform);
+	return Bezier(tx[0],ty[0],tx[1],ty[1],tx[2],ty[2],tx[3],ty[3]);
 }
 
+/** Number of arguments taken by each (upper case) path command **/
+static unsigned PathCommandArguments(char command)
+{
+	switch (command)
+	{
+		case 'M': case 'L': case 'T': return 2;
+		case 'H': case 'V': return 1;
+		case 'C': return 6;
+		case 'S': case 'Q': return 4;
+		case 'A': return 7;
+		case 'Z': return 0;
+		default: return 0;
+	}
+}
 
+/**
+ * Approximate an SVG elliptical arc from (x1,y1) to (x2,y2) with cubics of at most 90 degrees each
+ * Each cubic is {control 1, control 2, end}; returns how many there are
+ * Follows the endpoint to centre conversion in the SVG 1.1 spec (F.6.5 and F.6.6)
+ */
+static unsigned SVGArcToCubics(double x1, double y1, double rx, double ry, double angle, bool large_arc, bool sweep, double x2, double y2, double (&cubics)[4][6])
+{
+	if (x1 == x2 && y1 == y2)
+		return 0;
+	rx = fabs(rx);
+	ry = fabs(ry);
+	if (rx == 0 || ry == 0)
+	{
+		// A straight line, in the same form as L
+		for (int i = 0; i < 6; i += 2)
+		{
+			cubics[0][i] = x2;
+			cubics[0][i+1] = y2;
+		}
+		return 1;
+	}
+	double cos_phi = cos(angle * M_PI / 180);
+	double sin_phi = sin(angle * M_PI / 180);
+	double dx = (x1 - x2)/2;
+	double dy = (y1 - y2)/2;
+	double x1p = cos_phi*dx + sin_phi*dy;
+	double y1p = -sin_phi*dx + cos_phi*dy;
+	// Scale up radii that are too small to reach
+	double lambda = (x1p*x1p)/(rx*rx) + (y1p*y1p)/(ry*ry);
+	if (lambda > 1)
+	{
+		rx *= sqrt(lambda);
+		ry *= sqrt(lambda);
+	}
+	double numerator = rx*rx*ry*ry - rx*rx*y1p*y1p - ry*ry*x1p*x1p;
+	double denominator = rx*rx*y1p*y1p + ry*ry*x1p*x1p;
+	double coefficient = sqrt(max(0.0, numerator / denominator));
+	if (large_arc == sweep)
+		coefficient = -coefficient;
+	double cxp = coefficient * rx * y1p / ry;
+	double cyp = -coefficient * ry * x1p / rx;
+	double cx = cos_phi*cxp - sin_phi*cyp + (x1 + x2)/2;
+	double cy = sin_phi*cxp + cos_phi*cyp + (y1 + y2)/2;
+
+	double theta = atan2((y1p - cyp)/ry, (x1p - cxp)/rx);
+	double delta = atan2((-y1p - cyp)/ry, (-x1p - cxp)/rx) - theta;
+	if (!sweep && delta > 0)
+		delta -= 2*M_PI;
+	else if (sweep && delta < 0)
+		delta += 2*M_PI;
+
+	unsigned segments = min(4, max(1, (int)ceil(fabs(delta) / (M_PI/2) - 1e-9)));
+	delta /= segments;
+	double k = 4.0/3.0 * tan(delta/4); // length of the tangents on a unit circle
+	for (unsigned s = 0; s < segments; ++s)
+	{
+		double a = theta + s*delta;
+		double b = a + delta;
+		// Points on the unit circle, then scaled, rotated and moved onto the ellipse
+		double u[3] = {cos(a) - k*sin(a), cos(b) + k*sin(b), cos(b)};
+		double v[3] = {sin(a) + k*cos(a), sin(b) - k*cos(b), sin(b)};
+		for (int i = 0; i < 3; ++i)
+		{
+			cubics[s][2*i] = cx + rx*cos_phi*u[i] - ry*sin_phi*v[i];
+			cubics[s][2*i+1] = cy + rx*sin_phi*u[i] + ry*cos_phi*v[i];
+		}
+	}
+	return segments;
+}
 
 // Fear the wrath of the tokenizing svg data
 // Seriously this isn't really very DOM-like at all is it?
@@ -974,170 +2836,153 @@ pair<unsigned, unsigned> Document::ParseSVGPathData(const string & d, const SVGM
 	Real x[4] = {0,0,0,0};
 	Real y[4] = {0,0,0,0};
 	
-	string token("");
-	string command("m");
-	
-	Real x0(0);
+	Real x0(0); // start of the subpath
 	Real y0(0);
+	Real cx(0); // last control point of the previous command, reflected by S and T
+	Real cy(0);
 	
-	unsigned i = 0;
-	unsigned prev_i = 0;
-	
+	char command = 'm';
+	char previous = 'M'; // upper case
 	bool start = false;
 	
-
-	static string delims("()[],{}<>;:=LlHhVvmMqQzZcC");
-
-	pair<unsigned, unsigned> range(m_count, m_count);
+	Real n[7];
+	PathDataLexer lexer(d);
+	pair<unsigned, unsigned> range(InsertObjects().types.size(), InsertObjects().types.size());
 	
-	while (i < d.size() && GetToken(d, token, i, delims).size() > 0)
+	while (!lexer.AtEnd())
 	{
-		if (isalpha(token[0]))
-			command = token;
-		else
+		char letter = lexer.Command();
+		if (letter != '\0')
+			command = letter;
+		char upper = toupper((unsigned char)command);
+		if (strchr("MLHVCSQTAZ", upper) == NULL)
 		{
-			i = prev_i; // hax
-			if(command == "")
-				command = "L";
+			Warn("Unrecognised command \"%c\", set to \"m\"", command);
+			command = 'm';
+			continue;
 		}
+		bool relative = islower((unsigned char)command);
 		
-		bool relative = islower(command[0]);
-			
-		if (command == "m" || command == "M")
+		// Read all the arguments first; arcs have two flags in the middle
+		bool large_arc = false, sweep = false;
+		unsigned arguments = PathCommandArguments(upper);
+		for (unsigned a = 0; a < arguments; ++a)
 		{
-			//Debug("Construct moveto command");
-			Real dx = RealFromStr(GetToken(d,token,i,delims));
-			assert(GetToken(d,token,i,delims) == ",");
-			Real dy = RealFromStr(GetToken(d,token,i,delims));
-			
-			x[0] = (relative) ? x[0] + dx : dx;
-			y[0] = (relative) ? y[0] + dy : dy;
-			
-			x0 = x[0];
-			y0 = y[0];
-			//Debug("mmoveto %f,%f", Float(x[0]),Float(y[0]));
-			command = (command == "m") ? "l" : "L";
-		}
-		else if (command == "c" || command == "C" || command == "q" || command == "Q")
-		{
-			//Debug("Construct curveto command");
-			Real dx = RealFromStr(GetToken(d,token,i,delims));
-			assert(GetToken(d,token,i,delims) == ",");
-			Real dy = RealFromStr(GetToken(d,token,i,delims));
-			
-			x[1] = (relative) ? x[0] + dx : dx;
-			y[1] = (relative) ? y[0] + dy : dy;
-			
-			dx = RealFromStr(GetToken(d,token,i,delims));
-			assert(GetToken(d,token,i,delims) == ",");
-			dy = RealFromStr(GetToken(d,token,i,delims));
-			
-			x[2] = (relative) ? x[0] + dx : dx;
-			y[2] = (relative) ? y[0] + dy : dy;
-			
-			if (command != "q" && command != "Q")
-			{
-				dx = RealFromStr(GetToken(d,token,i,delims));
-				assert(GetToken(d,token,i,delims) == ",");
-				dy = RealFromStr(GetToken(d,token,i,delims));
-				x[3] = (relative) ? x[0] + dx : dx;
-				y[3] = (relative) ? y[0] + dy : dy;
-			}
-			else
+			bool ok = (upper == 'A' && a == 3) ? lexer.Flag(large_arc)
+				: (upper == 'A' && a == 4) ? lexer.Flag(sweep)
+				: lexer.Number(n[a]);
+			if (!ok)
 			{
-				x[3] = x[2];
-				y[3] = y[2];
-				Real old_x1(x[1]), old_y1(y[1]);
-				x[1] = x[0] + Real(2) * (old_x1 - x[0])/ Real(3);
-				y[1] = y[0] + Real(2) * (old_y1 - y[0])/ Real(3);
-				x[2] = x[3] + Real(2) * (old_x1 - x[3])/ Real(3);
-				y[2] = y[3] + Real(2) * (old_y1 - y[3])/ Real(3);
+				Warn("Expected %u arguments for \"%c\" in path data", arguments, command);
+				return range;
 			}
-			
-			Real x3(x[3]);
-			Real y3(y[3]);
-			for (int j = 0; j < 4; ++j)
-				TransformXYPair(x[j],y[j], transform);
-
-			range.second = AddBezier(Bezier(x[0],y[0],x[1],y[1],x[2],y[2],x[3],y[3]));
-			
-			//Debug("[%u] curveto %f,%f %f,%f %f,%f", index, Float(x[1]),Float(y[1]),Float(x[2]),Float(y[2]),Float(x[3]),Float(y[3]));
-			
-			x[0] = x3;
-			y[0] = y3;
-
-			
 		}
-		else if (command == "l" || command == "L" || command == "h" || command == "H" || command == "v" || command == "V")
+		// Make the (x,y) arguments absolute; for A only the last pair is a point
+		for (unsigned a = (upper == 'A') ? 5 : 0; relative && a+1 < arguments; a += 2)
 		{
-			//Debug("Construct lineto command, relative %d", relative);
+			n[a] += x[0];
+			n[a+1] += y[0];
+		}
 		
-			Real dx = RealFromStr(GetToken(d,token,i,delims));
-			Real dy = 0;
-			if (command == "l" || command == "L")
-			{
-				assert(GetToken(d,token,i,delims) == ",");
-				dy = RealFromStr(GetToken(d,token,i,delims));
-			}
-			else if (command == "v" || command == "V")
-			{
-				swap(dx,dy);
-			}
-			
-			x[1] = (relative) ? x[0] + dx : dx;
-			y[1] = (relative) ? y[0] + dy : dy;
-			if (command == "v" || command == "V")
-			{
-				x[1] = x[0];
-			}
-			else if (command == "h" || command == "H")
+		switch (upper)
+		{
+			case 'M':
+				x[0] = n[0];
+				y[0] = n[1];
+				x0 = x[0];
+				y0 = y[0];
+				command = (command == 'm') ? 'l' : 'L';
+				break;
+			case 'L': case 'H': case 'V': case 'Z':
+				if (upper == 'Z')
+				{
+					x[1] = x0;
+					y[1] = y0;
+				}
+				else
+				{
+					x[1] = (upper == 'V') ? x[0] : n[0];
+					y[1] = (upper == 'V') ? ((relative) ? y[0] + n[0] : n[0]) : (upper == 'H') ? y[0] : n[1];
+					if (upper == 'H' && relative)
+						x[1] += x[0];
+				}
+				x[2] = x[3] = x[1];
+				y[2] = y[3] = y[1];
+				range.second = AddBezier(TransformBezier(x, y, transform));
+				x[0] = x[3];
+				y[0] = y[3];
+				if (upper == 'Z')
+				{
+					command = 'm';
+					closed = true;
+				}
+				break;
+			case 'C': case 'S':
+				if (upper == 'S')
+				{
+					x[1] = (previous == 'C' || previous == 'S') ? Real(2)*x[0] - cx : x[0];
+					y[1] = (previous == 'C' || previous == 'S') ? Real(2)*y[0] - cy : y[0];
+				}
+				else
+				{
+					x[1] = n[0];
+					y[1] = n[1];
+				}
+				x[2] = n[arguments-4];
+				y[2] = n[arguments-3];
+				x[3] = n[arguments-2];
+				y[3] = n[arguments-1];
+				range.second = AddBezier(TransformBezier(x, y, transform));
+				cx = x[2];
+				cy = y[2];
+				x[0] = x[3];
+				y[0] = y[3];
+				break;
+			case 'Q': case 'T':
+				if (upper == 'T')
+				{
+					cx = (previous == 'Q' || previous == 'T') ? Real(2)*x[0] - cx : x[0];
+					cy = (previous == 'Q' || previous == 'T') ? Real(2)*y[0] - cy : y[0];
+				}
+				else
+				{
+					cx = n[0];
+					cy = n[1];
+				}
+				// Quadratic to cubic
+				x[3] = n[arguments-2];
+				y[3] = n[arguments-1];
+				x[1] = x[0] + Real(2) * (cx - x[0])/ Real(3);
+				y[1] = y[0] + Real(2) * (cy - y[0])/ Real(3);
+				x[2] = x[3] + Real(2) * (cx - x[3])/ Real(3);
+				y[2] = y[3] + Real(2) * (cy - y[3])/ Real(3);
+				range.second = AddBezier(TransformBezier(x, y, transform));
+				x[0] = x[3];
+				y[0] = y[3];
+				break;
+			case 'A':
 			{
-				y[1] = y[0];
+				double arc[4][6];
+				unsigned segments = SVGArcToCubics(Double(x[0]), Double(y[0]), Double(n[0]), Double(n[1]), Double(n[2]),
+					large_arc, sweep, Double(n[5]), Double(n[6]), arc);
+				for (unsigned s = 0; s < segments; ++s)
+				{
+					x[1] = Real(arc[s][0]);
+					y[1] = Real(arc[s][1]);
+					x[2] = Real(arc[s][2]);
+					y[2] = Real(arc[s][3]);
+					x[3] = (s+1 < segments) ? Real(arc[s][4]) : n[5]; // end exactly where asked
+					y[3] = (s+1 < segments) ? Real(arc[s][5]) : n[6];
+					range.second = AddBezier(TransformBezier(x, y, transform));
+					x[0] = x[3];
+					y[0] = y[3];
+				}
+				x[0] = n[5];
+				y[0] = n[6];
+				break;
 			}
-			
-			Real x1(x[1]);
-			Real y1(y[1]);
-			
-			TransformXYPair(x[0],y[0],transform);
-			TransformXYPair(x[1],y[1],transform);
-
-
-			range.second = AddBezier(Bezier(x[0],y[0],x[1],y[1],x[1],y[1],x[1],y[1]));
-			
-			//Debug("[%u] lineto %f,%f %f,%f", index, Float(x[0]),Float(y[0]),Float(x[1]),Float(y[1]));
-			
-			x[0] = x1;
-			y[0] = y1;
-
-		}
-		else if (command == "z" || command == "Z")
-		{
-			//Debug("Construct returnto command");
-			x[1] = x0;
-			y[1] = y0;
-			x[2] = x0;
-			y[2] = y0;
-			x[3] = x0;
-			y[3] = y0;
-			
-			Real x3(x[3]);
-			Real y3(y[3]);
-			for (int j = 0; j < 4; ++j)
-				TransformXYPair(x[j],y[j], transform);
-
-			range.second = AddBezier(Bezier(x[0],y[0],x[1],y[1],x[2],y[2],x[3],y[3]));
-			//Debug("[%u] returnto %f,%f %f,%f", index, Float(x[0]),Float(y[0]),Float(x[1]),Float(y[1]));
-			
-			x[0] = x3;
-			y[0] = y3;
-			command = "m";
-			closed = true;
-		}
-		else
-		{
-			Warn("Unrecognised command \"%s\", set to \"m\"", command.c_str());
-			command = "m";
 		}
+		previous = upper;
 		
 		if (!start)
 		{
@@ -1145,7 +2990,6 @@ pair<unsigned, unsigned> Document::ParseSVGPathData(const string & d, const SVGM
 			y0 = y[0];
 			start = true;
 		}
-		prev_i = i;
 	}
 	return range;
 }
@@ -1169,6 +3013,7 @@ void Document::SetFont(const string & font_filename)
 	}
 	fclose(font_file);
 	stbtt_InitFont(&m_font, m_font_data, 0);
+	m_glyph_cache.clear();
 }
 
 void Document::AddText(const string & text, Real scale, Real x, Real y)
@@ -1208,8 +3053,14 @@ void Document::AddText(const string & text, Real scale, Real x, Real y)
 	}
 }
 
-void Document::AddFontGlyphAtPoint(stbtt_fontinfo *font, int character, Real scale, Real x, Real y)
+/**
+ * Get a glyph's outline in font units (scale 1 at the origin), with the bounds of each Bezier already solved
+ */
+void Document::MakeGlyphOutline(stbtt_fontinfo * font, int character, GlyphOutline & glyph)
 {
+	glyph.beziers.clear();
+	glyph.bounds.clear();
+	glyph.types.clear();
 	int glyph_index = stbtt_FindGlyphIndex(font, character);
 
 	// Check if there is actully a glyph to render.
@@ -1222,29 +3073,27 @@ void Document::AddFontGlyphAtPoint(stbtt_fontinfo *font, int character, Real sca
 	int num_instructions = stbtt_GetGlyphShape(font, glyph_index, &instructions);
 
 	Real current_x(0), current_y(0);
-	unsigned start_index = m_count;
-	unsigned end_index = m_count;
 	for (int i = 0; i < num_instructions; ++i)
 	{
 		// TTF uses 16-bit signed ints for coordinates:
 		// with the y-axis inverted compared to us.
-		// Convert and scale any data.
-		Real inst_x = Real(instructions[i].x)*scale;
-		Real inst_y = Real(instructions[i].y)*-scale;
-		Real inst_cx = Real(instructions[i].cx)*scale;
-		Real inst_cy = Real(instructions[i].cy)*-scale;
+		Real inst_x = Real(instructions[i].x);
+		Real inst_y = -Real(instructions[i].y);
+		Real inst_cx = Real(instructions[i].cx);
+		Real inst_cy = -Real(instructions[i].cy);
 		Real old_x(current_x), old_y(current_y);
 		current_x = inst_x;
 		current_y = inst_y;
 		
+		Bezier bezier;
 		switch(instructions[i].type)
 		{
 		// Move To
 		case STBTT_vmove:
-			break;
+			continue;
 		// Line To
 		case STBTT_vline:
-			end_index = AddBezier(Bezier(old_x + x, old_y + y, old_x + x, old_y + y, current_x + x, current_y + y, current_x + x, current_y + y));
+			bezier = Bezier(old_x, old_y, old_x, old_y, current_x, current_y, current_x, current_y);
 			break;
 		// Quadratic Bezier To:
 		case STBTT_vcurve:
@@ -1252,23 +3101,74 @@ void Document::AddFontGlyphAtPoint(stbtt_fontinfo *font, int character, Real sca
 			// - Endpoints are the same.
 			// - cubic1 = quad0+(2/3)*(quad1-quad0)
 			// - cubic2 = quad2+(2/3)*(quad1-quad2)
-			end_index = AddBezier(Bezier(old_x + x, old_y + y, old_x + Real(2)*(inst_cx-old_x)/Real(3) + x, old_y + Real(2)*(inst_cy-old_y)/Real(3) + y,
-						current_x + Real(2)*(inst_cx-current_x)/Real(3) + x, current_y + Real(2)*(inst_cy-current_y)/Real(3) + y, current_x + x, current_y + y));
+			bezier = Bezier(old_x, old_y, old_x + Real(2)*(inst_cx-old_x)/Real(3), old_y + Real(2)*(inst_cy-old_y)/Real(3),
+						current_x + Real(2)*(inst_cx-current_x)/Real(3), current_y + Real(2)*(inst_cy-current_y)/Real(3), current_x, current_y);
 			break;
+		default:
+			continue;
 		}
+		glyph.bounds.push_back(bezier.SolveBounds());
+		glyph.beziers.push_back(bezier.ToRelative(glyph.bounds.back()));
+		glyph.types.push_back(BEZIER);
 	}
-	
-	if (start_index < m_count && end_index < m_count)
+	stbtt_FreeShape(font, instructions);
+}
+
+/**
+ * Add a glyph's outline as a Path; scale (which must be positive) and translation only change the bounds
+ */
+void Document::AddGlyphOutline(const GlyphOutline & glyph, const Real & scale, const Real & x, const Real & y)
+{
+	if (glyph.beziers.empty())
+		return;
+	m_glyph_bounds.clear();
+	m_glyph_data_indices.clear();
+	ReserveFor(InsertObjects().beziers, glyph.beziers.size());
+	for (unsigned i = 0; i < glyph.beziers.size(); ++i)
+	{
+		const Rect & b = glyph.bounds[i];
+		m_glyph_bounds.push_back(Rect(x + scale*b.x, y + scale*b.y, scale*b.w, scale*b.h));
+		m_glyph_data_indices.push_back(AddBezierData(glyph.beziers[i]));
+	}
+	unsigned start_index = AddBatch(glyph.types.data(), m_glyph_bounds.data(), m_glyph_data_indices.data(), glyph.beziers.size());
+	if (start_index < InsertObjects().types.size())
+	{
+		AddPath(start_index, InsertObjects().types.size()-1);
+	}
+}
+
+void Document::AddFontGlyphAtPoint(stbtt_fontinfo *font, int character, Real scale, Real x, Real y)
+{
+	if (font != &m_font)
+	{
+		GlyphOutline glyph;
+		MakeGlyphOutline(font, character, glyph);
+		AddGlyphOutline(glyph, scale, x, y);
+		return;
+	}
+	map<int, GlyphOutline>::iterator cached = m_glyph_cache.find(character);
+	if (cached == m_glyph_cache.end())
 	{
-		AddPath(start_index, end_index);
+		cached = m_glyph_cache.insert(pair<int, GlyphOutline>(character, GlyphOutline())).first;
+		MakeGlyphOutline(font, character, cached->second);
 	}
+	AddGlyphOutline(cached->second, scale, x, y);
 	//Debug("Added Glyph \"%c\" at %f %f, scale %f", (char)character, Float(x), Float(y), Float(scale));
+}
 
-	stbtt_FreeShape(font, instructions);
+std::vector<Objects*> Document::Arenas()
+{
+	std::vector<Objects*> arenas(1, &m_objects);
+#ifndef QUADTREE_DISABLED
+	for (size_t i = 0; i < m_quadtree.nodes.size(); ++i)
+		arenas.push_back(&m_quadtree.nodes[i].objects);
+#endif
+	return arenas;
 }
 
 void Document::TransformObjectBounds(const SVGMatrix & transform, ObjectType type)
 {
+	BoundsChanged();
 	#ifdef TRANSFORM_BEZIERS_TO_PATH
 		for (unsigned i = 0; i < m_objects.paths.size(); ++i)
 		{
@@ -1280,20 +3180,28 @@ void Document::TransformObjectBounds(const SVGMatrix & transform, ObjectType typ
 		}
 		return;
 	#endif		
-	
-	for (unsigned i = 0; i < m_count; ++i)
+
+	std::vector<Objects*> arenas = Arenas();
+	for (size_t a = 0; a < arenas.size(); ++a)
 	{
-		if (type == NUMBER_OF_OBJECT_TYPES || m_objects.types[i] == type)
+		Objects & objects = *arenas[a];
+		for (unsigned i = 0; i < objects.types.size(); ++i)
 		{
-			TransformXYPair(m_objects.bounds[i].x, m_objects.bounds[i].y, transform);
-			m_objects.bounds[i].w *= transform.a;
-			m_objects.bounds[i].h *= transform.d;
+			if (type == NUMBER_OF_OBJECT_TYPES || objects.types[i] == type)
+			{
+				Rect bounds = objects.bounds[i];
+				TransformXYPair(bounds.x, bounds.y, transform);
+				bounds.w *= transform.a;
+				bounds.h *= transform.d;
+				objects.bounds.Set(i, bounds);
+			}
 		}
 	}
 }
 
 void Document::TranslateObjects(const Real & dx, const Real & dy, ObjectType type)
 {
+	BoundsChanged();
 	#ifdef TRANSFORM_BEZIERS_TO_PATH
 	for (unsigned i = 0; i < m_objects.paths.size(); ++i)
 	{
@@ -1304,18 +3212,26 @@ void Document::TranslateObjects(const Real & dx, const Real & dy, ObjectType typ
 	return;
 	#endif
 
-	for (unsigned i = 0; i < m_count; ++i)
+	std::vector<Objects*> arenas = Arenas();
+	for (size_t a = 0; a < arenas.size(); ++a)
 	{
-		if (type == NUMBER_OF_OBJECT_TYPES || m_objects.types[i] == type)
+		Objects & objects = *arenas[a];
+		for (unsigned i = 0; i < objects.types.size(); ++i)
 		{
-			m_objects.bounds[i].x += dx;
-			m_objects.bounds[i].y += dy;
+			if (type == NUMBER_OF_OBJECT_TYPES || objects.types[i] == type)
+			{
+				Rect bounds = objects.bounds[i];
+				bounds.x += dx;
+				bounds.y += dy;
+				objects.bounds.Set(i, bounds);
+			}
 		}
 	}
 }
 
 void Document::ScaleObjectsAboutPoint(const Real & x, const Real & y, const Real & scale_amount, ObjectType type)
 {
+	BoundsChanged();
 	#ifdef TRANSFORM_BEZIERS_TO_PATH
 		for (unsigned i = 0; i < m_objects.paths.size(); ++i)
 		{
@@ -1331,25 +3247,79 @@ void Document::ScaleObjectsAboutPoint(const Real & x, const Real & y, const Real
 		}
 		return;
 	#endif
-	
-	for (unsigned i = 0; i < m_count; ++i)
+
+	std::vector<Objects*> arenas = Arenas();
+	for (size_t a = 0; a < arenas.size(); ++a)
 	{
-		if (type != NUMBER_OF_OBJECT_TYPES && m_objects.types[i] != type)
-			continue;
-		
-		m_objects.bounds[i].w /= scale_amount;
-		m_objects.bounds[i].h /= scale_amount;
-		//m_objects.bounds[i].x = x + (m_objects.bounds[i].x-x)/scale_amount;
-		//m_objects.bounds[i].y = y + (m_objects.bounds[i].y-x)/scale_amount;
-		m_objects.bounds[i].x -= x;
-		m_objects.bounds[i].x /= scale_amount;
-		m_objects.bounds[i].x += x;
-		
-		m_objects.bounds[i].y -= y;
-		m_objects.bounds[i].y /= scale_amount;
-		m_objects.bounds[i].y += y;
+		Objects & objects = *arenas[a];
+		for (unsigned i = 0; i < objects.types.size(); ++i)
+		{
+			if (type != NUMBER_OF_OBJECT_TYPES && objects.types[i] != type)
+				continue;
+
+			Rect bounds = objects.bounds[i];
+			bounds.w /= scale_amount;
+			bounds.h /= scale_amount;
+			//bounds.x = x + (bounds.x-x)/scale_amount;
+			//bounds.y = y + (bounds.y-x)/scale_amount;
+			bounds.x -= x;
+			bounds.x /= scale_amount;
+			bounds.x += x;
+
+			bounds.y -= y;
+			bounds.y /= scale_amount;
+			bounds.y += y;
+			objects.bounds.Set(i, bounds);
+		}
 	}
-
 }
 
+/**
+ * Append the objects whose bounds intersect rect; key names the RTree over them (see m_spatial_indices)
+ * Too few objects to be worth an RTree are checked one by one
+ */
+void Document::QueryObjects(const Objects & objects, int key, const Rect & rect, std::vector<unsigned> & result)
+{
+	size_t first = result.size();
+	unsigned end = objects.bounds.size();
+	if (end < 4*RTree::NODE_SIZE)
+	{
+		for (unsigned i = 0; i < end; ++i)
+		{
+			if (objects.bounds[i].Intersects(rect))
+				result.push_back(i);
+		}
+		return;
+	}
+	map<int, SpatialIndex>::iterator index = m_spatial_indices.find(key);
+	if (index == m_spatial_indices.end() || index->second.end != end)
+	{
+		PROFILE_SCOPE("Document::QueryObjects() build");
+		SpatialIndex & built = m_spatial_indices[key];
+		built.end = end;
+		built.tree.Build(objects.bounds, 0, end);
+		index = m_spatial_indices.find(key);
+	}
+	index->second.tree.Query(rect, result);
+	// The RTree's boxes are rounded outwards, so check the candidates exactly
+	size_t count = first;
+	for (size_t i = first; i < result.size(); ++i)
+	{
+		if (objects.bounds[result[i]].Intersects(rect))
+			result[count++] = result[i];
+	}
+	result.resize(count);
+	sort(result.begin() + first, result.end());
+}
 
+#ifndef QUADTREE_DISABLED
+void Document::Query(const Rect & rect, std::vector<unsigned> & result, QuadTreeIndex node)
+{
+	QueryObjects(m_quadtree.nodes[node].objects, node, rect, result);
+}
+#else
+void Document::Query(const Rect & rect, std::vector<unsigned> & result)
+{
+	QueryObjects(m_objects, 0, rect, result);
+}
+#endif
@@ -3,6 +3,8 @@
 
 #include "ipdf.h"
 #include "quadtree.h"
+#include "svgreader.h"
+#include "rtree.h"
 
 #include <map>
 
@@ -26,51 +28,81 @@ namespace IPDF
 	// SVG matrix transforms (x,y) <- (a x' + c y' + e, b x' + d y' + f)
 	// Equivelant to OpenGL 3d matrix transform ((a, c, e) (b, d, f) (0,0,1))
 	
+	class Deserialiser;
+
 	class Document
 	{
 		public:
-			Document(const std::string & filename = "", const std::string & font_filename = "fonts/DejaVuSansMono.ttf") : m_objects(), m_count(0), m_font_data(NULL), m_font()
+			Document(const std::string & filename = "", const std::string & font_filename = "fonts/DejaVuSansMono.ttf") : m_objects(), m_count(0), m_bounds_generation(0), m_font_data(NULL), m_font(), m_import_threads(1), m_clip_threads(0)
 			{
-				Load(filename);
-				if (font_filename != "")
-					SetFont(font_filename);
 #ifndef QUADTREE_DISABLED
 				m_current_insert_node = -1;
+				m_view_node = -1;
+				m_quadtree_budget = 0;
+				m_quad_use_count = 0;
+				m_quadtree_lod = 0;
 #endif
+				Load(filename);
+				if (font_filename != "")
+					SetFont(font_filename);
 			}
 			virtual ~Document() 
 			{
+#ifndef QUADTREE_DISABLED
+				CancelQuadChildren();
+#endif
 				free(m_font_data);
 			}
 			
 			
 
 			void Load(const std::string & filename = "");
+			void LoadMapped(const std::string & filename);
 			void Save(const std::string & filename);
 			void DebugDumpObjects();
 
+			/** Objects in the document, counting every quadtree node's **/
 			unsigned ObjectCount() const {return m_count;}
+			/** The objects being added to; the insert node's with the quadtree (if there is one) **/
+#ifndef QUADTREE_DISABLED
+			inline const Objects & GetObjects() const {return (m_current_insert_node == -1) ? m_objects : m_quadtree.nodes[m_current_insert_node].objects;}
+			inline const Objects & GetObjects(QuadTreeIndex node) const {return m_quadtree.nodes[node].objects;}
+#else
 			inline const Objects & GetObjects() const {return m_objects;}
+#endif
 
 			bool operator==(const Document & equ) const;
 			bool operator!=(const Document & equ) const {return !(this->operator==(equ));}
 
 			unsigned AddPath(unsigned start_index, unsigned end_index, const Colour & shading=Colour(0.6,0.6,0.6,1), const Colour & stroke=Colour(0,0,0,0));
 			unsigned AddBezier(const Bezier & bezier);
-			int AddClip(ObjectType type, const Rect & bounds, unsigned data_index, const Rect & clip_rect);
+			static int AddClip(Objects & objects, ObjectType type, const Rect & bounds, unsigned data_index, const Rect & clip_rect);
 			unsigned Add(ObjectType type, const Rect & bounds, unsigned data_index = 0, QuadTreeIndex qtnode = -1);
+			/** Add count objects at once; returns the ID of the first one (see Document::AddBatch) **/
+			unsigned AddBatch(const ObjectType * types, const Rect * bounds, const unsigned * data_indices, unsigned count, QuadTreeIndex qtnode = -1);
 			unsigned AddBezierData(const Bezier & bezier);
 			unsigned AddPathData(const Path & path);
 
 
 			/** SVG Related functions **/
 			
-			/** Load an SVG text file and add to the document **/
+			/** Load an SVG text file and add to the document (streamed) **/
 			void LoadSVG(const std::string & filename, const Rect & bounds = Rect(0,0,1,1));
+			/** Parse an SVG string and add it to the document (via a DOM) **/
 			void ParseSVG(const std::string & svg, const Rect & bounds = Rect(0,0,1,1));
+			/** Threads used to add SVG elements; 1 (the default) uses only the calling thread, 0 uses one per CPU; always 1 with one CPU **/
+			void SetImportThreads(unsigned threads) {m_import_threads = threads;}
+			/** Threads used to clip objects into new quadtree nodes; 0 (the default) uses one per CPU **/
+			void SetClipThreads(unsigned threads) {m_clip_threads = threads;}
 			
-			/** Parse an SVG node or SVG-group node, adding children to the document **/
+			/** Parse an SVG node or SVG-group node, adding children to the document (or queueing them, see FlushSVGImport) **/
 			void ParseSVGNode(pugi::xml_node & root, SVGMatrix & transform);
+			/** Parse SVG elements as they are read, adding them to the document **/
+			void ParseSVGStream(SVGReader & reader, const SVGMatrix & transform);
+			/** Add a single (non group) SVG element to the document **/
+			void ParseSVGElement(const SVGElement & element, const SVGMatrix & transform, const std::string & text);
+			/** Add the SVG elements queued by ParseSVGNode when using more than one thread, in document order **/
+			void FlushSVGImport();
 			/** Parse an SVG path with string **/
 			std::pair<unsigned, unsigned> ParseSVGPathData(const std::string & d, const SVGMatrix & transform, bool & closed);
 			
@@ -89,40 +121,158 @@ namespace IPDF
 			void TransformObjectBounds(const SVGMatrix & transform, ObjectType type = NUMBER_OF_OBJECT_TYPES);
 			void TranslateObjects(const Real & x, const Real & y, ObjectType type = NUMBER_OF_OBJECT_TYPES);
 			void ScaleObjectsAboutPoint(const Real & x, const Real & y, const Real & scale_amount, ObjectType type = NUMBER_OF_OBJECT_TYPES);
+
+			/** Append the (sorted) indices of the objects whose bounds intersect rect, or contain a point **/
+#ifndef QUADTREE_DISABLED
+			// In the coordinates of node, from its objects
+			void Query(const Rect & rect, std::vector<unsigned> & result, QuadTreeIndex node);
+			void QueryPoint(const Real & x, const Real & y, std::vector<unsigned> & result, QuadTreeIndex node) {Query(Rect(x, y, 0, 0), result, node);}
+#else
+			void Query(const Rect & rect, std::vector<unsigned> & result);
+			void QueryPoint(const Real & x, const Real & y, std::vector<unsigned> & result) {Query(Rect(x, y, 0, 0), result);}
+#endif
 			
 #ifndef QUADTREE_DISABLED
 			inline const QuadTree& GetQuadTree() { if (m_quadtree.root_id == QUADTREE_EMPTY) { GenBaseQuadtree(); } return m_quadtree; }
 			QuadTreeIndex GenQuadChild(QuadTreeIndex parent, QuadTreeNodeChildren type);
+			void GenQuadChildren(QuadTreeIndex parent);
 			QuadTreeIndex GenQuadParent(QuadTreeIndex child, QuadTreeNodeChildren mytype);
-			void OverlayQuadChildren(QuadTreeIndex orig_parent, QuadTreeIndex parent, QuadTreeNodeChildren type);
-			void OverlayQuadParent(QuadTreeIndex orig_child, QuadTreeIndex child, QuadTreeNodeChildren type);
+			void PropagateToQuadChild(QuadTreeIndex parent, QuadTreeNodeChildren type, unsigned begin, unsigned end);
+			void PropagateToQuadParent(QuadTreeIndex child, unsigned begin, unsigned end);
 			void PropagateQuadChanges(QuadTreeIndex node);
-			// Returns the number of objects the current object formed when clipped, the objects in question are added to the end of the document.
-			int ClipObjectToQuadChild(int object_id, QuadTreeNodeChildren type);
+			// Returns the number of objects the current object formed when clipped, the objects in question are added to the end of to.
+			static int ClipObjectToQuadChild(const Objects & from, unsigned object_id, QuadTreeNodeChildren type, Objects & to);
 
 			void SetQuadtreeInsertNode(QuadTreeIndex node) { m_current_insert_node = node; }
+			/** The node a View was last looking at; saved with the document so it reopens there **/
+			void SetQuadtreeViewNode(QuadTreeIndex node);
+			QuadTreeIndex GetQuadtreeViewNode() { return (m_view_node == -1) ? GetQuadTree().root_id : m_view_node; }
+
+			/** Generate a child on a background thread; returns it if it exists, otherwise QUADTREE_EMPTY until MergeQuadChildren adds it **/
+			QuadTreeIndex RequestQuadChild(QuadTreeIndex parent, QuadTreeNodeChildren type, bool prefetch = false);
+			/** Add the children that have finished generating; returns true if there were any **/
+			bool MergeQuadChildren();
+			void CancelQuadChildren();
+
+			/** Most objects to keep before generated nodes far from the view node are evicted; 0 (the default) for no limit **/
+			void SetQuadtreeBudget(unsigned max_objects) { m_quadtree_budget = max_objects; }
+			unsigned GetQuadtreeBudget() const { return m_quadtree_budget; }
+			/** Evict nodes if over budget; returns true if any were (their nodes will be reused for others) **/
+			bool EnforceQuadtreeBudget();
+
+			/** Objects smaller than this (in node units) when a parent is made that look alike are merged into one per square of this size; 0 (the default) keeps them all **/
+			void SetQuadtreeLOD(const Real & size) { m_quadtree_lod = size; }
+			const Real & GetQuadtreeLOD() const { return m_quadtree_lod; }
 #endif
 
 			void ClearObjects()
 			{
+#ifndef QUADTREE_DISABLED
+				CancelQuadChildren();
+#endif
 				m_count = 0;
 				m_objects.Clear();
+#ifndef QUADTREE_DISABLED
+				for (size_t i = 0; i < m_quadtree.nodes.size(); ++i)
+					m_quadtree.nodes[i].objects.Clear();
+#endif
+				BoundsChanged();
 			}
 
+			/** Changes whenever objects already in the document are moved, removed or replaced (not when more are added) **/
+			unsigned BoundsGeneration() const {return m_bounds_generation;}
+
 
 		private:
 			friend class View;
-			Objects m_objects;
+			void LoadChunk(FILE * file, DocChunkTypes chunk_type, uint64_t chunk_size, DocChunkEncoding encoding = CE_RAW);
+			void LoadChunkStream(FILE * file);
+			void LoadPackedChunk(Deserialiser & packed, DocChunkTypes chunk_type);
+			/** Where each quadtree node's objects are in the object chunks of a saved document **/
+			struct QuadNodeRecord;
+			void LoadQuadNodes(const QuadNodeRecord * records, size_t count);
+			Objects m_objects; // those not yet in (or without) the quadtree
+			static int LODKey(const Objects & objects, unsigned id);
+			/** m_objects, then each quadtree node's **/
+			std::vector<Objects*> Arenas();
 #ifndef QUADTREE_DISABLED
 			QuadTree m_quadtree;
+			inline Objects & InsertObjects() {return (m_current_insert_node == -1) ? m_objects : m_quadtree.nodes[m_current_insert_node].objects;}
 			void GenBaseQuadtree();
+			void MarkQuadDirty(QuadTreeIndex node, unsigned begin, unsigned end);
+			unsigned QuadNodeObjects(QuadTreeIndex node) const;
+
+			/** A child being clipped on a background thread **/
+			struct QuadChildJob;
+			std::vector<QuadChildJob*> m_quad_jobs;
+			QuadTreeIndex FinishQuadChild(QuadChildJob * job);
+			static int RunQuadChildJob(void * job);
+
+			struct QuadClipChunk;
+			struct QuadClipWorker;
+			unsigned ClipThreads() const;
+			void ClipQuadChildren(QuadTreeIndex parent, const QuadTreeNodeChildren * types, unsigned count);
+			static int RunQuadClipWorker(void * worker);
+
+			QuadTreeIndex NewQuadNode(QuadTreeIndex parent, QuadTreeNodeChildren type);
+			void EvictQuadNodes(const std::vector<bool> & evicted);
+			std::vector<QuadTreeIndex> m_free_quad_nodes; // evicted, to be reused by NewQuadNode
+			std::vector<unsigned> m_quad_node_used; // m_quad_use_count when each node (or a descendant) was last the view node
+			unsigned m_quad_use_count;
+			unsigned m_quadtree_budget;
+			Real m_quadtree_lod;
+			unsigned AddToQuadParent(const Objects & from, unsigned begin, unsigned end, QuadTreeNodeChildren type, Objects & to);
 
 			QuadTreeIndex m_current_insert_node;
+			QuadTreeIndex m_view_node;
+#else
+			inline Objects & InsertObjects() {return m_objects;}
 #endif
 			bool m_document_dirty;
 			unsigned m_count;
+
+			/** An RTree over the first end objects of a node (or of m_objects), built by the first Query that needs it **/
+			struct SpatialIndex
+			{
+				unsigned end;
+				RTree tree;
+			};
+			std::map<int, SpatialIndex> m_spatial_indices; // by node (0 without the quadtree); cleared whenever bounds are changed in place
+			unsigned m_bounds_generation;
+			void BoundsChanged() {m_spatial_indices.clear(); ++m_bounds_generation;}
+			void QueryObjects(const Objects & objects, int key, const Rect & rect, std::vector<unsigned> & result);
 			unsigned char * m_font_data;
 			stbtt_fontinfo m_font;
+
+			/** A glyph's Beziers (relative to their bounds) and their bounds in font units, with y down **/
+			struct GlyphOutline
+			{
+				std::vector<Bezier> beziers;
+				std::vector<Rect> bounds;
+				std::vector<ObjectType> types; // all BEZIER, for AddBatch
+			};
+			static void MakeGlyphOutline(stbtt_fontinfo * font, int character, GlyphOutline & glyph);
+			void AddGlyphOutline(const GlyphOutline & glyph, const Real & scale, const Real & x, const Real & y);
+			std::map<int, GlyphOutline> m_glyph_cache; // outlines from m_font by codepoint; cleared by SetFont
+			std::vector<Rect> m_glyph_bounds; // scratch for AddGlyphOutline
+			std::vector<unsigned> m_glyph_data_indices; // ''
+
+			/** An SVG element waiting to be added by FlushSVGImport **/
+			struct SVGImportTask
+			{
+				SVGElement element;
+				SVGMatrix transform;
+				std::string text;
+			};
+			struct SVGImportChunk;
+			struct SVGImportWorker;
+			unsigned ImportThreads() const;
+			void ImportSVGElement(const SVGElement & element, const SVGMatrix & transform, const std::string & text);
+			static int RunSVGImportWorker(void * worker);
+
+			unsigned m_import_threads;
+			unsigned m_clip_threads;
+			std::vector<SVGImportTask> m_import_queue;
 		
 			
 
@@ -53,6 +53,9 @@ class Gmpint
 		Gmpint Abs() const {Gmpint a(*this); mpz_abs(a.m_op, a.m_op); return a;}
 		
 		
+		// For the Serialiser
+		mpz_srcptr Op() const {return m_op;}
+		mpz_ptr Op() {return m_op;}
 	private:
 		mpz_t m_op;
 };	
@@ -109,6 +109,10 @@ class Gmprat
 			return sizeof(uint64_t) * (mpq_numref(m_op)->_mp_alloc + mpq_denref(m_op)->_mp_alloc);
 		}
 		
+		// For the Serialiser
+		mpq_srcptr Op() const {return m_op;}
+		mpq_ptr Op() {return m_op;}
+		
 	private:
 		friend std::ostream& operator<<(std::ostream& os, const Gmprat & fith);
 		mpq_t m_op;
@@ -84,7 +84,8 @@ GraphicsBuffer::~GraphicsBuffer()
 	{
 		UnMap();
 	}
-	glDeleteBuffers(1, &m_buffer_handle);
+	if (m_buffer_handle) // never created if there was no GL (headless)
+		glDeleteBuffers(1, &m_buffer_handle);
 }
 
 void GraphicsBuffer::SetType(GraphicsBuffer::BufferType bufType)
@@ -256,6 +257,8 @@ void GraphicsBuffer::UploadRange(size_t length, intptr_t offset, const void* dat
 
 void GraphicsBuffer::Resize(size_t length)
 {
+	if (length == m_buffer_size)
+		return;
 	if (!m_buffer_size)
 	{
 		m_invalidated = true;
@@ -7,6 +7,8 @@
 #include "rect.h"
 
 #include "path.h"
+#include "chunkvector.h"
+#include "tieredvector.h"
 
 namespace IPDF
 {
@@ -37,18 +39,37 @@ namespace IPDF
 		CT_OBJBOUNDS,
 		CT_OBJINDICES,
 		CT_OBJBEZIERS,
-		CT_OBJPATHS
+		CT_OBJPATHS,
+		CT_QUADTREE, // root, insert and view node ids
+		CT_QUADTREENODES
 	};
 
+	/** How the elements of a chunk are stored **/
+	enum DocChunkEncoding
+	{
+		CE_RAW, // the in memory structs (can be mapped)
+		CE_PACKED // written by a Serialiser, prefixed with the number of elements
+	};
+
+#ifdef TIERED_OBJECTS
+	#if REALTYPE == REAL_SINGLE || REALTYPE == REAL_DOUBLE || REALTYPE == REAL_LONG_DOUBLE
+		#error "TIERED_OBJECTS only helps when Real is a big number type"
+	#endif
+	/** Bounds and Beziers are kept as doubles until they need more **/
+	template <class T> using ObjectVector = TieredVector<T>;
+#else
+	template <class T> using ObjectVector = ChunkVector<T>;
+#endif
+
 	struct Objects
 	{
 		/** Used by all objects **/
-		std::vector<ObjectType> types; // types of objects
-		std::vector<Rect> bounds; // rectangle bounds of objects
+		ChunkVector<ObjectType> types; // types of objects
+		ObjectVector<Rect> bounds; // rectangle bounds of objects
 		/** Used by BEZIER and GROUP to identify data position in relevant vector **/
-		std::vector<unsigned> data_indices;
+		ChunkVector<unsigned> data_indices;
 		/** Used by BEZIER only **/
-		std::vector<Bezier> beziers; // bezier curves - look up by data_indices
+		ObjectVector<Bezier> beziers; // bezier curves - look up by data_indices
 		/** Used by PATH only **/
 		std::vector<Path> paths;
 		
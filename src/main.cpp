@@ -1,5 +1,6 @@
 #include "main.h"
 #include <unistd.h> // Because we can.
+#include <strings.h>
 
 #include "controlpanel.h"
 
@@ -21,6 +22,48 @@ void sigfpe_handler(int sig)
 	exit(EXIT_SUCCESS);
 }
 
+/**
+ * Is the file an SVG (named .svg in any case, or starting with a tag) rather than a saved document?
+ */
+bool IsSVG(const char * filename)
+{
+	size_t len = strlen(filename);
+	if (len >= 4 && strcasecmp(filename + len - 4, ".svg") == 0)
+		return true;
+	FILE * file = fopen(filename, "rb");
+	if (file == NULL)
+		return false; // (LoadMapped will say why)
+	int c = fgetc(file);
+	if (c == 0xEF && fgetc(file) == 0xBB && fgetc(file) == 0xBF) // UTF-8 byte order mark
+		c = fgetc(file);
+	while (c != EOF && isspace(c))
+		c = fgetc(file);
+	fclose(file);
+	return (c == '<');
+}
+
+/**
+ * Load a saved document, or an SVG (scaled so its pixels are those of a width*height view of bounds), or add some text
+ */
+void LoadInput(Document & doc, const char * input_filename, const char * input_text, const Rect & bounds, int width, int height)
+{
+	if (input_filename != NULL)
+	{
+		if (!IsSVG(input_filename))
+			doc.LoadMapped(input_filename);
+		else
+		#ifdef TRANSFORM_OBJECTS_NOT_VIEW
+			doc.LoadSVG(input_filename, Rect(Real(1)/Real(2),Real(1)/Real(2),Real(1)/Real(width),Real(1)/Real(height)));
+		#else
+			doc.LoadSVG(input_filename, Rect(bounds.x+bounds.w/Real(2),bounds.y+bounds.h/Real(2),bounds.w/Real(width),bounds.h/Real(height)));
+		#endif
+	}
+	else if (input_text != NULL)
+	{
+		doc.AddText(input_text, bounds.h/Real(2), bounds.x, bounds.y+bounds.h/Real(2));
+	}
+}
+
 int main(int argc, char ** argv)
 {	
 	program_name = argv[0];
@@ -69,6 +112,11 @@ int main(int argc, char ** argv)
 	bool hide_control_panel = false;
 	bool lazy_rendering = true;
 	bool window_visible = true;
+	float lod_pixels = 0;
+	bool headless = false;
+	bool anti_alias = false;
+	int width = 800, height = 600;
+	unsigned transform_threads = 0;
 	bool gpu_transform = USE_GPU_TRANSFORM;
 	bool gpu_rendering = USE_GPU_RENDERING;
 	#ifdef TRANSFORM_OBJECTS_NOT_VIEW
@@ -170,6 +218,24 @@ int main(int argc, char ** argv)
 			case 'q':
 				hide_control_panel = true;
 				break;
+			case 'H':
+				// No window or GL at all; render -o on the CPU
+				headless = true;
+				hide_control_panel = true;
+				break;
+			case 'A':
+				// Anti-alias Beziers and paths rendered on the CPU
+				anti_alias = true;
+				break;
+			case 'R':
+				// Size to render headless (-H) at, and to scale SVGs to; the window stays 800x600
+				if (i+2 >= argc)
+					Fatal("Expected width and height after -R switch");
+				width = strtol(argv[++i], NULL, 10);
+				height = strtol(argv[++i], NULL, 10);
+				if (width <= 0 || height <= 0)
+					Fatal("Can't render %d x %d pixels", width, height);
+				break;
 					
 			case 'Q':
 				hide_control_panel = true;
@@ -184,29 +250,61 @@ int main(int argc, char ** argv)
 			case 'm':
 				make_movie = true;
 				break;
+			case 'j':
+				if (++i >= argc)
+					Fatal("Expected number of threads after -j switch");
+				doc.SetImportThreads(strtoul(argv[i], NULL, 10)); // 0 for one per CPU
+				doc.SetClipThreads(strtoul(argv[i], NULL, 10));
+				transform_threads = strtoul(argv[i], NULL, 10);
+				break;
+			case 'L':
+				if (++i >= argc)
+					Fatal("Expected number of pixels after -L switch");
+				lod_pixels = strtof(argv[i], NULL); // 0 (the default) to draw every object
+				break;
+			#ifndef QUADTREE_DISABLED
+			case 'M':
+				if (++i >= argc)
+					Fatal("Expected number of objects after -M switch");
+				doc.SetQuadtreeBudget(strtoul(argv[i], NULL, 10)); // 0 for no limit
+				break;
+			#endif
 		}	
 	}
 
 	Rect bounds(b[0],b[1],b[2],b[3]);
+	if (headless)
+	{
+		if (output_bmp == NULL)
+			Fatal("Nothing to do headless without an output file (-o)");
+		LoadInput(doc, input_filename, input_text, bounds, width, height);
+		View view(doc, bounds);
+		view.SetLODPixels(lod_pixels);
+		view.SetTransformThreads(transform_threads);
+		view.AntiAliasOnCPU(anti_alias);
+		view.SaveCPUBMP(output_bmp, width, height);
+		ignore_sigfpe = true;
+		return 0;
+	}
+
+	// The window is always 800x600
+	if (width != 800 || height != 600)
+	{
+		Warn("-R only applies with -H; the window is 800 x 600");
+		width = 800;
+		height = 600;
+	}
 	Screen scr(window_visible);
 	View view(doc,scr, bounds);
 	
 	view.SetLazyRendering(lazy_rendering);
 	view.SetGPURendering(gpu_rendering);
 	view.SetGPUTransform(gpu_transform);
+	view.SetLODPixels(lod_pixels);
+	view.SetTransformThreads(transform_threads);
+	view.AntiAliasOnCPU(anti_alias);
 
-	if (input_filename != NULL)
-	{
-		#ifdef TRANSFORM_OBJECTS_NOT_VIEW
-			doc.LoadSVG(input_filename, Rect(Real(1)/Real(2),Real(1)/Real(2),Real(1)/Real(800),Real(1)/Real(600)));		
-		#else
-			doc.LoadSVG(input_filename, Rect(bounds.x+bounds.w/Real(2),bounds.y+bounds.h/Real(2),bounds.w/Real(800),bounds.h/Real(600)));
-		#endif
-	}
-	else if (input_text != NULL)
-	{
-		doc.AddText(input_text, bounds.h/Real(2), bounds.x, bounds.y+bounds.h/Real(2));
-	}
+	LoadInput(doc, input_filename, input_text, bounds, width, height);
 
 
 
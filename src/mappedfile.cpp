@@ -0,0 +1,68 @@
+/**
+ * @file mappedfile.cpp
+ * @brief Implements MappedFile
+ */
+
+#include "mappedfile.h"
+
+#ifndef __MINGW32__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace IPDF
+{
+
+MappedFile::MappedFile(const string & filename) : m_filename(filename), m_data(NULL), m_size(0)
+{
+#ifndef __MINGW32__
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		Fatal("Couldn't open file \"%s\" - %s", filename.c_str(), strerror(errno));
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+		Fatal("Couldn't stat file \"%s\" - %s", filename.c_str(), strerror(errno));
+	m_size = st.st_size;
+	if (m_size > 0)
+	{
+		// MAP_PRIVATE; writes go to anonymous copies of the touched pages only
+		void * data = mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+			Fatal("Couldn't map file \"%s\" (%u bytes) - %s", filename.c_str(), m_size, strerror(errno));
+		m_data = (uint8_t*)data;
+	}
+	close(fd);
+#else
+	// No mmap; just read the whole thing
+	FILE * file = fopen(filename.c_str(), "rb");
+	if (file == NULL)
+		Fatal("Couldn't open file \"%s\" - %s", filename.c_str(), strerror(errno));
+	fseek(file, 0, SEEK_END);
+	m_size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	m_data = (uint8_t*)malloc(m_size);
+	if (m_size > 0 && m_data == NULL)
+		Fatal("Couldn't allocate %u bytes for \"%s\"", m_size, filename.c_str());
+	if (fread(m_data, 1, m_size, file) != m_size)
+		Fatal("Couldn't read %u bytes from \"%s\" - %s", m_size, filename.c_str(), strerror(errno));
+	fclose(file);
+#endif
+	Debug("Mapped \"%s\" (%u bytes) at %p", filename.c_str(), m_size, m_data);
+}
+
+MappedFile::~MappedFile()
+{
+	if (m_data == NULL)
+		return;
+#ifndef __MINGW32__
+	munmap(m_data, m_size);
+#else
+	free(m_data);
+#endif
+}
+
+}
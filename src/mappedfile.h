@@ -0,0 +1,39 @@
+/**
+ * @file mappedfile.h
+ * @brief Read-only (copy on write) memory mapping of a whole file
+ */
+
+#ifndef _MAPPEDFILE_H
+#define _MAPPEDFILE_H
+
+#include "common.h"
+
+namespace IPDF
+{
+	/**
+	 * A file mapped privately into memory.
+	 * Pages are only read from disk when they are touched, and are copied by the kernel
+	 *  the first time they are written to (the file itself is never modified).
+	 * On platforms without mmap the whole file is read into memory instead.
+	 */
+	class MappedFile
+	{
+		public:
+			MappedFile(const std::string & filename);
+			virtual ~MappedFile();
+
+			uint8_t * Data() const {return m_data;}
+			size_t Size() const {return m_size;}
+			const std::string & Filename() const {return m_filename;}
+
+		private:
+			MappedFile(const MappedFile & cpy); // not copyable
+			MappedFile & operator=(const MappedFile & equ);
+
+			std::string m_filename;
+			uint8_t * m_data;
+			size_t m_size;
+	};
+}
+
+#endif //_MAPPEDFILE_H
@@ -8,6 +8,11 @@
 #include <vector>
 #include <queue>
 #include <stack>
+#include <algorithm>
+#include <cstring>
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
@@ -21,10 +26,10 @@ namespace IPDF
  * 	ShaderProgram member
  */
 ObjectRenderer::ObjectRenderer(const ObjectType & type, 
-		const char * vert_glsl_file, const char * frag_glsl_file, const char * geom_glsl_file)
-		: m_type(type), m_shader_program(), m_indexes(), m_buffer_builder(NULL)
+		const char * vert_glsl_file, const char * frag_glsl_file, const char * geom_glsl_file, bool gpu)
+		: m_type(type), m_shader_program(), m_indexes(), m_buffer_builder(NULL), m_gpu(gpu)
 {
-	if (vert_glsl_file != NULL && frag_glsl_file != NULL && geom_glsl_file != NULL)
+	if (m_gpu && vert_glsl_file != NULL && frag_glsl_file != NULL && geom_glsl_file != NULL)
 	{
 		m_shader_program.InitialiseShaders(vert_glsl_file, frag_glsl_file, geom_glsl_file);
 		m_shader_program.Use();
@@ -73,6 +78,8 @@ void ObjectRenderer::PrepareBuffers(unsigned max_objects)
 	// Empty and reserve the indexes vector (for CPU rendering)
 	m_indexes.clear();
 	m_indexes.reserve(max_objects); //TODO: Can probably make this smaller? Or leave it out? Do we care?
+	if (!m_gpu)
+		return;
 
 	// Initialise and resize the ibo (for GPU rendering)
 	m_ibo.Invalidate();
@@ -89,12 +96,15 @@ void ObjectRenderer::PrepareBuffers(unsigned max_objects)
  */
 void ObjectRenderer::AddObjectToBuffers(unsigned index)
 {
-	if (m_buffer_builder == NULL) // No BufferBuilder!
+	if (m_gpu)
 	{
-		Fatal("Called without calling PrepareBuffers");
+		if (m_buffer_builder == NULL) // No BufferBuilder!
+		{
+			Fatal("Called without calling PrepareBuffers");
+		}
+		m_buffer_builder->Add(2*index); // ibo for GPU rendering
+		m_buffer_builder->Add(2*index+1);
 	}
-	m_buffer_builder->Add(2*index); // ibo for GPU rendering
-	m_buffer_builder->Add(2*index+1);
 	m_indexes.push_back(index); // std::vector of indices for CPU rendering
 }
 
@@ -103,6 +113,8 @@ void ObjectRenderer::AddObjectToBuffers(unsigned index)
  */
 void ObjectRenderer::FinaliseBuffers()
 {
+	if (!m_gpu)
+		return;
 	if (m_buffer_builder == NULL) // No BufferBuilder!
 	{
 		Fatal("Called without calling PrepareBuffers");
@@ -116,6 +128,37 @@ void ObjectRenderer::FinaliseBuffers()
 	// Nothing is necessary for CPU rendering
 }
 
+/**
+ * Add more objects to buffers that have been finalised, without rebuilding them
+ * The indices must all be after those already there; the ibo grows geometrically
+ */
+void ObjectRenderer::AppendToBuffers(const std::vector<unsigned> & indices)
+{
+	if (indices.empty())
+		return;
+	if (!m_gpu)
+	{
+		m_indexes.insert(m_indexes.end(), indices.begin(), indices.end());
+		return;
+	}
+	if (m_buffer_builder != NULL)
+	{
+		Fatal("Called between PrepareBuffers and FinaliseBuffers");
+	}
+	size_t used = m_indexes.size() * 2 * sizeof(uint32_t);
+	size_t needed = used + indices.size() * 2 * sizeof(uint32_t);
+	if (needed > m_ibo.GetSize())
+		m_ibo.Resize(max(needed, 2 * m_ibo.GetSize()));
+	std::vector<uint32_t> ibo;
+	ibo.reserve(2 * indices.size());
+	for (unsigned i = 0; i < indices.size(); ++i)
+	{
+		ibo.push_back(2*indices[i]);
+		ibo.push_back(2*indices[i]+1);
+	}
+	m_ibo.UploadRange(needed - used, used, ibo.data());
+	m_indexes.insert(m_indexes.end(), indices.begin(), indices.end());
+}
 
 /**
  * Rectangle (filled)
@@ -126,24 +169,18 @@ void RectFilledRenderer::RenderUsingCPU(Objects & objects, const View & view, co
 	{
 		if (m_indexes[i] < first_obj_id) continue;
 		if (m_indexes[i] >= last_obj_id) continue;
-		PixelBounds bounds(CPURenderBounds(objects.bounds[m_indexes[i]], view, target));
-		FloodFillOnCPU(bounds.x+1, bounds.y+1, bounds, target, Colour(0,0,0,1));
-		/*
-		for (int64_t x = max((int64_t)0, bounds.x); x <= min(bounds.x+bounds.w, target.w-1); ++x)
-		{
-			for (int64_t y = max((int64_t)0, bounds.y); y <= min(bounds.y+bounds.h, target.h-1); ++y)
-			{
-				int index = (x+target.w*y)*4;
-				target.pixels[index+0] = 0;
-				target.pixels[index+1] = 0;
-				target.pixels[index+2] = 0;
-				target.pixels[index+3] = 255;
-			}
-		}
-		*/
+		RenderObjectOnCPU(objects, view, target, m_indexes[i]);
 	}
 }
 
+void RectFilledRenderer::RenderObjectOnCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned id) const
+{
+	// The same pixels the flood fill from the corner used to reach, without reading any, a row at a time
+	PixelBounds bounds(CPURenderBounds(objects.bounds[id], view, target));
+	for (int64_t y = max(target.clip_y0, bounds.y); y < min(bounds.y + bounds.h, target.clip_y1); ++y)
+		FillSpanOnCPU(bounds.x, bounds.x + bounds.w - 1, y, target, Colour(0,0,0,1));
+}
+
 /**
  * Rectangle (outine)
  */
@@ -154,24 +191,29 @@ void RectOutlineRenderer::RenderUsingCPU(Objects & objects, const View & view, c
 	{
 		if (m_indexes[i] < first_obj_id) continue;
 		if (m_indexes[i] >= last_obj_id) continue;
-		PixelBounds bounds(CPURenderBounds(objects.bounds[m_indexes[i]], view, target));
-		
-		// Using bresenham's lines now mainly because I want to see if they work
-		// top
-		ObjectRenderer::RenderLineOnCPU(bounds.x, bounds.y, bounds.x+bounds.w, bounds.y, target);
-		// bottom
-		ObjectRenderer::RenderLineOnCPU(bounds.x, bounds.y+bounds.h, bounds.x+bounds.w, bounds.y+bounds.h, target);
-		// left
-		ObjectRenderer::RenderLineOnCPU(bounds.x, bounds.y, bounds.x, bounds.y+bounds.h, target);
-		// right
-		ObjectRenderer::RenderLineOnCPU(bounds.x+bounds.w, bounds.y, bounds.x+bounds.w, bounds.y+bounds.h, target);
-
-		// Diagonal for testing (from bottom left to top right)
-		//ObjectRenderer::RenderLineOnCPU(bounds.x,bounds.y+bounds.h, bounds.x+bounds.w, bounds.y,target, C_BLUE);
-		//ObjectRenderer::RenderLineOnCPU(bounds.x+bounds.w, bounds.y+bounds.h, bounds.x, bounds.y, target,C_GREEN);
+		RenderObjectOnCPU(objects, view, target, m_indexes[i]);
 	}
 }
 
+void RectOutlineRenderer::RenderObjectOnCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned id) const
+{
+	PixelBounds bounds(CPURenderBounds(objects.bounds[id], view, target));
+	
+	// Using bresenham's lines now mainly because I want to see if they work
+	// top
+	ObjectRenderer::RenderLineOnCPU(bounds.x, bounds.y, bounds.x+bounds.w, bounds.y, target);
+	// bottom
+	ObjectRenderer::RenderLineOnCPU(bounds.x, bounds.y+bounds.h, bounds.x+bounds.w, bounds.y+bounds.h, target);
+	// left
+	ObjectRenderer::RenderLineOnCPU(bounds.x, bounds.y, bounds.x, bounds.y+bounds.h, target);
+	// right
+	ObjectRenderer::RenderLineOnCPU(bounds.x+bounds.w, bounds.y, bounds.x+bounds.w, bounds.y+bounds.h, target);
+
+	// Diagonal for testing (from bottom left to top right)
+	//ObjectRenderer::RenderLineOnCPU(bounds.x,bounds.y+bounds.h, bounds.x+bounds.w, bounds.y,target, C_BLUE);
+	//ObjectRenderer::RenderLineOnCPU(bounds.x+bounds.w, bounds.y+bounds.h, bounds.x, bounds.y, target,C_GREEN);
+}
+
 /**
  * Circle (filled)
  */
@@ -181,33 +223,65 @@ void CircleFilledRenderer::RenderUsingCPU(Objects & objects, const View & view,
 	{
 		if (m_indexes[i] < first_obj_id) continue;
 		if (m_indexes[i] >= last_obj_id) continue;
-		PixelBounds bounds(CPURenderBounds(objects.bounds[m_indexes[i]], view, target));
-		int64_t centre_x = bounds.x + bounds.w / 2;
-		int64_t centre_y = bounds.y + bounds.h / 2;
-		
-		//Debug("Centre is %d, %d", centre_x, centre_y);
-		//Debug("Bounds are %d,%d,%d,%d", bounds.x, bounds.y, bounds.w, bounds.h);
-		//Debug("Windos is %d,%d", target.w, target.h);
-		for (int64_t x = max((int64_t)0, bounds.x); x <= min(bounds.x+bounds.w, target.w-1); ++x)
+		RenderObjectOnCPU(objects, view, target, m_indexes[i]);
+	}
+}
+
+void CircleFilledRenderer::RenderObjectOnCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned id) const
+{
+	PixelBounds bounds(CPURenderBounds(objects.bounds[id], view, target));
+	if (bounds.w == 0 || bounds.h == 0)
+		return; // (and the tests below would divide by zero)
+	int64_t centre_x = bounds.x + bounds.w / 2;
+	int64_t centre_y = bounds.y + bounds.h / 2;
+	
+	//Debug("Centre is %d, %d", centre_x, centre_y);
+	//Debug("Bounds are %d,%d,%d,%d", bounds.x, bounds.y, bounds.w, bounds.h);
+	//Debug("Windos is %d,%d", target.w, target.h);
+	int64_t x_begin = max(target.clip_x0, bounds.x), x_end = min(bounds.x+bounds.w, target.clip_x1-1);
+	if (x_begin > x_end)
+		return;
+	// Furthest any pixel we could draw is from the centre
+	int64_t reach = max(abs(x_begin - centre_x), abs(x_end - centre_x));
+	for (int64_t y = max(target.clip_y0, bounds.y); y <= min(bounds.y + bounds.h, target.clip_y1-1); ++y)
+	{
+		Real dy(2); dy *= Real(y - centre_y)/Real(bounds.h);
+		Real dy2(dy*dy);
+		// The test only gets harder to pass further from the centre (rounding can't change that), so each row
+		// is one span; search for its end with the same test the pixels used to be drawn with one by one
+		auto inside = [&](int64_t k) {Real dx(2); dx *= Real(k)/Real(bounds.w); return dx*dx + dy2 <= Real(1);};
+		if (!inside(0))
+			continue;
+		int64_t in = 0, out = reach + 1;
+		while (out - in > 1)
 		{
-			for (int64_t y = max((int64_t)0, bounds.y); y <= min(bounds.y + bounds.h, target.h-1); ++y)
-			{
-				Real dx(2); dx *= Real(x - centre_x)/Real(bounds.w);
-				Real dy(2); dy *= Real(y - centre_y)/Real(bounds.h);
-				int64_t index = (x+target.w*y)*4;
-				
-				if (dx*dx + dy*dy <= Real(1))
-				{
-					target.pixels[index+0] = 0;
-					target.pixels[index+1] = 0;
-					target.pixels[index+2] = 0;
-					target.pixels[index+3] = 255;
-				}
-			}
+			int64_t k = in + (out - in) / 2;
+			if (inside(k))
+				in = k;
+			else
+				out = k;
 		}
+		FillSpanOnCPU(max(x_begin, centre_x - in), min(x_end, centre_x + in), y, target, Colour(0,0,0,255));
 	}
 }
 
+ObjectRenderer::PixelBounds ObjectRenderer::DrawnBoundsOnCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned id) const
+{
+	PixelBounds drawn(CPURenderBounds(objects.bounds[id], view, target));
+	// (Clipping can leave bounds with a negative width or height; lines are still drawn between the edges)
+	if (drawn.w < 0)
+	{
+		drawn.x += drawn.w;
+		drawn.w = -drawn.w;
+	}
+	if (drawn.h < 0)
+	{
+		drawn.y += drawn.h;
+		drawn.h = -drawn.h;
+	}
+	return drawn;
+}
+
 Rect ObjectRenderer::CPURenderBounds(const Rect & bounds, const View & view, const CPURenderTarget & target)
 {
 	Rect result = view.TransformToViewCoords(bounds);
@@ -228,6 +302,88 @@ ObjectRenderer::PixelPoint ObjectRenderer::CPUPointLocation(const Vec2 & point,
 }
 	
 	
+/**
+ * Append lines (in pixels) along a Bezier that is in pixels
+ * Enough that none is more than a quarter of a pixel from the curve (Wang's formula), and at most 100
+ */
+static void FlattenOnCPU(const Bezier & control, vector<ObjectRenderer::PixelEdge> & lines)
+{
+	double ddx = max(fabs(Double(control.x0 - control.x1 - control.x1 + control.x2)), fabs(Double(control.x1 - control.x2 - control.x2 + control.x3)));
+	double ddy = max(fabs(Double(control.y0 - control.y1 - control.y1 + control.y2)), fabs(Double(control.y1 - control.y2 - control.y2 + control.y3)));
+	double n = ceil(sqrt(0.75*sqrt(ddx*ddx + ddy*ddy)/0.25));
+	int64_t segments = (n >= 1) ? (int64_t)min(n, 100.0) : 1;
+	double x = Double(control.x0), y = Double(control.y0);
+	for (int64_t j = 1; j <= segments; ++j)
+	{
+		Vec2 v;
+		control.Evaluate(v.x, v.y, Real(j)/Real(segments));
+		lines.push_back(ObjectRenderer::PixelEdge{x, y, Double(v.x), Double(v.y)});
+		x = Double(v.x);
+		y = Double(v.y);
+	}
+}
+
+/**
+ * Append the edges of a ribbon one pixel wide along joined lines, reaching half a pixel past the ends
+ * Joins are mitred, unless they turn back on themselves by more than 120 degrees; fill it with the nonzero rule
+ */
+static void StrokeEdgesOnCPU(const vector<ObjectRenderer::PixelEdge> & lines, vector<ObjectRenderer::PixelEdge> & edges)
+{
+	// Points along the lines, and (half) normals of the lines leaving them
+	vector<double> px, py, nx, ny;
+	px.reserve(lines.size() + 1);
+	py.reserve(lines.size() + 1);
+	nx.reserve(lines.size());
+	ny.reserve(lines.size());
+	for (unsigned i = 0; i < lines.size(); ++i)
+	{
+		double dx = lines[i].x1 - lines[i].x0, dy = lines[i].y1 - lines[i].y0;
+		double length = sqrt(dx*dx + dy*dy);
+		if (!(length > 1e-9))
+			continue;
+		px.push_back(lines[i].x0);
+		py.push_back(lines[i].y0);
+		nx.push_back(-0.5*dy/length);
+		ny.push_back(0.5*dx/length);
+	}
+	if (px.empty())
+		return;
+	unsigned n = px.size();
+	px.push_back(lines.back().x1);
+	py.push_back(lines.back().y1);
+
+	// Offsets of the sides from each point
+	vector<double> ox(n+1), oy(n+1);
+	ox[0] = nx[0]; oy[0] = ny[0];
+	ox[n] = nx[n-1]; oy[n] = ny[n-1];
+	for (unsigned i = 1; i < n; ++i)
+	{
+		double cos_turn = 4*(nx[i-1]*nx[i] + ny[i-1]*ny[i]);
+		if (cos_turn > -0.5)
+		{
+			ox[i] = (nx[i-1] + nx[i])/(1 + cos_turn);
+			oy[i] = (ny[i-1] + ny[i])/(1 + cos_turn);
+		}
+		else
+		{
+			ox[i] = nx[i];
+			oy[i] = ny[i];
+		}
+	}
+	// Square ends
+	double sx = ny[0], sy = -nx[0];
+	double ex = ny[n-1], ey = -nx[n-1];
+	px[0] -= sx; py[0] -= sy;
+	px[n] += ex; py[n] += ey;
+
+	for (unsigned i = 0; i < n; ++i)
+		edges.push_back(ObjectRenderer::PixelEdge{px[i] + ox[i], py[i] + oy[i], px[i+1] + ox[i+1], py[i+1] + oy[i+1]});
+	edges.push_back(ObjectRenderer::PixelEdge{px[n] + ox[n], py[n] + oy[n], px[n] - ox[n], py[n] - oy[n]});
+	for (unsigned i = n; i > 0; --i)
+		edges.push_back(ObjectRenderer::PixelEdge{px[i] - ox[i], py[i] - oy[i], px[i-1] - ox[i-1], py[i-1] - oy[i-1]});
+	edges.push_back(ObjectRenderer::PixelEdge{px[0] - ox[0], py[0] - oy[0], px[0] + ox[0], py[0] + oy[0]});
+}
+
 void BezierRenderer::RenderBezierOnCPU(const Bezier & relative, const Rect & bounds, const View & view, const CPURenderTarget & target, const Colour & c)
 {
 	//const Rect & bounds = objects.bounds[i];
@@ -242,6 +398,17 @@ void BezierRenderer::RenderBezierOnCPU(const Bezier & relative, const Rect & bou
 		ObjectRenderer::RenderLineOnCPU(pix_bounds.x, pix_bounds.y, pix_bounds.x, pix_bounds.y+pix_bounds.h, target, Colour(255,0,0,0));
 		ObjectRenderer::RenderLineOnCPU(pix_bounds.x+pix_bounds.w, pix_bounds.y, pix_bounds.x+pix_bounds.w, pix_bounds.y+pix_bounds.h, target, Colour(0,255,0,0));
 	}
+
+	if (view.AntiAliasingOnCPU())
+	{
+		vector<PixelEdge> lines;
+		vector<PixelEdge> edges;
+		FlattenOnCPU(control, lines);
+		edges.reserve(2*lines.size() + 2);
+		StrokeEdgesOnCPU(lines, edges);
+		FillPolygonAAOnCPU(edges, target, c, true);
+		return;
+	}
 	
 	int64_t blen =	min((int64_t)50,pix_bounds.w);//min(max(2U, (unsigned)Int64(Real(target.w)/view.GetBounds().w)), 
 			//min((unsigned)(pix_bounds.w+pix_bounds.h)/4 + 1, 100U));
@@ -278,7 +445,7 @@ void BezierRenderer::RenderBezierOnCPU(const Bezier & relative, const Rect & bou
 		for (int64_t j = 1; j <= blen; ++j)
 		{
 			control.Evaluate(v1.x, v1.y, t);
-			RenderLineOnCPU(v0.x, v0.y, v1.x, v1.y, target);
+			RenderLineOnCPU(v0.x, v0.y, v1.x, v1.y, target, c);
 			t += invblen;
 			v0 = v1;
 		}
@@ -302,36 +469,67 @@ void BezierRenderer::RenderUsingCPU(Objects & objects, const View & view, const
 	{
 		if (m_indexes[i] < first_obj_id) continue;
 		if (m_indexes[i] >= last_obj_id) continue;
-		Colour c(0,0,0,255);
-		if (view.ShowingBezierType())
+		RenderObjectOnCPU(objects, view, target, m_indexes[i]);
+	}
+}
+
+/**
+ * Beziers can be drawn in tiles unless their bounds are shown (those are drawn in the wrong place)
+ */
+bool BezierRenderer::TileableOnCPU(const View & view) const
+{
+	#ifdef TRANSFORM_BEZIERS_TO_PATH
+		return false;
+	#endif
+	return !view.PerformingShading() && !view.ShowingBezierBounds();
+}
+
+/**
+ * The curve is inside the box around its control points; the lines along it are at most a pixel out from rounding
+ */
+ObjectRenderer::PixelBounds BezierRenderer::DrawnBoundsOnCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned id) const
+{
+	Rect bounds = view.TransformToViewCoords(objects.bounds[id]);
+	Bezier control(objects.beziers[objects.data_indices[id]].ToAbsolute(bounds), Rect(0,0,target.w, target.h));
+	double x0 = min(min(Double(control.x0), Double(control.x1)), min(Double(control.x2), Double(control.x3)));
+	double y0 = min(min(Double(control.y0), Double(control.y1)), min(Double(control.y2), Double(control.y3)));
+	double x1 = max(max(Double(control.x0), Double(control.x1)), max(Double(control.x2), Double(control.x3)));
+	double y1 = max(max(Double(control.y0), Double(control.y1)), max(Double(control.y2), Double(control.y3)));
+	int64_t left = Int64(floor(x0)) - 1, top = Int64(floor(y0)) - 1;
+	return PixelBounds(left, top, Int64(ceil(x1)) + 1 - left, Int64(ceil(y1)) + 1 - top);
+}
+
+void BezierRenderer::RenderObjectOnCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned id) const
+{
+	Colour c(0,0,0,255);
+	if (view.ShowingBezierType())
+	{
+		switch (objects.beziers[objects.data_indices[id]].GetType())
 		{
-			switch (objects.beziers[objects.data_indices[m_indexes[i]]].GetType())
-			{
-				case Bezier::LINE:
-					break;
-				case Bezier::QUADRATIC:
-					c.b = 255;
-					break;
-				case Bezier::SERPENTINE:
-					c.r = 255;
-					break;
-				case Bezier::CUSP:
-					c.g = 255;
-					break;
-				case Bezier::LOOP:
-					c.r = 128;
-					c.b = 128;
-					break;
-				default:
-					c.r = 128;
-					c.g = 128;
-					break;
-			}
+			case Bezier::LINE:
+				break;
+			case Bezier::QUADRATIC:
+				c.b = 255;
+				break;
+			case Bezier::SERPENTINE:
+				c.r = 255;
+				break;
+			case Bezier::CUSP:
+				c.g = 255;
+				break;
+			case Bezier::LOOP:
+				c.r = 128;
+				c.b = 128;
+				break;
+			default:
+				c.r = 128;
+				c.g = 128;
+				break;
 		}
-		Rect bounds = view.TransformToViewCoords(objects.bounds[m_indexes[i]]);
-		Bezier & bez = objects.beziers[objects.data_indices[m_indexes[i]]];
-		RenderBezierOnCPU(bez, bounds, view, target, c);
 	}
+	Rect bounds = view.TransformToViewCoords(objects.bounds[id]);
+	const Bezier & bez = objects.beziers[objects.data_indices[id]];
+	RenderBezierOnCPU(bez, bounds, view, target, c);
 }
 
 void BezierRenderer::PrepareBezierGPUBuffer(Objects & objects)
@@ -344,14 +542,7 @@ void BezierRenderer::PrepareBezierGPUBuffer(Objects & objects)
 	
 	for (unsigned i = 0; i < objects.beziers.size(); ++i)
 	{
-		const Bezier & bez = objects.beziers[i];
-		GPUBezierCoeffs coeffs = {
-			Float(bez.x0), Float(bez.y0),
-			Float(bez.x1), Float(bez.y1),
-			Float(bez.x2), Float(bez.y2),
-			Float(bez.x3), Float(bez.y3)
-			};
-		builder.Add(coeffs);
+		builder.Add(Coeffs(objects.beziers[i]));
 	}
 	
 	m_bezier_coeffs.UnMap();
@@ -361,7 +552,14 @@ void BezierRenderer::PrepareBezierGPUBuffer(Objects & objects)
 
 	m_bezier_ids.SetType(GraphicsBuffer::BufferTypeTexture);
 	m_bezier_ids.SetUsage(GraphicsBuffer::BufferUsageDynamicDraw);
-	m_bezier_ids.Upload(objects.data_indices.size() * sizeof(uint32_t), &objects.data_indices[0]);
+	m_bezier_ids.Resize(objects.data_indices.size() * sizeof(uint32_t));
+	BufferBuilder<uint32_t> ids(m_bezier_ids.Map(false, true, true), m_bezier_ids.GetSize());
+	for (size_t p = 0; p < objects.data_indices.PageCount(); ++p)
+	{
+		for (size_t i = 0; i < objects.data_indices.PageLength(p); ++i)
+			ids.Add(objects.data_indices.Page(p)[i]);
+	}
+	m_bezier_ids.UnMap();
 	
 	glGenTextures(1, &m_bezier_id_buffer_texture);
 	glActiveTexture(GL_TEXTURE1);
@@ -370,6 +568,47 @@ void BezierRenderer::PrepareBezierGPUBuffer(Objects & objects)
 	glActiveTexture(GL_TEXTURE0);
 }
 
+/**
+ * Add the beziers from first_bezier and the data indices from first_obj to the GPU buffers
+ * Must follow PrepareBezierGPUBuffer; the buffers grow geometrically so this is cheap when appending often
+ */
+void BezierRenderer::AppendBezierGPUBuffer(Objects & objects, unsigned first_bezier, unsigned first_obj)
+{
+	size_t used = first_bezier * sizeof(GPUBezierCoeffs);
+	size_t needed = objects.beziers.size() * sizeof(GPUBezierCoeffs);
+	if (needed > used)
+	{
+		if (needed > m_bezier_coeffs.GetSize())
+			m_bezier_coeffs.Resize(max(needed, 2 * m_bezier_coeffs.GetSize()));
+		std::vector<GPUBezierCoeffs> coeffs;
+		coeffs.reserve(objects.beziers.size() - first_bezier);
+		for (unsigned i = first_bezier; i < objects.beziers.size(); ++i)
+			coeffs.push_back(Coeffs(objects.beziers[i]));
+		m_bezier_coeffs.UploadRange(needed - used, used, coeffs.data());
+	}
+
+	used = first_obj * sizeof(uint32_t);
+	needed = objects.data_indices.size() * sizeof(uint32_t);
+	if (needed > used)
+	{
+		if (needed > m_bezier_ids.GetSize())
+			m_bezier_ids.Resize(max(needed, 2 * m_bezier_ids.GetSize()));
+		std::vector<uint32_t> ids;
+		ids.reserve(objects.data_indices.size() - first_obj);
+		for (unsigned i = first_obj; i < objects.data_indices.size(); ++i)
+			ids.push_back(objects.data_indices[i]);
+		m_bezier_ids.UploadRange(needed - used, used, ids.data());
+	}
+
+	// Resizing can replace the buffers, so attach them again
+	glBindTexture(GL_TEXTURE_BUFFER, m_bezier_buffer_texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32F, m_bezier_coeffs.GetHandle());
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_BUFFER, m_bezier_id_buffer_texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, m_bezier_ids.GetHandle());
+	glActiveTexture(GL_TEXTURE0);
+}
+
 void BezierRenderer::RenderUsingGPU(unsigned first_obj_id, unsigned last_obj_id)
 {
 
@@ -411,20 +650,71 @@ void BezierRenderer::RenderUsingGPU(unsigned first_obj_id, unsigned last_obj_id)
 /**
  * Render Path (shading)
  */
-void PathRenderer::RenderUsingCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned first_obj_id, unsigned last_obj_id)
+/**
+ * Bounds of Bezier b of a path, in view coordinates
+ * (With TRANSFORM_BEZIERS_TO_PATH, the Bezier's bounds are relative to the path's)
+ */
+static Rect PathBezierBounds(const Objects & objects, const View & view, unsigned path_id, unsigned b)
+{
+	#ifndef TRANSFORM_BEZIERS_TO_PATH
+	return view.TransformToViewCoords(objects.bounds[b]);
+	#else
+	const Rect & path_bounds = objects.bounds[path_id];
+	Rect bbounds = objects.bounds[b];
+	bbounds.x *= path_bounds.w;
+	bbounds.x += path_bounds.x;
+	bbounds.y *= path_bounds.h;
+	bbounds.y += path_bounds.y;
+	bbounds.w *= path_bounds.w;
+	bbounds.h *= path_bounds.h;
+	return view.TransformToViewCoords(bbounds);
+	#endif
+}
+
+/**
+ * Flatten a path's Beziers to edges in pixels
+ * Where a Bezier doesn't start (within half a pixel) where the last one ended, the run before it is closed back to its start
+ */
+static void PathEdgesOnCPU(const Objects & objects, const View & view, const ObjectRenderer::CPURenderTarget & target, unsigned path_id, vector<ObjectRenderer::PixelEdge> & edges)
 {
+	const Path & path = objects.paths[objects.data_indices[path_id]];
+	double start_x = 0, start_y = 0, x = 0, y = 0;
+	for (unsigned b = path.m_start; b <= path.m_end; ++b)
+	{
+		Bezier control(objects.beziers[objects.data_indices[b]].ToAbsolute(PathBezierBounds(objects, view, path_id, b)), Rect(0,0,target.w, target.h));
+		double x0 = Double(control.x0), y0 = Double(control.y0);
+		if (b == path.m_start || fabs(x0 - x) + fabs(y0 - y) > 0.5)
+		{
+			if (b != path.m_start)
+				edges.push_back(ObjectRenderer::PixelEdge{x, y, start_x, start_y});
+			start_x = x0;
+			start_y = y0;
+		}
+		else
+		{
+			edges.push_back(ObjectRenderer::PixelEdge{x, y, x0, y0});
+		}
+		FlattenOnCPU(control, edges);
+		x = edges.back().x1;
+		y = edges.back().y1;
+	}
+	if (path.m_end >= path.m_start)
+		edges.push_back(ObjectRenderer::PixelEdge{x, y, start_x, start_y});
+}
 
-		
+/**
+ * Paths are filled as polygons (from flattening their Beziers) under the even-odd rule, like Path::PointInside, then outlined
+ */
+void PathRenderer::RenderUsingCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned first_obj_id, unsigned last_obj_id)
+{
+	vector<PixelEdge> edges;
 	for (unsigned i = 0; i < m_indexes.size(); ++i)
 	{
 		if (m_indexes[i] < first_obj_id) continue;
 		if (m_indexes[i] >= last_obj_id) continue;
 		
-		
-	
 		Path & path = objects.paths[objects.data_indices[m_indexes[i]]];
-		Rect bounds(CPURenderBounds(path.GetBounds(objects), view, target));
-		PixelBounds pix_bounds(bounds);
+		path.GetBounds(objects); // (sets the path's object bounds)
 		
 		if (view.ShowingFillPoints())
 		{
@@ -438,72 +728,25 @@ void PathRenderer::RenderUsingCPU(Objects & objects, const View & view, const CP
 		}
 		
 		#ifndef TRANSFORM_BEZIERS_TO_PATH
-		if (!view.PerformingShading())
-			continue;
-		for (unsigned b = path.m_start; b <= path.m_end; ++b)
-		{
-			Rect bbounds = view.TransformToViewCoords(objects.bounds[b]);
-			Bezier & bez = objects.beziers[objects.data_indices[b]];
-			BezierRenderer::RenderBezierOnCPU(bez,bbounds,view,target,path.m_stroke);
-		}
-		#else
-		// Outlines still get drawn if using TRANSFORM_BEZIERS_TO_PATH
-		for (unsigned b = path.m_start; b <= path.m_end; ++b)
-		{
-			Colour stroke = (view.PerformingShading()) ? path.m_stroke : Colour(0,0,0,255);
-			// bezier's bounds are relative to this object's bounds, convert back to view bounds
-			Rect bbounds = objects.bounds[b];
-			bbounds.x *= objects.bounds[m_indexes[i]].w;
-			bbounds.x += objects.bounds[m_indexes[i]].x;
-			bbounds.y *= objects.bounds[m_indexes[i]].h;
-			bbounds.y += objects.bounds[m_indexes[i]].y;
-			bbounds.w *= objects.bounds[m_indexes[i]].w;
-			bbounds.h *= objects.bounds[m_indexes[i]].h;
-			bbounds = view.TransformToViewCoords(bbounds);
-			//Debug("Bounds: %s", objects.bounds[m_indexes[i]].Str().c_str());
-			//Debug("Relative Bez Bounds: %s", objects.bounds[b].Str().c_str());
-			//Debug("Bez Bounds: %s", bbounds.Str().c_str());
-			
-			Bezier & bez = objects.beziers[objects.data_indices[b]];
-			
-			BezierRenderer::RenderBezierOnCPU(bez,bbounds,view,target, stroke);
-		}
 		if (!view.PerformingShading())
 			continue;
 		#endif
-		
-		
-		if (pix_bounds.w*pix_bounds.h > 100)
+		if (view.PerformingShading())
 		{
-			vector<Vec2> & fill_points = path.FillPoints(objects, view);
-			Debug("High resolution; use fill points %u,%u", pix_bounds.w, pix_bounds.h);
-			for (unsigned f = 0; f < fill_points.size(); ++f)
-			{
-				PixelPoint fill_point(CPUPointLocation(fill_points[f], view, target));
-				
-				FloodFillOnCPU(fill_point.first, fill_point.second, pix_bounds, target, path.m_fill, path.m_stroke);
-			}
+			edges.clear();
+			PathEdgesOnCPU(objects, view, target, m_indexes[i], edges);
+			if (view.AntiAliasingOnCPU())
+				FillPolygonAAOnCPU(edges, target, path.m_fill);
+			else
+				FillPolygonOnCPU(edges, target, path.m_fill);
 		}
-		else
+		
+		// Outlines go over the fill (and still get drawn without shading if using TRANSFORM_BEZIERS_TO_PATH)
+		Colour stroke = (view.PerformingShading()) ? path.m_stroke : Colour(0,0,0,255);
+		for (unsigned b = path.m_start; b <= path.m_end; ++b)
 		{
-			Debug("Low resolution; use brute force %u,%u",pix_bounds.w, pix_bounds.h);
-			int64_t y_min = max((int64_t)0, pix_bounds.y);
-			int64_t y_max = min(pix_bounds.y+pix_bounds.h, target.h);
-			int64_t x_min = max((int64_t)0, pix_bounds.x);
-			int64_t x_max = min(pix_bounds.x+pix_bounds.w, target.w);
-			for (int64_t y = y_min; y < y_max; ++y)
-			{
-				for (int64_t x = x_min; x < x_max; ++x)
-				{
-					Rect pb(path.SolveBounds(objects));
-					Vec2 pt(pb.x + (Real(x-pix_bounds.x)/Real(pix_bounds.w))*pb.w, 
-							pb.y + (Real(y-pix_bounds.y)/Real(pix_bounds.h))*pb.h);
-					if (path.PointInside(objects, pt))
-					{
-						FloodFillOnCPU(x, y, pix_bounds, target, path.m_fill, path.m_stroke);
-					}
-				}
-			}
+			const Bezier & bez = objects.beziers[objects.data_indices[b]];
+			BezierRenderer::RenderBezierOnCPU(bez, PathBezierBounds(objects, view, m_indexes[i], b), view, target, stroke);
 		}
 	}	
 }
@@ -538,8 +781,56 @@ void ObjectRenderer::SaveBMP(const CPURenderTarget & target, const char * filena
 /**
  * Bresenham's lines
  */
+void ObjectRenderer::FillSpanOnCPU(int64_t x0, int64_t x1, int64_t y, const CPURenderTarget & target, const Colour & colour)
+{
+	if (y < target.clip_y0 || y >= target.clip_y1)
+		return;
+	x0 = max(x0, target.clip_x0);
+	x1 = min(x1, target.clip_x1 - 1);
+	if (x0 > x1)
+		return;
+	uint32_t pixel;
+	memcpy(&pixel, &colour, sizeof(pixel)); // r, g, b, a; as they are in the target
+	uint8_t * span = target.pixels + 4*(x0 + y*target.w);
+	int64_t count = x1 - x0 + 1;
+	int64_t i = 0;
+	#ifdef __AVX2__
+	__m256i pixels8 = _mm256_set1_epi32((int)pixel);
+	for (; i + 8 <= count; i += 8)
+		_mm256_storeu_si256((__m256i*)(span + 4*i), pixels8);
+	#endif
+	#ifdef __SSE2__
+	__m128i pixels4 = _mm_set1_epi32((int)pixel);
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_si128((__m128i*)(span + 4*i), pixels4);
+	#endif
+	for (; i < count; ++i)
+		memcpy(span + 4*i, &pixel, sizeof(pixel));
+}
+
+void ObjectRenderer::FillColumnOnCPU(int64_t x, int64_t y0, int64_t y1, const CPURenderTarget & target, const Colour & colour)
+{
+	if (x < target.clip_x0 || x >= target.clip_x1)
+		return;
+	y0 = max(y0, target.clip_y0);
+	y1 = min(y1, target.clip_y1 - 1);
+	for (int64_t y = y0; y <= y1; ++y)
+		memcpy(target.pixels + 4*(x + y*target.w), &colour, 4);
+}
+
 void ObjectRenderer::RenderLineOnCPU(int64_t x0, int64_t y0, int64_t x1, int64_t y1, const CPURenderTarget & target, const Colour & colour, bool transpose)
 {
+	// Horizontal and vertical lines (every outlined rectangle) are just spans
+	if (!transpose && y0 == y1)
+	{
+		FillSpanOnCPU(min(x0, x1), max(x0, x1), y0, target, colour);
+		return;
+	}
+	if (!transpose && x0 == x1)
+	{
+		FillColumnOnCPU(x0, min(y0, y1), max(y0, y1), target, colour);
+		return;
+	}
 	int64_t dx = x1 - x0;
 	int64_t dy = y1 - y0;
 	bool neg_m = (dy*dx < 0);
@@ -586,10 +877,15 @@ void ObjectRenderer::RenderLineOnCPU(int64_t x0, int64_t y0, int64_t x1, int64_t
 		x_end = width-1;
 	}
 
+	// Past the clip rectangle (of a tile) nothing more is drawn; before it the line still has to be stepped along
+	int64_t clip_end = (transpose ? target.clip_y1 : target.clip_x1);
+	if (x_end >= clip_end)
+		x_end = clip_end - 1;
+
 	// TODO: Avoid extra inner conditionals
 	do
 	{	
-		if (x >= 0 && x < width && y >= 0 && y < height)
+		if (x >= 0 && x < width && y >= 0 && y < height && (transpose ? target.InClip(y, x) : target.InClip(x, y)))
 		{
 			int64_t index = (transpose ? (y + x*target.w)*4 : (x + y*target.w)*4);
 			target.pixels[index+0] = colour.r;
@@ -608,49 +904,252 @@ void ObjectRenderer::RenderLineOnCPU(int64_t x0, int64_t y0, int64_t x1, int64_t
 }
 
 
-void ObjectRenderer::FloodFillOnCPU(int64_t x, int64_t y, const PixelBounds & bounds, const CPURenderTarget & target, const Colour & fill, const Colour & stroke)
+/**
+ * Scanline fill; the edges are sorted by the first row they cross, and those crossing the current row are kept sorted by x
+ * Costs O(edges + rows * crossings + pixels filled)
+ */
+void ObjectRenderer::FillPolygonOnCPU(const vector<PixelEdge> & edges, const CPURenderTarget & target, const Colour & colour, bool nonzero)
 {
-	// HACK to prevent overflooding (when the fill points for a path round to the pixel outside the boundary)
-	// (I totally just made that term up...)
-	Colour c = GetColour(target, x+1, y);
-	if (c == fill || c == stroke)
-		return;
-	c = GetColour(target, x-1, y);
-	if (c == fill || c == stroke)
-		return;
-	c = GetColour(target, x, y+1);
-	if (c == fill || c == stroke)
-		return;
-	c = GetColour(target, x, y-1);
-	if (c == fill || c == stroke)
+	struct ScanEdge
+	{
+		int64_t first; int64_t last; // rows whose centres the edge crosses
+		double x0; double y0; double dxdy; // top of the edge, and slope
+		int winding; // +1 going down, -1 going up
+		double x; // where it crosses the centre of the current row
+	};
+	vector<ScanEdge> table;
+	table.reserve(edges.size());
+	for (unsigned i = 0; i < edges.size(); ++i)
+	{
+		const PixelEdge & e = edges[i];
+		bool down = (e.y0 < e.y1);
+		double x0 = down ? e.x0 : e.x1; double y0 = down ? e.y0 : e.y1;
+		double x1 = down ? e.x1 : e.x0; double y1 = down ? e.y1 : e.y0;
+		// Only rows in the clip rectangle; horizontal (and NaN) edges never cross a row centre
+		double top = max(y0, (double)target.clip_y0);
+		double bottom = min(y1, (double)target.clip_y1);
+		if (!(top < bottom))
+			continue;
+		int64_t first = (int64_t)ceil(top - 0.5);
+		int64_t last = (int64_t)ceil(bottom - 0.5) - 1;
+		if (first > last)
+			continue;
+		table.push_back(ScanEdge{first, last, x0, y0, (x1 - x0)/(y1 - y0), down ? 1 : -1, 0});
+	}
+	sort(table.begin(), table.end(), [](const ScanEdge & a, const ScanEdge & b) {return a.first < b.first;});
+
+	vector<ScanEdge> active;
+	unsigned next = 0;
+	for (int64_t y = table.empty() ? 0 : table[0].first; next < table.size() || !active.empty(); ++y)
+	{
+		if (active.empty() && table[next].first > y)
+			y = table[next].first; // skip rows with nothing on them
+		unsigned kept = 0;
+		for (unsigned i = 0; i < active.size(); ++i)
+		{
+			if (active[i].last >= y)
+				active[kept++] = active[i];
+		}
+		active.resize(kept);
+		for (; next < table.size() && table[next].first == y; ++next)
+			active.push_back(table[next]);
+
+		// Insertion sort; the order hardly changes from one row to the next
+		for (unsigned i = 0; i < active.size(); ++i)
+		{
+			active[i].x = active[i].x0 + (double(y) + 0.5 - active[i].y0) * active[i].dxdy;
+			for (unsigned j = i; j > 0 && active[j].x < active[j-1].x; --j)
+				swap(active[j], active[j-1]);
+		}
+		int winding = 0;
+		for (unsigned i = 0; i+1 < active.size(); ++i)
+		{
+			winding = nonzero ? winding + active[i].winding : winding ^ 1;
+			if (winding == 0)
+				continue;
+			// Pixels with centres in [x_i, x_i+1)
+			double left = max(active[i].x, (double)target.clip_x0 - 1.0);
+			double right = min(active[i+1].x, (double)target.clip_x1 + 1.0);
+			if (left < right)
+				FillSpanOnCPU((int64_t)ceil(left - 0.5), (int64_t)ceil(right - 0.5) - 1, y, target, colour);
+		}
+	}
+}
+
+/**
+ * Cells for FillPolygonAAOnCPU, one set per thread (for the tiles)
+ * They are left zeroed after each polygon, clearing only the cells it touched, so a small polygon doesn't pay to clear them all
+ */
+struct CoverageCells
+{
+	vector<float> cells;
+	vector<int64_t> first; // first and last cell touched in each row
+	vector<int64_t> last;
+	int64_t w; int64_t h;
+};
+static thread_local CoverageCells coverage_cells;
+
+/**
+ * Add the signed area a line (in cells) covers in each cell of the rows it crosses (from font-rs' accumulation rasteriser)
+ * x must be in [0, w-2]
+ */
+static void AccumulateCoverage(CoverageCells & c, double x0, double y0, double x1, double y1)
+{
+	if (!(y0 != y1))
 		return;
-		
-	// The hack works but now we get underflooding, or, "droughts".
-	
-		
-	queue<PixelPoint > traverse;
-	traverse.push(PixelPoint(x,y));
-	// now with 100% less stack overflows!
-	while (traverse.size() > 0)
-	{
-		PixelPoint cur(traverse.front());
-		traverse.pop();
-		if (cur.first < 0 || cur.first < bounds.x || cur.first >= bounds.x+bounds.w || cur.first >= target.w ||
-			cur.second < 0 || cur.second < bounds.y || cur.second >= bounds.y+bounds.h || cur.second >= target.h)
+	double dir = 1;
+	if (y0 > y1)
+	{
+		dir = -1;
+		swap(x0, x1);
+		swap(y0, y1);
+	}
+	double dxdy = (x1 - x0)/(y1 - y0);
+	double x_max = (double)(c.w - 2);
+	int64_t row_end = (int64_t)min(ceil(y1), (double)c.h);
+	for (int64_t row = (int64_t)max(floor(y0), 0.0); row < row_end; ++row)
+	{
+		double ya = max((double)row, y0);
+		double yb = min((double)row + 1, y1);
+		if (!(ya < yb))
 			continue;
-		c = GetColour(target, cur.first, cur.second);
-		if (c == fill || c == stroke)
+		// Where the line enters and leaves the row; worked out from its start, so it is the same whatever rows are done
+		double xa = min(max(x0 + (ya - y0)*dxdy, 0.0), x_max);
+		double xb = min(max(x0 + (yb - y0)*dxdy, 0.0), x_max);
+		double d = dir*(yb - ya);
+		double xl = min(xa, xb), xr = max(xa, xb);
+		int64_t xli = (int64_t)floor(xl), xri = (int64_t)ceil(xr);
+		float * line = &c.cells[row*c.w];
+		if (xri <= xli + 1)
+		{
+			double xmf = 0.5*(xa + xb) - xli;
+			line[xli] += d - d*xmf;
+			line[xli+1] += d*xmf;
+			xri = xli + 1;
+		}
+		else
+		{
+			double s = 1/(xr - xl);
+			double x0f = xl - xli;
+			double a0 = 0.5*s*(1 - x0f)*(1 - x0f);
+			double x1f = xr - xri + 1;
+			double am = 0.5*s*x1f*x1f;
+			line[xli] += d*a0;
+			if (xri == xli + 2)
+			{
+				line[xli+1] += d*(1 - a0 - am);
+			}
+			else
+			{
+				double a1 = s*(1.5 - x0f);
+				line[xli+1] += d*(a1 - a0);
+				for (int64_t i = xli + 2; i < xri - 1; ++i)
+					line[i] += d*s;
+				double a2 = a1 + (xri - xli - 3)*s;
+				line[xri-1] += d*(1 - a2 - am);
+			}
+			line[xri] += d*am;
+		}
+		c.first[row] = min(c.first[row], xli);
+		c.last[row] = max(c.last[row], xri);
+	}
+}
+
+void ObjectRenderer::FillPolygonAAOnCPU(const vector<PixelEdge> & edges, const CPURenderTarget & target, const Colour & colour, bool nonzero)
+{
+	double min_x = HUGE_VAL, min_y = HUGE_VAL, max_x = -HUGE_VAL, max_y = -HUGE_VAL;
+	for (unsigned i = 0; i < edges.size(); ++i)
+	{
+		const PixelEdge & e = edges[i];
+		if (!isfinite(e.x0) || !isfinite(e.y0) || !isfinite(e.x1) || !isfinite(e.y1))
 			continue;
+		min_x = min(min_x, min(e.x0, e.x1));
+		max_x = max(max_x, max(e.x0, e.x1));
+		min_y = min(min_y, min(e.y0, e.y1));
+		max_y = max(max_y, max(e.y0, e.y1));
+	}
+	// Cells span the polygon's columns in the whole target, not just the clip rectangle, so every tile sums them the same
+	// Left of the target an edge covers the same pixels as if it ran down the target's side; right of it, none
+	double left = max(floor(min_x), 0.0);
+	double right = min(ceil(max_x), (double)target.w);
+	double top = max(floor(min_y), (double)target.clip_y0);
+	double bottom = min(ceil(max_y), (double)target.clip_y1);
+	if (!(left < right) || !(top < bottom))
+		return;
 
-		SetColour(target, cur.first, cur.second, fill);
-		
-		//Debug("c is {%u,%u,%u,%u} fill is {%u,%u,%u,%u}, stroke is {%u,%u,%u,%u}",
-		//	c.r,c.g,c.b,c.a, fill.r,fill.g,fill.b,fill.a, stroke.r,stroke.g,stroke.b,stroke.a);
+	CoverageCells & c = coverage_cells;
+	int64_t x0 = (int64_t)left, y0 = (int64_t)top;
+	c.w = (int64_t)right - x0 + 2;
+	c.h = (int64_t)bottom - y0;
+	if (c.cells.size() < (size_t)(c.w*c.h))
+		c.cells.resize(c.w*c.h, 0);
+	c.first.assign(c.h, c.w);
+	c.last.assign(c.h, -1);
+	for (unsigned i = 0; i < edges.size(); ++i)
+	{
+		const PixelEdge & e = edges[i];
+		if (!isfinite(e.x0) || !isfinite(e.y0) || !isfinite(e.x1) || !isfinite(e.y1))
+			continue;
+		// Split where the edge crosses the sides of the cells, and run the pieces outside along them
+		double t[4] = {0, 1, 1, 1};
+		unsigned n = 1;
+		if (e.x0 != e.x1)
+		{
+			double tl = (left - e.x0)/(e.x1 - e.x0), tr = (right - e.x0)/(e.x1 - e.x0);
+			if (tl > 0 && tl < 1) t[n++] = tl;
+			if (tr > 0 && tr < 1) t[n++] = tr;
+			if (n == 3 && t[2] < t[1])
+				swap(t[1], t[2]);
+		}
+		t[n] = 1;
+		double xa = e.x0, ya = e.y0;
+		for (unsigned j = 1; j <= n; ++j)
+		{
+			double xb = (j == n) ? e.x1 : e.x0 + t[j]*(e.x1 - e.x0);
+			double yb = (j == n) ? e.y1 : e.y0 + t[j]*(e.y1 - e.y0);
+			AccumulateCoverage(c, min(max(xa, left), right) - x0, ya - y0, min(max(xb, left), right) - x0, yb - y0);
+			xa = xb;
+			ya = yb;
+		}
+	}
 
-		traverse.push(PixelPoint(cur.first+1, cur.second));
-		traverse.push(PixelPoint(cur.first-1, cur.second));
-		traverse.push(PixelPoint(cur.first, cur.second-1));
-		traverse.push(PixelPoint(cur.first, cur.second+1)); 
+	for (int64_t row = 0; row < c.h; ++row)
+	{
+		float * line = &c.cells[row*c.w];
+		int64_t y = y0 + row;
+		float sum = 0;
+		for (int64_t i = c.first[row]; i <= c.last[row]; ++i)
+		{
+			sum += line[i];
+			line[i] = 0;
+			int64_t x = x0 + i;
+			if (x < target.clip_x0 || x >= target.clip_x1)
+				continue;
+			float cover = fabs(sum);
+			if (nonzero)
+				cover = min(cover, 1.0f);
+			else
+			{
+				cover = fmod(cover, 2.0f);
+				cover = (cover > 1) ? 2 - cover : cover;
+			}
+			int alpha = (int)(cover*255 + 0.5f);
+			if (alpha <= 0)
+				continue;
+			uint8_t * pixel = target.pixels + 4*(x + y*target.w);
+			if (alpha >= 255)
+			{
+				pixel[0] = colour.r;
+				pixel[1] = colour.g;
+				pixel[2] = colour.b;
+				pixel[3] = colour.a;
+				continue;
+			}
+			pixel[0] = (colour.r*alpha + pixel[0]*(255 - alpha) + 127)/255;
+			pixel[1] = (colour.g*alpha + pixel[1]*(255 - alpha) + 127)/255;
+			pixel[2] = (colour.b*alpha + pixel[2]*(255 - alpha) + 127)/255;
+			pixel[3] = (colour.a*alpha + pixel[3]*(255 - alpha) + 127)/255;
+		}
 	}
 }
 
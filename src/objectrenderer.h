@@ -29,8 +29,8 @@ namespace IPDF
 	class ObjectRenderer
 	{
 		public:
-			/** Construct the ObjectRenderer **/
-			ObjectRenderer(const ObjectType & type, const char * vert_glsl_file="", const char * frag_glsl_file="", const char * geom_glsl_file = "");
+			/** Construct the ObjectRenderer; without gpu it only renders on the CPU and never touches GL **/
+			ObjectRenderer(const ObjectType & type, const char * vert_glsl_file="", const char * frag_glsl_file="", const char * geom_glsl_file = "", bool gpu = true);
 			virtual ~ObjectRenderer() {}
 
 			/**
@@ -49,9 +49,12 @@ namespace IPDF
 				uint8_t * pixels;
 				int64_t w;
 				int64_t h;
+				// Only pixels in [clip_x0, clip_x1) x [clip_y0, clip_y1) are drawn (for tiles); the whole target by default
+				int64_t clip_x0, clip_y0, clip_x1, clip_y1;
 				
-				
-				
+				CPURenderTarget(uint8_t * _pixels, int64_t _w, int64_t _h)
+					: pixels(_pixels), w(_w), h(_h), clip_x0(0), clip_y0(0), clip_x1(_w), clip_y1(_h) {}
+				bool InClip(int64_t x, int64_t y) const {return x >= clip_x0 && x < clip_x1 && y >= clip_y0 && y < clip_y1;}
 			};
 			
 			static Colour GetColour(const CPURenderTarget & target, int64_t x, int64_t y)
@@ -78,10 +81,17 @@ namespace IPDF
 			{
 				int64_t x; int64_t y; int64_t w; int64_t h;
 				PixelBounds(const Rect & bounds);
+				PixelBounds(int64_t _x, int64_t _y, int64_t _w, int64_t _h) : x(_x), y(_y), w(_w), h(_h) {}
 			};
 			
 			typedef std::pair<int64_t, int64_t> PixelPoint;
 
+			/** A directed edge of a polygon, in pixels (pixel (x,y) covers [x,x+1) x [y,y+1)) **/
+			struct PixelEdge
+			{
+				double x0; double y0; double x1; double y1;
+			};
+
 			static Rect CPURenderBounds(const Rect & bounds, const View & view, const CPURenderTarget & target);
 			static PixelPoint CPUPointLocation(const Vec2 & point, const View & view, const CPURenderTarget & target);
 
@@ -89,8 +99,16 @@ namespace IPDF
 
 
 			virtual void RenderUsingCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned first_obj_id, unsigned last_obj_id) = 0;
-			
-			
+
+			/**
+			 * Whether objects can be drawn one at a time into tiles (with RenderObjectOnCPU), and come out the same
+			 * That needs them to only write pixels inside DrawnBoundsOnCPU, and never read any they don't write
+			 */
+			virtual bool TileableOnCPU(const View & view) const {return false;}
+			/** Pixels an object might draw on, including the right and bottom edges (x+w, y+h) **/
+			virtual PixelBounds DrawnBoundsOnCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned id) const;
+			/** Draw one object (only if TileableOnCPU); must be safe to call from several threads at once **/
+			virtual void RenderObjectOnCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned id) const {}
 			
 			const ObjectType m_type; /** Type of objects **/
 		protected:
@@ -98,52 +116,78 @@ namespace IPDF
 			void PrepareBuffers(unsigned max_size);
 			void FinaliseBuffers();
 			void AddObjectToBuffers(unsigned index);			
+			void AppendToBuffers(const std::vector<unsigned> & indices);
 		
+			/** Fill pixels x0 to x1 (inclusive) of row y; clipped once for the whole span, then stored 4 or 8 at a time where there is SSE2/AVX2 **/
+			static void FillSpanOnCPU(int64_t x0, int64_t x1, int64_t y, const CPURenderTarget & target, const Colour & colour);
+			/** Fill pixels y0 to y1 (inclusive) of column x **/
+			static void FillColumnOnCPU(int64_t x, int64_t y0, int64_t y1, const CPURenderTarget & target, const Colour & colour);
+
 			/** Helper for CPU rendering that will render a line using Bresenham's algorithm. Do not use the transpose argument. **/
 			static void RenderLineOnCPU(int64_t x0, int64_t y0, int64_t x1, int64_t y1, const CPURenderTarget & target, const Colour & colour = Colour(0,0,0,1), bool transpose = false);
 			
-			static void FloodFillOnCPU(int64_t x0, int64_t y0, const PixelBounds & bounds, const CPURenderTarget & target, const Colour & fill, const Colour & stroke=Colour(0,0,0,0));
+			/**
+			 * Fill the pixels whose centres are inside the closed polygon(s) made of edges, one scanline at a time with an active edge list.
+			 * Inside is by the nonzero winding rule, or the even-odd rule; nothing is read back from the target.
+			 */
+			static void FillPolygonOnCPU(const std::vector<PixelEdge> & edges, const CPURenderTarget & target, const Colour & colour, bool nonzero = false);
+			/**
+			 * Blend colour into the pixels the polygon(s) cover, by the exact area covered; each edge adds its signed area to cells
+			 * along its rows, and a pixel's coverage is the sum of its row's cells up to it. Covered pixels are read (only those).
+			 */
+			static void FillPolygonAAOnCPU(const std::vector<PixelEdge> & edges, const CPURenderTarget & target, const Colour & colour, bool nonzero = false);
 
 			ShaderProgram m_shader_program; /** GLSL shaders for GPU **/
 			GraphicsBuffer m_ibo; /** Index Buffer Object for GPU rendering **/
 			std::vector<unsigned> m_indexes; /** Index vector for CPU rendering **/
 			BufferBuilder<uint32_t> * m_buffer_builder; /** A BufferBuilder is temporarily used when preparing the ibo and std::vector **/
+			bool m_gpu; /** Whether there is an ibo (and shaders) at all **/
 	};
 
 	/** Renderer for filled rectangles **/
 	class RectFilledRenderer : public ObjectRenderer
 	{
 		public:
-			RectFilledRenderer() : ObjectRenderer(RECT_FILLED, "shaders/rect_vert.glsl", "shaders/rect_frag.glsl","shaders/rect_filled_geom.glsl") {}
+			RectFilledRenderer(bool gpu = true) : ObjectRenderer(RECT_FILLED, "shaders/rect_vert.glsl", "shaders/rect_frag.glsl","shaders/rect_filled_geom.glsl", gpu) {}
 			virtual ~RectFilledRenderer() {}
 			virtual void RenderUsingCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned first_obj_id, unsigned last_obj_id);
+			virtual bool TileableOnCPU(const View & view) const {return true;}
+			virtual void RenderObjectOnCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned id) const;
 	};
 	/** Renderer for outlined rectangles **/
 	class RectOutlineRenderer : public ObjectRenderer
 	{
 		public:
-			RectOutlineRenderer() : ObjectRenderer(RECT_OUTLINE, "shaders/rect_vert.glsl", "shaders/rect_frag.glsl", "shaders/rect_outline_geom.glsl") {}
+			RectOutlineRenderer(bool gpu = true) : ObjectRenderer(RECT_OUTLINE, "shaders/rect_vert.glsl", "shaders/rect_frag.glsl", "shaders/rect_outline_geom.glsl", gpu) {}
 			virtual ~RectOutlineRenderer() {}
 			virtual void RenderUsingCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned first_obj_id, unsigned last_obj_id);
+			virtual bool TileableOnCPU(const View & view) const {return true;}
+			virtual void RenderObjectOnCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned id) const;
 	};
 	/** Renderer for filled circles **/
 	class CircleFilledRenderer : public ObjectRenderer
 	{
 		public:
-			CircleFilledRenderer() : ObjectRenderer(CIRCLE_FILLED, "shaders/rect_vert.glsl", "shaders/circle_frag.glsl", "shaders/circle_filled_geom.glsl") {}
+			CircleFilledRenderer(bool gpu = true) : ObjectRenderer(CIRCLE_FILLED, "shaders/rect_vert.glsl", "shaders/circle_frag.glsl", "shaders/circle_filled_geom.glsl", gpu) {}
 			virtual ~CircleFilledRenderer() {}
 			virtual void RenderUsingCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned first_obj_id, unsigned last_obj_id);
+			virtual bool TileableOnCPU(const View & view) const {return true;}
+			virtual void RenderObjectOnCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned id) const;
 	};
 
 	/** Renderer for bezier curves **/
 	class BezierRenderer : public ObjectRenderer
 	{
 		public:
-			BezierRenderer() : ObjectRenderer(BEZIER, "shaders/rect_vert.glsl", "shaders/rect_frag.glsl", "shaders/bezier_texbuf_geom.glsl") {}
+			BezierRenderer(bool gpu = true) : ObjectRenderer(BEZIER, "shaders/rect_vert.glsl", "shaders/rect_frag.glsl", "shaders/bezier_texbuf_geom.glsl", gpu) {}
 			virtual ~BezierRenderer() {}
 			virtual void RenderUsingGPU(unsigned first_obj_id, unsigned last_obj_id); 
 			virtual void RenderUsingCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned first_obj_id, unsigned last_obj_id);
+			virtual bool TileableOnCPU(const View & view) const;
+			virtual PixelBounds DrawnBoundsOnCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned id) const;
+			virtual void RenderObjectOnCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned id) const;
 			void PrepareBezierGPUBuffer(Objects & objects);
+			void AppendBezierGPUBuffer(Objects & objects, unsigned first_bezier, unsigned first_obj);
 			
 			static void RenderBezierOnCPU(const Bezier & relative, const Rect & bounds, const View & view, const CPURenderTarget & target, const Colour & c=Colour(0,0,0,255));
 			
@@ -157,6 +201,10 @@ namespace IPDF
 				float x2, y2;
 				float x3, y3;
 			};
+			static GPUBezierCoeffs Coeffs(const Bezier & bez)
+			{
+				return GPUBezierCoeffs{Float(bez.x0), Float(bez.y0), Float(bez.x1), Float(bez.y1), Float(bez.x2), Float(bez.y2), Float(bez.x3), Float(bez.y3)};
+			}
 
 			GLuint m_bezier_buffer_texture;
 			GLuint m_bezier_id_buffer_texture;
@@ -167,7 +215,7 @@ namespace IPDF
 	class PathRenderer : public ObjectRenderer
 	{
 		public:
-			PathRenderer() : ObjectRenderer(PATH, "shaders/rect_vert.glsl", "shaders/rect_frag.glsl", "shaders/bezier_texbuf_geom.glsl") {}
+			PathRenderer(bool gpu = true) : ObjectRenderer(PATH, "shaders/rect_vert.glsl", "shaders/rect_frag.glsl", "shaders/bezier_texbuf_geom.glsl", gpu) {}
 			virtual ~PathRenderer() {}
 			virtual void RenderUsingCPU(Objects & objects, const View & view, const CPURenderTarget & target, unsigned first_obj_id, unsigned last_obj_id);
 			// do nothing on GPU
@@ -157,6 +157,9 @@ namespace IPDF
 			bool NoFactors() const {return (m_next[MULTIPLY].size() == 0 && m_next[DIVIDE].size() == 0);}
 			bool NoTerms() const {return (m_next[ADD].size() == 0 && m_next[SUBTRACT].size() == 0);}
 			
+			digit_t Value() const {return m_value;}
+			const std::vector<ParanoidNumber*> & Next(Optype op) const {return m_next[op];}
+			
 			
 			ParanoidNumber & operator+=(const ParanoidNumber & a);
 			ParanoidNumber & operator-=(const ParanoidNumber & a);
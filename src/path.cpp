@@ -59,7 +59,7 @@ Path::Path(Objects & objects, unsigned start, unsigned end, const Colour & fill,
 	for (unsigned i = m_start; i <= m_end; ++i)
 	{
 		//Debug("Transform %s -> %s", objects.bounds[i].Str().c_str(), bounds.Str().c_str());
-		objects.bounds[i] = TransformRectCoordinates(m_bounds.Convert<Real>(), objects.bounds[i]);
+		objects.bounds.Set(i, TransformRectCoordinates(m_bounds.Convert<Real>(), objects.bounds[i]));
 		//Debug("-> %s", objects.bounds[i].Str().c_str());
 	}
 	#endif
@@ -196,10 +196,11 @@ Rect Path::SolveBounds(const Objects & objects)
 	return Rect(m_left.x, m_top.y, m_right.x-m_left.x, m_bottom.y-m_top.y);
 }
 
-Rect & Path::GetBounds(Objects & objects) 
+Rect Path::GetBounds(Objects & objects) 
 {
-	objects.bounds[m_index] = m_bounds.Convert<Real>();
-	return objects.bounds[m_index];
+	Rect bounds(m_bounds.Convert<Real>());
+	objects.bounds.Set(m_index, bounds);
+	return bounds;
 }
 
 }
@@ -35,9 +35,10 @@ namespace IPDF
 	struct Path
 	{
 		Path(Objects & objects, unsigned _start, unsigned _end, const Colour & _fill = Colour(128,128,128,255), const Colour & _stroke = Colour(0,0,0,0));
+		Path() = default; // Used when loading a document; the loader fills in the members
 		
 		Rect SolveBounds(const Objects & objects);
-		Rect & GetBounds(Objects & objects);
+		Rect GetBounds(Objects & objects);
 		std::vector<Vec2> & FillPoints(const Objects & objects, const View & view);
 		
 		// Is point inside shape?
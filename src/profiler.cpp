@@ -7,8 +7,14 @@ using namespace IPDF;
 
 Profiler IPDF::g_profiler;
 
+Profiler::Profiler() : m_enabled(false), m_thread(SDL_ThreadID())
+{
+}
+
 void Profiler::BeginZone(std::string name)
 {
+	if (SDL_ThreadID() != m_thread)
+		return;
 	if (!m_zones.count(name))
 		m_zones[name] = ProfileZone{0,0,0,0,0,0};
 	m_zones[name].tics_begin = SDL_GetPerformanceCounter();
@@ -17,6 +23,8 @@ void Profiler::BeginZone(std::string name)
 
 void Profiler::EndZone()
 {
+	if (SDL_ThreadID() != m_thread)
+		return;
 	std::string name = m_zone_stack.top();
 	m_zone_stack.pop();
 	m_zones[name].tics_end = SDL_GetPerformanceCounter();
@@ -13,7 +13,7 @@ namespace IPDF
 	class Profiler
 	{
 	public:
-		Profiler() : m_enabled(false) {}
+		Profiler();
 		
 		void BeginZone(std::string name);
 		void EndZone();
@@ -35,6 +35,7 @@ namespace IPDF
 		std::map<std::string, ProfileZone> m_zones;
 		std::stack<std::string> m_zone_stack;
 		bool m_enabled;
+		unsigned long m_thread; // SDL_threadID; zones on other threads (eg: importing SVGs) aren't recorded
 	};
 
 	extern Profiler g_profiler;
@@ -66,9 +66,194 @@ bool ContainedInQuadChild(const Rect& src, QuadTreeNodeChildren child_type)
 
 
 
-QuadTreeIndex QuadTree::GetNeighbour(QuadTreeIndex start, int xdir, int ydir, Document *addTo) const
+QuadTreeIndex QuadTree::Child(QuadTreeIndex node, QuadTreeNodeChildren type) const
+{
+	switch (type)
+	{
+		case QTC_TOP_LEFT:
+			return nodes[node].top_left;
+		case QTC_TOP_RIGHT:
+			return nodes[node].top_right;
+		case QTC_BOTTOM_LEFT:
+			return nodes[node].bottom_left;
+		case QTC_BOTTOM_RIGHT:
+			return nodes[node].bottom_right;
+		default:
+			return QUADTREE_EMPTY;
+	}
+}
+
+// Make a child that GetNeighbour needs; in the background it won't be ready yet.
+static QuadTreeIndex NeighbourChild(Document *addTo, QuadTreeIndex parent, QuadTreeNodeChildren type, bool background)
+{
+	return (background) ? addTo->RequestQuadChild(parent, type) : addTo->GenQuadChild(parent, type);
+}
+
+// Spread the low 32 bits of v out to the even bits
+static uint64_t MortonSpread(uint64_t v)
+{
+	v &= 0xffffffffULL;
+	v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+	v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+	v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	v = (v | (v << 2)) & 0x3333333333333333ULL;
+	v = (v | (v << 1)) & 0x5555555555555555ULL;
+	return v;
+}
+
+// Gather the even bits of v back together
+static uint64_t MortonCompact(uint64_t v)
+{
+	v &= 0x5555555555555555ULL;
+	v = (v | (v >> 1)) & 0x3333333333333333ULL;
+	v = (v | (v >> 2)) & 0x0f0f0f0f0f0f0f0fULL;
+	v = (v | (v >> 4)) & 0x00ff00ff00ff00ffULL;
+	v = (v | (v >> 8)) & 0x0000ffff0000ffffULL;
+	v = (v | (v >> 16)) & 0x00000000ffffffffULL;
+	return v;
+}
+
+static unsigned KeyDepth(QuadTreeKey key)
+{
+	return (63 - __builtin_clzll(key)) / 2;
+}
+
+// The two bits a child adds to its parent's key: x in the low bit, y in the high one.
+static unsigned ChildQuadrant(QuadTreeNodeChildren type)
+{
+	switch (type)
+	{
+		case QTC_TOP_LEFT:
+			return 0;
+		case QTC_TOP_RIGHT:
+			return 1;
+		case QTC_BOTTOM_LEFT:
+			return 2;
+		default:
+			return 3;
+	}
+}
+
+static const QuadTreeNodeChildren QUADRANT_CHILDREN[] = {QTC_TOP_LEFT, QTC_TOP_RIGHT, QTC_BOTTOM_LEFT, QTC_BOTTOM_RIGHT};
+
+void QuadTree::SetChild(QuadTreeIndex parent, QuadTreeNodeChildren type, QuadTreeIndex child)
+{
+	QuadTreeIndex old = Child(parent, type);
+	switch (type)
+	{
+		case QTC_TOP_LEFT:
+			nodes[parent].top_left = child;
+			break;
+		case QTC_TOP_RIGHT:
+			nodes[parent].top_right = child;
+			break;
+		case QTC_BOTTOM_LEFT:
+			nodes[parent].bottom_left = child;
+			break;
+		case QTC_BOTTOM_RIGHT:
+			nodes[parent].bottom_right = child;
+			break;
+		default:
+			Fatal("Tried to add a QuadTree child of invalid type!");
+	}
+	if (old != QUADTREE_EMPTY && old != child)
+		Unindex(old);
+	QuadTreeKey parent_key = Key(parent);
+	if (child != QUADTREE_EMPTY && parent_key != QUADTREE_NO_KEY && KeyDepth(parent_key) < QUADTREE_MAX_KEY_DEPTH)
+		Index(child, (parent_key << 2) | ChildQuadrant(type));
+}
+
+QuadTreeIndex QuadTree::Find(QuadTreeKey key) const
+{
+	std::unordered_map<QuadTreeKey, QuadTreeIndex>::const_iterator i = index.find(key);
+	return (i == index.end()) ? QUADTREE_EMPTY : i->second;
+}
+
+void QuadTree::Index(QuadTreeIndex node, QuadTreeKey key)
+{
+	if (keys.size() < nodes.size())
+		keys.resize(nodes.size(), QUADTREE_NO_KEY);
+	keys[node] = key;
+	index[key] = node;
+}
+
+void QuadTree::Unindex(QuadTreeIndex node)
+{
+	QuadTreeKey key = Key(node);
+	if (key == QUADTREE_NO_KEY)
+		return;
+	if (Find(key) == node)
+		index.erase(key);
+	keys[node] = QUADTREE_NO_KEY;
+}
+
+void QuadTree::Reindex()
+{
+	index.clear();
+	keys.assign(nodes.size(), QUADTREE_NO_KEY);
+	if (root_id == QUADTREE_EMPTY)
+		return;
+	Index(root_id, 1);
+	std::vector<QuadTreeIndex> todo(1, root_id);
+	while (!todo.empty())
+	{
+		QuadTreeIndex node = todo.back();
+		todo.pop_back();
+		if (KeyDepth(keys[node]) >= QUADTREE_MAX_KEY_DEPTH)
+			continue;
+		for (unsigned q = 0; q < 4; ++q)
+		{
+			QuadTreeIndex child = Child(node, QUADRANT_CHILDREN[q]);
+			if (child == QUADTREE_EMPTY)
+				continue;
+			Index(child, (keys[node] << 2) | q);
+			todo.push_back(child);
+		}
+	}
+}
+
+/**
+ * Find the node xdir across and ydir down from start, at the same depth
+ * Indexed nodes get there by arithmetic on their Morton code and one lookup; the rest walk the tree
+ * If addTo is given, missing nodes on the way down from the nearest existing ancestor are generated (or requested, in the background)
+ */
+QuadTreeIndex QuadTree::GetNeighbour(QuadTreeIndex start, int xdir, int ydir, Document *addTo, bool background) const
 {
 	if (!xdir && !ydir) return start;
+	if (start == QUADTREE_EMPTY) return QUADTREE_EMPTY;
+	QuadTreeKey key = Key(start);
+	if (key == QUADTREE_NO_KEY)
+		return WalkToNeighbour(start, xdir, ydir, addTo, background);
+
+	unsigned depth = KeyDepth(key);
+	QuadTreeKey code = key ^ ((QuadTreeKey)1 << (2*depth));
+	int64_t x = (int64_t)MortonCompact(code) + xdir;
+	int64_t y = (int64_t)MortonCompact(code >> 1) + ydir;
+	// Nothing beyond the edges of the root
+	if (x < 0 || y < 0 || x >= ((int64_t)1 << depth) || y >= ((int64_t)1 << depth))
+		return QUADTREE_EMPTY;
+	QuadTreeKey target = ((QuadTreeKey)1 << (2*depth)) | MortonSpread(x) | (MortonSpread(y) << 1);
+	QuadTreeIndex found = Find(target);
+	if (found != QUADTREE_EMPTY || addTo == NULL)
+		return found;
+
+	// Come down from the closest ancestor that exists (the root always does)
+	unsigned level = depth;
+	QuadTreeIndex node = QUADTREE_EMPTY;
+	while (node == QUADTREE_EMPTY && level > 0)
+		node = Find(target >> (2*(depth - --level)));
+	for (++level; level <= depth && node != QUADTREE_EMPTY; ++level)
+	{
+		QuadTreeNodeChildren type = QUADRANT_CHILDREN[(target >> (2*(depth - level))) & 3];
+		QuadTreeIndex child = Child(node, type);
+		node = (child != QUADTREE_EMPTY) ? child : NeighbourChild(addTo, node, type, background);
+	}
+	return node;
+}
+
+// Walk up to a common ancestor and back down; for nodes without a key.
+QuadTreeIndex QuadTree::WalkToNeighbour(QuadTreeIndex start, int xdir, int ydir, Document *addTo, bool background) const
+{
 
 	if (addTo && (nodes[start].parent == -1) && nodes[start].child_type != QTC_UNKNOWN)
 	{
@@ -90,7 +275,7 @@ QuadTreeIndex QuadTree::GetNeighbour(QuadTreeIndex start, int xdir, int ydir, Do
 				newNode = nodes[nodes[start].parent].top_right;
 				if (addTo && newNode == -1)
 				{
-					newNode = addTo->GenQuadChild(nodes[start].parent, QTC_TOP_RIGHT);
+					newNode = NeighbourChild(addTo, nodes[start].parent, QTC_TOP_RIGHT, background);
 				}
 			}
 			else
@@ -98,22 +283,22 @@ QuadTreeIndex QuadTree::GetNeighbour(QuadTreeIndex start, int xdir, int ydir, Do
 				newNode = nodes[nodes[start].parent].bottom_right;
 				if (addTo && newNode == -1)
 				{
-					newNode = addTo->GenQuadChild(nodes[start].parent, QTC_BOTTOM_RIGHT);
+					newNode = NeighbourChild(addTo, nodes[start].parent, QTC_BOTTOM_RIGHT, background);
 				}
 			}	
-			return GetNeighbour(newNode, xdir - 1, ydir, addTo);
+			return GetNeighbour(newNode, xdir - 1, ydir, addTo, background);
 		}
 		case QTC_TOP_RIGHT:
 		case QTC_BOTTOM_RIGHT:
 		{
-			QuadTreeIndex right_parent = GetNeighbour(nodes[start].parent, 1, 0, addTo);
+			QuadTreeIndex right_parent = GetNeighbour(nodes[start].parent, 1, 0, addTo, background);
 			if (right_parent == -1) return -1;
 			if (nodes[start].child_type == QTC_TOP_RIGHT)
 			{
 				newNode = nodes[right_parent].top_left;
 				if (addTo && newNode == -1)
 				{
-					newNode = addTo->GenQuadChild(right_parent, QTC_TOP_LEFT);
+					newNode = NeighbourChild(addTo, right_parent, QTC_TOP_LEFT, background);
 				}
 			}
 			else
@@ -121,10 +306,10 @@ QuadTreeIndex QuadTree::GetNeighbour(QuadTreeIndex start, int xdir, int ydir, Do
 				newNode = nodes[right_parent].bottom_left;
 				if (addTo && newNode == -1)
 				{
-					newNode = addTo->GenQuadChild(right_parent, QTC_BOTTOM_LEFT);
+					newNode = NeighbourChild(addTo, right_parent, QTC_BOTTOM_LEFT, background);
 				}
 			}
-			return GetNeighbour(newNode, xdir - 1, ydir, addTo);
+			return GetNeighbour(newNode, xdir - 1, ydir, addTo, background);
 		}
 		default:
 			return -1;
@@ -145,7 +330,7 @@ QuadTreeIndex QuadTree::GetNeighbour(QuadTreeIndex start, int xdir, int ydir, Do
 				newNode = nodes[nodes[start].parent].top_left;
 				if (addTo && newNode == -1)
 				{
-					newNode = addTo->GenQuadChild(nodes[start].parent, QTC_TOP_LEFT);
+					newNode = NeighbourChild(addTo, nodes[start].parent, QTC_TOP_LEFT, background);
 				}
 			}
 			else
@@ -153,23 +338,23 @@ QuadTreeIndex QuadTree::GetNeighbour(QuadTreeIndex start, int xdir, int ydir, Do
 				newNode = nodes[nodes[start].parent].bottom_left;
 				if (addTo && newNode == -1)
 				{
-					newNode = addTo->GenQuadChild(nodes[start].parent, QTC_BOTTOM_LEFT);
+					newNode = NeighbourChild(addTo, nodes[start].parent, QTC_BOTTOM_LEFT, background);
 				}
 			}
 				
-			return GetNeighbour(newNode, xdir + 1, ydir, addTo);
+			return GetNeighbour(newNode, xdir + 1, ydir, addTo, background);
 		}
 		case QTC_TOP_LEFT:
 		case QTC_BOTTOM_LEFT:
 		{
-			QuadTreeIndex left_parent = GetNeighbour(nodes[start].parent, -1, 0, addTo);
+			QuadTreeIndex left_parent = GetNeighbour(nodes[start].parent, -1, 0, addTo, background);
 			if (left_parent == -1) return -1;
 			if (nodes[start].child_type == QTC_TOP_LEFT)
 			{
 				newNode = nodes[left_parent].top_right;
 				if (addTo && newNode == -1)
 				{
-					newNode = addTo->GenQuadChild(left_parent, QTC_TOP_RIGHT);
+					newNode = NeighbourChild(addTo, left_parent, QTC_TOP_RIGHT, background);
 				}
 			}
 			else
@@ -177,10 +362,10 @@ QuadTreeIndex QuadTree::GetNeighbour(QuadTreeIndex start, int xdir, int ydir, Do
 				newNode = nodes[left_parent].bottom_right;
 				if (addTo && newNode == -1)
 				{
-					newNode = addTo->GenQuadChild(left_parent, QTC_BOTTOM_RIGHT);
+					newNode = NeighbourChild(addTo, left_parent, QTC_BOTTOM_RIGHT, background);
 				}
 			}
-			return GetNeighbour(newNode, xdir + 1, ydir, addTo);
+			return GetNeighbour(newNode, xdir + 1, ydir, addTo, background);
 		}
 		default:
 			return -1;
@@ -200,7 +385,7 @@ QuadTreeIndex QuadTree::GetNeighbour(QuadTreeIndex start, int xdir, int ydir, Do
 				newNode = nodes[nodes[start].parent].bottom_left;
 				if (addTo && newNode == -1)
 				{
-					newNode = addTo->GenQuadChild(nodes[start].parent, QTC_BOTTOM_LEFT);
+					newNode = NeighbourChild(addTo, nodes[start].parent, QTC_BOTTOM_LEFT, background);
 				}
 			}
 			else
@@ -208,22 +393,22 @@ QuadTreeIndex QuadTree::GetNeighbour(QuadTreeIndex start, int xdir, int ydir, Do
 				newNode = nodes[nodes[start].parent].bottom_right;
 				if (addTo && newNode == -1)
 				{
-					newNode = addTo->GenQuadChild(nodes[start].parent, QTC_BOTTOM_RIGHT);
+					newNode = NeighbourChild(addTo, nodes[start].parent, QTC_BOTTOM_RIGHT, background);
 				}
 			}	
-			return GetNeighbour(newNode, xdir, ydir - 1, addTo);
+			return GetNeighbour(newNode, xdir, ydir - 1, addTo, background);
 		}
 		case QTC_BOTTOM_LEFT:
 		case QTC_BOTTOM_RIGHT:
 		{
-			QuadTreeIndex bottom_parent = GetNeighbour(nodes[start].parent, 0, 1, addTo);
+			QuadTreeIndex bottom_parent = GetNeighbour(nodes[start].parent, 0, 1, addTo, background);
 			if (bottom_parent == -1) return -1;
 			if (nodes[start].child_type == QTC_BOTTOM_LEFT)
 			{
 				newNode = nodes[bottom_parent].top_left;
 				if (addTo && newNode == -1)
 				{
-					newNode = addTo->GenQuadChild(bottom_parent, QTC_TOP_LEFT);
+					newNode = NeighbourChild(addTo, bottom_parent, QTC_TOP_LEFT, background);
 				}
 			}
 			else
@@ -231,10 +416,10 @@ QuadTreeIndex QuadTree::GetNeighbour(QuadTreeIndex start, int xdir, int ydir, Do
 				newNode = nodes[bottom_parent].top_right;
 				if (addTo && newNode == -1)
 				{
-					newNode = addTo->GenQuadChild(bottom_parent, QTC_TOP_RIGHT);
+					newNode = NeighbourChild(addTo, bottom_parent, QTC_TOP_RIGHT, background);
 				}
 			}
-			return GetNeighbour(newNode, xdir, ydir - 1, addTo);
+			return GetNeighbour(newNode, xdir, ydir - 1, addTo, background);
 		}
 		default:
 			return -1;
@@ -254,7 +439,7 @@ QuadTreeIndex QuadTree::GetNeighbour(QuadTreeIndex start, int xdir, int ydir, Do
 				newNode = nodes[nodes[start].parent].top_left;
 				if (addTo && newNode == -1)
 				{
-					newNode = addTo->GenQuadChild(nodes[start].parent, QTC_TOP_LEFT);
+					newNode = NeighbourChild(addTo, nodes[start].parent, QTC_TOP_LEFT, background);
 				}
 			}
 			else
@@ -262,22 +447,22 @@ QuadTreeIndex QuadTree::GetNeighbour(QuadTreeIndex start, int xdir, int ydir, Do
 				newNode = nodes[nodes[start].parent].top_right;
 				if (addTo && newNode == -1)
 				{
-					newNode = addTo->GenQuadChild(nodes[start].parent, QTC_TOP_RIGHT);
+					newNode = NeighbourChild(addTo, nodes[start].parent, QTC_TOP_RIGHT, background);
 				}
 			}	
-			return GetNeighbour(newNode, xdir, ydir + 1, addTo);
+			return GetNeighbour(newNode, xdir, ydir + 1, addTo, background);
 		}
 		case QTC_TOP_LEFT:
 		case QTC_TOP_RIGHT:
 		{
-			QuadTreeIndex top_parent = GetNeighbour(nodes[start].parent, 0, -1, addTo);
+			QuadTreeIndex top_parent = GetNeighbour(nodes[start].parent, 0, -1, addTo, background);
 			if (top_parent == -1) return -1;
 			if (nodes[start].child_type == QTC_TOP_LEFT)
 			{
 				newNode = nodes[top_parent].bottom_left;
 				if (addTo && newNode == -1)
 				{
-					newNode = addTo->GenQuadChild(top_parent, QTC_BOTTOM_LEFT);
+					newNode = NeighbourChild(addTo, top_parent, QTC_BOTTOM_LEFT, background);
 				}
 			}
 			else
@@ -285,10 +470,10 @@ QuadTreeIndex QuadTree::GetNeighbour(QuadTreeIndex start, int xdir, int ydir, Do
 				newNode = nodes[top_parent].bottom_right;
 				if (addTo && newNode == -1)
 				{
-					newNode = addTo->GenQuadChild(top_parent, QTC_BOTTOM_RIGHT);
+					newNode = NeighbourChild(addTo, top_parent, QTC_BOTTOM_RIGHT, background);
 				}
 			}
-			return GetNeighbour(newNode, xdir, ydir + 1, addTo);
+			return GetNeighbour(newNode, xdir, ydir + 1, addTo, background);
 		}
 		default:
 			return -1;
@@ -7,12 +7,18 @@
 
 #include "common.h"
 #include "ipdf.h"
+#include <unordered_map>
 
 namespace IPDF
 {
 
 	typedef int QuadTreeIndex;
 	static const QuadTreeIndex QUADTREE_EMPTY = -1;
+	// Where a node is: a 1 followed by the Morton code (y and x bits interleaved, one pair per level) of its position at its depth.
+	// The root is 1. QUADTREE_NO_KEY for nodes too deep to fit, or not under the root.
+	typedef uint64_t QuadTreeKey;
+	static const QuadTreeKey QUADTREE_NO_KEY = 0;
+	static const unsigned QUADTREE_MAX_KEY_DEPTH = 31;
 	class Document;
 
 	enum QuadTreeNodeChildren
@@ -27,6 +33,9 @@ namespace IPDF
 	// Represents a single node in a quadtree.
 	struct QuadTreeNode
 	{
+		QuadTreeNode(QuadTreeIndex _parent = QUADTREE_EMPTY, QuadTreeNodeChildren _child_type = QTC_UNKNOWN)
+			: top_left(QUADTREE_EMPTY), top_right(QUADTREE_EMPTY), bottom_left(QUADTREE_EMPTY), bottom_right(QUADTREE_EMPTY),
+			parent(_parent), child_type(_child_type), objects(), dirty(), render_dirty(true) {}
 		// Indices of children nodes, QUADTREE_EMPTY if no such child.
 		QuadTreeIndex top_left;
 		QuadTreeIndex top_right;
@@ -36,14 +45,10 @@ namespace IPDF
 		QuadTreeIndex parent;
 		// Which child am I?
 		QuadTreeNodeChildren child_type;
-		// First object in the node.
-		unsigned object_begin;
-		// Last object in the node.
-		unsigned object_end;
-		// Linked list of "extra" nodes
-		QuadTreeIndex next_overlay;
-		// First object which has not yet been propagated to extant children/parent.
-		unsigned object_dirty;
+		// The node's own objects, in its coordinates; their data indices are into its own Beziers and paths.
+		Objects objects;
+		// Runs [first, second) of objects added to the node which have not yet been propagated to extant children/parent.
+		std::vector<std::pair<unsigned, unsigned> > dirty;
 		bool render_dirty;
 	};
 
@@ -53,9 +58,24 @@ namespace IPDF
 		QuadTreeIndex root_id;
 		std::vector<QuadTreeNode> nodes;
 
-		QuadTreeIndex GetNeighbour(QuadTreeIndex start, int xdir, int ydir, Document *doc) const;
+		QuadTreeIndex Child(QuadTreeIndex node, QuadTreeNodeChildren type) const;
+		// Link (or with QUADTREE_EMPTY, unlink) a child, keeping the key index up to date.
+		void SetChild(QuadTreeIndex parent, QuadTreeNodeChildren type, QuadTreeIndex child);
+		// With background set, missing nodes are requested from doc rather than generated, and QUADTREE_EMPTY is returned until they are ready.
+		QuadTreeIndex GetNeighbour(QuadTreeIndex start, int xdir, int ydir, Document *doc, bool background = false) const;
 		void GetCanonicalCoords(QuadTreeIndex& start, Real& x, Real& y, Document *doc);
 
+		QuadTreeKey Key(QuadTreeIndex node) const { return ((size_t)node < keys.size()) ? keys[node] : QUADTREE_NO_KEY; }
+		QuadTreeIndex Find(QuadTreeKey key) const;
+		// Rebuild the key index from the nodes (after loading them)
+		void Reindex();
+		void Unindex(QuadTreeIndex node);
+
+		private:
+			void Index(QuadTreeIndex node, QuadTreeKey key);
+			QuadTreeIndex WalkToNeighbour(QuadTreeIndex start, int xdir, int ydir, Document *addTo, bool background) const;
+			std::vector<QuadTreeKey> keys; // by node
+			std::unordered_map<QuadTreeKey, QuadTreeIndex> index;
 	};
 
 	Rect TransformToQuadChild(const Rect& src, QuadTreeNodeChildren child_type);
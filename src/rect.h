@@ -21,6 +21,8 @@ namespace IPDF
 			s << "{" << x << ", " << y << ", " << (x + w) << ", " << (y + h) << " (w: " << w <<", h: " << h <<")}";
 			return s.str();
 		}
+		bool operator==(const TRect & equ) const {return (x == equ.x && y == equ.y && w == equ.w && h == equ.h);}
+		bool operator!=(const TRect & equ) const {return !this->operator==(equ);}
 		inline bool PointIn(T pt_x, T pt_y) const
 		{
 			if (pt_x <= x) return false;
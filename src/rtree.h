@@ -0,0 +1,141 @@
+/**
+ * @file rtree.h
+ * @brief Bounding volume hierarchy over a range of Rects, packed in one go
+ */
+
+#ifndef _RTREE_H
+#define _RTREE_H
+
+#include "common.h"
+#include "rect.h"
+#include <algorithm>
+#include <cmath>
+
+namespace IPDF
+{
+	/**
+	 * An R-tree that is built once from a range of bounds (Sort-Tile-Recursive packing) and then only queried.
+	 * Boxes are doubles rounded outwards, so Query can give extra candidates but never misses one;
+	 * check the candidates against the real bounds to be exact.
+	 */
+	class RTree
+	{
+		public:
+			static const unsigned NODE_SIZE = 16;
+
+			RTree() : m_nodes(), m_entries(), m_leaf_end(0) {}
+
+			/** Index bounds[begin] to bounds[end-1] **/
+			template <class V> void Build(const V & bounds, unsigned begin, unsigned end)
+			{
+				m_nodes.clear();
+				m_entries.clear();
+				std::vector<Node> level;
+				for (unsigned i = begin; i < end; ++i)
+				{
+					const Rect & b = bounds[i];
+					level.push_back(Node{Lower(b.x), Lower(b.y), Upper(b.x + b.w), Upper(b.y + b.h), i, 1});
+				}
+				m_leaf_end = 0;
+				bool leaves = true;
+				while (!level.empty())
+				{
+					Pack(level);
+					unsigned first = leaves ? 0 : m_nodes.size();
+					std::vector<Node> parents;
+					for (unsigned i = 0; i < level.size(); i += NODE_SIZE)
+					{
+						unsigned count = std::min(level.size() - i, (size_t)NODE_SIZE); // (by value; NODE_SIZE has no definition to bind a reference to)
+						Node parent{level[i].x0, level[i].y0, level[i].x1, level[i].y1, first + i, count};
+						for (unsigned j = i; j < i + count; ++j)
+						{
+							parent.x0 = std::min(parent.x0, level[j].x0);
+							parent.y0 = std::min(parent.y0, level[j].y0);
+							parent.x1 = std::max(parent.x1, level[j].x1);
+							parent.y1 = std::max(parent.y1, level[j].y1);
+						}
+						parents.push_back(parent);
+					}
+					// The bottom level is the entries; the level above it (the leaves) is the first in m_nodes
+					for (unsigned i = 0; i < level.size(); ++i)
+					{
+						if (leaves)
+							m_entries.push_back(level[i].first);
+						else
+							m_nodes.push_back(level[i]);
+					}
+					if (!leaves && m_leaf_end == 0)
+						m_leaf_end = m_nodes.size();
+					if (parents.size() == 1)
+					{
+						m_nodes.push_back(parents[0]);
+						if (leaves)
+							m_leaf_end = 1;
+						break;
+					}
+					level.swap(parents);
+					leaves = false;
+				}
+			}
+
+			/** Append the indices of the bounds whose boxes intersect rect **/
+			void Query(const Rect & rect, std::vector<unsigned> & result) const
+			{
+				if (m_nodes.empty())
+					return;
+				double x0 = Lower(rect.x), y0 = Lower(rect.y), x1 = Upper(rect.x + rect.w), y1 = Upper(rect.y + rect.h);
+				std::vector<unsigned> stack(1, m_nodes.size() - 1);
+				while (!stack.empty())
+				{
+					const Node & node = m_nodes[stack.back()];
+					bool leaf = IsLeaf(stack.back());
+					stack.pop_back();
+					if (node.x1 < x0 || node.y1 < y0 || node.x0 > x1 || node.y0 > y1)
+						continue;
+					for (unsigned i = node.first; i < node.first + node.count; ++i)
+					{
+						if (!leaf)
+							stack.push_back(i);
+						else
+							result.push_back(m_entries[i]);
+					}
+				}
+			}
+
+			bool empty() const {return m_entries.empty();}
+			size_t size() const {return m_entries.size();}
+
+		private:
+			struct Node
+			{
+				double x0; double y0; double x1; double y1;
+				unsigned first; // leaves: into m_entries; otherwise: into m_nodes
+				unsigned count;
+			};
+
+			/** Nearest doubles at or beyond r, so boxes only ever grow **/
+			static double Lower(const Real & r) {double d = Double(r); return (Real(d) > r) ? nextafter(d, -HUGE_VAL) : d;}
+			static double Upper(const Real & r) {double d = Double(r); return (Real(d) < r) ? nextafter(d, HUGE_VAL) : d;}
+
+			bool IsLeaf(unsigned node) const {return node < m_leaf_end;}
+
+			/** Sort into vertical slices by x, then each slice by y, so consecutive runs of NODE_SIZE are close together **/
+			static void Pack(std::vector<Node> & level)
+			{
+				unsigned groups = (level.size() + NODE_SIZE - 1) / NODE_SIZE;
+				unsigned slice = NODE_SIZE * (unsigned)ceil(sqrt((double)groups));
+				std::sort(level.begin(), level.end(), [](const Node & a, const Node & b) {return a.x0 + a.x1 < b.x0 + b.x1;});
+				for (unsigned i = 0; i < level.size(); i += slice)
+				{
+					std::sort(level.begin() + i, level.begin() + std::min<size_t>(i + slice, level.size()),
+						[](const Node & a, const Node & b) {return a.y0 + a.y1 < b.y0 + b.y1;});
+				}
+			}
+
+			std::vector<Node> m_nodes; // bottom level first; the root is last
+			std::vector<unsigned> m_entries;
+			unsigned m_leaf_end; // nodes before this are leaves
+	};
+}
+
+#endif //_RTREE_H
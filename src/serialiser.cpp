@@ -0,0 +1,598 @@
+/**
+ * @file serialiser.cpp
+ * @brief Implements Serialiser and Deserialiser
+ */
+
+#include "serialiser.h"
+
+using namespace std;
+
+namespace IPDF
+{
+
+/** Swaps bytes between the host order and little endian (a no-op on little endian hosts) **/
+static inline void LittleEndian(uint8_t * bytes, size_t size)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	reverse(bytes, bytes+size);
+#endif
+}
+
+/** The 4 ways a Bezier coordinate can be stored **/
+enum {BEZIER_ZERO, BEZIER_ONE, BEZIER_REPEAT, BEZIER_EXPLICIT};
+
+Serialiser::Serialiser(FILE * file) : m_file(file), m_used(0), m_size(0), m_limbs()
+{
+
+}
+
+void Serialiser::Flush()
+{
+	if (m_used == 0)
+		return;
+	if (fwrite(m_buffer, 1, m_used, m_file) != m_used)
+		Fatal("Only wrote part of %u bytes - %s", m_used, strerror(errno));
+	m_used = 0;
+}
+
+void Serialiser::Bytes(const void * data, size_t size)
+{
+	const uint8_t * bytes = (const uint8_t*)data;
+	m_size += size;
+	while (size > 0)
+	{
+		size_t n = min(size, sizeof(m_buffer) - m_used);
+		memcpy(m_buffer + m_used, bytes, n);
+		m_used += n;
+		bytes += n;
+		size -= n;
+		if (m_used == sizeof(m_buffer))
+			Flush();
+	}
+}
+
+void Serialiser::Varint(uint64_t value)
+{
+	uint8_t bytes[10];
+	size_t n = 0;
+	do
+	{
+		bytes[n] = value & 0x7f;
+		value >>= 7;
+		if (value != 0)
+			bytes[n] |= 0x80;
+		++n;
+	} while (value != 0);
+	Bytes(bytes, n);
+}
+
+void Serialiser::SignedVarint(int64_t value)
+{
+	Varint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+void Serialiser::Write(float value)
+{
+	uint8_t bytes[sizeof(float)];
+	memcpy(bytes, &value, sizeof(bytes));
+	LittleEndian(bytes, sizeof(bytes));
+	Bytes(bytes, sizeof(bytes));
+}
+
+void Serialiser::Write(double value)
+{
+	uint8_t bytes[sizeof(double)];
+	memcpy(bytes, &value, sizeof(bytes));
+	LittleEndian(bytes, sizeof(bytes));
+	Bytes(bytes, sizeof(bytes));
+}
+
+void Serialiser::Write(long double value)
+{
+	uint8_t bytes[sizeof(long double)];
+	memcpy(bytes, &value, sizeof(bytes));
+	LittleEndian(bytes, sizeof(bytes));
+	Bytes(bytes, sizeof(bytes));
+}
+
+void Serialiser::WriteMpz(mpz_srcptr value)
+{
+	size_t count = (mpz_sgn(value) == 0) ? 0 : (mpz_sizeinbase(value, 2) + 63) / 64;
+	m_limbs.resize(count);
+	if (count > 0)
+		mpz_export(m_limbs.data(), &count, -1, sizeof(uint64_t), 0, 0, value);
+	Varint((count << 1) | (mpz_sgn(value) < 0));
+	for (size_t i = 0; i + 1 < count; ++i)
+	{
+		uint8_t bytes[sizeof(uint64_t)];
+		memcpy(bytes, &m_limbs[i], sizeof(bytes));
+		LittleEndian(bytes, sizeof(bytes));
+		Bytes(bytes, sizeof(bytes));
+	}
+	// The most significant limb is often much smaller than the rest (or is all there is)
+	if (count > 0)
+		Varint(m_limbs[count-1]);
+}
+
+void Serialiser::Write(const Gmprat & value)
+{
+	WriteMpz(mpq_numref(value.Op()));
+	WriteMpz(mpq_denref(value.Op()));
+}
+
+#ifdef SERIALISE_MPREAL
+void Serialiser::Write(const mpfr::mpreal & value)
+{
+	mpfr_srcptr x = value.mpfr_srcptr();
+	uint8_t kind = (mpfr_nan_p(x)) ? 3 : (mpfr_inf_p(x)) ? 2 : (mpfr_zero_p(x)) ? 1 : 0;
+	kind = (kind << 1) | (mpfr_signbit(x) != 0);
+	Bytes(&kind, 1);
+	Varint(mpfr_get_prec(x));
+	if ((kind >> 1) != 0)
+		return;
+	mpz_t mantissa;
+	mpz_init(mantissa);
+	SignedVarint(mpfr_get_z_2exp(mantissa, x));
+	WriteMpz(mantissa);
+	mpz_clear(mantissa);
+}
+#endif
+
+#if REALTYPE == REAL_VFPU
+void Serialiser::Write(const Real & value)
+{
+	Write(Float(value));
+}
+#elif REALTYPE == REAL_RATIONAL
+void Serialiser::Write(const Real & value)
+{
+	SignedVarint(value.P);
+	SignedVarint(value.Q);
+}
+#elif REALTYPE == REAL_RATIONAL_ARBINT
+void Serialiser::WriteInteger(const Arbint & value)
+{
+	const vector<Arbint::digit_t> & digits = value.Digits();
+	Varint((digits.size() << 1) | value.Sign());
+	for (size_t i = 0; i < digits.size(); ++i)
+	{
+		uint8_t bytes[sizeof(Arbint::digit_t)];
+		memcpy(bytes, &digits[i], sizeof(bytes));
+		LittleEndian(bytes, sizeof(bytes));
+		Bytes(bytes, sizeof(bytes));
+	}
+}
+
+void Serialiser::WriteInteger(const Gmpint & value)
+{
+	WriteMpz(value.Op());
+}
+
+void Serialiser::Write(const Real & value)
+{
+	WriteInteger(value.P);
+	WriteInteger(value.Q);
+}
+#elif REALTYPE == REAL_IRRAM
+void Serialiser::Write(const Real & value)
+{
+	// An iRRAM REAL is a computation, not a value; the best we can save is an approximation
+	Write(Double(value));
+}
+#elif REALTYPE == REAL_PARANOIDNUMBER
+void Serialiser::WriteParanoid(const ParanoidNumber & value)
+{
+	// In the order that ParanoidNumber::Digit evaluates them
+	static const Optype ops[] = {MULTIPLY, DIVIDE, ADD, SUBTRACT};
+	Write(value.Value());
+	for (unsigned i = 0; i < sizeof(ops)/sizeof(Optype); ++i)
+	{
+		const vector<ParanoidNumber*> & next = value.Next(ops[i]);
+		Varint(next.size());
+		for (auto n : next)
+			WriteParanoid(*n);
+	}
+}
+
+void Serialiser::Write(const Real & value)
+{
+	WriteParanoid(value);
+}
+#endif
+
+#if REALTYPE == REAL_GMPRAT
+/** Bytes that WriteMpz takes for value **/
+static size_t MpzSize(mpz_srcptr value)
+{
+	if (mpz_sgn(value) == 0)
+		return 1;
+	size_t bits = mpz_sizeinbase(value, 2);
+	size_t count = (bits + 63) / 64;
+	return 1 + 8*(count - 1) + (bits - 64*(count - 1) + 6) / 7;
+}
+
+/**
+ * Write the coordinates of a Bezier that aren't tagged
+ * They are relative to the Bezier's bounds, (x - bounds.x)/bounds.w, so usually share most of a denominator; write the
+ * least common one first, then the numerators over it. If that wouldn't be smaller, write 0 and then each in full.
+ */
+void Serialiser::WriteBezierCoords(const BReal * const * coords, unsigned count)
+{
+	mpz_t denominator, numerator;
+	mpz_init_set_ui(denominator, 1);
+	mpz_init(numerator);
+	size_t separate = 0;
+	for (unsigned i = 0; i < count; ++i)
+	{
+		mpq_srcptr q = coords[i]->Op();
+		mpz_lcm(denominator, denominator, mpq_denref(q));
+		separate += MpzSize(mpq_numref(q)) + MpzSize(mpq_denref(q));
+	}
+	size_t shared = MpzSize(denominator);
+	for (unsigned i = 0; i < count && shared < separate; ++i)
+	{
+		mpq_srcptr q = coords[i]->Op();
+		mpz_divexact(numerator, denominator, mpq_denref(q));
+		mpz_mul(numerator, numerator, mpq_numref(q));
+		shared += MpzSize(numerator);
+	}
+	if (shared < separate)
+	{
+		WriteMpz(denominator);
+		for (unsigned i = 0; i < count; ++i)
+		{
+			mpq_srcptr q = coords[i]->Op();
+			mpz_divexact(numerator, denominator, mpq_denref(q));
+			mpz_mul(numerator, numerator, mpq_numref(q));
+			WriteMpz(numerator);
+		}
+	}
+	else
+	{
+		Varint(0);
+		for (unsigned i = 0; i < count; ++i)
+			Write(*coords[i]);
+	}
+	mpz_clear(denominator);
+	mpz_clear(numerator);
+}
+#endif
+
+void Serialiser::Write(const Bezier & bezier)
+{
+	const BReal * coords[] = {&bezier.x0, &bezier.y0, &bezier.x1, &bezier.y1, &bezier.x2, &bezier.y2, &bezier.x3, &bezier.y3};
+	uint16_t tags = 0;
+	for (unsigned i = 0; i < 8; ++i)
+	{
+		unsigned tag = BEZIER_EXPLICIT;
+		if (*coords[i] == BReal(0))
+			tag = BEZIER_ZERO;
+		else if (*coords[i] == BReal(1))
+			tag = BEZIER_ONE;
+		else if (i >= 2 && *coords[i] == *coords[i-2])
+			tag = BEZIER_REPEAT;
+		tags |= tag << (2*i);
+	}
+	uint8_t bytes[2] = {(uint8_t)(tags & 0xff), (uint8_t)(tags >> 8)};
+	Bytes(bytes, sizeof(bytes));
+#if REALTYPE == REAL_GMPRAT
+	const BReal * explicit_coords[8];
+	unsigned count = 0;
+	for (unsigned i = 0; i < 8; ++i)
+	{
+		if (((tags >> (2*i)) & 3) == BEZIER_EXPLICIT)
+			explicit_coords[count++] = coords[i];
+	}
+	if (count > 0)
+		WriteBezierCoords(explicit_coords, count);
+#else
+	for (unsigned i = 0; i < 8; ++i)
+	{
+		if (((tags >> (2*i)) & 3) == BEZIER_EXPLICIT)
+			Write(*coords[i]);
+	}
+#endif
+}
+
+Deserialiser::Deserialiser(FILE * file, uint64_t size) : m_file(file), m_pos(m_buffer), m_end(m_buffer), m_remaining(size), m_limbs()
+{
+
+}
+
+Deserialiser::Deserialiser(const uint8_t * data, uint64_t size) : m_file(NULL), m_pos(data), m_end(data + size), m_remaining(0), m_limbs()
+{
+
+}
+
+void Deserialiser::Refill()
+{
+	if (m_file == NULL || m_remaining == 0)
+		Fatal("Tried to read past the end of the data");
+	size_t n = min((uint64_t)sizeof(m_buffer), m_remaining);
+	if (fread(m_buffer, 1, n, m_file) != n)
+		Fatal("Only read part of %u bytes - %s", n, strerror(errno));
+	m_remaining -= n;
+	m_pos = m_buffer;
+	m_end = m_buffer + n;
+}
+
+void Deserialiser::Bytes(void * data, size_t size)
+{
+	uint8_t * bytes = (uint8_t*)data;
+	while (size > 0)
+	{
+		if (m_pos == m_end)
+			Refill();
+		size_t n = min(size, (size_t)(m_end - m_pos));
+		memcpy(bytes, m_pos, n);
+		m_pos += n;
+		bytes += n;
+		size -= n;
+	}
+}
+
+uint64_t Deserialiser::Varint()
+{
+	uint64_t value = 0;
+	for (unsigned shift = 0; shift < 64; shift += 7)
+	{
+		if (m_pos == m_end)
+			Refill();
+		uint8_t byte = *(m_pos++);
+		value |= (uint64_t)(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0)
+			return value;
+	}
+	Fatal("Varint is longer than 64 bits");
+	return value;
+}
+
+int64_t Deserialiser::SignedVarint()
+{
+	uint64_t value = Varint();
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+void Deserialiser::Read(float & value)
+{
+	uint8_t bytes[sizeof(float)];
+	Bytes(bytes, sizeof(bytes));
+	LittleEndian(bytes, sizeof(bytes));
+	memcpy(&value, bytes, sizeof(bytes));
+}
+
+void Deserialiser::Read(double & value)
+{
+	uint8_t bytes[sizeof(double)];
+	Bytes(bytes, sizeof(bytes));
+	LittleEndian(bytes, sizeof(bytes));
+	memcpy(&value, bytes, sizeof(bytes));
+}
+
+void Deserialiser::Read(long double & value)
+{
+	uint8_t bytes[sizeof(long double)];
+	Bytes(bytes, sizeof(bytes));
+	LittleEndian(bytes, sizeof(bytes));
+	memcpy(&value, bytes, sizeof(bytes));
+}
+
+void Deserialiser::ReadMpz(mpz_ptr value)
+{
+	uint64_t header = Varint();
+	uint64_t count = header >> 1;
+	if (count > 0 && count - 1 > Remaining() / sizeof(uint64_t))
+		Fatal("Integer of %lu limbs is longer than the remaining %lu bytes", (unsigned long)count, (unsigned long)Remaining());
+	m_limbs.resize(count);
+	for (uint64_t i = 0; i + 1 < count; ++i)
+	{
+		uint8_t bytes[sizeof(uint64_t)];
+		Bytes(bytes, sizeof(bytes));
+		LittleEndian(bytes, sizeof(bytes));
+		memcpy(&m_limbs[i], bytes, sizeof(bytes));
+	}
+	if (count > 0)
+		m_limbs[count-1] = Varint();
+	mpz_import(value, count, -1, sizeof(uint64_t), 0, 0, m_limbs.data());
+	if (header & 1)
+		mpz_neg(value, value);
+}
+
+void Deserialiser::Read(Gmprat & value)
+{
+	ReadMpz(mpq_numref(value.Op()));
+	ReadMpz(mpq_denref(value.Op()));
+	if (mpz_sgn(mpq_denref(value.Op())) == 0)
+		Fatal("Rational has a zero denominator");
+}
+
+#ifdef SERIALISE_MPREAL
+void Deserialiser::Read(mpfr::mpreal & value)
+{
+	uint8_t kind;
+	Bytes(&kind, 1);
+	mpfr_ptr x = value.mpfr_ptr();
+	mpfr_set_prec(x, Varint());
+	int sign = (kind & 1) ? -1 : 1;
+	switch (kind >> 1)
+	{
+	case 0:
+	{
+		mpz_t mantissa;
+		mpz_init(mantissa);
+		mpfr_exp_t exponent = SignedVarint();
+		ReadMpz(mantissa);
+		mpfr_set_z_2exp(x, mantissa, exponent, MPFR_RNDN);
+		mpz_clear(mantissa);
+		break;
+	}
+	case 1:
+		mpfr_set_zero(x, sign);
+		break;
+	case 2:
+		mpfr_set_inf(x, sign);
+		break;
+	default:
+		mpfr_set_nan(x);
+		break;
+	}
+}
+#endif
+
+#if REALTYPE == REAL_VFPU
+void Deserialiser::Read(Real & value)
+{
+	float f;
+	Read(f);
+	value = Real(f);
+}
+#elif REALTYPE == REAL_RATIONAL
+void Deserialiser::Read(Real & value)
+{
+	int64_t p = SignedVarint();
+	int64_t q = SignedVarint();
+	if (q == 0)
+		Fatal("Rational has a zero denominator");
+	value = Real(p, q);
+}
+#elif REALTYPE == REAL_RATIONAL_ARBINT
+void Deserialiser::ReadInteger(Arbint & value)
+{
+	uint64_t header = Varint();
+	uint64_t count = header >> 1;
+	if (count > Remaining() / sizeof(Arbint::digit_t))
+		Fatal("Integer of %lu digits is longer than the remaining %lu bytes", (unsigned long)count, (unsigned long)Remaining());
+	vector<Arbint::digit_t> digits(count);
+	for (uint64_t i = 0; i < count; ++i)
+	{
+		uint8_t bytes[sizeof(Arbint::digit_t)];
+		Bytes(bytes, sizeof(bytes));
+		LittleEndian(bytes, sizeof(bytes));
+		memcpy(&digits[i], bytes, sizeof(bytes));
+	}
+	value = Arbint(digits, (header & 1) != 0);
+}
+
+void Deserialiser::ReadInteger(Gmpint & value)
+{
+	ReadMpz(value.Op());
+}
+
+void Deserialiser::Read(Real & value)
+{
+	ARBINT p(0L);
+	ARBINT q(1L);
+	ReadInteger(p);
+	ReadInteger(q);
+	value = Real(p, q);
+}
+#elif REALTYPE == REAL_IRRAM
+void Deserialiser::Read(Real & value)
+{
+	double d;
+	Read(d);
+	value = Real(d);
+}
+#elif REALTYPE == REAL_PARANOIDNUMBER
+void Deserialiser::ReadParanoid(ParanoidNumber & value)
+{
+	ParanoidNumber::digit_t digit;
+	Read(digit);
+	value = ParanoidNumber(digit);
+	for (unsigned i = 0; i < 4; ++i)
+	{
+		uint64_t count = Varint();
+		for (uint64_t j = 0; j < count; ++j)
+		{
+			ParanoidNumber next;
+			ReadParanoid(next);
+			switch (i)
+			{
+			case 0: value *= next; break;
+			case 1: value /= next; break;
+			case 2: value += next; break;
+			default: value -= next; break;
+			}
+		}
+	}
+}
+
+void Deserialiser::Read(Real & value)
+{
+	ReadParanoid(value);
+}
+#endif
+
+#if REALTYPE == REAL_GMPRAT
+/** Read what Serialiser::WriteBezierCoords wrote **/
+void Deserialiser::ReadBezierCoords(BReal * const * coords, unsigned count)
+{
+	mpz_t denominator;
+	mpz_init(denominator);
+	ReadMpz(denominator);
+	if (mpz_sgn(denominator) < 0)
+		Fatal("Bezier coordinates have a negative denominator");
+	for (unsigned i = 0; i < count; ++i)
+	{
+		if (mpz_sgn(denominator) == 0)
+		{
+			Read(*coords[i]);
+			continue;
+		}
+		mpq_ptr q = coords[i]->Op();
+		ReadMpz(mpq_numref(q));
+		mpz_set(mpq_denref(q), denominator);
+		mpq_canonicalize(q);
+	}
+	mpz_clear(denominator);
+}
+#endif
+
+void Deserialiser::Read(Bezier & bezier)
+{
+	BReal * coords[] = {&bezier.x0, &bezier.y0, &bezier.x1, &bezier.y1, &bezier.x2, &bezier.y2, &bezier.x3, &bezier.y3};
+	uint8_t bytes[2];
+	Bytes(bytes, sizeof(bytes));
+	uint16_t tags = bytes[0] | (bytes[1] << 8);
+#if REALTYPE == REAL_GMPRAT
+	BReal * explicit_coords[8];
+	unsigned count = 0;
+#endif
+	for (unsigned i = 0; i < 8; ++i)
+	{
+		switch ((tags >> (2*i)) & 3)
+		{
+		case BEZIER_ZERO:
+			*coords[i] = BReal(0);
+			break;
+		case BEZIER_ONE:
+			*coords[i] = BReal(1);
+			break;
+		case BEZIER_REPEAT:
+			if (i < 2)
+				Fatal("First Bezier control point can't repeat the previous one");
+			*coords[i] = *coords[i-2];
+			break;
+		default:
+#if REALTYPE == REAL_GMPRAT
+			explicit_coords[count++] = coords[i];
+#else
+			Read(*coords[i]);
+#endif
+			break;
+		}
+	}
+#if REALTYPE == REAL_GMPRAT
+	if (count > 0)
+		ReadBezierCoords(explicit_coords, count);
+	// (Repeats of explicit coordinates were copied before those were read)
+	for (unsigned i = 2; i < 8; ++i)
+	{
+		if (((tags >> (2*i)) & 3) == BEZIER_REPEAT)
+			*coords[i] = *coords[i-2];
+	}
+#endif
+	bezier.type = Bezier::UNKNOWN;
+}
+
+}
@@ -0,0 +1,138 @@
+/**
+ * @file serialiser.h
+ * @brief Portable, variable length encoding of Reals (and the things made of them) for saving documents
+ */
+
+#ifndef _SERIALISER_H
+#define _SERIALISER_H
+
+#include "common.h"
+#include "real.h"
+#include "rect.h"
+#include "bezier.h"
+#include "gmprat.h"
+
+#if REALTYPE == REAL_MPFRCPP || (defined(TRANSFORM_BEZIERS_TO_PATH) && PATHREAL == REAL_MPFRCPP)
+	#define SERIALISE_MPREAL
+	#include <mpreal.h>
+#endif
+
+namespace IPDF
+{
+	/**
+	 * Encoding (the same for every platform):
+	 *  - Unsigned integers are LEB128 varints; signed integers are zigzag encoded first
+	 *  - float, double and long double are their raw little endian bytes
+	 *  - Big integers are a varint (number of 64 bit limbs << 1 | sign) followed by the limbs, least significant first;
+	 *    the last (most significant) limb is a varint
+	 *  - Rationals are a numerator and denominator; mpfr numbers are their precision, exponent and mantissa
+	 *  - Beziers start with 2 bits per coordinate saying whether it is 0, 1, the same as the previous control point, or follows;
+	 *    with GMP rationals, those that follow share a denominator where that is smaller (see WriteBezierCoords)
+	 */
+	class Serialiser
+	{
+		public:
+			Serialiser(FILE * file);
+			virtual ~Serialiser() {Flush();}
+
+			void Bytes(const void * data, size_t size);
+			void Varint(uint64_t value);
+			void SignedVarint(int64_t value);
+
+			void Write(float value);
+			void Write(double value);
+			void Write(long double value);
+			void Write(const Gmprat & value);
+			#ifdef SERIALISE_MPREAL
+			void Write(const mpfr::mpreal & value);
+			#endif
+			#if REALTYPE == REAL_VFPU || REALTYPE == REAL_RATIONAL || REALTYPE == REAL_RATIONAL_ARBINT || REALTYPE == REAL_IRRAM || REALTYPE == REAL_PARANOIDNUMBER
+			void Write(const Real & value);
+			#endif
+
+			template <class T> void Write(const TRect<T> & rect) {Write(rect.x); Write(rect.y); Write(rect.w); Write(rect.h);}
+			void Write(const Vec2 & vec) {Write(vec.x); Write(vec.y);}
+			void Write(const Bezier & bezier);
+
+			/** Write out anything that is buffered **/
+			void Flush();
+			/** Total bytes written so far **/
+			uint64_t Size() const {return m_size;}
+
+		private:
+			#if REALTYPE == REAL_RATIONAL_ARBINT
+			void WriteInteger(const Arbint & value);
+			void WriteInteger(const Gmpint & value);
+			#endif
+			#if REALTYPE == REAL_PARANOIDNUMBER
+			void WriteParanoid(const ParanoidNumber & value);
+			#endif
+			#if REALTYPE == REAL_GMPRAT
+			void WriteBezierCoords(const BReal * const * coords, unsigned count);
+			#endif
+			void WriteMpz(mpz_srcptr value);
+
+			FILE * m_file;
+			uint8_t m_buffer[BUFSIZ];
+			size_t m_used;
+			uint64_t m_size;
+			std::vector<uint64_t> m_limbs; // scratch for one big integer
+	};
+
+	/**
+	 * Reads what a Serialiser wrote; either from a FILE (reading at most a given number of bytes) or from memory
+	 * Reading past the end is Fatal
+	 */
+	class Deserialiser
+	{
+		public:
+			Deserialiser(FILE * file, uint64_t size);
+			Deserialiser(const uint8_t * data, uint64_t size);
+			virtual ~Deserialiser() {}
+
+			void Bytes(void * data, size_t size);
+			uint64_t Varint();
+			int64_t SignedVarint();
+
+			void Read(float & value);
+			void Read(double & value);
+			void Read(long double & value);
+			void Read(Gmprat & value);
+			#ifdef SERIALISE_MPREAL
+			void Read(mpfr::mpreal & value);
+			#endif
+			#if REALTYPE == REAL_VFPU || REALTYPE == REAL_RATIONAL || REALTYPE == REAL_RATIONAL_ARBINT || REALTYPE == REAL_IRRAM || REALTYPE == REAL_PARANOIDNUMBER
+			void Read(Real & value);
+			#endif
+
+			template <class T> void Read(TRect<T> & rect) {Read(rect.x); Read(rect.y); Read(rect.w); Read(rect.h);}
+			void Read(Vec2 & vec) {Read(vec.x); Read(vec.y);}
+			void Read(Bezier & bezier);
+
+			/** Bytes that haven't been read yet **/
+			uint64_t Remaining() const {return m_remaining + (m_end - m_pos);}
+
+		private:
+			#if REALTYPE == REAL_RATIONAL_ARBINT
+			void ReadInteger(Arbint & value);
+			void ReadInteger(Gmpint & value);
+			#endif
+			#if REALTYPE == REAL_PARANOIDNUMBER
+			void ReadParanoid(ParanoidNumber & value);
+			#endif
+			#if REALTYPE == REAL_GMPRAT
+			void ReadBezierCoords(BReal * const * coords, unsigned count);
+			#endif
+			void ReadMpz(mpz_ptr value);
+			void Refill();
+
+			FILE * m_file;
+			uint8_t m_buffer[BUFSIZ];
+			const uint8_t * m_pos;
+			const uint8_t * m_end;
+			uint64_t m_remaining; // still in m_file
+			std::vector<uint64_t> m_limbs;
+	};
+}
+
+#endif //_SERIALISER_H
@@ -0,0 +1,329 @@
+/**
+ * @file svgreader.cpp
+ * @brief Implements SVGReader
+ * Entities, whitespace in attributes and line endings are treated exactly as pugixml does with parse_default,
+ * so that streaming an SVG gives the same document as parsing it into a DOM
+ */
+
+#include "svgreader.h"
+
+using namespace std;
+
+namespace IPDF
+{
+
+static inline bool IsSpace(int c)
+{
+	return (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+}
+
+static void AppendUTF8(string & out, unsigned code)
+{
+	if (code < 0x80)
+	{
+		out += (char)code;
+	}
+	else if (code < 0x800)
+	{
+		out += (char)(0xC0 | (code >> 6));
+		out += (char)(0x80 | (code & 0x3F));
+	}
+	else if (code < 0x10000)
+	{
+		out += (char)(0xE0 | (code >> 12));
+		out += (char)(0x80 | ((code >> 6) & 0x3F));
+		out += (char)(0x80 | (code & 0x3F));
+	}
+	else
+	{
+		out += (char)(0xF0 | (code >> 18));
+		out += (char)(0x80 | ((code >> 12) & 0x3F));
+		out += (char)(0x80 | ((code >> 6) & 0x3F));
+		out += (char)(0x80 | (code & 0x3F));
+	}
+}
+
+/**
+ * Decode the entity at raw[i] (which is '&') and advance i past it
+ * Returns false (leaving everything alone) if it isn't a valid entity
+ */
+static bool DecodeEntity(const string & raw, size_t & i, string & out)
+{
+	size_t j = i + 1;
+	if (j < raw.size() && raw[j] == '#')
+	{
+		bool hex = (j + 1 < raw.size() && raw[j+1] == 'x');
+		j += (hex) ? 2 : 1;
+		size_t first_digit = j;
+		unsigned code = 0;
+		for (; j < raw.size() && raw[j] != ';'; ++j)
+		{
+			char c = raw[j];
+			if (c >= '0' && c <= '9')
+				code = ((hex) ? 16 : 10) * code + (c - '0');
+			else if (hex && (c|' ') >= 'a' && (c|' ') <= 'f')
+				code = 16 * code + ((c|' ') - 'a' + 10);
+			else
+				return false;
+		}
+		if (j == raw.size() || j == first_digit)
+			return false;
+		AppendUTF8(out, code);
+		i = j + 1;
+		return true;
+	}
+
+	static const char * names[] = {"amp;", "apos;", "gt;", "lt;", "quot;"};
+	static const char values[] = {'&', '\'', '>', '<', '"'};
+	for (unsigned n = 0; n < sizeof(values); ++n)
+	{
+		size_t length = strlen(names[n]);
+		if (raw.compare(j, length, names[n]) == 0)
+		{
+			out += values[n];
+			i = j + length;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Attributes have each whitespace character (or CRLF) replaced with a space
+ * Text has CRLF and CR replaced with LF
+ */
+static void Decode(const string & raw, string & out, bool attribute, bool entities)
+{
+	out.clear();
+	out.reserve(raw.size());
+	for (size_t i = 0; i < raw.size();)
+	{
+		char c = raw[i];
+		if (c == '\r')
+		{
+			out += (attribute) ? ' ' : '\n';
+			i += (i + 1 < raw.size() && raw[i+1] == '\n') ? 2 : 1;
+		}
+		else if (attribute && (c == '\n' || c == '\t'))
+		{
+			out += ' ';
+			++i;
+		}
+		else if (!entities || c != '&' || !DecodeEntity(raw, i, out))
+		{
+			out += c;
+			++i;
+		}
+	}
+}
+
+SVGReader::SVGReader(FILE * file) : m_file(file), m_input(), m_pos(m_buffer), m_end(m_buffer), m_element(), m_text(), m_raw(), m_pending_end(false), m_failed(false)
+{
+	// Skip a UTF-8 byte order mark
+	if (Refill() && m_end - m_pos >= 3 && memcmp(m_pos, "\xEF\xBB\xBF", 3) == 0)
+		m_pos += 3;
+}
+
+SVGReader::SVGReader(const string & input) : m_file(NULL), m_input(input), m_pos(NULL), m_end(NULL), m_element(), m_text(), m_raw(), m_pending_end(false), m_failed(false)
+{
+	m_pos = m_input.data();
+	m_end = m_pos + m_input.size();
+	if (m_end - m_pos >= 3 && memcmp(m_pos, "\xEF\xBB\xBF", 3) == 0)
+		m_pos += 3;
+}
+
+bool SVGReader::Refill()
+{
+	if (m_file == NULL)
+		return false;
+	size_t n = fread(m_buffer, 1, sizeof(m_buffer), m_file);
+	if (n == 0)
+		return false;
+	m_pos = m_buffer;
+	m_end = m_buffer + n;
+	return true;
+}
+
+SVGReader::Event SVGReader::Fail(const char * reason)
+{
+	Error("Couldn't parse SVG - %s", reason);
+	m_failed = true;
+	return DONE;
+}
+
+void SVGReader::SkipSpace()
+{
+	while (IsSpace(Peek()))
+		++m_pos;
+}
+
+/**
+ * Skip past the next occurence of terminator, optionally keeping what was skipped (not including the terminator)
+ * Returns false at the end of the input
+ */
+bool SVGReader::SkipPast(const char * terminator, string * skipped)
+{
+	size_t length = strlen(terminator);
+	string window;
+	string & seen = (skipped != NULL) ? *skipped : window;
+	seen.clear();
+	for (int c = Get(); c != EOF; c = Get())
+	{
+		seen += (char)c;
+		if (seen.size() >= length && seen.compare(seen.size() - length, length, terminator) == 0)
+		{
+			seen.resize(seen.size() - length);
+			return true;
+		}
+		if (skipped == NULL && seen.size() > length)
+			seen.erase(0, 1);
+	}
+	return false;
+}
+
+bool SVGReader::ReadName(string & name)
+{
+	name.clear();
+	for (int c = Peek(); c != EOF && !IsSpace(c) && strchr("=/><\"'", c) == NULL; c = Peek())
+	{
+		name += (char)c;
+		++m_pos;
+	}
+	return !name.empty();
+}
+
+SVGReader::Event SVGReader::ReadStart()
+{
+	m_element.attributes.clear();
+	if (!ReadName(m_element.name))
+		return Fail("Expected an element name after '<'");
+	while (true)
+	{
+		SkipSpace();
+		int c = Peek();
+		if (c == '>')
+		{
+			++m_pos;
+			return START;
+		}
+		if (c == '/')
+		{
+			++m_pos;
+			if (Get() != '>')
+				return Fail("Expected '>' after '/'");
+			m_pending_end = true;
+			return START;
+		}
+		string key;
+		if (!ReadName(key))
+			return Fail("Expected an attribute name");
+		SkipSpace();
+		if (Get() != '=')
+			return Fail("Expected '=' after attribute name");
+		SkipSpace();
+		int quote = Get();
+		if (quote != '"' && quote != '\'')
+			return Fail("Expected a quoted attribute value");
+		m_raw.clear();
+		for (c = Get(); c != quote; c = Get())
+		{
+			if (c == EOF)
+				return Fail("Unterminated attribute value");
+			m_raw += (char)c;
+		}
+		m_element.attributes.push_back(pair<string, string>(key, ""));
+		Decode(m_raw, m_element.attributes.back().second, true, true);
+	}
+}
+
+SVGReader::Event SVGReader::Next()
+{
+	if (m_pending_end)
+	{
+		m_pending_end = false;
+		m_element.attributes.clear();
+		return END;
+	}
+	while (!m_failed)
+	{
+		int c = Peek();
+		if (c == EOF)
+			return DONE;
+		if (c != '<')
+		{
+			bool space = true;
+			m_raw.clear();
+			for (; c != EOF && c != '<'; c = Peek())
+			{
+				space = space && IsSpace(c);
+				m_raw += (char)c;
+				++m_pos;
+			}
+			if (space)
+				continue;
+			Decode(m_raw, m_text, false, true);
+			return TEXT;
+		}
+
+		++m_pos;
+		c = Get();
+		if (c == '/')
+		{
+			m_element.attributes.clear();
+			if (!ReadName(m_element.name))
+				return Fail("Expected an element name after \"</\"");
+			SkipSpace();
+			if (Get() != '>')
+				return Fail("Expected '>' after closing element name");
+			return END;
+		}
+		else if (c == '?')
+		{
+			if (!SkipPast("?>"))
+				return Fail("Unterminated processing instruction");
+		}
+		else if (c == '!')
+		{
+			c = Get();
+			if (c == '-')
+			{
+				if (Get() != '-' || !SkipPast("-->"))
+					return Fail("Bad comment");
+			}
+			else if (c == '[')
+			{
+				for (const char * s = "CDATA["; *s != '\0'; ++s)
+				{
+					if (Get() != *s)
+						return Fail("Bad CDATA section");
+				}
+				if (!SkipPast("]]>", &m_raw))
+					return Fail("Unterminated CDATA section");
+				Decode(m_raw, m_text, false, false);
+				return TEXT;
+			}
+			else
+			{
+				// DOCTYPE (possibly with an internal subset in [])
+				int depth = 0;
+				for (; c != EOF && (c != '>' || depth > 0); c = Get())
+				{
+					if (c == '[') ++depth;
+					else if (c == ']') --depth;
+				}
+				if (c == EOF)
+					return Fail("Unterminated DOCTYPE");
+			}
+		}
+		else
+		{
+			if (c == EOF)
+				return Fail("Unexpected end of input after '<'");
+			--m_pos; // Get only refills before returning a character, so c is still in the buffer
+			return ReadStart();
+		}
+	}
+	return DONE;
+}
+
+}
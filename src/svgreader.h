@@ -0,0 +1,94 @@
+/**
+ * @file svgreader.h
+ * @brief Reads SVG (XML) one element at a time, without building a DOM
+ */
+
+#ifndef _SVGREADER_H
+#define _SVGREADER_H
+
+#include "common.h"
+
+namespace IPDF
+{
+	/** An element's name and attributes (with entities and whitespace already handled the way pugixml does) **/
+	struct SVGElement
+	{
+		std::string name;
+		std::vector<std::pair<std::string, std::string> > attributes;
+
+		/** The first attribute called key, or NULL **/
+		const std::string * Attribute(const char * key) const
+		{
+			for (unsigned i = 0; i < attributes.size(); ++i)
+			{
+				if (attributes[i].first == key)
+					return &attributes[i].second;
+			}
+			return NULL;
+		}
+		bool Has(const char * key) const {return Attribute(key) != NULL;}
+		const char * String(const char * key) const {const std::string * a = Attribute(key); return (a != NULL) ? a->c_str() : "";}
+		float Float(const char * key) const {const std::string * a = Attribute(key); return (a != NULL) ? (float)strtod(a->c_str(), NULL) : 0;}
+	};
+
+	/**
+	 * Pull parser for XML
+	 * Only the current element (or piece of text) and a fixed size buffer are kept in memory
+	 * Comments, processing instructions and DOCTYPEs are skipped; text that is only whitespace is dropped
+	 * Input must be UTF-8
+	 */
+	class SVGReader
+	{
+		public:
+			typedef enum {START, END, TEXT, DONE} Event;
+
+			SVGReader(FILE * file);
+			SVGReader(const std::string & input);
+			virtual ~SVGReader() {}
+
+			/** Advance to the next event; a self closing element gives START then END **/
+			Event Next();
+
+			/** The element from the last START or END (only the name is set for END) **/
+			const SVGElement & Element() const {return m_element;}
+			/** The text (or CDATA) from the last TEXT **/
+			const std::string & Text() const {return m_text;}
+			/** Set if the input wasn't well formed; Next returns DONE after an error **/
+			bool Failed() const {return m_failed;}
+
+		private:
+			inline int Peek()
+			{
+				if (m_pos == m_end && !Refill())
+					return EOF;
+				return (unsigned char)(*m_pos);
+			}
+			inline int Get()
+			{
+				int c = Peek();
+				if (c != EOF)
+					++m_pos;
+				return c;
+			}
+			bool Refill();
+			void SkipSpace();
+			bool SkipPast(const char * terminator, std::string * skipped = NULL);
+			bool ReadName(std::string & name);
+			Event ReadStart();
+			Event Fail(const char * reason);
+
+			FILE * m_file;
+			std::string m_input; // when not reading from a file
+			char m_buffer[BUFSIZ];
+			const char * m_pos;
+			const char * m_end;
+
+			SVGElement m_element;
+			std::string m_text;
+			std::string m_raw; // scratch
+			bool m_pending_end; // from a self closing element
+			bool m_failed;
+	};
+}
+
+#endif //_SVGREADER_H
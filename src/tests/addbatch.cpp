@@ -0,0 +1,66 @@
+/**
+ * Check that Document::AddBatch gives the same objects as Document::Add, and compare how long they take
+ * Build with QUADTREE=enabled to check adding to a quadtree node as well
+ */
+#include "document.h"
+#include <ctime>
+
+using namespace std;
+using namespace IPDF;
+
+unsigned test_objects = 100000;
+
+int main(int argc, char ** argv)
+{
+	Debug("TEST STARTING %s", argv[0]);
+	srand(time(NULL));
+	if (argc > 1)
+		test_objects = strtoul(argv[1], NULL, 10);
+
+	Document one("", "");
+	Document batch("", "");
+	vector<ObjectType> types;
+	vector<Rect> bounds;
+	vector<unsigned> data_indices;
+	for (unsigned i = 0; i < test_objects; ++i)
+	{
+		if (i % 3 == 0)
+		{
+			types.push_back((ObjectType)(rand() % 2));
+			bounds.push_back(Rect(Random(), Random(), Random(), Random()));
+			data_indices.push_back(0);
+			continue;
+		}
+		Bezier bezier(Random(), Random(), Random(), Random(), Random(), Random(), Random(), Random());
+		Rect b = bezier.SolveBounds();
+		one.AddBezierData(bezier.ToRelative(b));
+		types.push_back(BEZIER);
+		bounds.push_back(b);
+		data_indices.push_back(batch.AddBezierData(bezier.ToRelative(b)));
+	}
+#ifndef QUADTREE_DISABLED
+	one.SetQuadtreeInsertNode(one.GetQuadTree().root_id);
+	batch.SetQuadtreeInsertNode(batch.GetQuadTree().root_id);
+#endif
+
+	clock_t start = clock();
+	for (unsigned i = 0; i < test_objects; ++i)
+		one.Add(types[i], bounds[i], data_indices[i]);
+	clock_t added = clock();
+	unsigned first = batch.AddBatch(types.data(), bounds.data(), data_indices.data(), test_objects);
+	clock_t batched = clock();
+
+	if (first != 0 || one != batch)
+		Fatal("TEST FAILED; AddBatch gave %u objects starting at %u, Add gave %u", batch.ObjectCount(), first, one.ObjectCount());
+	for (unsigned i = 0; i < batch.ObjectCount(); ++i)
+	{
+		if (one.GetObjects().types[i] != batch.GetObjects().types[i])
+			Fatal("TEST FAILED; object %u has type %d, not %d", i, batch.GetObjects().types[i], one.GetObjects().types[i]);
+	}
+#ifndef QUADTREE_DISABLED
+	Debug("Quadtree nodes (including overlays): %u with Add, %u with AddBatch", one.GetQuadTree().nodes.size(), batch.GetQuadTree().nodes.size());
+#endif
+	Debug("%u objects; Add took %li clocks, AddBatch took %li clocks", test_objects, (long)(added - start), (long)(batched - added));
+	Debug("TEST SUCCEEDED");
+	return 0;
+}
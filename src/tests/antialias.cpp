@@ -0,0 +1,106 @@
+/**
+ * Check that anti-aliasing on the CPU covers pixels by the exact area of a polygon, and is the same in tiles
+ */
+#include "view.h"
+#include <ctime>
+
+using namespace std;
+using namespace IPDF;
+
+unsigned test_objects = 2000;
+
+/** To get at the polygon filler **/
+struct Coverage : public ObjectRenderer
+{
+	using ObjectRenderer::FillPolygonAAOnCPU;
+};
+
+/** Fraction of a pixel drawn black on white **/
+double Covered(const vector<uint8_t> & pixels, int w, int x, int y)
+{
+	return (255 - pixels[4*(x + y*w)]) / 255.0;
+}
+
+void AddPolygon(vector<ObjectRenderer::PixelEdge> & edges, const double (*points)[2], unsigned count)
+{
+	for (unsigned i = 0; i < count; ++i)
+	{
+		const double * a = points[i];
+		const double * b = points[(i+1) % count];
+		edges.push_back(ObjectRenderer::PixelEdge{a[0], a[1], b[0], b[1]});
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	Debug("TEST STARTING %s", argv[0]);
+	srand(time(NULL));
+	if (argc > 1)
+		test_objects = strtoul(argv[1], NULL, 10);
+
+	// Edges between pixels; a rectangle, and a triangle hanging off the left
+	const int w = 40, h = 30;
+	vector<uint8_t> pixels(w*h*4, 255);
+	ObjectRenderer::CPURenderTarget target(pixels.data(), w, h);
+	double rect[][2] = {{10.25, 5.5}, {20.75, 5.5}, {20.75, 15.5}, {10.25, 15.5}};
+	double triangle[][2] = {{-6.5, 18.2}, {33.7, 21.9}, {9.1, 28.6}};
+	vector<ObjectRenderer::PixelEdge> edges;
+	AddPolygon(edges, rect, 4);
+	AddPolygon(edges, triangle, 3);
+	Coverage::FillPolygonAAOnCPU(edges, target, Colour(0,0,0,255));
+
+	struct {int x; int y; double covered;} expected[] = {{15,10,1}, {10,10,0.75}, {20,10,0.75}, {15,5,0.5}, {15,15,0.5}, {10,5,0.375}, {20,15,0.375}, {9,10,0}, {21,10,0}};
+	for (unsigned i = 0; i < sizeof(expected)/sizeof(expected[0]); ++i)
+	{
+		double covered = Covered(pixels, w, expected[i].x, expected[i].y);
+		if (fabs(covered - expected[i].covered) > 1/255.0)
+			Fatal("TEST FAILED; pixel (%d, %d) is %f covered, not %f", expected[i].x, expected[i].y, covered, expected[i].covered);
+	}
+	// Only the part of the triangle in the target (x >= 0) is drawn
+	double area = 0;
+	for (int y = 17; y < h; ++y)
+	{
+		for (int x = 0; x < w; ++x)
+			area += Covered(pixels, w, x, y);
+	}
+	// The triangle's area, less the corner left of x = 0 (between where its two left sides cross it)
+	double y_top = 18.2 + 6.5*(21.9 - 18.2)/(33.7 + 6.5);
+	double y_bottom = 18.2 + 6.5*(28.6 - 18.2)/(9.1 + 6.5);
+	double in_target = 0.5*fabs((33.7 + 6.5)*(28.6 - 18.2) - (9.1 + 6.5)*(21.9 - 18.2)) - 0.5*6.5*(y_bottom - y_top);
+	if (fabs(area - in_target) > 0.01*in_target)
+		Fatal("TEST FAILED; the triangle covers %f pixels, not %f", area, in_target);
+
+	// Tiles on several threads come out the same as one thread
+	Document doc("", "");
+#ifndef QUADTREE_DISABLED
+	doc.SetQuadtreeInsertNode(doc.GetQuadTree().root_id);
+#endif
+	for (unsigned i = 0; i < test_objects; ++i)
+	{
+		Rect bounds(Random()*Real(1.2) - Real(0.1), Random()*Real(1.2) - Real(0.1), Random()/Real(10), Random()/Real(10));
+		doc.Add(BEZIER, bounds, doc.AddBezierData(Bezier(Random(), Random(), Random(), Random(), Random(), Random(), Random(), Random())));
+	}
+	const int view_w = 1000, view_h = 700;
+	vector<uint8_t> aliased(view_w*view_h*4), serial(view_w*view_h*4), tiled(view_w*view_h*4);
+	View view(doc);
+	view.SetTransformThreads(1);
+	view.RenderToPixels(view_w, view_h, aliased.data()); // (quadtree nodes the view needs are made the first time)
+	clock_t start = clock();
+	view.RenderToPixels(view_w, view_h, aliased.data());
+	clock_t aliased_clocks = clock() - start;
+
+	view.AntiAliasOnCPU(true);
+	start = clock();
+	view.RenderToPixels(view_w, view_h, serial.data());
+	clock_t serial_clocks = clock() - start;
+	view.SetTransformThreads(4);
+	view.RenderToPixels(view_w, view_h, tiled.data());
+	for (unsigned i = 0; i < serial.size(); ++i)
+	{
+		if (serial[i] != tiled[i])
+			Fatal("TEST FAILED; pixel (%u, %u) is %u in tiles, not %u", (i/4) % view_w, (i/4) / view_w, tiled[i], serial[i]);
+	}
+	Debug("%u Beziers; aliased took %li clocks, anti-aliased took %li", test_objects, (long)aliased_clocks, (long)serial_clocks);
+	Debug("TEST SUCCEEDED");
+	return 0;
+}
@@ -0,0 +1,72 @@
+/**
+ * Check that a ChunkVector behaves like a std::vector across page boundaries
+ */
+#include "chunkvector.h"
+#include <ctime>
+
+using namespace std;
+using namespace IPDF;
+
+unsigned test_elements = 50000;
+
+int main(int argc, char ** argv)
+{
+	Debug("TEST STARTING %s", argv[0]);
+	srand(time(NULL));
+	if (argc > 1)
+		test_elements = strtoul(argv[1], NULL, 10);
+
+	ChunkVector<int> chunks;
+	vector<int> reference;
+	for (unsigned i = 0; i < test_elements; ++i)
+	{
+		int r = rand();
+		chunks.push_back(r);
+		reference.push_back(r);
+	}
+	const int * first = &chunks[0];
+	for (unsigned i = 0; i < test_elements; ++i)
+	{
+		// Including elements of itself
+		chunks.push_back(chunks[i]);
+		reference.push_back(reference[i]);
+	}
+	if (test_elements >= ChunkVector<int>::PAGE_SIZE && &chunks[0] != first)
+		Fatal("TEST FAILED; growing moved the first page");
+
+	unsigned sizes[] = {test_elements/3, test_elements + 1, test_elements/2 + 7};
+	for (unsigned i = 0; i < sizeof(sizes)/sizeof(sizes[0]); ++i)
+	{
+		chunks.resize(sizes[i]);
+		reference.resize(sizes[i]);
+	}
+	for (unsigned i = 0; i < 10 && !reference.empty(); ++i)
+	{
+		chunks.pop_back();
+		reference.pop_back();
+	}
+	chunks.Set(0, 42);
+	reference[0] = 42;
+
+	if (chunks.size() != reference.size() || !equal(chunks.begin(), chunks.end(), reference.begin()))
+		Fatal("TEST FAILED; %u elements, not the expected %u", chunks.size(), reference.size());
+	ChunkVector<int> copy(chunks);
+	if (copy.size() != reference.size() || !equal(copy.begin(), copy.end(), reference.begin()))
+		Fatal("TEST FAILED; copy is different");
+
+	size_t total = 0;
+	for (size_t p = 0; p < chunks.PageCount(); ++p)
+	{
+		if (p + 1 < chunks.PageCount() && chunks.PageLength(p) != ChunkVector<int>::PAGE_SIZE)
+			Fatal("TEST FAILED; page %u of %u has %u elements", p, chunks.PageCount(), chunks.PageLength(p));
+		total += chunks.PageLength(p);
+	}
+	if (total != chunks.size())
+		Fatal("TEST FAILED; pages hold %u elements, not %u", total, chunks.size());
+
+	chunks.clear();
+	if (!chunks.empty() || chunks.PageCount() != 0)
+		Fatal("TEST FAILED; clear left elements");
+	Debug("TEST SUCCEEDED");
+	return 0;
+}
@@ -0,0 +1,52 @@
+/**
+ * Check that a View with no Screen renders on the CPU (without SDL or GL), and picks up objects added afterwards
+ */
+#include "view.h"
+
+using namespace std;
+using namespace IPDF;
+
+/** Pixels that have been drawn on (the background is white) **/
+unsigned Drawn(const vector<uint8_t> & pixels)
+{
+	unsigned drawn = 0;
+	for (unsigned i = 0; i < pixels.size(); i += 4)
+		drawn += (pixels[i] != 255);
+	return drawn;
+}
+
+int main(int argc, char ** argv)
+{
+	Debug("TEST STARTING %s", argv[0]);
+	Document doc("", "");
+#ifndef QUADTREE_DISABLED
+	doc.SetQuadtreeInsertNode(doc.GetQuadTree().root_id);
+#endif
+	View view(doc);
+	if (!view.Headless())
+		Fatal("TEST FAILED; the view has a Screen");
+	view.SetGPURendering(true);
+	if (view.UsingGPURendering())
+		Fatal("TEST FAILED; a headless view can't render on the GPU");
+
+	const int w = 64, h = 48;
+	vector<uint8_t> pixels(w*h*4);
+	view.RenderToPixels(w, h, pixels.data());
+	if (Drawn(pixels) != 0)
+		Fatal("TEST FAILED; an empty document drew %u pixels", Drawn(pixels));
+
+	doc.Add(RECT_FILLED, Rect(Real(1)/Real(4), Real(1)/Real(4), Real(1)/Real(2), Real(1)/Real(2)), 0);
+	view.ForceRenderDirty();
+	view.RenderToPixels(w, h, pixels.data());
+	unsigned rect = Drawn(pixels);
+	if (rect < (unsigned)(w*h/4) - w - h || rect > (unsigned)(w*h/4) + w + h)
+		Fatal("TEST FAILED; a rectangle a quarter of the view drew %u of %u pixels", rect, w*h);
+
+	doc.Add(RECT_FILLED, Rect(0, 0, Real(1)/Real(8), Real(1)/Real(8)), 0);
+	view.ForceRenderDirty();
+	view.RenderToPixels(w, h, pixels.data());
+	if (Drawn(pixels) <= rect)
+		Fatal("TEST FAILED; the object added after the first render wasn't drawn");
+	Debug("TEST SUCCEEDED");
+	return 0;
+}
@@ -0,0 +1,80 @@
+/**
+ * Check that the different ways of writing the same SVG path data give the same Beziers
+ * Run with an SVG filename to also time parsing all of its path data
+ */
+#include "document.h"
+#include "svgreader.h"
+#include <ctime>
+
+using namespace std;
+using namespace IPDF;
+
+/** Each line is a group of equivalent paths **/
+const char * equivalent[][4] = {
+	{"M0,0 L10,0 L10,10 Z", "M0 0L10 0 10 10z", "m0,0 l10,0 l0,10 z", "M0 0 H10 V10 Z"},
+	{"M1,2 C3,4 5,6 7,8 C9,10 11,12 13,14", "M1,2 C3,4 5,6 7,8 S11,12 13,14", "M1 2c2 2 4 4 6 6s4 4 6 6", "M1,2,C3,4,5,6,7,8,S11,12,13,14"},
+	{"M0,0 Q5,10 10,0 Q15,-10 20,0", "M0,0 Q5,10 10,0 T20,0", "M0 0q5 10 10 0t10 0", "M0,0 Q5,10 10,0 Q15-10 20,0"},
+	{"M0.5-.5L1e1,2E-1", "M.5,-0.5 L10,0.2", "M+0.5 -5e-1 L10.0 .2", "M 5e-1 , -0.5e0 L 1e+1 , 0.02e1"},
+	{"M0,0 A0,5 0 0 1 10,0", "M0,0 L10,0", "M0 0a0 5 0 0010 0", "M0,0 l10,0"},
+	{"M0,0 L1e69,0", "M0,0 L1000000000000000000000000000000000000000000000000000000000000000000000,0", "M0 0 L10e68 0", "M0,0 L1.0e69,0"},
+	{"M0,0 L10,0", "M0,0 L10,0 \xc3\xa9", "M0 0 L10 0 \xff", "M0,0 L10,0 \xe2\x80\x94 L5,5"} // parsing stops at bytes that aren't ASCII
+};
+
+bool Same(const char * a, const char * b)
+{
+	SVGMatrix identity = {1,0,0,0,1,0};
+	bool closed_a, closed_b;
+	Document doc_a("", "");
+	Document doc_b("", "");
+	doc_a.ParseSVGPathData(a, identity, closed_a);
+	doc_b.ParseSVGPathData(b, identity, closed_b);
+	return (doc_a == doc_b) && closed_a == closed_b && doc_a.ObjectCount() > 0;
+}
+
+int main(int argc, char ** argv)
+{
+	Debug("TEST STARTING %s", argv[0]);
+	for (unsigned i = 0; i < sizeof(equivalent)/sizeof(equivalent[0]); ++i)
+	{
+		for (unsigned j = 1; j < 4; ++j)
+		{
+			if (!Same(equivalent[i][0], equivalent[i][j]))
+				Fatal("TEST FAILED; \"%s\" and \"%s\" are different", equivalent[i][0], equivalent[i][j]);
+		}
+	}
+
+	// A semicircle should be two quarters, ending exactly where asked
+	SVGMatrix identity = {1,0,0,0,1,0};
+	bool closed;
+	Document arc("", "");
+	pair<unsigned, unsigned> range = arc.ParseSVGPathData("M0,0 A10,10 0 0 1 20,0", identity, closed);
+	if (range.second - range.first != 1)
+		Fatal("TEST FAILED; semicircle gave %u Beziers", range.second - range.first + 1);
+	const Rect & bounds = arc.GetObjects().bounds[range.second];
+	if (bounds.x + bounds.w != Real(20))
+		Fatal("TEST FAILED; semicircle ends at %f", Float(bounds.x + bounds.w));
+
+	if (argc > 1)
+	{
+		FILE * file = fopen(argv[1], "rb");
+		if (file == NULL)
+			Fatal("Couldn't open \"%s\" - %s", argv[1], strerror(errno));
+		vector<string> paths;
+		SVGReader reader(file);
+		for (SVGReader::Event e = reader.Next(); e != SVGReader::DONE; e = reader.Next())
+		{
+			if (e == SVGReader::START && reader.Element().name == "path")
+				paths.push_back(reader.Element().String("d"));
+		}
+		fclose(file);
+
+		Document doc("", "");
+		clock_t start = clock();
+		for (unsigned i = 0; i < paths.size(); ++i)
+			doc.ParseSVGPathData(paths[i], identity, closed);
+		clock_t end = clock();
+		Debug("%u paths, %u Beziers in %li clocks", (unsigned)paths.size(), doc.ObjectCount(), (long)(end - start));
+	}
+	Debug("TEST SUCCEEDED");
+	return 0;
+}
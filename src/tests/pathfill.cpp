@@ -0,0 +1,74 @@
+/**
+ * Check that paths are filled on the CPU inside their outlines (holes included), even when the fill is the stroke's colour
+ */
+#include "view.h"
+
+using namespace std;
+using namespace IPDF;
+
+const int w = 100, h = 100;
+
+/** A closed square of line Beziers, clockwise or not **/
+void AddSquare(Document & doc, const Real & x, const Real & y, const Real & size, bool clockwise)
+{
+	Real xs[] = {x, x+size, x+size, x};
+	Real ys[] = {y, y, y+size, y+size};
+	for (int i = 0; i < 4; ++i)
+	{
+		int a = clockwise ? i : (4-i) % 4;
+		int b = clockwise ? (i+1) % 4 : 3-i;
+		doc.AddBezier(Bezier(xs[a], ys[a], xs[a], ys[a], xs[b], ys[b], xs[b], ys[b]));
+	}
+}
+
+Colour Pixel(const vector<uint8_t> & pixels, int x, int y)
+{
+	const uint8_t * p = &pixels[4*(x + y*w)];
+	return Colour(p[0], p[1], p[2], p[3]);
+}
+
+int main(int argc, char ** argv)
+{
+	Debug("TEST STARTING %s", argv[0]);
+	Document doc("", "");
+#ifndef QUADTREE_DISABLED
+	doc.SetQuadtreeInsertNode(doc.GetQuadTree().root_id);
+#endif
+	// A square with a square hole, and a small square filled with the colour the outline is drawn in
+	Colour fill(0,0,255,255), black(0,0,0,1);
+	unsigned start = doc.ObjectCount();
+	AddSquare(doc, Real(1)/Real(5), Real(1)/Real(5), Real(3)/Real(5), true);
+	AddSquare(doc, Real(2)/Real(5), Real(2)/Real(5), Real(1)/Real(5), false);
+	doc.AddPath(start, doc.ObjectCount()-1, fill, black);
+	start = doc.ObjectCount();
+	AddSquare(doc, Real(1)/Real(50), Real(1)/Real(50), Real(1)/Real(10), true);
+	doc.AddPath(start, doc.ObjectCount()-1, black, black);
+
+	View view(doc);
+	view.PerformShading(true);
+	vector<uint8_t> pixels(w*h*4);
+	view.RenderToPixels(w, h, pixels.data());
+
+	int ring[][2] = {{30,30}, {30,70}, {70,30}, {70,70}, {50,25}, {25,50}};
+	for (unsigned i = 0; i < sizeof(ring)/sizeof(ring[0]); ++i)
+	{
+		if (Pixel(pixels, ring[i][0], ring[i][1]) != fill)
+			Fatal("TEST FAILED; pixel (%d, %d) inside the path wasn't filled", ring[i][0], ring[i][1]);
+	}
+	int outside[][2] = {{50,50}, {45,55}, {10,90}, {90,10}, {90,90}, {50,85}};
+	for (unsigned i = 0; i < sizeof(outside)/sizeof(outside[0]); ++i)
+	{
+		if (Pixel(pixels, outside[i][0], outside[i][1]) != Colour(255,255,255,255))
+			Fatal("TEST FAILED; pixel (%d, %d) outside the path (or in its hole) was drawn", outside[i][0], outside[i][1]);
+	}
+	for (int y = 3; y < 12; ++y)
+	{
+		for (int x = 3; x < 12; ++x)
+		{
+			if (Pixel(pixels, x, y) != black)
+				Fatal("TEST FAILED; pixel (%d, %d) of the path filled in the stroke colour wasn't filled", x, y);
+		}
+	}
+	Debug("TEST SUCCEEDED");
+	return 0;
+}
@@ -0,0 +1,102 @@
+/**
+ * Check that Document::EnforceQuadtreeBudget evicts nodes far from the view node (but not those drawn beside it), and that they come back the same
+ * Build with QUADTREE=enabled
+ */
+#include "document.h"
+#include <ctime>
+
+using namespace std;
+using namespace IPDF;
+
+unsigned test_objects = 2000;
+
+#ifndef QUADTREE_DISABLED
+/** Objects of a node, with the Beziers they use **/
+bool SameNode(Document & a, QuadTreeIndex na, Document & b, QuadTreeIndex nb)
+{
+	const Objects & oa = a.GetObjects(na);
+	const Objects & ob = b.GetObjects(nb);
+	if (oa.types.size() != ob.types.size())
+		return false;
+	for (unsigned i = 0; i < oa.types.size(); ++i)
+	{
+		if (oa.types[i] != ob.types[i] || oa.bounds[i] != ob.bounds[i])
+			return false;
+		if (oa.types[i] != BEZIER)
+			continue;
+		Bezier ba = oa.beziers[oa.data_indices[i]];
+		Bezier bb = ob.beziers[ob.data_indices[i]];
+		if (!(ba.x0 == bb.x0 && ba.y0 == bb.y0 && ba.x1 == bb.x1 && ba.y1 == bb.y1 && ba.x2 == bb.x2 && ba.y2 == bb.y2 && ba.x3 == bb.x3 && ba.y3 == bb.y3))
+			return false;
+	}
+	return true;
+}
+#endif //QUADTREE_DISABLED
+
+int main(int argc, char ** argv)
+{
+	Debug("TEST STARTING %s", argv[0]);
+#ifdef QUADTREE_DISABLED
+	Debug("TEST SKIPPED; built without the quadtree (build with QUADTREE=enabled)");
+#else
+	srand(time(NULL));
+	if (argc > 1)
+		test_objects = strtoul(argv[1], NULL, 10);
+
+	Document doc("", "");
+	Document reference("", "");
+	doc.SetQuadtreeInsertNode(doc.GetQuadTree().root_id);
+	reference.SetQuadtreeInsertNode(reference.GetQuadTree().root_id);
+	for (unsigned i = 0; i < test_objects; ++i)
+	{
+		Bezier bezier(Random(), Random(), Random(), Random(), Random(), Random(), Random(), Random());
+		Rect b = bezier.SolveBounds();
+		doc.Add(BEZIER, b, doc.AddBezierData(bezier.ToRelative(b)));
+		reference.Add(BEZIER, b, reference.AddBezierData(bezier.ToRelative(b)));
+	}
+	QuadTreeIndex root = doc.GetQuadTree().root_id;
+	QuadTreeIndex far = reference.GenQuadChild(reference.GetQuadTree().root_id, QTC_BOTTOM_RIGHT);
+
+	// Look into the top left corner, having been to the bottom right first
+	doc.GenQuadChild(root, QTC_BOTTOM_RIGHT);
+	doc.GenQuadChild(doc.GetQuadTree().Child(root, QTC_BOTTOM_RIGHT), QTC_TOP_LEFT);
+	QuadTreeIndex top_left = doc.GenQuadChild(root, QTC_TOP_LEFT);
+	QuadTreeIndex view = doc.GenQuadChild(top_left, QTC_TOP_LEFT);
+	doc.SetQuadtreeViewNode(view);
+	unsigned before = doc.ObjectCount();
+
+	doc.SetQuadtreeBudget(before - 1);
+	if (!doc.EnforceQuadtreeBudget())
+		Fatal("TEST FAILED; nothing was evicted with %u objects and a budget of %u", before, before - 1);
+	if (doc.GetQuadTree().Child(root, QTC_BOTTOM_RIGHT) != QUADTREE_EMPTY)
+		Fatal("TEST FAILED; the bottom right node is still there");
+	if (doc.GetQuadTree().Child(root, QTC_TOP_LEFT) != top_left || doc.GetQuadTree().Child(top_left, QTC_TOP_LEFT) != view)
+		Fatal("TEST FAILED; the view node or its ancestors moved");
+	if (!SameNode(doc, view, reference, reference.GenQuadChild(reference.GenQuadChild(reference.GetQuadTree().root_id, QTC_TOP_LEFT), QTC_TOP_LEFT)))
+		Fatal("TEST FAILED; the view node changed");
+	Debug("%u objects, %u after eviction", before, doc.ObjectCount());
+
+	// Coming back regenerates it, in the place of an evicted node
+	size_t nodes = doc.GetQuadTree().nodes.size();
+	QuadTreeIndex again = doc.GenQuadChild(root, QTC_BOTTOM_RIGHT);
+	if (doc.GetQuadTree().nodes.size() != nodes)
+		Fatal("TEST FAILED; evicted nodes weren't reused");
+	if (!SameNode(doc, again, reference, far))
+		Fatal("TEST FAILED; the regenerated node is different");
+
+	// The neighbours drawn with the view node (right, below and diagonal) stay, however tight the budget
+	doc.GenQuadChild(root, QTC_TOP_RIGHT);
+	doc.GenQuadChild(root, QTC_BOTTOM_LEFT);
+	doc.SetQuadtreeViewNode(top_left);
+	doc.SetQuadtreeBudget(1);
+	doc.EnforceQuadtreeBudget();
+	QuadTreeNodeChildren neighbours[] = {QTC_TOP_RIGHT, QTC_BOTTOM_LEFT, QTC_BOTTOM_RIGHT};
+	for (unsigned i = 0; i < sizeof(neighbours)/sizeof(neighbours[0]); ++i)
+	{
+		if (doc.GetQuadTree().Child(root, neighbours[i]) == QUADTREE_EMPTY)
+			Fatal("TEST FAILED; a neighbour of the view node (child %d of the root) was evicted", neighbours[i]);
+	}
+	Debug("TEST SUCCEEDED");
+#endif
+	return 0;
+}
@@ -0,0 +1,76 @@
+/**
+ * Check that quadtree children generated in the background are the same as those generated by Document::GenQuadChild,
+ * and that clipping them all on several threads with Document::GenQuadChildren gives the same too
+ * Build with QUADTREE=enabled
+ */
+#include "document.h"
+#include <ctime>
+
+using namespace std;
+using namespace IPDF;
+
+unsigned test_objects = 10000;
+
+int main(int argc, char ** argv)
+{
+	Debug("TEST STARTING %s", argv[0]);
+#ifdef QUADTREE_DISABLED
+	Debug("TEST SKIPPED; built without the quadtree (build with QUADTREE=enabled)");
+#else
+	srand(time(NULL));
+	if (argc > 1)
+		test_objects = strtoul(argv[1], NULL, 10);
+
+	Document now("", "");
+	Document later("", "");
+	Document parallel("", "");
+	now.SetClipThreads(1);
+	parallel.SetClipThreads(4);
+	now.SetQuadtreeInsertNode(now.GetQuadTree().root_id);
+	later.SetQuadtreeInsertNode(later.GetQuadTree().root_id);
+	parallel.SetQuadtreeInsertNode(parallel.GetQuadTree().root_id);
+	for (unsigned i = 0; i < test_objects; ++i)
+	{
+		Bezier bezier(Random(), Random(), Random(), Random(), Random(), Random(), Random(), Random());
+		Rect b = bezier.SolveBounds();
+		now.Add(BEZIER, b, now.AddBezierData(bezier.ToRelative(b)));
+		later.Add(BEZIER, b, later.AddBezierData(bezier.ToRelative(b)));
+		parallel.Add(BEZIER, b, parallel.AddBezierData(bezier.ToRelative(b)));
+	}
+
+	QuadTreeNodeChildren children[] = {QTC_TOP_LEFT, QTC_TOP_RIGHT, QTC_BOTTOM_LEFT, QTC_BOTTOM_RIGHT};
+	clock_t start = clock();
+	for (unsigned i = 0; i < 4; ++i)
+		now.GenQuadChild(now.GetQuadTree().root_id, children[i]);
+	clock_t generated = clock();
+	// One at a time, so the children are appended in the same order as GenQuadChild appended them
+	for (unsigned i = 0; i < 4; ++i)
+	{
+		if (later.RequestQuadChild(later.GetQuadTree().root_id, children[i]) != QUADTREE_EMPTY)
+			Fatal("TEST FAILED; child %d existed before it was requested", children[i]);
+		while (later.GetQuadTree().Child(later.GetQuadTree().root_id, children[i]) == QUADTREE_EMPTY)
+			later.MergeQuadChildren();
+	}
+	clock_t merged = clock();
+	parallel.GenQuadChildren(parallel.GetQuadTree().root_id);
+	clock_t clipped = clock();
+
+	if (now != later)
+		Fatal("TEST FAILED; background generation gave %u objects, not %u", later.ObjectCount(), now.ObjectCount());
+	if (now != parallel)
+		Fatal("TEST FAILED; parallel clipping gave %u objects, not %u", parallel.ObjectCount(), now.ObjectCount());
+	for (unsigned i = 0; i < 4; ++i)
+	{
+		const Objects & a = now.GetObjects(now.GetQuadTree().Child(now.GetQuadTree().root_id, children[i]));
+		const Objects & b = later.GetObjects(later.GetQuadTree().Child(later.GetQuadTree().root_id, children[i]));
+		const Objects & c = parallel.GetObjects(parallel.GetQuadTree().Child(parallel.GetQuadTree().root_id, children[i]));
+		if (a.types.size() != b.types.size() || a.beziers.size() != b.beziers.size())
+			Fatal("TEST FAILED; child %d has %u objects (%u Beziers), not %u (%u)", children[i], b.types.size(), b.beziers.size(), a.types.size(), a.beziers.size());
+		if (a.types.size() != c.types.size() || a.beziers.size() != c.beziers.size())
+			Fatal("TEST FAILED; parallel child %d has %u objects (%u Beziers), not %u (%u)", children[i], c.types.size(), c.beziers.size(), a.types.size(), a.beziers.size());
+	}
+	Debug("%u objects; GenQuadChild took %li clocks, RequestQuadChild and MergeQuadChildren took %li clocks, GenQuadChildren took %li clocks", test_objects, (long)(generated - start), (long)(merged - generated), (long)(clipped - merged));
+	Debug("TEST SUCCEEDED");
+#endif
+	return 0;
+}
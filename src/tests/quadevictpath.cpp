@@ -0,0 +1,89 @@
+/**
+ * Check that evicting the quadtree node a path was added in leaves the copy of it in the parent whole, and still renders
+ * Build with QUADTREE=enabled
+ */
+#include "view.h"
+
+using namespace std;
+using namespace IPDF;
+
+const int w = 100, h = 100;
+
+/** A closed square of line Beziers **/
+void AddSquare(Document & doc, const Real & x, const Real & y, const Real & size)
+{
+	Real xs[] = {x, x+size, x+size, x};
+	Real ys[] = {y, y, y+size, y+size};
+	for (int i = 0; i < 4; ++i)
+		doc.AddBezier(Bezier(xs[i], ys[i], xs[i], ys[i], xs[(i+1)%4], ys[(i+1)%4], xs[(i+1)%4], ys[(i+1)%4]));
+}
+
+/** Pixels drawn in colour **/
+unsigned Drawn(Document & doc, const Colour & colour)
+{
+	View view(doc);
+	view.PerformShading(true);
+	vector<uint8_t> pixels(w*h*4);
+	view.RenderToPixels(w, h, pixels.data());
+	unsigned drawn = 0;
+	for (unsigned i = 0; i < pixels.size(); i += 4)
+		drawn += (Colour(pixels[i], pixels[i+1], pixels[i+2], pixels[i+3]) == colour);
+	return drawn;
+}
+
+int main(int argc, char ** argv)
+{
+	Debug("TEST STARTING %s", argv[0]);
+#ifdef QUADTREE_DISABLED
+	Debug("TEST SKIPPED; built without the quadtree (build with QUADTREE=enabled)");
+#else
+	Document doc("", "");
+	QuadTreeIndex root = doc.GetQuadTree().root_id;
+	doc.SetQuadtreeInsertNode(root);
+	// A path that stays, in the root, and one added while zoomed in to the bottom right
+	Colour kept(0,255,0,255), zoomed(0,0,255,255), black(0,0,0,255);
+	unsigned start = doc.GetObjects().types.size();
+	AddSquare(doc, Real(1)/Real(10), Real(1)/Real(10), Real(3)/Real(10));
+	doc.AddPath(start, doc.GetObjects().types.size()-1, kept, black);
+	QuadTreeIndex bottom_right = doc.GenQuadChild(root, QTC_BOTTOM_RIGHT);
+	doc.SetQuadtreeInsertNode(bottom_right);
+	start = doc.GetObjects().types.size();
+	AddSquare(doc, Real(1)/Real(5), Real(1)/Real(5), Real(3)/Real(5));
+	doc.AddPath(start, doc.GetObjects().types.size()-1, zoomed, black);
+	doc.PropagateQuadChanges(bottom_right);
+	doc.SetQuadtreeInsertNode(root);
+	doc.SetQuadtreeViewNode(root);
+	if (Drawn(doc, kept) == 0 || Drawn(doc, zoomed) == 0)
+		Fatal("TEST FAILED; the paths weren't drawn before evicting anything");
+
+	// Look into the top left, far from the bottom right
+	QuadTreeIndex top_left = doc.GenQuadChild(root, QTC_TOP_LEFT);
+	doc.SetQuadtreeViewNode(doc.GenQuadChild(top_left, QTC_TOP_LEFT));
+	doc.SetQuadtreeBudget(1);
+	if (!doc.EnforceQuadtreeBudget() || doc.GetQuadTree().Child(root, QTC_BOTTOM_RIGHT) != QUADTREE_EMPTY)
+		Fatal("TEST FAILED; the bottom right node wasn't evicted");
+	doc.SetQuadtreeBudget(0);
+
+	// The root has its own copy of each path, over its own copies of the Beziers
+	const Objects & objects = doc.GetObjects(root);
+	if (objects.paths.size() != 2)
+		Fatal("TEST FAILED; %u paths in the root after eviction, not 2", (unsigned)objects.paths.size());
+	for (unsigned p = 0; p < objects.paths.size(); ++p)
+	{
+		const Path & path = objects.paths[p];
+		if (path.m_index >= objects.types.size() || objects.types[path.m_index] != PATH || objects.data_indices[path.m_index] != p)
+			Fatal("TEST FAILED; path %u doesn't point at its PATH object", p);
+		for (unsigned i = path.m_start; i <= path.m_end; ++i)
+		{
+			if (i >= objects.types.size() || objects.types[i] != BEZIER || objects.data_indices[i] >= objects.beziers.size())
+				Fatal("TEST FAILED; path %u doesn't point at its Beziers", p);
+		}
+	}
+
+	doc.SetQuadtreeViewNode(root);
+	if (Drawn(doc, kept) == 0 || Drawn(doc, zoomed) == 0)
+		Fatal("TEST FAILED; the paths weren't drawn after evicting the bottom right node");
+	Debug("TEST SUCCEEDED");
+#endif
+	return 0;
+}
@@ -0,0 +1,94 @@
+/**
+ * Check that Document::GenQuadParent merges objects smaller than the LOD size that look alike, and that what is left still covers them
+ * Build with QUADTREE=enabled
+ */
+#include "document.h"
+#include <ctime>
+
+using namespace std;
+using namespace IPDF;
+
+unsigned test_objects = 20000;
+
+#ifndef QUADTREE_DISABLED
+/** Same type, and for Beziers the same kind (so the same colour however they're drawn) **/
+bool LookAlike(const Objects & objects_a, unsigned a, const Objects & objects_b, unsigned b)
+{
+	if (objects_a.types[a] != objects_b.types[b])
+		return false;
+	if (objects_a.types[a] != BEZIER)
+		return true;
+	Bezier ba = objects_a.beziers[objects_a.data_indices[a]];
+	Bezier bb = objects_b.beziers[objects_b.data_indices[b]];
+	return ba.GetType() == bb.GetType();
+}
+#endif //QUADTREE_DISABLED
+
+int main(int argc, char ** argv)
+{
+	Debug("TEST STARTING %s", argv[0]);
+#ifdef QUADTREE_DISABLED
+	Debug("TEST SKIPPED; built without the quadtree (build with QUADTREE=enabled)");
+#else
+	srand(time(NULL));
+	if (argc > 1)
+		test_objects = strtoul(argv[1], NULL, 10);
+
+	Document doc("", "");
+	QuadTreeIndex root = doc.GetQuadTree().root_id;
+	doc.SetQuadtreeInsertNode(root);
+	Real lod = Real(1) / Real(256);
+	for (unsigned i = 0; i < test_objects; ++i)
+	{
+		// Half will be too small to see in the parent, and crowded together (like text)
+		bool tiny = (i % 2 == 0);
+		Real size = tiny ? Random()/Real(512) : Real(1)/Real(64) + Random()/Real(16);
+		Real spread = tiny ? Real(1)/Real(16) : Real(7)/Real(8);
+		Bezier bezier(Random()*size, Random()*size, Random()*size, Random()*size, Random()*size, Random()*size, size, size);
+		Rect b = bezier.SolveBounds();
+		b.x += Random() * spread;
+		b.y += Random() * spread;
+		doc.Add(BEZIER, b, doc.AddBezierData(bezier.ToRelative(b)));
+	}
+	// (Objects with no width or height are dropped from parents anyway)
+	vector<unsigned> children;
+	const Objects & child = doc.GetObjects(root);
+	for (unsigned i = 0; i < child.types.size(); ++i)
+	{
+		Rect b = TransformFromQuadChild(child.bounds[i], QTC_TOP_LEFT);
+		if (b.w != Real(0) && b.h != Real(0))
+			children.push_back(i);
+	}
+
+	doc.SetQuadtreeLOD(0);
+	unsigned all = doc.GetObjects(doc.GenQuadParent(root, QTC_TOP_LEFT)).types.size();
+	doc.SetQuadtreeLOD(lod);
+	const Objects & parent = doc.GetObjects(doc.GenQuadParent(root, QTC_TOP_LEFT));
+	if (all != children.size())
+		Fatal("TEST FAILED; without LOD the parent has %u objects, not %u", all, children.size());
+	if (parent.types.size() >= all)
+		Fatal("TEST FAILED; with LOD the parent has %u objects; nothing was merged", parent.types.size());
+
+	// Everything in the child is either still there, or inside an object like it (in the same colour) standing in for it
+	for (unsigned c = 0; c < children.size(); ++c)
+	{
+		Rect b = TransformFromQuadChild(doc.GetObjects(root).bounds[children[c]], QTC_TOP_LEFT);
+		bool covered = false;
+		for (unsigned p = 0; p < parent.types.size() && !covered; ++p)
+		{
+			const Rect & cover = parent.bounds[p];
+			if (!LookAlike(parent, p, doc.GetObjects(root), children[c]))
+				continue;
+			if (cover == b)
+				covered = true;
+			else if (cover.x <= b.x && cover.y <= b.y && cover.x + cover.w >= b.x + b.w && cover.y + cover.h >= b.y + b.h)
+				covered = (cover.w < Real(2)*lod && cover.h < Real(2)*lod);
+		}
+		if (!covered)
+			Fatal("TEST FAILED; object %u %s isn't in the parent", children[c], b.Str().c_str());
+	}
+	Debug("%u objects in the child; %u in the parent without LOD, %u with", children.size(), all, parent.types.size());
+	Debug("TEST SUCCEEDED");
+#endif
+	return 0;
+}
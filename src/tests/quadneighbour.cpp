@@ -0,0 +1,82 @@
+/**
+ * Check that QuadTree::GetNeighbour finds (or makes) the node at the right place, by walking up from what it returns
+ * Build with QUADTREE=enabled
+ */
+#include "document.h"
+#include <ctime>
+
+using namespace std;
+using namespace IPDF;
+
+unsigned test_steps = 2000;
+
+/** Depth below the root, and position at that depth, from the child types on the way up **/
+void Place(const QuadTree & quadtree, QuadTreeIndex node, unsigned & depth, int64_t & x, int64_t & y)
+{
+	depth = 0;
+	x = y = 0;
+	for (; node != quadtree.root_id; node = quadtree.nodes[node].parent, ++depth)
+	{
+		QuadTreeNodeChildren type = quadtree.nodes[node].child_type;
+		if (type == QTC_TOP_RIGHT || type == QTC_BOTTOM_RIGHT)
+			x |= (int64_t)1 << depth;
+		if (type == QTC_BOTTOM_LEFT || type == QTC_BOTTOM_RIGHT)
+			y |= (int64_t)1 << depth;
+	}
+}
+
+int main(int argc, char ** argv)
+{
+	Debug("TEST STARTING %s", argv[0]);
+#ifdef QUADTREE_DISABLED
+	Debug("TEST SKIPPED; built without the quadtree (build with QUADTREE=enabled)");
+#else
+	srand(time(NULL));
+	if (argc > 1)
+		test_steps = strtoul(argv[1], NULL, 10);
+
+	Document doc("", "");
+	doc.SetQuadtreeInsertNode(doc.GetQuadTree().root_id);
+	for (unsigned i = 0; i < 100; ++i)
+		doc.Add(RECT_OUTLINE, Rect(Random(), Random(), Random()/Real(4), Random()/Real(4)), 0);
+
+	QuadTreeNodeChildren children[] = {QTC_TOP_LEFT, QTC_TOP_RIGHT, QTC_BOTTOM_LEFT, QTC_BOTTOM_RIGHT};
+	QuadTreeIndex node = doc.GetQuadTree().root_id;
+	for (unsigned d = 0; d < 6; ++d)
+		node = doc.GenQuadChild(node, children[rand() % 4]);
+
+	unsigned made = 0, edges = 0;
+	clock_t start = clock();
+	for (unsigned i = 0; i < test_steps; ++i)
+	{
+		int xdir = rand() % 5 - 2;
+		int ydir = rand() % 5 - 2;
+		unsigned depth;
+		int64_t x, y;
+		Place(doc.GetQuadTree(), node, depth, x, y);
+		size_t nodes = doc.GetQuadTree().nodes.size();
+		QuadTreeIndex next = doc.GetQuadTree().GetNeighbour(node, xdir, ydir, &doc);
+		made += doc.GetQuadTree().nodes.size() - nodes;
+
+		int64_t side = (int64_t)1 << depth;
+		if (x + xdir < 0 || y + ydir < 0 || x + xdir >= side || y + ydir >= side)
+		{
+			if (next != QUADTREE_EMPTY)
+				Fatal("TEST FAILED; (%d, %d) from (%li, %li) is off the edge, but gave node %d", xdir, ydir, (long)x, (long)y, next);
+			++edges;
+			continue;
+		}
+		unsigned next_depth;
+		int64_t next_x, next_y;
+		Place(doc.GetQuadTree(), next, next_depth, next_x, next_y);
+		if (next_depth != depth || next_x != x + xdir || next_y != y + ydir)
+			Fatal("TEST FAILED; (%d, %d) from (%li, %li) at depth %u gave (%li, %li) at depth %u", xdir, ydir, (long)x, (long)y, depth, (long)next_x, (long)next_y, next_depth);
+		if (doc.GetQuadTree().GetNeighbour(node, xdir, ydir, NULL) != next)
+			Fatal("TEST FAILED; the node made for (%d, %d) can't be found again", xdir, ydir);
+		node = next;
+	}
+	Debug("%u steps (%u off the edge) made %u nodes in %li clocks", test_steps, edges, made, (long)(clock() - start));
+	Debug("TEST SUCCEEDED");
+#endif
+	return 0;
+}
@@ -0,0 +1,76 @@
+/**
+ * Check that Document::Query and Document::QueryPoint find the same objects as checking every one
+ */
+#include "document.h"
+#include <ctime>
+
+using namespace std;
+using namespace IPDF;
+
+unsigned test_objects = 20000;
+unsigned test_queries = 500;
+
+/** The objects of the document (or root node) that intersect rect, one by one **/
+vector<unsigned> Expected(Document & doc, const Rect & rect)
+{
+	vector<unsigned> expected;
+	for (unsigned i = 0; i < doc.ObjectCount(); ++i)
+	{
+		if (doc.GetObjects().bounds[i].Intersects(rect))
+			expected.push_back(i);
+	}
+	return expected;
+}
+
+vector<unsigned> Found(Document & doc, const Rect & rect, bool point)
+{
+	vector<unsigned> found;
+#ifndef QUADTREE_DISABLED
+	QuadTreeIndex root = doc.GetQuadTree().root_id;
+	if (point)
+		doc.QueryPoint(rect.x, rect.y, found, root);
+	else
+		doc.Query(rect, found, root);
+#else
+	if (point)
+		doc.QueryPoint(rect.x, rect.y, found);
+	else
+		doc.Query(rect, found);
+#endif
+	return found;
+}
+
+int main(int argc, char ** argv)
+{
+	Debug("TEST STARTING %s", argv[0]);
+	srand(time(NULL));
+	if (argc > 1)
+		test_objects = strtoul(argv[1], NULL, 10);
+
+	Document doc("", "");
+#ifndef QUADTREE_DISABLED
+	doc.SetQuadtreeInsertNode(doc.GetQuadTree().root_id);
+#endif
+	for (unsigned i = 0; i < test_objects; ++i)
+		doc.Add(RECT_FILLED, Rect(Random(), Random(), Random()/Real(50), Random()/Real(50)), 0);
+
+	clock_t query_clocks = 0, expected_clocks = 0;
+	for (unsigned i = 0; i < test_queries; ++i)
+	{
+		bool point = (i % 2 == 1);
+		Rect rect(Random(), Random(), point ? Real(0) : Random()/Real(10), point ? Real(0) : Random()/Real(10));
+		if (i == test_queries / 2)
+			doc.TranslateObjects(Real(1)/Real(8), Real(0)); // moving objects has to rebuild the index
+		clock_t start = clock();
+		vector<unsigned> found = Found(doc, rect, point);
+		clock_t queried = clock();
+		vector<unsigned> expected = Expected(doc, rect);
+		query_clocks += queried - start;
+		expected_clocks += clock() - queried;
+		if (found != expected)
+			Fatal("TEST FAILED; %s %s found %u objects, not %u", point ? "point" : "rect", rect.Str().c_str(), found.size(), expected.size());
+	}
+	Debug("%u queries of %u objects; Query took %li clocks, checking every object took %li clocks", test_queries, test_objects, (long)query_clocks, (long)expected_clocks);
+	Debug("TEST SUCCEEDED");
+	return 0;
+}
@@ -0,0 +1,70 @@
+/**
+ * Benchmark saving and loading documents
+ * Prints the bytes and time per object for the REALTYPE it is compiled with
+ * eg: for r in 0 1 2 9; do make DEFS="REALTYPE=$r" tests/savebench && tests/savebench; done
+ */
+#include "document.h"
+#include <unistd.h>
+#include <ctime> // for performance measurements
+
+using namespace std;
+using namespace IPDF;
+
+unsigned test_objects = 10000;
+
+void Cleanup()
+{
+	unlink("savebench.ipdf");
+}
+
+int main(int argc, char ** argv)
+{
+	Debug("TEST STARTING %s", argv[0]);
+	atexit(Cleanup);
+	srand(time(NULL));
+	if (argc > 1)
+		test_objects = strtoul(argv[1], NULL, 10);
+
+	Document doc("", ""); // no font needed
+	for (unsigned id = 0; id < test_objects; ++id)
+	{
+		if (id % 2 == 0)
+		{
+			doc.Add((ObjectType)(rand() % 2), Rect(Random(), Random(), Random(), Random()));
+		}
+		else if (id % 4 == 1)
+		{
+			doc.AddBezier(Bezier(Random(), Random(), Random(), Random(), Random(), Random(), Random(), Random()));
+		}
+		else
+		{
+			// Like most from SVGs, bounded by their end points
+			Real x(Random()), y(Random());
+			doc.AddBezier(Bezier(x, y, x+Random(), y+Random(), x+Real(1)+Random(), y+Real(1)+Random(), x+Real(2)+Random(), y+Real(2)+Random()));
+		}
+	}
+
+	clock_t start = clock();
+	doc.Save("savebench.ipdf");
+	clock_t saved = clock();
+	Document equ("savebench.ipdf", "");
+	clock_t loaded = clock();
+
+	if (doc != equ)
+		Fatal("TEST FAILED; loaded document is not equivelant to saved document");
+
+	FILE * file = fopen("savebench.ipdf", "rb");
+	if (file == NULL)
+		Fatal("Couldn't open savebench.ipdf - %s", strerror(errno));
+	fseek(file, 0, SEEK_END);
+	long bytes = ftell(file);
+	fclose(file);
+
+	unsigned count = doc.ObjectCount();
+	double save_us = 1e6 * (double)(saved - start) / CLOCKS_PER_SEC;
+	double load_us = 1e6 * (double)(loaded - saved) / CLOCKS_PER_SEC;
+	printf("# REALTYPE\tobjects\tbytes\tbytes/object\tsave us/object\tload us/object\n");
+	printf("%s\t%u\t%li\t%f\t%f\t%f\n", g_real_name[REALTYPE], count, bytes, (double)bytes/count, save_us/count, load_us/count);
+	Debug("TEST SUCCEEDED");
+	return 0;
+}
@@ -28,6 +28,16 @@ int main(int argc, char ** argv)
 		equ.DebugDumpObjects();
 		Fatal("TEST FAILED");
 	}
+
+	Document mapped;
+	mapped.LoadMapped("saveload.ipdf");
+	if (doc != mapped || mapped != doc)
+	{
+		Error("Mapped document is not equivelant to saved document!");
+		doc.DebugDumpObjects();
+		mapped.DebugDumpObjects();
+		Fatal("TEST FAILED");
+	}
 	
 	doc.Add((ObjectType)(0), Rect());
 	if (doc == equ)
@@ -0,0 +1,106 @@
+/**
+ * Check that streaming an SVG (Document::LoadSVG) gives the same document as parsing it into a DOM (Document::ParseSVG)
+ * and that importing with several threads gives the same document as importing with one
+ * Run with an SVG filename to check that file, otherwise a generated one is used
+ */
+#include "document.h"
+#include <unistd.h>
+
+using namespace std;
+using namespace IPDF;
+
+void Cleanup()
+{
+	unlink("svgstream.svg");
+}
+
+bool Same(const Document & a_doc, const Document & b_doc)
+{
+	const Objects & a = a_doc.GetObjects();
+	const Objects & b = b_doc.GetObjects();
+	bool same = (a_doc == b_doc) && a.types.size() == b.types.size() && a.paths.size() == b.paths.size();
+	for (unsigned i = 0; same && i < a.types.size(); ++i)
+		same = (a.types[i] == b.types[i]);
+	for (unsigned i = 0; same && i < a.paths.size(); ++i)
+		same = (a.paths[i].m_start == b.paths[i].m_start && a.paths[i].m_end == b.paths[i].m_end && a.paths[i].m_index == b.paths[i].m_index
+			&& a.paths[i].m_fill == b.paths[i].m_fill && a.paths[i].m_stroke == b.paths[i].m_stroke);
+	return same;
+}
+
+/** Nested groups and transforms, plus the XML that a DOM hides (comments, entities, CDATA, CRLFs) **/
+string GenerateSVG(unsigned groups)
+{
+	stringstream s;
+	s << "\xEF\xBB\xBF<?xml version=\"1.0\" encoding=\"UTF-8\"?>\r\n";
+	s << "<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" \"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\" [ <!ENTITY ignored \"x\"> ]>\n";
+	s << "<svg width=\"800\" height=\"600\">\n<!-- a <comment> with a <rect/> in it -->\n";
+	for (unsigned g = 0; g < groups; ++g)
+	{
+		s << "<g transform=\"translate(" << rand()%400 << "," << rand()%300 << ")\r\n scale(" << 1+rand()%3 << ")\">\n";
+		s << "\t<path d=\"M 0,0 C 10,20 30,40 50,&#54;0\r\n L 100,100 Z\" style=\"fill:#ff0000;fill-opacity:0.5\" stroke='#00ff00'/>\n";
+		s << "\t<rect x=\"" << rand()%100 << "\" y=\"" << rand()%100 << "\" width=\"10\" height=\"20\" fill=\"#0000ff\"></rect>\n";
+		s << "\t<circle cx=\"5\" cy=\"5\" r=\"" << 1+rand()%10 << "\"/><line x1=\"0\" y1=\"0\" x2=\"&#x31;0\" y2=\"10\"/>\n";
+		s << "\t<defs><path d=\"M 0,0 L 1,1\"/></defs>\n";
+		s << "\t<svg width=\"100\" height=\"50\"><g><rect x=\"1\" y=\"2\" width=\"3\" height=\"4\"/></g></svg>\n";
+		s << "\t<desc><![CDATA[ <path d=\"M 0,0\"/> ]]> &amp; &lt;</desc>\n";
+		s << "</g>\n";
+	}
+	s << "</svg>\n";
+	return s.str();
+}
+
+int main(int argc, char ** argv)
+{
+	Debug("TEST STARTING %s", argv[0]);
+	srand(time(NULL));
+
+	string filename("svgstream.svg");
+	string font("");
+	if (argc > 1)
+	{
+		filename = argv[1];
+		font = "fonts/DejaVuSansMono.ttf"; // in case there is <text>
+	}
+	else
+	{
+		atexit(Cleanup);
+		FILE * file = fopen(filename.c_str(), "wb");
+		if (file == NULL)
+			Fatal("Couldn't open \"%s\" - %s", filename.c_str(), strerror(errno));
+		string svg = GenerateSVG(100);
+		fwrite(svg.c_str(), 1, svg.size(), file);
+		fclose(file);
+	}
+
+	string contents;
+	FILE * file = fopen(filename.c_str(), "rb");
+	if (file == NULL)
+		Fatal("Couldn't open \"%s\" - %s", filename.c_str(), strerror(errno));
+	char buffer[BUFSIZ];
+	for (size_t n = fread(buffer, 1, sizeof(buffer), file); n > 0; n = fread(buffer, 1, sizeof(buffer), file))
+		contents.append(buffer, n);
+	fclose(file);
+
+	Document dom("", font);
+	clock_t start = clock();
+	dom.ParseSVG(contents);
+	clock_t parsed = clock();
+	Document streamed("", font);
+	streamed.LoadSVG(filename);
+	clock_t loaded = clock();
+
+	Document parallel("", font);
+	parallel.SetImportThreads(4);
+	parallel.LoadSVG(filename);
+	clock_t imported = clock();
+
+	if (!Same(dom, streamed))
+		Fatal("TEST FAILED; streamed %u objects, DOM gave %u", streamed.ObjectCount(), dom.ObjectCount());
+	if (!Same(dom, parallel))
+		Fatal("TEST FAILED; imported %u objects with 4 threads, DOM gave %u", parallel.ObjectCount(), dom.ObjectCount());
+
+	Debug("%u objects; DOM took %li clocks, streaming took %li clocks, 4 threads took %li clocks", dom.ObjectCount(),
+		(long)(parsed - start), (long)(loaded - parsed), (long)(imported - loaded));
+	Debug("TEST SUCCEEDED");
+	return 0;
+}
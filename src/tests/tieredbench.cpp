@@ -0,0 +1,74 @@
+/**
+ * Benchmark reading from a TieredVector against the ChunkVector Objects use without TIERED_OBJECTS
+ * Prints ns/read for the first pass (which joins the doubles into Reals) and for later passes
+ * eg: for r in 6 9; do make DEFS="REALTYPE=$r" tests/tieredbench && tests/tieredbench; done
+ */
+#include "tieredvector.h"
+#include <ctime> // for performance measurements
+
+using namespace std;
+using namespace IPDF;
+
+unsigned test_elements = 100000;
+unsigned test_passes = 10;
+
+/** Reads every element, doing the same (small) work with each **/
+template <class V> unsigned ReadAll(const V & v)
+{
+	Real zero(0);
+	unsigned found = 0;
+	for (size_t i = 0; i < v.size(); ++i)
+	{
+		const Rect & r = v[i];
+		found += (r.x == zero) + (r.w == zero);
+	}
+	return found;
+}
+
+double NsPerRead(clock_t start, clock_t end, unsigned passes)
+{
+	return 1e9 * (double)(end - start) / CLOCKS_PER_SEC / ((double)passes * test_elements);
+}
+
+int main(int argc, char ** argv)
+{
+	Debug("TEST STARTING %s", argv[0]);
+	srand(time(NULL));
+	if (argc > 1)
+		test_elements = strtoul(argv[1], NULL, 10);
+
+	ChunkVector<Rect> baseline;
+	TieredVector<Rect> tiered;
+	for (unsigned i = 0; i < test_elements; ++i)
+	{
+		Rect r(Real(rand() % 1024) / Real(1024), Real(rand() % 1024) / Real(1024), Real(rand() % 16) / Real(64), Real(rand() % 16) / Real(64));
+		baseline.push_back(r);
+		tiered.push_back(r);
+	}
+
+	unsigned expected = ReadAll(baseline);
+	clock_t start = clock();
+	for (unsigned p = 0; p < test_passes; ++p)
+		ReadAll(baseline);
+	clock_t baseline_end = clock();
+	unsigned first = ReadAll(tiered);
+	clock_t first_end = clock();
+	unsigned later = 0;
+	for (unsigned p = 0; p < test_passes; ++p)
+		later = ReadAll(tiered);
+	clock_t later_end = clock();
+
+	if (first != expected || later != expected)
+		Fatal("TEST FAILED; read %u and %u zeroes from the TieredVector, not %u", first, later, expected);
+
+	double baseline_ns = NsPerRead(start, baseline_end, test_passes);
+	double first_ns = NsPerRead(baseline_end, first_end, 1);
+	double later_ns = NsPerRead(first_end, later_end, test_passes);
+	printf("# REALTYPE\telements\tpromoted\tChunkVector ns/read\tfirst ns/read\tlater ns/read\n");
+	printf("%s\t%u\t%u\t%f\t%f\t%f\n", g_real_name[REALTYPE], test_elements, (unsigned)tiered.Promoted(), baseline_ns, first_ns, later_ns);
+	// Generous, so that a busy machine doesn't fail it; joining on every read was many times slower
+	if (later_ns > 2 * baseline_ns + 1)
+		Fatal("TEST FAILED; reading a TieredVector (%f ns) is slower than a ChunkVector (%f ns)", later_ns, baseline_ns);
+	Debug("TEST SUCCEEDED");
+	return 0;
+}
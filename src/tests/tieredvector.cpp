@@ -0,0 +1,91 @@
+/**
+ * Check that a TieredVector gives back exactly what was put in, whether or not it fits in doubles
+ * Build with REALTYPE=9 to see elements get promoted
+ */
+#include "tieredvector.h"
+#include <ctime>
+
+using namespace std;
+using namespace IPDF;
+
+unsigned test_elements = 10000;
+
+/** Half are sums of powers of two, the rest have thirds in them (which only fit a double when Real is binary) **/
+Real TestReal(unsigned i)
+{
+	Real r = Real((int)(rand() % 2048) - 1024) / Real(1 << (rand() % 16));
+	if (i % 2 == 1)
+		r += Real(1) / Real(3);
+	return r;
+}
+
+int main(int argc, char ** argv)
+{
+	Debug("TEST STARTING %s", argv[0]);
+	srand(time(NULL));
+	if (argc > 1)
+		test_elements = strtoul(argv[1], NULL, 10);
+
+	vector<Rect> rects;
+	vector<Bezier> beziers;
+	TieredVector<Rect> tiered_rects;
+	TieredVector<Bezier> tiered_beziers;
+	for (unsigned i = 0; i < test_elements; ++i)
+	{
+		rects.push_back(Rect(TestReal(i), TestReal(i), TestReal(0), TestReal(0)));
+		beziers.push_back(Bezier(TestReal(0), TestReal(0), TestReal(i), TestReal(0), TestReal(0), TestReal(i), TestReal(0), TestReal(0)));
+		beziers.back().GetType();
+		tiered_rects.push_back(rects.back());
+		tiered_beziers.push_back(beziers.back());
+	}
+	Debug("%u of %u Rects and %u of %u Beziers promoted", tiered_rects.Promoted(), tiered_rects.size(), tiered_beziers.Promoted(), tiered_beziers.size());
+
+	// Move everything by a third and back again; with rationals elements are promoted and then demoted
+	for (unsigned i = 0; i < test_elements; ++i)
+	{
+		Rect r = tiered_rects[i];
+		r.x += Real(1) / Real(3);
+		tiered_rects.Set(i, r);
+		rects[i].x += Real(1) / Real(3);
+	}
+	for (unsigned i = 0; i < test_elements; ++i)
+	{
+		Rect r = tiered_rects[i];
+		r.x -= Real(1) / Real(3);
+		tiered_rects.Set(i, r);
+		rects[i].x -= Real(1) / Real(3);
+	}
+
+	for (unsigned i = 0; i < test_elements; ++i)
+	{
+		if (tiered_rects[i] != rects[i])
+			Fatal("TEST FAILED; Rect %u is %s, not %s", i, tiered_rects[i].Str().c_str(), rects[i].Str().c_str());
+		const Bezier & a = tiered_beziers[i];
+		const Bezier & b = beziers[i];
+		if (!(a.x0 == b.x0 && a.y0 == b.y0 && a.x1 == b.x1 && a.y1 == b.y1 && a.x2 == b.x2 && a.y2 == b.y2 && a.x3 == b.x3 && a.y3 == b.y3) || a.type != b.type)
+			Fatal("TEST FAILED; Bezier %u is different", i);
+	}
+	if (!equal(tiered_rects.begin(), tiered_rects.end(), rects.begin()))
+		Fatal("TEST FAILED; iterating gave different Rects");
+
+	// Reads are kept until Uncache; a copy has to stand on its own
+	TieredVector<Bezier> copy(tiered_beziers);
+	tiered_beziers.Uncache();
+	for (unsigned i = 0; i < test_elements; ++i)
+	{
+		const Bezier & a = tiered_beziers[i];
+		const Bezier & c = copy[i];
+		if (&tiered_beziers[i] != &a)
+			Fatal("TEST FAILED; reading Bezier %u twice gave different references", i);
+		if (!(a.x0 == c.x0 && a.y1 == c.y1 && a.x2 == c.x2 && a.y3 == c.y3) || a.type != c.type)
+			Fatal("TEST FAILED; Bezier %u is different after copying or uncaching", i);
+	}
+	if (copy.Promoted() != tiered_beziers.Promoted())
+		Fatal("TEST FAILED; the copy has %u promoted Beziers, not %u", copy.Promoted(), tiered_beziers.Promoted());
+
+	tiered_rects.resize(test_elements / 2);
+	if (tiered_rects.size() != test_elements / 2 || (test_elements > 1 && tiered_rects.back() != rects[test_elements/2 - 1]))
+		Fatal("TEST FAILED; resize lost elements");
+	Debug("TEST SUCCEEDED");
+	return 0;
+}
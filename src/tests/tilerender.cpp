@@ -0,0 +1,66 @@
+/**
+ * Check that rasterising on the CPU in tiles, on several threads, gives exactly the same pixels as one thread
+ */
+#include "view.h"
+#include <ctime>
+
+using namespace std;
+using namespace IPDF;
+
+unsigned test_objects = 5000;
+
+/** Wall time to render at w x h on some threads **/
+double Render(View & view, int w, int h, unsigned threads, vector<uint8_t> & pixels)
+{
+	pixels.resize(w*h*4);
+	view.SetTransformThreads(threads);
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	view.RenderToPixels(w, h, pixels.data());
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start.tv_sec) + 1e-9*(end.tv_nsec - start.tv_nsec);
+}
+
+int main(int argc, char ** argv)
+{
+	Debug("TEST STARTING %s", argv[0]);
+	srand(time(NULL));
+	if (argc > 1)
+		test_objects = strtoul(argv[1], NULL, 10);
+
+	Document doc("", "");
+#ifndef QUADTREE_DISABLED
+	doc.SetQuadtreeInsertNode(doc.GetQuadTree().root_id);
+#endif
+	ObjectType types[] = {CIRCLE_FILLED, RECT_FILLED, RECT_OUTLINE, BEZIER};
+	for (unsigned i = 0; i < test_objects; ++i)
+	{
+		ObjectType type = types[rand() % 4];
+		// Some hang off the edges of the view
+		Rect bounds(Random()*Real(1.2) - Real(0.1), Random()*Real(1.2) - Real(0.1), Random()/Real(10), Random()/Real(10));
+		unsigned data = 0;
+		if (type == BEZIER)
+			data = doc.AddBezierData(Bezier(Random(), Random(), Random(), Random(), Random(), Random(), Random(), Random()));
+		doc.Add(type, bounds, data);
+	}
+
+	// Not a whole number of tiles, and 4K
+	int sizes[][2] = {{1000, 700}, {3840, 2160}};
+	View view(doc);
+	vector<uint8_t> serial, tiled;
+	for (unsigned s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s)
+	{
+		int w = sizes[s][0], h = sizes[s][1];
+		Render(view, w, h, 1, serial); // (quadtree nodes the view needs are made the first time)
+		double serial_time = Render(view, w, h, 1, serial);
+		double tiled_time = Render(view, w, h, 4, tiled);
+		for (unsigned i = 0; i < serial.size(); ++i)
+		{
+			if (serial[i] != tiled[i])
+				Fatal("TEST FAILED; pixel (%u, %u) of %d x %d is %u in tiles, not %u", (i/4) % w, (i/4) / w, w, h, tiled[i], serial[i]);
+		}
+		Debug("%u objects at %d x %d; one thread took %f s, four took %f s", test_objects, w, h, serial_time, tiled_time);
+	}
+	Debug("TEST SUCCEEDED");
+	return 0;
+}
@@ -0,0 +1,240 @@
+#ifndef _TIEREDVECTOR_H
+#define _TIEREDVECTOR_H
+
+#include "common.h"
+#include "chunkvector.h"
+#include "real.h"
+#include "rect.h"
+#include "bezier.h"
+#include <iterator>
+#include <atomic>
+#include <thread>
+#include <type_traits>
+
+namespace IPDF
+{
+	/** Sets d to r, returning false if that isn't exact **/
+	inline bool ExactDouble(const Real & r, double & d)
+	{
+	#if REALTYPE == REAL_GMPRAT
+		// Doubles are integers of at most 53 bits over a power of two; checking that directly saves making a Gmprat to compare
+		mpq_srcptr q = r.Op();
+		d = mpq_get_d(q);
+		if (mpz_sgn(mpq_numref(q)) == 0)
+			return true;
+		if (mpz_popcount(mpq_denref(q)) != 1)
+			return false;
+		long low = (long)mpz_scan1(mpq_numref(q), 0);
+		long high = (long)mpz_sizeinbase(mpq_numref(q), 2);
+		long shift = (long)mpz_sizeinbase(mpq_denref(q), 2) - 1;
+		return (high - low <= 53 && low - shift >= -1074 && high - shift <= 1024);
+	#else
+		d = Double(r);
+		return std::isfinite(d) && Real(d) == r;
+	#endif
+	}
+
+	/** How to split a T into doubles (and an int for anything else it carries) and put it back together **/
+	template <class T> struct Tier;
+
+	template <> struct Tier<Rect>
+	{
+		static const unsigned COUNT = 4;
+		static const Real * Coord(const Rect & r, unsigned i) {const Real * c[] = {&r.x, &r.y, &r.w, &r.h}; return c[i];}
+		static int Tag(const Rect &) {return 0;}
+		static Rect Join(const double * d, int) {return Rect(Real(d[0]), Real(d[1]), Real(d[2]), Real(d[3]));}
+	};
+
+	template <> struct Tier<Bezier>
+	{
+		static const unsigned COUNT = 8;
+		static const Real * Coord(const Bezier & b, unsigned i) {const Real * c[] = {&b.x0, &b.y0, &b.x1, &b.y1, &b.x2, &b.y2, &b.x3, &b.y3}; return c[i];}
+		static int Tag(const Bezier & b) {return (int)b.type;}
+		static Bezier Join(const double * d, int tag)
+		{
+			Bezier b = Bezier(Real(d[0]), Real(d[1]), Real(d[2]), Real(d[3]), Real(d[4]), Real(d[5]), Real(d[6]), Real(d[7]));
+			b.type = (Bezier::Type)tag;
+			return b;
+		}
+	};
+
+	/**
+	 * Holds Rects or Beziers as doubles, promoting an element to full Reals only when one of its coordinates isn't exactly a double
+	 * For when Real is a big number type; most objects are exact in a double and then cost no allocations until they are read
+	 * The first read of an exact element joins its doubles into a T kept in its slot, so later reads cost about what a ChunkVector's do
+	 * Several threads may read at once; references stay valid until that element is Set, or the vector is resized or Uncached
+	 */
+	template <class T>
+	class TieredVector
+	{
+		public:
+			class const_iterator : public std::iterator<std::input_iterator_tag, T, std::ptrdiff_t, const T*, const T&>
+			{
+				public:
+					const_iterator(const TieredVector * v, size_t i) : m_v(v), m_i(i) {}
+					const T & operator*() const {return (*m_v)[m_i];}
+					const T * operator->() const {return &(*m_v)[m_i];}
+					const_iterator & operator++() {++m_i; return *this;}
+					const_iterator operator+(size_t n) const {return const_iterator(m_v, m_i + n);}
+					bool operator==(const const_iterator & equ) const {return m_i == equ.m_i;}
+					bool operator!=(const const_iterator & equ) const {return m_i != equ.m_i;}
+				private:
+					const TieredVector * m_v;
+					size_t m_i;
+			};
+
+			TieredVector() : m_slots(), m_promoted(0) {}
+
+			size_t size() const {return m_slots.size();}
+			size_t capacity() const {return m_slots.capacity();}
+			bool empty() const {return m_slots.empty();}
+			/** Number of elements that currently need full Reals **/
+			size_t Promoted() const {return m_promoted;}
+
+			const T & operator[](size_t i) const
+			{
+				const Slot & s = m_slots[i];
+				return (s.state.load(std::memory_order_acquire) == READY) ? s.Get() : s.Cache();
+			}
+			const T & back() const {return (*this)[size()-1];}
+
+			const_iterator begin() const {return const_iterator(this, 0);}
+			const_iterator end() const {return const_iterator(this, size());}
+
+			void Set(size_t i, const T & t)
+			{
+				Slot & s = m_slots[i];
+				double split[Tier<T>::COUNT];
+				bool exact = Split(t, split);
+				if (exact != s.exact)
+					m_promoted = exact ? m_promoted - 1 : m_promoted + 1;
+				s.exact = exact;
+				s.tag = Tier<T>::Tag(t);
+				if (s.state.load(std::memory_order_relaxed) == READY)
+					s.Get() = t; // reuses the big numbers already allocated
+				else if (exact)
+					std::copy(split, split + Tier<T>::COUNT, s.d);
+				else
+					s.Construct(t);
+			}
+
+			void push_back(const T & t)
+			{
+				m_slots.push_back(Slot());
+				Set(size()-1, t);
+			}
+			void reserve(size_t n) {m_slots.reserve(n);}
+			void resize(size_t n)
+			{
+				while (size() > n)
+				{
+					m_promoted -= (size_t)!m_slots.back().exact;
+					m_slots.pop_back();
+				}
+				m_slots.reserve(n);
+				while (size() < n)
+					push_back(T());
+			}
+			void clear() {m_slots.clear(); m_promoted = 0;}
+
+			/** Free the Ts kept for exact elements that have been read; not while anything else is reading **/
+			void Uncache()
+			{
+				for (size_t i = 0; i < size(); ++i)
+				{
+					if (m_slots[i].exact)
+						m_slots[i].Uncache();
+				}
+			}
+
+		private:
+			enum {EMPTY, BUSY, READY}; // whether a Slot holds a T
+
+			/** The element as doubles or as a T, in the same bytes so that a read T is laid out about as a ChunkVector's **/
+			struct Slot
+			{
+				int32_t tag;
+				bool exact; // the element fits in doubles; otherwise only the T has it
+				mutable std::atomic<uint8_t> state;
+				union
+				{
+					double d[Tier<T>::COUNT]; // while EMPTY
+					mutable typename std::aligned_storage<sizeof(T), alignof(T)>::type t; // while READY
+				};
+
+				Slot() : tag(0), exact(true), state(EMPTY), d() {}
+				Slot(const Slot & cpy) : tag(cpy.tag), exact(cpy.exact), state(EMPTY) {CopyFrom(cpy);}
+				Slot & operator=(const Slot & equ)
+				{
+					if (&equ == this) return *this;
+					Release();
+					tag = equ.tag;
+					exact = equ.exact;
+					CopyFrom(equ);
+					return *this;
+				}
+				~Slot() {Release();}
+
+				T & Get() const {return *reinterpret_cast<T*>(&t);}
+				void Construct(const T & from) const
+				{
+					new (&t) T(from);
+					state.store(READY, std::memory_order_release);
+				}
+				void Release()
+				{
+					if (state.load(std::memory_order_relaxed) == READY)
+						Get().~T();
+					state.store(EMPTY, std::memory_order_relaxed);
+				}
+				/** Back to doubles; only for exact elements **/
+				void Uncache()
+				{
+					if (state.load(std::memory_order_relaxed) != READY)
+						return;
+					double split[Tier<T>::COUNT];
+					Split(Get(), split);
+					Get().~T();
+					std::copy(split, split + Tier<T>::COUNT, d);
+					state.store(EMPTY, std::memory_order_relaxed);
+				}
+				void CopyFrom(const Slot & from)
+				{
+					if (from.state.load(std::memory_order_acquire) == READY)
+						Construct(from.Get());
+					else
+						std::copy(from.d, from.d + Tier<T>::COUNT, d);
+				}
+				/** Join the doubles into the T, or wait for the thread that got here first to **/
+				const T & Cache() const
+				{
+					uint8_t expected = EMPTY;
+					if (state.compare_exchange_strong(expected, BUSY, std::memory_order_acquire))
+					{
+						double joined[Tier<T>::COUNT];
+						std::copy(d, d + Tier<T>::COUNT, joined);
+						Construct(Tier<T>::Join(joined, tag));
+					}
+					while (state.load(std::memory_order_acquire) != READY)
+						std::this_thread::yield();
+					return Get();
+				}
+			};
+
+			/** Returns false if any coordinate of t isn't exactly a double **/
+			static bool Split(const T & t, double * d)
+			{
+				for (unsigned i = 0; i < Tier<T>::COUNT; ++i)
+				{
+					if (!ExactDouble(*Tier<T>::Coord(t, i), d[i]))
+						return false;
+				}
+				return true;
+			}
+
+			ChunkVector<Slot> m_slots;
+			size_t m_promoted;
+	};
+}
+
+#endif //_TIEREDVECTOR_H
@@ -3,6 +3,7 @@
 #include "screen.h"
 #include "profiler.h"
 #include "gl_core44.h"
+#include <set>
 
 #ifndef CONTROLPANEL_DISABLED
 	#include "controlpanel.h"
@@ -18,6 +19,11 @@
 using namespace IPDF;
 using namespace std;
 
+#ifndef QUADTREE_DISABLED
+/** How many frames ahead View::PrefetchQuadtree looks **/
+static const int QUADTREE_PREFETCH_FRAMES = 8;
+#endif
+
 /**
  * Constructs a view
  * Allocates memory for ObjectRenderers
@@ -26,22 +32,45 @@ using namespace std;
  * @param colour - Colour to use for rendering this view. TODO: Make sure this actually works, or just remove it
  */
 View::View(Document & document, Screen & screen, const VRect & bounds, const Colour & colour)
-	: m_use_gpu_transform(false), m_use_gpu_rendering(USE_GPU_RENDERING), m_bounds_dirty(true), m_buffer_dirty(true), 
-		m_render_dirty(true), m_document(document), m_screen(screen), m_cached_display(), m_bounds(bounds), m_colour(colour), m_bounds_ubo(), 
-		m_objbounds_vbo(), m_object_renderers(NUMBER_OF_OBJECT_TYPES), m_cpu_rendering_pixels(NULL),
-		m_perform_shading(USE_SHADING), m_show_bezier_bounds(false), m_show_bezier_type(false),
+	: View(document, &screen, bounds, colour)
+{
+}
+
+/**
+ * Constructs a headless view, which has no Screen and never touches SDL or GL
+ * It can only render on the CPU with RenderToPixels (or SaveCPUBMP)
+ */
+View::View(Document & document, const VRect & bounds, const Colour & colour)
+	: View(document, (Screen*)NULL, bounds, colour)
+{
+}
+
+View::View(Document & document, Screen * screen, const VRect & bounds, const Colour & colour)
+	: m_use_gpu_transform(false), m_use_gpu_rendering(USE_GPU_RENDERING && screen != NULL), m_bounds_dirty(true), m_buffer_dirty(true), 
+		m_render_dirty(true), m_prepared_objects(0), m_prepared_beziers(0), m_prepared_generation(0), m_document(document), m_render_objects(&document.m_objects), m_screen(screen), m_cached_display(), m_bounds(bounds), m_colour(colour), m_bounds_ubo(), 
+		m_objbounds_vbo(), m_objbounds_written(), m_objbounds_generation(0), m_object_renderers(NUMBER_OF_OBJECT_TYPES), m_cpu_rendering_pixels(NULL),
+		m_perform_shading(USE_SHADING), m_anti_alias_cpu(false), m_show_bezier_bounds(false), m_show_bezier_type(false),
 		m_show_fill_points(false), m_show_fill_bounds(false), m_lazy_rendering(true),
-		m_query_gpu_bounds_on_next_frame(NULL)
+		m_query_gpu_bounds_on_next_frame(NULL), m_lod_pixels(0), m_transform_threads(0)
 {
 	Debug("View Created - Bounds => {%s}", m_bounds.Str().c_str());
 
-	screen.SetView(this); // oh dear...
+	if (screen != NULL)
+		screen->SetView(this); // oh dear...
 
 	
 
 	// Create ObjectRenderers - new's match delete's in View::~View
 	//TODO: Don't forget to put new renderers here or things will be segfaultastic
-	if (screen.Valid())
+	if (screen == NULL)
+	{
+		m_object_renderers[RECT_FILLED] = new RectFilledRenderer(false);
+		m_object_renderers[RECT_OUTLINE] = new RectOutlineRenderer(false);
+		m_object_renderers[CIRCLE_FILLED] = new CircleFilledRenderer(false);
+		m_object_renderers[BEZIER] = new BezierRenderer(false);
+		m_object_renderers[PATH] = new PathRenderer(false);
+	}
+	else if (screen->Valid())
 	{
 		m_object_renderers[RECT_FILLED] = new RectFilledRenderer();
 		m_object_renderers[RECT_OUTLINE] = new RectOutlineRenderer();
@@ -64,7 +93,12 @@ View::View(Document & document, Screen & screen, const VRect & bounds, const Col
 
 #ifndef QUADTREE_DISABLED
 	m_quadtree_max_depth = 2;
-	m_current_quadtree_node = document.GetQuadTree().root_id;
+	m_current_quadtree_node = document.GetQuadtreeViewNode();
+	m_render_node = QUADTREE_EMPTY;
+	m_background_quadtree = (screen != NULL); // there are no later frames to wait for when headless
+	m_pan_x = m_pan_y = 0;
+	m_zoom_x = m_zoom_y = 0;
+	m_zoom = 1;
 #endif
 }
 
@@ -102,6 +136,10 @@ void View::Translate(Real x, Real y)
 	m_bounds.x += m_bounds.w*VReal(x);
 	m_bounds.y += m_bounds.h*VReal(y);
 	//Debug("View Bounds => %s", m_bounds.Str().c_str());
+	#ifndef QUADTREE_DISABLED
+	m_pan_x += Double(x);
+	m_pan_y += Double(y);
+	#endif
 
 	
 }
@@ -167,6 +205,11 @@ void View::ScaleAroundPoint(Real x, Real y, Real scale_amount)
 	m_bounds.y = vy - top;
 	m_bounds.w *= scale_amount;
 	m_bounds.h *= scale_amount;
+	#ifndef QUADTREE_DISABLED
+	m_zoom_x = Double(x);
+	m_zoom_y = Double(y);
+	m_zoom *= Double(scale_amount);
+	#endif
 	if (m_bounds.w == VReal(0))
 	{
 		Debug("Scaled to zero!!!");
@@ -200,7 +243,7 @@ Rect View::TransformToViewCoords(const Rect& inp) const
 void View::Render(int width, int height)
 {
 	PROFILE_SCOPE("View::Render()");
-	if (!m_screen.Valid()) return;
+	if (Headless() || !m_screen->Valid()) return;
 	glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION,42,-1, "Beginning View::Render()");
 	// View dimensions have changed (ie: Window was resized)
 	int prev_width = m_cached_display.GetWidth();
@@ -209,8 +252,17 @@ void View::Render(int width, int height)
 	{
 		m_cached_display.Create(width, height);
 		m_bounds_dirty = true;
+#ifndef QUADTREE_DISABLED
+		m_document.SetQuadtreeLOD(Real(m_lod_pixels) / Real(2*width));
+#endif
 	}
 
+#ifndef QUADTREE_DISABLED
+	// Children generated in the background since the last frame; we may be able to move into them now
+	if (m_document.MergeQuadChildren())
+		m_bounds_dirty = true;
+#endif
+
 	// View bounds have not changed; blit the FrameBuffer as it is
 	if (!m_bounds_dirty && m_lazy_rendering)
 	{
@@ -234,121 +286,12 @@ void View::Render(int width, int height)
 	// the bounds, it was easier to do it that way. (The top-left corner of the bounds are within the main
 	// quadtree node).
 	if (m_bounds_dirty || !m_lazy_rendering)
-	{
-		g_profiler.BeginZone("View::Render -- Quadtree view bounds management");
-		// If we're too far zoomed out, become the parent of the current node.
-		while ( m_bounds.w > 1.0 || m_bounds.h > 1.0)
-		{
-			// If a parent node exists, we'll become it.
-			//TODO: Generate a new parent node if none exists, and work out when to change child_type
-			// away from QTC_UNKNOWN
-			if (m_document.GetQuadTree().nodes[m_current_quadtree_node].parent != QUADTREE_EMPTY)
-			{
-				m_bounds = TransformFromQuadChild(m_bounds, m_document.GetQuadTree().nodes[m_current_quadtree_node].child_type);
-				m_current_quadtree_node = m_document.GetQuadTree().nodes[m_current_quadtree_node].parent;
-			}
-			else break;
-		}
-
-		// If we have a parent... (This prevents some crashes, but should disappear.)
-		if (m_document.GetQuadTree().nodes[m_current_quadtree_node].parent != QUADTREE_EMPTY)
-		{
-			// If the current node is off the left-hand side of the screen...
-			while (m_bounds.x > 1)
-			{
-				//... the current node becomes the node to its right.
-				m_bounds = Rect(m_bounds.x - 1, m_bounds.y, m_bounds.w, m_bounds.h);
-				m_current_quadtree_node = m_document.GetQuadTree().GetNeighbour(m_current_quadtree_node, 1, 0, &m_document);
-			}
-			while (m_bounds.y > 1)
-			{
-				m_bounds = Rect(m_bounds.x, m_bounds.y - 1, m_bounds.w, m_bounds.h);
-				m_current_quadtree_node = m_document.GetQuadTree().GetNeighbour(m_current_quadtree_node, 0, 1, &m_document);
-			}
-			while (m_bounds.x < 0)
-			{
-				m_bounds = Rect(m_bounds.x + 1, m_bounds.y, m_bounds.w, m_bounds.h);
-				m_current_quadtree_node = m_document.GetQuadTree().GetNeighbour(m_current_quadtree_node, -1, 0, &m_document);
-			}
-			while (m_bounds.y < 0)
-			{
-				m_bounds = Rect(m_bounds.x, m_bounds.y + 1, m_bounds.w, m_bounds.h);
-				m_current_quadtree_node = m_document.GetQuadTree().GetNeighbour(m_current_quadtree_node, 0, -1, &m_document);
-			}
-		}
+		UpdateQuadtreeNode();
 
-		// Recurse into a node if we are completely within it. (If we're okay with having an invalid frame or two, we can remove this.)
-		if (ContainedInQuadChild(m_bounds, QTC_TOP_LEFT))
-		{
-			if (m_document.GetQuadTree().nodes[m_current_quadtree_node].top_left == QUADTREE_EMPTY)
-			{
-				// We want to reparent into a child node, but none exist. Get the document to create one.
-				m_document.GenQuadChild(m_current_quadtree_node, QTC_TOP_LEFT);
-				m_render_dirty = true;
-			}
-			m_bounds = TransformToQuadChild(m_bounds, QTC_TOP_LEFT);
-			m_current_quadtree_node = m_document.GetQuadTree().nodes[m_current_quadtree_node].top_left;
-		}
-		if (ContainedInQuadChild(m_bounds, QTC_TOP_RIGHT))
-		{
-			if (m_document.GetQuadTree().nodes[m_current_quadtree_node].top_right == QUADTREE_EMPTY)
-			{
-				// We want to reparent into a child node, but none exist. Get the document to create one.
-				m_document.GenQuadChild(m_current_quadtree_node, QTC_TOP_RIGHT);
-				m_render_dirty = true;
-			}
-			m_bounds = TransformToQuadChild(m_bounds, QTC_TOP_RIGHT);
-			m_current_quadtree_node = m_document.GetQuadTree().nodes[m_current_quadtree_node].top_right;
-		}
-		if (ContainedInQuadChild(m_bounds, QTC_BOTTOM_LEFT))
-		{
-			if (m_document.GetQuadTree().nodes[m_current_quadtree_node].bottom_left == QUADTREE_EMPTY)
-			{
-				// We want to reparent into a child node, but none exist. Get the document to create one.
-				m_document.GenQuadChild(m_current_quadtree_node, QTC_BOTTOM_LEFT);
-				m_render_dirty = true;
-			}
-			m_bounds = TransformToQuadChild(m_bounds, QTC_BOTTOM_LEFT);
-			m_current_quadtree_node = m_document.GetQuadTree().nodes[m_current_quadtree_node].bottom_left;
-		}
-		if (ContainedInQuadChild(m_bounds, QTC_BOTTOM_RIGHT))
-		{
-			if (m_document.GetQuadTree().nodes[m_current_quadtree_node].bottom_right == QUADTREE_EMPTY)
-			{
-				// We want to reparent into a child node, but none exist. Get the document to create one.
-				m_document.GenQuadChild(m_current_quadtree_node, QTC_BOTTOM_RIGHT);
-				m_render_dirty = true;
-			}
-			m_bounds = TransformToQuadChild(m_bounds, QTC_BOTTOM_RIGHT);
-			m_current_quadtree_node = m_document.GetQuadTree().nodes[m_current_quadtree_node].bottom_right;
-		}
-
-		// Otherwise, we'll arbitrarily select the bottom-right.
-		// TODO: Perhaps select based on greatest area?
-		while (m_bounds.w < 0.5 || m_bounds.h < 0.5)
-		{
-			if (m_document.GetQuadTree().nodes[m_current_quadtree_node].bottom_right == QUADTREE_EMPTY)
-			{
-				// We want to reparent into a child node, but none exist. Get the document to create one.
-				m_document.GenQuadChild(m_current_quadtree_node, QTC_BOTTOM_RIGHT);
-				m_render_dirty = true;
-			}
-			m_bounds = TransformToQuadChild(m_bounds, QTC_BOTTOM_RIGHT);
-			m_current_quadtree_node = m_document.GetQuadTree().nodes[m_current_quadtree_node].bottom_right;
-		}
-		g_profiler.EndZone();
-	}
-
-	m_screen.DebugFontPrintF("Current View QuadTree");
-	QuadTreeIndex overlay = m_current_quadtree_node;
-	while (overlay != -1)
-	{
-		m_screen.DebugFontPrintF(" Node: %d (objs: %d -> %d)", overlay, m_document.GetQuadTree().nodes[overlay].object_begin,
-					m_document.GetQuadTree().nodes[overlay].object_end);
-		overlay = m_document.GetQuadTree().nodes[overlay].next_overlay;
-	}
-	m_screen.DebugFontPrintF("\n");
-	m_screen.DebugFontPrintF("Left: %d, Right: %d, Up: %d, Down: %d\n",
+	m_screen->DebugFontPrintF("Current View QuadTree");
+	m_screen->DebugFontPrintF(" Node: %d (objs: %u)", m_current_quadtree_node, m_document.GetQuadTree().nodes[m_current_quadtree_node].objects.types.size());
+	m_screen->DebugFontPrintF("\n");
+	m_screen->DebugFontPrintF("Left: %d, Right: %d, Up: %d, Down: %d\n",
 			m_document.GetQuadTree().GetNeighbour(m_current_quadtree_node, -1, 0, 0),
 			m_document.GetQuadTree().GetNeighbour(m_current_quadtree_node, 1, 0, 0),
 			m_document.GetQuadTree().GetNeighbour(m_current_quadtree_node, 0, -1, 0),
@@ -362,7 +305,7 @@ void View::Render(int width, int height)
 		view_top_bounds = TransformFromQuadChild(view_top_bounds, m_document.GetQuadTree().nodes[tmp].child_type);
 		tmp = m_document.GetQuadTree().nodes[tmp].parent;
 	}
-	m_screen.DebugFontPrintF("Equivalent View Bounds: %s\n", view_top_bounds.Str().c_str());
+	m_screen->DebugFontPrintF("Equivalent View Bounds: %s\n", view_top_bounds.Str().c_str());
 #endif
 
 	if (!m_use_gpu_rendering)
@@ -380,6 +323,13 @@ void View::Render(int width, int height)
 			m_cpu_rendering_pixels[i] = 255;
 	}
 #ifdef QUADTREE_DISABLED
+#ifdef VIEW_CULLING
+	if (CullObjects() && !m_render_dirty)
+	{
+		FillObjectRenderers();
+		m_buffer_dirty = true; // objects that came into view have no bounds in the VBO yet
+	}
+#endif
 	RenderRange(width, height, 0, m_document.ObjectCount());
 #else
 	// Make sure we update the gpu buffers properly.
@@ -392,7 +342,7 @@ void View::Render(int width, int height)
 #endif
 	if (!m_use_gpu_rendering)
 	{
-		m_screen.RenderPixels(0,0,width, height, m_cpu_rendering_pixels); //TODO: Make this work :(
+		m_screen->RenderPixels(0,0,width, height, m_cpu_rendering_pixels); //TODO: Make this work :(
 		// Debug for great victory (do something similar for GPU and compare?)
 		//ObjectRenderer::SaveBMP({m_cpu_rendering_pixels, width, height}, "cpu_rendering_last_frame.bmp");
 	}
@@ -409,43 +359,253 @@ void View::Render(int width, int height)
 	
 }
 
+/**
+ * Rasterise the view on the CPU into pixels (width*height RGBA)
+ * Unlike Render this doesn't need a Screen, so it is how a headless View renders
+ */
+void View::RenderToPixels(int width, int height, uint8_t * pixels)
+{
+	PROFILE_SCOPE("View::RenderToPixels()");
+	bool prev_gpu_rendering = m_use_gpu_rendering;
+	uint8_t * prev_pixels = m_cpu_rendering_pixels;
+	m_use_gpu_rendering = false;
+	m_cpu_rendering_pixels = pixels;
+	memset(pixels, 255, width*height*4);
+
+#ifdef QUADTREE_DISABLED
+#ifdef VIEW_CULLING
+	if (CullObjects() && !m_render_dirty)
+		FillObjectRenderers();
+#endif
+	RenderRange(width, height, 0, m_document.ObjectCount());
+#else
+	m_document.SetQuadtreeLOD(Real(m_lod_pixels) / Real(2*width));
+	m_document.MergeQuadChildren();
+	UpdateQuadtreeNode();
+	if (m_document.m_document_dirty)
+	{
+		m_render_dirty = m_buffer_dirty = true;
+		m_document.m_document_dirty = false;
+	}
+	RenderQuadtreeNode(width, height, m_current_quadtree_node, m_quadtree_max_depth);
+#endif
+	// The GPU buffers (if any) weren't touched, so they have to be brought up to date next time
+	m_bounds_dirty = m_buffer_dirty = true;
+	m_use_gpu_rendering = prev_gpu_rendering;
+	m_cpu_rendering_pixels = prev_pixels;
+}
+
 #ifndef QUADTREE_DISABLED
+/**
+ * Move to the quadtree node the bounds are in, keeping them between half and one node across
+ */
+void View::UpdateQuadtreeNode()
+{
+	PROFILE_SCOPE("View::UpdateQuadtreeNode()");
+	// If we're too far zoomed out, become the parent of the current node.
+	while ( m_bounds.w > 1.0 || m_bounds.h > 1.0)
+	{
+		// If a parent node exists, we'll become it.
+		//TODO: Generate a new parent node if none exists, and work out when to change child_type
+		// away from QTC_UNKNOWN
+		if (m_document.GetQuadTree().nodes[m_current_quadtree_node].parent != QUADTREE_EMPTY)
+		{
+			m_bounds = TransformFromQuadChild(m_bounds, m_document.GetQuadTree().nodes[m_current_quadtree_node].child_type);
+			m_current_quadtree_node = m_document.GetQuadTree().nodes[m_current_quadtree_node].parent;
+		}
+		else break;
+	}
+
+	// If we have a parent... (This prevents some crashes, but should disappear.)
+	if (m_document.GetQuadTree().nodes[m_current_quadtree_node].parent != QUADTREE_EMPTY)
+	{
+		// If the current node is off the left-hand side of the screen...
+		while (m_bounds.x > 1)
+		{
+			//... the current node becomes the node to its right.
+			if (!MoveToQuadNeighbour(1, 0))
+				break;
+		}
+		while (m_bounds.y > 1)
+		{
+			if (!MoveToQuadNeighbour(0, 1))
+				break;
+		}
+		while (m_bounds.x < 0)
+		{
+			if (!MoveToQuadNeighbour(-1, 0))
+				break;
+		}
+		while (m_bounds.y < 0)
+		{
+			if (!MoveToQuadNeighbour(0, -1))
+				break;
+		}
+	}
+
+	// Recurse into a node if we are completely within it. (If we're okay with having an invalid frame or two, we can remove this.)
+	if (ContainedInQuadChild(m_bounds, QTC_TOP_LEFT))
+		EnterQuadChild(QTC_TOP_LEFT);
+	if (ContainedInQuadChild(m_bounds, QTC_TOP_RIGHT))
+		EnterQuadChild(QTC_TOP_RIGHT);
+	if (ContainedInQuadChild(m_bounds, QTC_BOTTOM_LEFT))
+		EnterQuadChild(QTC_BOTTOM_LEFT);
+	if (ContainedInQuadChild(m_bounds, QTC_BOTTOM_RIGHT))
+		EnterQuadChild(QTC_BOTTOM_RIGHT);
+
+	// Otherwise, we'll arbitrarily select the bottom-right.
+	// TODO: Perhaps select based on greatest area?
+	while (m_bounds.w < 0.5 || m_bounds.h < 0.5)
+	{
+		if (!EnterQuadChild(QTC_BOTTOM_RIGHT))
+			break;
+	}
+	m_document.SetQuadtreeViewNode(m_current_quadtree_node);
+	// Eviction moves objects, so every buffer has to be rebuilt
+	if (m_document.EnforceQuadtreeBudget())
+		m_render_dirty = m_buffer_dirty = true;
+	if (m_background_quadtree)
+		PrefetchQuadtree();
+}
+
+/**
+ * Make a child of the current node the current node
+ * If it doesn't exist it is generated, or requested in the background, in which case we stay in the parent for now
+ * @returns false if we stayed in the parent
+ */
+bool View::EnterQuadChild(QuadTreeNodeChildren type)
+{
+	QuadTreeIndex child = m_document.GetQuadTree().Child(m_current_quadtree_node, type);
+	if (child == QUADTREE_EMPTY)
+	{
+		// We want to reparent into a child node, but none exist. Get the document to create one.
+		if (m_background_quadtree)
+			child = m_document.RequestQuadChild(m_current_quadtree_node, type);
+		else
+		{
+			// Its siblings are drawn as neighbours straight away, so clip them all in one pass
+			m_document.GenQuadChildren(m_current_quadtree_node);
+			child = m_document.GetQuadTree().Child(m_current_quadtree_node, type);
+		}
+		if (child == QUADTREE_EMPTY)
+			return false;
+		m_render_dirty = true;
+	}
+	m_bounds = TransformToQuadChild(m_bounds, type);
+	m_current_quadtree_node = child;
+	return true;
+}
+
+/**
+ * Make the neighbour of the current node the current node
+ * If it is still being generated in the background, become the parent instead
+ * @returns false if we couldn't move at all
+ */
+bool View::MoveToQuadNeighbour(int xdir, int ydir)
+{
+	QuadTreeIndex neighbour = m_document.GetQuadTree().GetNeighbour(m_current_quadtree_node, xdir, ydir, &m_document, m_background_quadtree);
+	if (neighbour != QUADTREE_EMPTY)
+	{
+		m_bounds = Rect(m_bounds.x - xdir, m_bounds.y - ydir, m_bounds.w, m_bounds.h);
+		m_current_quadtree_node = neighbour;
+		return true;
+	}
+	const QuadTreeNode & node = m_document.GetQuadTree().nodes[m_current_quadtree_node];
+	if (node.parent == QUADTREE_EMPTY)
+		return false;
+	m_bounds = TransformFromQuadChild(m_bounds, node.child_type);
+	m_current_quadtree_node = node.parent;
+	return true;
+}
+
+/**
+ * Start generating the nodes the view is heading for, guessing from how it moved since the last frame
+ */
+void View::PrefetchQuadtree()
+{
+	// Where we will be in QUADTREE_PREFETCH_FRAMES frames if we keep going (doubles are plenty for a guess)
+	double x = Double(m_bounds.x), y = Double(m_bounds.y), w = Double(m_bounds.w), h = Double(m_bounds.h);
+	for (int i = 0; i < QUADTREE_PREFETCH_FRAMES; ++i)
+	{
+		x += w * m_pan_x;
+		y += h * m_pan_y;
+		double vx = x + w * m_zoom_x;
+		double vy = y + h * m_zoom_y;
+		x = vx - (vx - x) * m_zoom;
+		y = vy - (vy - y) * m_zoom;
+		w *= m_zoom;
+		h *= m_zoom;
+	}
+	m_pan_x = m_pan_y = 0;
+	m_zoom = 1;
+	if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(w) || !std::isfinite(h))
+		return;
+
+	// Zooming in; we'll want the children we end up looking at
+	Rect predicted(x, y, w, h);
+	if (w < 0.5 || h < 0.5)
+	{
+		static const QuadTreeNodeChildren children[] = {QTC_TOP_LEFT, QTC_TOP_RIGHT, QTC_BOTTOM_LEFT, QTC_BOTTOM_RIGHT};
+		for (unsigned i = 0; i < sizeof(children)/sizeof(children[0]); ++i)
+		{
+			if (IntersectsQuadChild(predicted, children[i]))
+				m_document.RequestQuadChild(m_current_quadtree_node, children[i], true);
+		}
+	}
+
+	// Panning off the node; we'll want its neighbours (GetNeighbour requests any that are missing)
+	int xdir = (x + w > 1) ? 1 : ((x < 0) ? -1 : 0);
+	int ydir = (y + h > 1) ? 1 : ((y < 0) ? -1 : 0);
+	const QuadTree & quadtree = m_document.GetQuadTree();
+	if (xdir != 0)
+		quadtree.GetNeighbour(m_current_quadtree_node, xdir, 0, &m_document, true);
+	if (ydir != 0)
+		quadtree.GetNeighbour(m_current_quadtree_node, 0, ydir, &m_document, true);
+	if (xdir != 0 && ydir != 0)
+		quadtree.GetNeighbour(m_current_quadtree_node, xdir, ydir, &m_document, true);
+}
+
 void View::RenderQuadtreeNode(int width, int height, QuadTreeIndex node, int remaining_depth)
 {
 	Rect old_bounds = m_bounds;
 	if (node == QUADTREE_EMPTY) return;
 	if (!remaining_depth) return;
 	m_bounds_dirty = true;
-	QuadTreeIndex overlay = node;
-	while(overlay != -1)
+	//Debug("Rendering QT node %d, (objs: %u)\n", node, m_document.GetQuadTree().nodes[node].objects.types.size());
+	// The ObjectRenderers hold one node's objects at a time, so drawing another means preparing them again
+	QuadTreeNode & n = m_document.m_quadtree.nodes[node];
+	if (node != m_render_node)
 	{
-		//Debug("Rendering QT node %d, (overlay %d, objs: %d -- %d)\n", node, overlay, m_document.GetQuadTree().nodes[overlay].object_begin, m_document.GetQuadTree().nodes[overlay].object_end);
-		if (m_document.GetQuadTree().nodes[overlay].render_dirty)
-			m_buffer_dirty = m_render_dirty = true;
-		RenderRange(width, height, m_document.GetQuadTree().nodes[overlay].object_begin, m_document.GetQuadTree().nodes[overlay].object_end);
-		const_cast<bool&>(m_document.GetQuadTree().nodes[overlay].render_dirty) = false;
-		overlay = m_document.GetQuadTree().nodes[overlay].next_overlay;
+		m_buffer_dirty = m_render_dirty = true;
+		m_prepared_objects = 0;
+		m_objbounds_written.clear();
+		m_render_node = node;
 	}
+	if (n.render_dirty)
+		m_buffer_dirty = m_render_dirty = true;
+	m_render_objects = &n.objects;
+	RenderRange(width, height, 0, n.objects.types.size());
+	n.render_dirty = false;
 
 	if (m_bounds.Intersects(Rect(1,1,1,1)))
 	{
 		m_bounds = Rect(m_bounds.x - 1, m_bounds.y - 1, m_bounds.w, m_bounds.h);
 		m_bounds_dirty = true;
-		RenderQuadtreeNode(width, height, m_document.GetQuadTree().GetNeighbour(node, 1, 1, &m_document), remaining_depth - 1);
+		RenderQuadtreeNode(width, height, m_document.GetQuadTree().GetNeighbour(node, 1, 1, &m_document, m_background_quadtree), remaining_depth - 1);
 	}
 	m_bounds = old_bounds;
 	if (m_bounds.Intersects(Rect(1,0,1,1)))
 	{
 		m_bounds = Rect(m_bounds.x - 1, m_bounds.y, m_bounds.w, m_bounds.h);
 		m_bounds_dirty = true;
-		RenderQuadtreeNode(width, height, m_document.GetQuadTree().GetNeighbour(node, 1, 0, &m_document), remaining_depth - 1);
+		RenderQuadtreeNode(width, height, m_document.GetQuadTree().GetNeighbour(node, 1, 0, &m_document, m_background_quadtree), remaining_depth - 1);
 	}
 	m_bounds = old_bounds;
 	if (m_bounds.Intersects(Rect(0,1,1,1)))
 	{
 		m_bounds = Rect(m_bounds.x, m_bounds.y - 1, m_bounds.w, m_bounds.h);
 		m_bounds_dirty = true;
-		RenderQuadtreeNode(width, height, m_document.GetQuadTree().GetNeighbour(node, 0, 1, &m_document), remaining_depth - 1);
+		RenderQuadtreeNode(width, height, m_document.GetQuadTree().GetNeighbour(node, 0, 1, &m_document, m_background_quadtree), remaining_depth - 1);
 	}
 	m_bounds = old_bounds;
 	m_bounds_dirty = true;
@@ -475,7 +635,8 @@ void View::RenderRange(int width, int height, unsigned first_obj, unsigned last_
 	// so don't waste time setting up everything.
 	if (first_obj == last_obj) return;
 	PROFILE_SCOPE("View::RenderRange");
-	glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 43, -1, "View::RenderRange()");
+	if (!Headless())
+		glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 43, -1, "View::RenderRange()");
 	if (m_render_dirty) // document has changed
 		PrepareRender();
 
@@ -534,13 +695,215 @@ void View::RenderRange(int width, int height, unsigned first_obj, unsigned last_
 	}
 	else // Rasterise on CPU then blit texture to GPU
 	{
+		RenderRangeOnCPU(width, height, first_obj, last_obj);
+	}
+	if (!Headless())
+		glPopDebugGroup();
+}
 
-		for (unsigned i = 0; i < m_object_renderers.size(); ++i)
+/** Objects transformed by one thread at a time in UpdateObjBoundsVBO (and the least binned at a time in RenderRangeOnCPU) **/
+static const unsigned TRANSFORM_CHUNK = 1024;
+
+/** Side of the square tiles the CPU rasteriser splits the frame into **/
+static const int64_t CPU_TILE_SIZE = 128;
+
+/**
+ * Objects drawn on the CPU in tiles, shared by the threads doing it
+ * First each thread bins chunks of objects into the tiles they may draw on, then each draws whole tiles
+ */
+struct View::TileJob
+{
+	const View * view;
+	ObjectRenderer::CPURenderTarget target; // the whole frame
+	const vector<unsigned> * ids; // in the order they are drawn serially
+	unsigned chunk_size;
+	unsigned chunks;
+	int64_t tiles_x, tiles_y;
+	vector<vector<unsigned> > bins; // [chunk*tiles_x*tiles_y + tile], so each tile's objects stay in order
+	SDL_atomic_t next; // chunk or tile; threads take the next one when they finish theirs
+};
+
+int View::RunTileBinning(void * data)
+{
+	TileJob & job = *((TileJob*)data);
+	const View & view = *job.view;
+	Objects & objects = *view.m_render_objects;
+	int64_t tiles = job.tiles_x * job.tiles_y;
+	for (unsigned c = SDL_AtomicAdd(&job.next, 1); c < job.chunks; c = SDL_AtomicAdd(&job.next, 1))
+	{
+		unsigned end = min<unsigned>(job.ids->size(), (c+1)*job.chunk_size);
+		for (unsigned i = c*job.chunk_size; i < end; ++i)
 		{
-			m_object_renderers[i]->RenderUsingCPU(m_document.m_objects, *this, {m_cpu_rendering_pixels, width, height}, first_obj, last_obj);
+			unsigned id = (*job.ids)[i];
+			ObjectRenderer::PixelBounds drawn = view.m_object_renderers[objects.types[id]]->DrawnBoundsOnCPU(objects, view, job.target, id);
+			// Nothing is drawn outside the frame, so anything there is left out altogether
+			if (drawn.x + drawn.w < 0 || drawn.y + drawn.h < 0 || drawn.x >= job.target.w || drawn.y >= job.target.h)
+				continue;
+			int64_t tx0 = max<int64_t>(drawn.x, 0) / CPU_TILE_SIZE, tx1 = min<int64_t>(drawn.x + drawn.w, job.target.w - 1) / CPU_TILE_SIZE;
+			int64_t ty0 = max<int64_t>(drawn.y, 0) / CPU_TILE_SIZE, ty1 = min<int64_t>(drawn.y + drawn.h, job.target.h - 1) / CPU_TILE_SIZE;
+			for (int64_t ty = ty0; ty <= ty1; ++ty)
+			{
+				for (int64_t tx = tx0; tx <= tx1; ++tx)
+					job.bins[c*tiles + ty*job.tiles_x + tx].push_back(id);
+			}
 		}
 	}
-	glPopDebugGroup();
+	return 0;
+}
+
+int View::RunTileRendering(void * data)
+{
+	TileJob & job = *((TileJob*)data);
+	const View & view = *job.view;
+	Objects & objects = *view.m_render_objects;
+	int64_t tiles = job.tiles_x * job.tiles_y;
+	for (int64_t t = SDL_AtomicAdd(&job.next, 1); t < tiles; t = SDL_AtomicAdd(&job.next, 1))
+	{
+		ObjectRenderer::CPURenderTarget tile(job.target);
+		tile.clip_x0 = (t % job.tiles_x) * CPU_TILE_SIZE;
+		tile.clip_y0 = (t / job.tiles_x) * CPU_TILE_SIZE;
+		tile.clip_x1 = min(tile.clip_x0 + CPU_TILE_SIZE, job.target.w);
+		tile.clip_y1 = min(tile.clip_y0 + CPU_TILE_SIZE, job.target.h);
+		for (unsigned c = 0; c < job.chunks; ++c)
+		{
+			const vector<unsigned> & bin = job.bins[c*tiles + t];
+			for (unsigned i = 0; i < bin.size(); ++i)
+				view.m_object_renderers[objects.types[bin[i]]]->RenderObjectOnCPU(objects, view, tile, bin[i]);
+		}
+	}
+	return 0;
+}
+
+/**
+ * Run job on threads threads (this one included), each calling run until there is nothing left
+ */
+static void RunOnThreads(SDL_ThreadFunction run, void * job, unsigned threads, const char * name)
+{
+	vector<SDL_Thread*> pool;
+	for (unsigned i = 1; i < threads; ++i)
+	{
+		SDL_Thread * thread = SDL_CreateThread(run, name, job);
+		if (thread == NULL)
+			Warn("Couldn't create %s thread: %s", name, SDL_GetError()); // the others will do its share
+		else
+			pool.push_back(thread);
+	}
+	run(job);
+	for (unsigned i = 0; i < pool.size(); ++i)
+		SDL_WaitThread(pool[i], NULL);
+}
+
+/**
+ * Rasterise objects in [first_obj, last_obj) into m_cpu_rendering_pixels
+ * The ObjectRenderers go in the same order as ever, but runs of those that can be drawn in tiles are
+ * binned into tiles and drawn by a pool of threads; the pixels come out exactly as if drawn one by one
+ * (Renderers that flood fill read the frame, so they still draw all of it on this thread)
+ */
+void View::RenderRangeOnCPU(int width, int height, unsigned first_obj, unsigned last_obj)
+{
+	PROFILE_SCOPE("View::RenderRangeOnCPU()");
+	ObjectRenderer::CPURenderTarget target(m_cpu_rendering_pixels, width, height);
+	unsigned threads = TransformThreads();
+	unsigned r = 0;
+	while (r < m_object_renderers.size())
+	{
+		if (threads <= 1 || !m_object_renderers[r]->TileableOnCPU(*this))
+		{
+			m_object_renderers[r++]->RenderUsingCPU(*m_render_objects, *this, target, first_obj, last_obj);
+			continue;
+		}
+		TileJob job{this, target, NULL, TRANSFORM_CHUNK, 0, (width + CPU_TILE_SIZE - 1) / CPU_TILE_SIZE, (height + CPU_TILE_SIZE - 1) / CPU_TILE_SIZE};
+		vector<unsigned> ids;
+		unsigned run_begin = r;
+		for (; r < m_object_renderers.size() && m_object_renderers[r]->TileableOnCPU(*this); ++r)
+		{
+			const vector<unsigned> & indexes = m_object_renderers[r]->m_indexes;
+			ids.insert(ids.end(), lower_bound(indexes.begin(), indexes.end(), first_obj), lower_bound(indexes.begin(), indexes.end(), last_obj));
+		}
+		if (ids.empty())
+			continue;
+		// Less than a chunk isn't worth starting threads for (quadtree overlays are often only a few objects each)
+		if (ids.size() < TRANSFORM_CHUNK)
+		{
+			for (unsigned s = run_begin; s < r; ++s)
+				m_object_renderers[s]->RenderUsingCPU(*m_render_objects, *this, target, first_obj, last_obj);
+			continue;
+		}
+		job.ids = &ids;
+		// A few chunks per thread to share the binning out, but not so many that the bins are mostly empty
+		job.chunk_size = max(TRANSFORM_CHUNK, (unsigned)(ids.size() / (4*threads)) + 1);
+		job.chunks = (ids.size() + job.chunk_size - 1) / job.chunk_size;
+		job.bins.resize(job.chunks * job.tiles_x * job.tiles_y);
+		SDL_AtomicSet(&job.next, 0);
+		RunOnThreads(RunTileBinning, &job, min<unsigned>(threads, job.chunks), "TileBinning");
+		SDL_AtomicSet(&job.next, 0);
+		RunOnThreads(RunTileRendering, &job, min<unsigned>(threads, job.tiles_x * job.tiles_y), "TileRendering");
+	}
+}
+
+/** Object bounds to transform (or copy, with GPU transforms) into a mapped range of m_objbounds_vbo, shared by the threads doing it **/
+struct View::TransformJob
+{
+	const View * view;
+	GPUObjBounds * data; // where first_obj goes
+	size_t size; // in bytes
+	unsigned first_obj;
+	const unsigned * ids; // the objects (ascending), or NULL for [first_obj, first_obj + count)
+	unsigned count;
+	FILE * query; // m_query_gpu_bounds_on_next_frame
+	SDL_atomic_t next_chunk;
+};
+
+/**
+ * Number of threads to transform object bounds, or rasterise tiles, with
+ * (Except where the Real type keeps per-thread state)
+ */
+unsigned View::TransformThreads() const
+{
+#if REALTYPE == REAL_IRRAM || REALTYPE == REAL_MPFRCPP || REALTYPE == REAL_VFPU
+	return 1; // precision (and iRRAM's state) belongs to the main thread, and the VFPU has one socket for everyone
+#endif
+	return (m_transform_threads == 0) ? max(SDL_GetCPUCount(), 1) : m_transform_threads;
+}
+
+int View::RunTransformJob(void * data)
+{
+	TransformJob & job = *((TransformJob*)data);
+	const View & view = *job.view;
+	// Each thread has its own BufferBuilder into the same range, moved to each object it writes
+	BufferBuilder<GPUObjBounds> builder(job.data, job.size);
+	for (unsigned c = SDL_AtomicAdd(&job.next_chunk, 1); c*TRANSFORM_CHUNK < job.count; c = SDL_AtomicAdd(&job.next_chunk, 1))
+	{
+		unsigned end = min(job.count, (c+1)*TRANSFORM_CHUNK);
+		for (unsigned i = c*TRANSFORM_CHUNK; i < end; ++i)
+		{
+			unsigned id = (job.ids != NULL) ? job.ids[i] : job.first_obj + i;
+			Rect obj_bounds;
+			if (view.m_use_gpu_transform)
+			{
+				obj_bounds = view.m_render_objects->bounds[id];
+			}
+			else
+			{
+				obj_bounds = view.TransformToViewCoords(view.m_render_objects->bounds[id]);
+			}
+			GPUObjBounds gpu_bounds = {
+				Float(obj_bounds.x),
+				Float(obj_bounds.y),
+				Float(obj_bounds.x + obj_bounds.w),
+				Float(obj_bounds.y + obj_bounds.h)
+			};
+
+			if (job.query != NULL)
+			{
+				fprintf(job.query,"%d\t%f\t%f\t%f\t%f\n", id, Float(obj_bounds.x), Float(obj_bounds.y), Float(obj_bounds.w), Float(obj_bounds.h));
+			}
+
+			builder.m_bufferOffset = id - job.first_obj;
+			builder.Add(gpu_bounds);
+		}
+	}
+	return 0;
 }
 
 void View::UpdateObjBoundsVBO(unsigned first_obj, unsigned last_obj)
@@ -565,41 +928,40 @@ void View::UpdateObjBoundsVBO(unsigned first_obj, unsigned last_obj)
 	{
 		m_objbounds_vbo.SetUsage(GraphicsBuffer::BufferUsageDynamicCopy);
 	}
-	m_objbounds_vbo.Resize(m_document.ObjectCount()*sizeof(GPUObjBounds));
-
-	BufferBuilder<GPUObjBounds> obj_bounds_builder(m_objbounds_vbo.MapRange(first_obj*sizeof(GPUObjBounds), (last_obj-first_obj)*sizeof(GPUObjBounds), false, true, true), m_objbounds_vbo.GetSize());
+	// Grow geometrically; Resize has to copy everything already there into a new buffer
+	size_t size = m_render_objects->types.size()*sizeof(GPUObjBounds);
+	if (size > m_objbounds_vbo.GetSize())
+		m_objbounds_vbo.Resize(max(size, 2*m_objbounds_vbo.GetSize()));
 
 	#ifndef TRANSFORM_BEZIERS_TO_PATH
-	for (unsigned id = first_obj; id < last_obj; ++id)
+	if (m_use_gpu_transform && m_query_gpu_bounds_on_next_frame == NULL)
 	{
-		Rect obj_bounds;
-		if (m_use_gpu_transform)
-		{
-			obj_bounds = m_document.m_objects.bounds[id];
-		}
-		else
-		{
-			obj_bounds = TransformToViewCoords(m_document.m_objects.bounds[id]);
-		}
-		GPUObjBounds gpu_bounds = {
-			Float(obj_bounds.x),
-			Float(obj_bounds.y),
-			Float(obj_bounds.x + obj_bounds.w),
-			Float(obj_bounds.y + obj_bounds.h)
-		};
-
-		if (m_query_gpu_bounds_on_next_frame != NULL)
-		{	
-			fprintf(m_query_gpu_bounds_on_next_frame,"%d\t%f\t%f\t%f\t%f\n", id, Float(obj_bounds.x), Float(obj_bounds.y), Float(obj_bounds.w), Float(obj_bounds.h));
-		}
-		
-		obj_bounds_builder.Add(gpu_bounds);
+		UploadNewObjBounds(first_obj, last_obj);
+		return;
 	}
+	#endif
+	m_objbounds_written.clear(); // whatever is written below has to be written again next time
+
+	BufferBuilder<GPUObjBounds> obj_bounds_builder(m_objbounds_vbo.MapRange(first_obj*sizeof(GPUObjBounds), (last_obj-first_obj)*sizeof(GPUObjBounds), false, true, true), m_objbounds_vbo.GetSize());
+
+	#ifndef TRANSFORM_BEZIERS_TO_PATH
+	TransformJob job{this, obj_bounds_builder.m_bufferData, obj_bounds_builder.m_bufferSize, first_obj, NULL, last_obj - first_obj, m_query_gpu_bounds_on_next_frame};
+	#ifdef VIEW_CULLING
+	// Objects out of view are left out of the VBO; no ObjectRenderer refers to them
+	unsigned v_begin = lower_bound(m_visible_objects.begin(), m_visible_objects.end(), first_obj) - m_visible_objects.begin();
+	unsigned v_end = lower_bound(m_visible_objects.begin() + v_begin, m_visible_objects.end(), last_obj) - m_visible_objects.begin();
+	job.ids = m_visible_objects.data() + v_begin;
+	job.count = v_end - v_begin;
+	#endif
+	SDL_AtomicSet(&job.next_chunk, 0);
+	// (Objects are written to the file in order, so that's done on one thread)
+	unsigned threads = (m_query_gpu_bounds_on_next_frame != NULL) ? 1 : min(TransformThreads(), (job.count + TRANSFORM_CHUNK - 1) / TRANSFORM_CHUNK);
+	RunOnThreads(RunTransformJob, &job, threads, "Transform");
 	#else
-	for (unsigned i = 0; i < m_document.m_objects.paths.size(); ++i)
+	for (unsigned i = 0; i < m_render_objects->paths.size(); ++i)
 	{
-		Path & path = m_document.m_objects.paths[i];
-		Rect & pbounds = path.GetBounds(m_document.m_objects); // Not very efficient...
+		Path & path = m_render_objects->paths[i];
+		const Rect & pbounds = path.GetBounds(*m_render_objects); // Not very efficient...
 		//TODO: Add clipping here
 		//if (!pbounds.Intersects(Rect(0,0,1,1)) || pbounds.w < Real(1)/Real(800))
 		//	continue;
@@ -609,7 +971,7 @@ void View::UpdateObjBoundsVBO(unsigned first_obj, unsigned last_obj)
 			if (id < first_obj || id >= last_obj)
 				continue;
 				
-			Rect obj_bounds = m_document.m_objects.bounds[id];
+			Rect obj_bounds = m_render_objects->bounds[id];
 			obj_bounds.x *= pbounds.w;
 			obj_bounds.x += pbounds.x;
 			obj_bounds.y *= pbounds.h;
@@ -626,7 +988,7 @@ void View::UpdateObjBoundsVBO(unsigned first_obj, unsigned last_obj)
 				ClampFloat(obj_bounds.y + obj_bounds.h)
 			};
 			obj_bounds_builder.Add(gpu_bounds);
-			//Debug("Path %d %s -> %s via %s", id, m_document.m_objects.bounds[id].Str().c_str(), obj_bounds.Str().c_str(), pbounds.Str().c_str()); 
+			//Debug("Path %d %s -> %s via %s", id, m_render_objects->bounds[id].Str().c_str(), obj_bounds.Str().c_str(), pbounds.Str().c_str()); 
 			
 			if (m_query_gpu_bounds_on_next_frame != NULL)
 			{
@@ -658,7 +1020,11 @@ void View::UpdateObjBoundsVBO(unsigned first_obj, unsigned last_obj)
 void View::PrepareRender()
 {
 	PROFILE_SCOPE("View::PrepareRender()");
-	Debug("Recreate buffers with %u objects", m_document.ObjectCount());
+	// Objects are only ever appended, unless the bounds generation changes (loading, clearing, evicting)
+	bool rebuild = (m_prepared_objects == 0 || m_prepared_objects > m_render_objects->types.size()
+		|| m_prepared_generation != m_document.BoundsGeneration());
+	if (rebuild)
+		Debug("Recreate buffers with %u objects", m_render_objects->types.size());
 	// Prepare bounds vbo
 	if (UsingGPURendering())
 	{
@@ -673,16 +1039,60 @@ void View::PrepareRender()
 	//  and then finalise them
 	// This will totally be efficient if we have like, a lot of distinct ObjectTypes. Which could totally happen. You never know.
 
+#ifdef VIEW_CULLING
+	FillObjectRenderers(); // the visible objects can be anywhere, not just on the end
+#else
+	if (rebuild)
+		FillObjectRenderers();
+	else
+		AppendToObjectRenderers(m_prepared_objects, m_render_objects->types.size());
+#endif
+	if (UsingGPURendering())
+	{
+		BezierRenderer * bezier_renderer = dynamic_cast<BezierRenderer*>(m_object_renderers[BEZIER]);
+		if (rebuild || m_prepared_beziers == 0 || m_prepared_beziers > m_render_objects->beziers.size())
+			bezier_renderer->PrepareBezierGPUBuffer(*m_render_objects);
+		else
+			bezier_renderer->AppendBezierGPUBuffer(*m_render_objects, m_prepared_beziers, m_prepared_objects);
+		m_prepared_beziers = m_render_objects->beziers.size();
+	}
+	else
+	{
+		m_prepared_beziers = 0;
+	}
+	m_prepared_objects = m_render_objects->types.size();
+	m_prepared_generation = m_document.BoundsGeneration();
+	m_render_dirty = false;
+}
+
+/**
+ * Give each ObjectRenderer the indices of its objects
+ * Only those in m_visible_objects with VIEW_CULLING
+ */
+void View::FillObjectRenderers()
+{
+	PROFILE_SCOPE("View::FillObjectRenderers()");
+#ifdef VIEW_CULLING
+	unsigned max_objects = m_visible_objects.size();
+#else
+	unsigned max_objects = m_render_objects->types.size();
+#endif
 	// Prepare the buffers
 	for (unsigned i = 0; i < m_object_renderers.size(); ++i)
 	{
-		m_object_renderers[i]->PrepareBuffers(m_document.ObjectCount());
+		m_object_renderers[i]->PrepareBuffers(max_objects);
 	}
 
 	// Add objects from Document to buffers
-	for (unsigned id = 0; id < m_document.ObjectCount(); ++id)
+#ifdef VIEW_CULLING
+	for (unsigned v = 0; v < m_visible_objects.size(); ++v)
 	{
-		ObjectType type = m_document.m_objects.types[id];
+		unsigned id = m_visible_objects[v];
+#else
+	for (unsigned id = 0; id < m_render_objects->types.size(); ++id)
+	{
+#endif
+		ObjectType type = m_render_objects->types[id];
 		m_object_renderers.at(type)->AddObjectToBuffers(id); // Use at() in case the document is corrupt TODO: Better error handling?
 		// (Also, Wow I just actually used std::vector::at())
 		// (Also, I just managed to make it throw an exception because I'm a moron)
@@ -695,28 +1105,141 @@ void View::PrepareRender()
 	{
 		m_object_renderers[i]->FinaliseBuffers();
 	}
-	if (UsingGPURendering())
+}
+
+/**
+ * Give each ObjectRenderer the indices of its objects in [first_obj, last_obj), after those it already has
+ */
+void View::AppendToObjectRenderers(unsigned first_obj, unsigned last_obj)
+{
+	PROFILE_SCOPE("View::AppendToObjectRenderers()");
+	std::vector<std::vector<unsigned> > ids(m_object_renderers.size());
+	for (unsigned id = first_obj; id < last_obj; ++id)
+		ids.at(m_render_objects->types[id]).push_back(id);
+	for (unsigned i = 0; i < m_object_renderers.size(); ++i)
+		m_object_renderers[i]->AppendToBuffers(ids[i]);
+}
+
+/**
+ * With GPU transforms m_objbounds_vbo holds document coordinates, which don't change when the view does
+ * Only objects in [first_obj, last_obj) that aren't there yet (or have been changed since) are written
+ */
+void View::UploadNewObjBounds(unsigned first_obj, unsigned last_obj)
+{
+	if (m_objbounds_generation != m_document.BoundsGeneration())
 	{
-		dynamic_cast<BezierRenderer*>(m_object_renderers[BEZIER])->PrepareBezierGPUBuffer(m_document.m_objects);
+		m_objbounds_written.clear();
+		m_objbounds_generation = m_document.BoundsGeneration();
 	}
-	m_render_dirty = false;
+	if (m_objbounds_written.size() < m_render_objects->types.size())
+		m_objbounds_written.resize(m_render_objects->types.size(), false);
+
+	// Objects are uploaded in runs; small gaps between them are filled in rather than starting another
+	static const unsigned MAX_GAP = 64;
+	vector<GPUObjBounds> run;
+	unsigned run_begin = 0;
+#ifdef VIEW_CULLING
+	for (unsigned v = lower_bound(m_visible_objects.begin(), m_visible_objects.end(), first_obj) - m_visible_objects.begin();
+		v < m_visible_objects.size() && m_visible_objects[v] < last_obj; ++v)
+	{
+		unsigned id = m_visible_objects[v];
+#else
+	for (unsigned id = first_obj; id < last_obj; ++id)
+	{
+#endif
+		if (m_objbounds_written[id])
+			continue;
+		if (!run.empty() && id - (run_begin + run.size()) > MAX_GAP)
+		{
+			m_objbounds_vbo.UploadRange(run.size()*sizeof(GPUObjBounds), run_begin*sizeof(GPUObjBounds), run.data());
+			run.clear();
+		}
+		if (run.empty())
+			run_begin = id;
+		while (run_begin + run.size() <= id)
+		{
+			unsigned next = run_begin + run.size();
+			Rect obj_bounds = m_render_objects->bounds[next];
+			run.push_back(GPUObjBounds{Float(obj_bounds.x), Float(obj_bounds.y), Float(obj_bounds.x + obj_bounds.w), Float(obj_bounds.y + obj_bounds.h)});
+			m_objbounds_written[next] = true;
+		}
+	}
+	if (!run.empty())
+		m_objbounds_vbo.UploadRange(run.size()*sizeof(GPUObjBounds), run_begin*sizeof(GPUObjBounds), run.data());
 }
 
-void View::SaveCPUBMP(const char * filename)
+/**
+ * With the quadtree, parents are made with the objects smaller than this merged (see Document::SetQuadtreeLOD);
+ * the view is at least half a node wide, so a pixel is at most 2/width of a node.
+ * Without it, CullObjects keeps one of them per square of this size on the screen's pixel grid.
+ */
+void View::SetLODPixels(float pixels)
 {
-	bool prev = UsingGPURendering();
-	SetGPURendering(false);
-	Render(800, 600);
-	ObjectRenderer::SaveBMP({m_cpu_rendering_pixels, 800, 600}, filename);
-	SetGPURendering(prev);
+	m_lod_pixels = pixels;
+#ifndef QUADTREE_DISABLED
+	if (m_cached_display.GetWidth() > 0)
+		m_document.SetQuadtreeLOD(Real(m_lod_pixels) / Real(2*m_cached_display.GetWidth()));
+#endif
+	m_render_dirty = m_bounds_dirty = true;
+}
+
+#ifdef VIEW_CULLING
+/**
+ * Find the objects that might be in view, with a margin of a view on each side so that small moves don't need to look again
+ * @returns true if m_visible_objects changed
+ */
+bool View::CullObjects()
+{
+	// Still inside, and not zoomed in twice over since (nor moved at all, if the objects were thinned out on the pixel grid)
+	if (!m_render_dirty && m_cull_bounds.Contains(m_bounds) && m_bounds.w*Real(6) > m_cull_bounds.w && (m_lod_pixels <= 0 || m_lod_bounds == m_bounds))
+		return false;
+	PROFILE_SCOPE("View::CullObjects()");
+	m_cull_bounds = Rect(m_bounds.x - m_bounds.w, m_bounds.y - m_bounds.h, Real(3)*m_bounds.w, Real(3)*m_bounds.h);
+	m_visible_objects.clear();
+	m_document.Query(m_cull_bounds, m_visible_objects);
+
+	// Of the objects smaller than m_lod_pixels that look alike (see Document::LODKey), one per square of that many screen pixels
+	// is drawn; the rest would mostly land on the same pixels, but can be a pixel or so off
+	m_lod_bounds = m_bounds;
+	if (m_lod_pixels > 0 && m_cached_display.GetWidth() > 0 && m_cached_display.GetHeight() > 0)
+	{
+		Real size_x = Real(m_lod_pixels) * m_bounds.w / Real(m_cached_display.GetWidth());
+		Real size_y = Real(m_lod_pixels) * m_bounds.h / Real(m_cached_display.GetHeight());
+		set<pair<pair<int64_t, int64_t>, int> > squares;
+		unsigned count = 0;
+		for (unsigned v = 0; v < m_visible_objects.size(); ++v)
+		{
+			Rect bounds = m_render_objects->bounds[m_visible_objects[v]];
+			int key = (bounds.w < size_x && bounds.h < size_y) ? Document::LODKey(*m_render_objects, m_visible_objects[v]) : -1;
+			if (key >= 0)
+			{
+				pair<int64_t, int64_t> square((int64_t)floor(Double((bounds.x - m_bounds.x) / size_x)), (int64_t)floor(Double((bounds.y - m_bounds.y) / size_y)));
+				if (!squares.insert(make_pair(square, key)).second)
+					continue;
+			}
+			m_visible_objects[count++] = m_visible_objects[v];
+		}
+		m_visible_objects.resize(count);
+	}
+	return true;
+}
+#endif
+
+void View::SaveCPUBMP(const char * filename, int width, int height)
+{
+	std::vector<uint8_t> pixels(width*height*4);
+	RenderToPixels(width, height, pixels.data());
+	ObjectRenderer::SaveBMP({pixels.data(), width, height}, filename);
 }
 
 void View::SaveGPUBMP(const char * filename)
 {
 	bool prev = UsingGPURendering();
 	SetGPURendering(true);
+	if (Headless())
+		Fatal("Can't render on the GPU without a Screen");
 	Render(800,600);
-	m_screen.ScreenShot(filename);
+	m_screen->ScreenShot(filename);
 	SetGPURendering(prev);	
 }
 
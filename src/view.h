@@ -12,6 +12,12 @@
 #define USE_GPU_RENDERING true
 #define USE_SHADING !(USE_GPU_RENDERING) && true
 
+// Without the quadtree, only objects near the view are given to the ObjectRenderers
+// (Not when the objects themselves are transformed; their bounds change every frame)
+#if defined(QUADTREE_DISABLED) && !defined(TRANSFORM_OBJECTS_NOT_VIEW) && !defined(TRANSFORM_BEZIERS_TO_PATH)
+#define VIEW_CULLING
+#endif
+
 
 #include "gmprat.h"
 
@@ -30,9 +36,12 @@ namespace IPDF
 	{
 		public:
 			View(Document & document, Screen & screen, const VRect & bounds = VRect(0,0,1,1), const Colour & colour = Colour(0.f,0.f,0.f,1.f));
+			View(Document & document, const VRect & bounds = VRect(0,0,1,1), const Colour & colour = Colour(0.f,0.f,0.f,1.f)); // headless
 			virtual ~View();
 
 			void Render(int width = 0, int height = 0);
+			void RenderToPixels(int width, int height, uint8_t * pixels); // CPU only; works headless
+			bool Headless() const {return m_screen == NULL;}
 			
 			void Translate(Real x, Real y);
 			void ScaleAroundPoint(Real x, Real y, Real scale_amount);
@@ -46,10 +55,10 @@ namespace IPDF
 			const bool UsingGPUTransform() const { return m_use_gpu_transform; } // whether view transform calculated on CPU or GPU
 			const bool UsingGPURendering() const { return m_use_gpu_rendering; } // whether GPU shaders are used or CPU rendering
 			void ToggleGPUTransform() { m_use_gpu_transform = (!m_use_gpu_transform); m_bounds_dirty = true; m_buffer_dirty = true; }
-			void ToggleGPURendering() { m_use_gpu_rendering = (!m_use_gpu_rendering); m_bounds_dirty = true; m_buffer_dirty = true; }
+			void ToggleGPURendering() { SetGPURendering(!m_use_gpu_rendering); }
 			void SetGPUTransform(bool state) {m_use_gpu_transform = state; m_bounds_dirty = true; m_buffer_dirty = true;}
 			
-			void SetGPURendering(bool state) {m_use_gpu_rendering = state; m_bounds_dirty = true; m_buffer_dirty = true;}
+			void SetGPURendering(bool state) {m_use_gpu_rendering = state && !Headless(); m_bounds_dirty = true; m_buffer_dirty = true;}
 
 			bool ShowingBezierBounds() const {return m_show_bezier_bounds;} // render bounds rectangles
 			void ShowBezierBounds(bool state) {m_show_bezier_bounds = state; m_bounds_dirty = true; m_buffer_dirty = true;}
@@ -62,6 +71,8 @@ namespace IPDF
 			
 			bool PerformingShading() const {return m_perform_shading;}
 			void PerformShading(bool state) {m_perform_shading = state; m_bounds_dirty = true; m_buffer_dirty = true;}
+			bool AntiAliasingOnCPU() const {return m_anti_alias_cpu;} // Beziers and paths drawn with exact pixel coverage on the CPU
+			void AntiAliasOnCPU(bool state) {m_anti_alias_cpu = state; m_bounds_dirty = true; m_buffer_dirty = true;}
 
 			void ForceBoundsDirty() {m_bounds_dirty = true;}		
 			void ForceBufferDirty() {m_buffer_dirty = true;}		
@@ -71,15 +82,25 @@ namespace IPDF
 			
 			void SetLazyRendering(bool state = true) {m_lazy_rendering = state;}
 			bool UsingLazyRendering() const {return m_lazy_rendering;}
+
+			/** Objects smaller than this many pixels across that look alike are merged, or thinned out, to one per square of this size; this can move a few pixels. 0 (the default) draws everything **/
+			void SetLODPixels(float pixels);
+			float GetLODPixels() const {return m_lod_pixels;}
+
+			/** Threads to transform object bounds (and rasterise tiles) with, when the CPU does it; 0 (the default) for one per CPU **/
+			void SetTransformThreads(unsigned threads) {m_transform_threads = threads;}
 			
 			void SaveBMP(const char * filename) {if (UsingGPURendering()) SaveGPUBMP(filename); else SaveCPUBMP(filename);}
 			
-			void SaveCPUBMP(const char * filename);
+			void SaveCPUBMP(const char * filename, int width = 800, int height = 600);
 			void SaveGPUBMP(const char * filename);
 
 			Document & Doc() {return m_document;}
 #ifndef QUADTREE_DISABLED
 			QuadTreeIndex GetCurrentQuadtreeNode() { return m_current_quadtree_node; }
+			/** Generate quadtree nodes in the background (drawing the parent until they are ready), and prefetch them **/
+			void SetBackgroundQuadtree(bool state) {m_background_quadtree = state;}
+			bool UsingBackgroundQuadtree() const {return m_background_quadtree;}
 #endif
 
 		private:
@@ -91,18 +112,33 @@ namespace IPDF
 			
 			
 
+			View(Document & document, Screen * screen, const VRect & bounds, const Colour & colour);
 			void PrepareRender(); // call when m_render_dirty is true
+			void FillObjectRenderers();
+			void AppendToObjectRenderers(unsigned first_obj, unsigned last_obj);
 			void UpdateObjBoundsVBO(unsigned first_obj, unsigned last_obj); // call when m_buffer_dirty is true
+			void UploadNewObjBounds(unsigned first_obj, unsigned last_obj);
+			struct TransformJob;
+			static int RunTransformJob(void * job);
+			unsigned TransformThreads() const;
 
 			void RenderRange(int width, int height, unsigned first_obj, unsigned last_obj);
+			void RenderRangeOnCPU(int width, int height, unsigned first_obj, unsigned last_obj);
+			struct TileJob;
+			static int RunTileBinning(void * job);
+			static int RunTileRendering(void * job);
 
 			bool m_use_gpu_transform;
 			bool m_use_gpu_rendering;
 			bool m_bounds_dirty; // the view bounds has changed (occurs when changing view)
 			bool m_buffer_dirty; // the object bounds have changed (also occurs when changing view, but only when not using GPU transforms)
 			bool m_render_dirty; // the document has changed (occurs when document first loaded)
+			unsigned m_prepared_objects; // objects (and beziers) in the ObjectRenderers as of the last PrepareRender
+			unsigned m_prepared_beziers;
+			unsigned m_prepared_generation; // Document::BoundsGeneration then; if it changes objects may have gone, so rebuild
 			Document & m_document;
-			Screen & m_screen;
+			Objects * m_render_objects; // being drawn; with the quadtree, each node's in turn (see RenderQuadtreeNode)
+			Screen * m_screen; // NULL if headless
 			FrameBuffer m_cached_display;
 			VRect m_bounds;
 			Colour m_colour;
@@ -111,6 +147,8 @@ namespace IPDF
 			GraphicsBuffer m_bounds_ubo; //bounds_dirty means this one has changed
 			// Stores the bounds for _all_ objects.
 			GraphicsBuffer m_objbounds_vbo; //buffer_dirty means this one has changed
+			std::vector<bool> m_objbounds_written; // objects whose document bounds are in m_objbounds_vbo (with GPU transforms)
+			unsigned m_objbounds_generation; // Document::BoundsGeneration when they were
 
 			// ObjectRenderers to be initialised in constructor
 			// Trust me it will be easier to generalise things this way. Even though there are pointers.
@@ -120,6 +158,7 @@ namespace IPDF
 			
 			// shading
 			bool m_perform_shading;
+			bool m_anti_alias_cpu;
 			
 			// Debug rendering
 			bool m_show_bezier_bounds;
@@ -130,13 +169,30 @@ namespace IPDF
 			bool m_lazy_rendering;// don't redraw frames unless we need to
 			
 			FILE * m_query_gpu_bounds_on_next_frame;
+			float m_lod_pixels;
+			unsigned m_transform_threads;
 
 
 #ifndef QUADTREE_DISABLED
 			QuadTreeIndex m_current_quadtree_node;	// The highest node we will traverse.
+			QuadTreeIndex m_render_node;		// The node whose objects are in the ObjectRenderers.
 			int m_quadtree_max_depth;		// The maximum quadtree depth.
 			void RenderQuadtreeNode(int width, int height, QuadTreeIndex node, int remaining_depth);
+			void UpdateQuadtreeNode();
+			bool EnterQuadChild(QuadTreeNodeChildren type);
+			bool MoveToQuadNeighbour(int xdir, int ydir);
+			void PrefetchQuadtree();
+			bool m_background_quadtree;
+			// How the view moved since the last frame, for PrefetchQuadtree
+			double m_pan_x, m_pan_y;
+			double m_zoom_x, m_zoom_y, m_zoom;
 
+#endif
+#ifdef VIEW_CULLING
+			bool CullObjects();
+			std::vector<unsigned> m_visible_objects; // sorted; all the ObjectRenderers are given
+			Rect m_cull_bounds; // m_visible_objects are those that intersect this
+			VRect m_lod_bounds; // m_bounds when they were thinned out (see SetLODPixels)
 #endif
 	};
 }